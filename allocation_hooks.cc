@@ -0,0 +1,191 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "allocation_hooks.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "allocation_profiler.h"
+
+namespace wvu {
+namespace {
+// The counters are plain thread-local integers. They must not require dynamic
+// initialization since operator new can run before main() and during thread
+// start-up.
+thread_local uint64_t thread_allocations = 0;
+thread_local uint64_t thread_deallocations = 0;
+
+void* AllocateOrNull(const size_t num_bytes) {
+  ++thread_allocations;
+  // malloc(0) may return nullptr, but operator new must return a unique
+  // pointer.
+  void* pointer = std::malloc(num_bytes == 0 ? 1 : num_bytes);
+  if (pointer != nullptr) internal::RecordAllocation(pointer);
+  return pointer;
+}
+
+void* AlignedAllocateOrNull(const size_t num_bytes, const size_t alignment) {
+  ++thread_allocations;
+  // aligned_alloc requires the size to be a multiple of the alignment.
+  const size_t padded_size =
+      ((num_bytes == 0 ? 1 : num_bytes) + alignment - 1) & ~(alignment - 1);
+  void* pointer = std::aligned_alloc(alignment, padded_size);
+  if (pointer != nullptr) internal::RecordAllocation(pointer);
+  return pointer;
+}
+
+void Deallocate(void* pointer) {
+  if (pointer == nullptr) return;
+  ++thread_deallocations;
+  internal::RecordDeallocation(pointer);
+  std::free(pointer);
+}
+
+void* Allocate(const size_t num_bytes) {
+  void* pointer = AllocateOrNull(num_bytes);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+void* AlignedAllocate(const size_t num_bytes, const size_t alignment) {
+  void* pointer = AlignedAllocateOrNull(num_bytes, alignment);
+  if (pointer == nullptr) throw std::bad_alloc();
+  return pointer;
+}
+
+}  // namespace
+
+uint64_t ThreadAllocationCount() {
+  return thread_allocations;
+}
+
+uint64_t ThreadDeallocationCount() {
+  return thread_deallocations;
+}
+
+}  // namespace wvu
+
+// Replacements of the global allocation functions. See
+// http://en.cppreference.com/w/cpp/memory/new/operator_new for the list of
+// replaceable functions.
+void* operator new(size_t num_bytes) {
+  return wvu::Allocate(num_bytes);
+}
+
+void* operator new[](size_t num_bytes) {
+  return wvu::Allocate(num_bytes);
+}
+
+void* operator new(size_t num_bytes, const std::nothrow_t&) noexcept {
+  return wvu::AllocateOrNull(num_bytes);
+}
+
+void* operator new[](size_t num_bytes, const std::nothrow_t&) noexcept {
+  return wvu::AllocateOrNull(num_bytes);
+}
+
+void* operator new(size_t num_bytes, std::align_val_t alignment) {
+  return wvu::AlignedAllocate(num_bytes, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t num_bytes, std::align_val_t alignment) {
+  return wvu::AlignedAllocate(num_bytes, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t num_bytes,
+                   std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return wvu::AlignedAllocateOrNull(num_bytes, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t num_bytes,
+                     std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return wvu::AlignedAllocateOrNull(num_bytes, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete(void* pointer,
+                     std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  wvu::Deallocate(pointer);
+}
+
+void operator delete[](void* pointer,
+                       std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  wvu::Deallocate(pointer);
+}
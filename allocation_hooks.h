@@ -0,0 +1,81 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef ALLOCATION_HOOKS_H_
+#define ALLOCATION_HOOKS_H_
+
+#include <cstdint>
+
+namespace wvu {
+// allocation_hooks.cc replaces the global operator new and operator delete to
+// count the heap allocations made by every thread. Counting is a thread-local
+// increment, so the hooks are cheap enough to stay linked in all binaries. The
+// hooks also feed the AllocationProfiler (see allocation_profiler.h) when one
+// is alive.
+
+// Returns the number of allocations made with operator new by the calling
+// thread.
+uint64_t ThreadAllocationCount();
+
+// Returns the number of deallocations made with operator delete by the calling
+// thread.
+uint64_t ThreadDeallocationCount();
+
+// Counts the heap allocations made by the calling thread during the lifetime
+// of the object. Useful to verify that a code path does not allocate, e.g.:
+//
+//   ScopedAllocationCounter counter;
+//   RenderScene(...);
+//   CHECK_EQ(counter.num_allocations(), 0);
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter()
+      : initial_allocations_(ThreadAllocationCount()),
+        initial_deallocations_(ThreadDeallocationCount()) {}
+
+  uint64_t num_allocations() const {
+    return ThreadAllocationCount() - initial_allocations_;
+  }
+  uint64_t num_deallocations() const {
+    return ThreadDeallocationCount() - initial_deallocations_;
+  }
+
+ private:
+  const uint64_t initial_allocations_;
+  const uint64_t initial_deallocations_;
+};
+
+}  // namespace wvu
+
+#endif  // ALLOCATION_HOOKS_H_
@@ -0,0 +1,407 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "allocation_profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "json_utils.h"
+
+namespace wvu {
+namespace {
+// Maximum number of stack frames recorded per sampled allocation.
+constexpr int kMaxStackDepth = 16;
+// Maximum number of distinct call sites. The table uses open addressing, so
+// the size must be a power of two.
+constexpr int kMaxCallSites = 2048;
+// Number of entries probed for a call site before evicting one of them.
+constexpr int kMaxCallSiteProbes = 32;
+// Number of call sites written to the JSON report.
+constexpr int kNumReportedCallSites = 20;
+
+// A sampled call stack and the allocations attributed to it.
+struct CallSiteEntry {
+  uint64_t hash;
+  int depth;
+  void* frames[kMaxStackDepth];
+  uint64_t num_samples;
+  uint64_t sampled_bytes;
+};
+
+// The state shared by the hooks of all the threads. It only uses atomics and
+// static storage since it is updated from within operator new.
+std::atomic<bool> profiling_enabled(false);
+std::atomic<int> current_sampling_interval(0);
+std::atomic<uint64_t> num_allocations(0);
+std::atomic<uint64_t> num_deallocations(0);
+std::atomic<uint64_t> bytes_allocated(0);
+std::atomic<uint64_t> bytes_freed(0);
+// Live bytes are relative to the moment the profiler started, so they can be
+// negative if memory allocated before that is freed.
+std::atomic<int64_t> live_bytes(0);
+std::atomic<int64_t> peak_live_bytes(0);
+
+CallSiteEntry call_sites[kMaxCallSites];
+std::atomic_flag call_sites_lock = ATOMIC_FLAG_INIT;
+// Samples of the evicted call sites. Guarded by call_sites_lock.
+uint64_t num_dropped_call_site_samples = 0;
+
+// Set while a thread is inside the profiler, so the allocations made by
+// backtrace() and by the profiler itself are not sampled recursively.
+thread_local bool inside_profiler = false;
+thread_local int allocations_until_sample = 0;
+
+class SpinLock {
+ public:
+  explicit SpinLock(std::atomic_flag* flag) : flag_(flag) {
+    while (flag_->test_and_set(std::memory_order_acquire)) {}
+  }
+  ~SpinLock() { flag_->clear(std::memory_order_release); }
+
+ private:
+  std::atomic_flag* flag_;
+};
+
+void UpdatePeakLiveBytes(const int64_t current_live_bytes) {
+  int64_t peak = peak_live_bytes.load(std::memory_order_relaxed);
+  while (current_live_bytes > peak &&
+         !peak_live_bytes.compare_exchange_weak(peak, current_live_bytes,
+                                                std::memory_order_relaxed)) {}
+}
+
+// FNV-1a hash of the stack frames.
+uint64_t HashStack(void* const* frames, const int depth) {
+  uint64_t hash = 14695981039346656037ull;
+  for (int i = 0; i < depth; ++i) {
+    hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+void SampleCallStack(const size_t num_bytes) {
+  void* frames[kMaxStackDepth + 1];
+  // Skip the frame of this function.
+  const int depth = backtrace(frames, kMaxStackDepth + 1) - 1;
+  if (depth <= 0) return;
+  const uint64_t hash = HashStack(frames + 1, depth);
+  const SpinLock lock(&call_sites_lock);
+  CallSiteEntry* least_sampled_entry = nullptr;
+  for (int probe = 0; probe < kMaxCallSiteProbes; ++probe) {
+    CallSiteEntry& entry = call_sites[(hash + probe) & (kMaxCallSites - 1)];
+    if (entry.hash == 0) {
+      least_sampled_entry = &entry;
+      break;
+    }
+    if (entry.hash == hash) {
+      ++entry.num_samples;
+      entry.sampled_bytes += num_bytes;
+      return;
+    }
+    if (least_sampled_entry == nullptr ||
+        entry.num_samples < least_sampled_entry->num_samples) {
+      least_sampled_entry = &entry;
+    }
+  }
+  // Entries are never emptied, so the call site is not further down the probe
+  // sequence. It takes the first empty entry. If every probed entry is taken,
+  // e.g., by the call sites of the start-up, the least sampled one is evicted
+  // so that the call sites of the frame loop still make it into the table.
+  CallSiteEntry& entry = *least_sampled_entry;
+  num_dropped_call_site_samples += entry.num_samples;
+  entry.hash = hash;
+  entry.depth = depth;
+  memcpy(entry.frames, frames + 1, depth * sizeof(frames[0]));
+  entry.num_samples = 1;
+  entry.sampled_bytes = num_bytes;
+}
+
+// Returns a human readable name of the code address, e.g.,
+// "wvu::RenderScene(...)+0x1c (draw_scene)".
+std::string SymbolizeAddress(void* address) {
+  Dl_info info;
+  if (dladdr(address, &info) == 0 || info.dli_fname == nullptr) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%p", address);
+    return buffer;
+  }
+  std::string symbol;
+  if (info.dli_sname != nullptr) {
+    int status = 0;
+    char* demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    symbol = status == 0 ? demangled : info.dli_sname;
+    free(demangled);
+    char offset[32];
+    snprintf(offset, sizeof(offset), "+0x%zx",
+             static_cast<size_t>(static_cast<char*>(address) -
+                                 static_cast<char*>(info.dli_saddr)));
+    symbol += offset;
+  } else {
+    char offset[32];
+    snprintf(offset, sizeof(offset), "0x%zx",
+             static_cast<size_t>(static_cast<char*>(address) -
+                                 static_cast<char*>(info.dli_fbase)));
+    symbol = offset;
+  }
+  const char* module = strrchr(info.dli_fname, '/');
+  symbol += " (";
+  symbol += module != nullptr ? module + 1 : info.dli_fname;
+  symbol += ")";
+  return symbol;
+}
+
+void WriteFrameJson(const FrameAllocationStats& frame, std::ostream* stream) {
+  *stream << "{\"label\": " << ToJsonString(frame.label)
+          << ", \"allocations\": " << frame.num_allocations
+          << ", \"deallocations\": " << frame.num_deallocations
+          << ", \"bytes_allocated\": " << frame.bytes_allocated
+          << ", \"bytes_freed\": " << frame.bytes_freed
+          << ", \"peak_live_bytes\": " << frame.peak_live_bytes << "}";
+}
+
+}  // namespace
+
+namespace internal {
+
+void RecordAllocation(void* pointer) {
+  if (!profiling_enabled.load(std::memory_order_relaxed)) return;
+  const size_t num_bytes = malloc_usable_size(pointer);
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  bytes_allocated.fetch_add(num_bytes, std::memory_order_relaxed);
+  UpdatePeakLiveBytes(
+      live_bytes.fetch_add(num_bytes, std::memory_order_relaxed) + num_bytes);
+
+  const int interval = current_sampling_interval.load(std::memory_order_relaxed);
+  if (interval <= 0 || inside_profiler || --allocations_until_sample > 0) {
+    return;
+  }
+  allocations_until_sample = interval;
+  inside_profiler = true;
+  SampleCallStack(num_bytes);
+  inside_profiler = false;
+}
+
+void RecordDeallocation(void* pointer) {
+  if (!profiling_enabled.load(std::memory_order_relaxed)) return;
+  const size_t num_bytes = malloc_usable_size(pointer);
+  num_deallocations.fetch_add(1, std::memory_order_relaxed);
+  bytes_freed.fetch_add(num_bytes, std::memory_order_relaxed);
+  live_bytes.fetch_sub(num_bytes, std::memory_order_relaxed);
+}
+
+}  // namespace internal
+
+AllocationProfiler::AllocationProfiler(const int sampling_interval,
+                                       const int max_retained_frames)
+    : sampling_interval_(sampling_interval),
+      max_retained_frames_(max_retained_frames),
+      num_frames_(0) {
+  CHECK(!profiling_enabled.load()) << "Only one AllocationProfiler can be "
+                                   << "alive at a time.";
+  CHECK_GT(max_retained_frames, 0);
+  // Reserve the ring so that ending a frame does not allocate.
+  frames_.reserve(max_retained_frames);
+  totals_.label = "total";
+  // backtrace() loads its unwinder lazily, which allocates. Load it now so the
+  // first sample does not show up in the profile.
+  void* frame;
+  backtrace(&frame, 1);
+  memset(call_sites, 0, sizeof(call_sites));
+  num_dropped_call_site_samples = 0;
+  current_sampling_interval.store(sampling_interval);
+  live_bytes.store(0);
+  peak_live_bytes.store(0);
+  BeginFrame();
+  profiling_enabled.store(true);
+}
+
+AllocationProfiler::~AllocationProfiler() {
+  profiling_enabled.store(false);
+}
+
+void AllocationProfiler::BeginFrame() {
+  frame_start_allocations_ = num_allocations.load();
+  frame_start_deallocations_ = num_deallocations.load();
+  frame_start_bytes_allocated_ = bytes_allocated.load();
+  frame_start_bytes_freed_ = bytes_freed.load();
+  peak_live_bytes.store(live_bytes.load());
+}
+
+const FrameAllocationStats& AllocationProfiler::EndFrame(const char* label) {
+  // Read the counters before storing the frame, since copying the label may
+  // allocate.
+  FrameAllocationStats frame;
+  frame.num_allocations = num_allocations.load() - frame_start_allocations_;
+  frame.num_deallocations =
+      num_deallocations.load() - frame_start_deallocations_;
+  frame.bytes_allocated =
+      bytes_allocated.load() - frame_start_bytes_allocated_;
+  frame.bytes_freed = bytes_freed.load() - frame_start_bytes_freed_;
+  frame.peak_live_bytes = peak_live_bytes.load();
+  frame.label = label;
+
+  totals_.num_allocations += frame.num_allocations;
+  totals_.num_deallocations += frame.num_deallocations;
+  totals_.bytes_allocated += frame.bytes_allocated;
+  totals_.bytes_freed += frame.bytes_freed;
+  totals_.peak_live_bytes =
+      std::max(totals_.peak_live_bytes, frame.peak_live_bytes);
+
+  const int index = num_frames_ % max_retained_frames_;
+  ++num_frames_;
+  if (index == static_cast<int>(frames_.size())) {
+    frames_.push_back(frame);
+  } else {
+    frames_[index] = frame;
+  }
+  return frames_[index];
+}
+
+std::vector<FrameAllocationStats> AllocationProfiler::RetainedFrames() const {
+  // Once the ring is full, the oldest frame is the one overwritten next.
+  const int oldest_index =
+      static_cast<int>(frames_.size()) < max_retained_frames_
+          ? 0
+          : num_frames_ % max_retained_frames_;
+  std::vector<FrameAllocationStats> frames(frames_.begin() + oldest_index,
+                                           frames_.end());
+  frames.insert(frames.end(), frames_.begin(),
+                frames_.begin() + oldest_index);
+  return frames;
+}
+
+uint64_t AllocationProfiler::num_dropped_samples() const {
+  const SpinLock lock(&call_sites_lock);
+  return num_dropped_call_site_samples;
+}
+
+std::vector<AllocationCallSite> AllocationProfiler::TopCallSites(
+    const int max_call_sites) const {
+  // Reserve the memory up front since allocating while holding the lock would
+  // deadlock if the allocation is sampled.
+  std::vector<CallSiteEntry> entries;
+  entries.reserve(kMaxCallSites);
+  {
+    const SpinLock lock(&call_sites_lock);
+    for (const CallSiteEntry& entry : call_sites) {
+      if (entry.hash != 0) entries.push_back(entry);
+    }
+  }
+  const int num_call_sites =
+      std::min(max_call_sites, static_cast<int>(entries.size()));
+  std::partial_sort(entries.begin(), entries.begin() + num_call_sites,
+                    entries.end(),
+                    [](const CallSiteEntry& lhs, const CallSiteEntry& rhs) {
+                      return lhs.num_samples > rhs.num_samples;
+                    });
+
+  std::vector<AllocationCallSite> top_call_sites(num_call_sites);
+  for (int i = 0; i < num_call_sites; ++i) {
+    const CallSiteEntry& entry = entries[i];
+    AllocationCallSite& call_site = top_call_sites[i];
+    call_site.num_samples = entry.num_samples;
+    call_site.sampled_bytes = entry.sampled_bytes;
+    for (int j = 0; j < entry.depth; ++j) {
+      call_site.stack.push_back(SymbolizeAddress(entry.frames[j]));
+    }
+    // Drop the frames of the allocation hooks, i.e., everything up to the last
+    // operator new, so the stack starts at the caller.
+    for (int j = call_site.stack.size() - 1; j >= 0; --j) {
+      if (call_site.stack[j].compare(0, 12, "operator new") == 0) {
+        call_site.stack.erase(call_site.stack.begin(),
+                              call_site.stack.begin() + j + 1);
+        break;
+      }
+    }
+  }
+  return top_call_sites;
+}
+
+bool AllocationProfiler::WriteJson(const std::string& filepath) const {
+  std::ofstream stream(filepath);
+  if (!stream.is_open()) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+
+  stream << "{\n\"sampling_interval\": " << sampling_interval_
+         << ",\n\"num_frames\": " << num_frames_
+         << ",\n\"dropped_samples\": " << num_dropped_samples()
+         << ",\n\"total\": ";
+  WriteFrameJson(totals_, &stream);
+  // Only the latest frames are listed.
+  stream << ",\n\"frames\": [";
+  const std::vector<FrameAllocationStats> frames = RetainedFrames();
+  for (size_t i = 0; i < frames.size(); ++i) {
+    stream << (i == 0 ? "\n  " : ",\n  ");
+    WriteFrameJson(frames[i], &stream);
+  }
+  stream << "],\n\"top_call_sites\": [";
+  const std::vector<AllocationCallSite> call_sites =
+      TopCallSites(kNumReportedCallSites);
+  for (size_t i = 0; i < call_sites.size(); ++i) {
+    const AllocationCallSite& call_site = call_sites[i];
+    stream << (i == 0 ? "\n  " : ",\n  ")
+           << "{\"samples\": " << call_site.num_samples
+           << ", \"estimated_allocations\": "
+           << call_site.num_samples * sampling_interval_
+           << ", \"estimated_bytes\": "
+           << call_site.sampled_bytes * sampling_interval_
+           << ", \"stack\": [";
+    for (size_t j = 0; j < call_site.stack.size(); ++j) {
+      stream << (j == 0 ? "" : ", ") << ToJsonString(call_site.stack[j]);
+    }
+    stream << "]}";
+  }
+  stream << "]\n}\n";
+  return stream.good();
+}
+
+}  // namespace wvu
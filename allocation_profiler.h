@@ -0,0 +1,141 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef ALLOCATION_PROFILER_H_
+#define ALLOCATION_PROFILER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wvu {
+// Heap statistics of a profiled frame (or any other profiled interval, e.g., a
+// unit test).
+struct FrameAllocationStats {
+  std::string label;
+  uint64_t num_allocations = 0;
+  uint64_t num_deallocations = 0;
+  uint64_t bytes_allocated = 0;
+  uint64_t bytes_freed = 0;
+  // Peak number of live heap bytes of the whole process during the frame.
+  int64_t peak_live_bytes = 0;
+};
+
+// A call site that allocates memory, found by sampling the allocations.
+struct AllocationCallSite {
+  // Symbolized stack frames, innermost first.
+  std::vector<std::string> stack;
+  uint64_t num_samples = 0;
+  uint64_t sampled_bytes = 0;
+};
+
+// Opt-in heap profiler built on the global operator new/delete hooks (see
+// allocation_hooks.h). While a profiler is alive, every allocation of every
+// thread updates the counters, and one in sampling_interval allocations
+// records its call stack. The profiler reports the heap activity per frame,
+// keeping the latest frames and running totals over all of them:
+//
+//   AllocationProfiler profiler(64, 4096);
+//   while (...) {
+//     profiler.BeginFrame();
+//     RenderScene(...);
+//     profiler.EndFrame("frame");
+//   }
+//   profiler.WriteJson("allocations.json");
+//
+// Only one profiler can be alive at a time.
+class AllocationProfiler {
+ public:
+  // Params:
+  //   sampling_interval  Records the call stack of 1 in sampling_interval
+  //     allocations. Zero disables the call stack sampling.
+  //   max_retained_frames  Number of latest frames kept for the report. Older
+  //     frames only count towards the totals.
+  AllocationProfiler(const int sampling_interval,
+                     const int max_retained_frames);
+  ~AllocationProfiler();
+
+  AllocationProfiler(const AllocationProfiler&) = delete;
+  AllocationProfiler& operator=(const AllocationProfiler&) = delete;
+
+  // Starts and ends a profiled frame. EndFrame() returns the statistics of the
+  // frame, which are also kept for the report until max_retained_frames newer
+  // frames end.
+  void BeginFrame();
+  const FrameAllocationStats& EndFrame(const char* label);
+
+  // Returns the most frequently sampled call sites, symbolized.
+  std::vector<AllocationCallSite> TopCallSites(const int max_call_sites) const;
+
+  // Writes the frame statistics and the top call sites as JSON. Returns true
+  // upon success.
+  bool WriteJson(const std::string& filepath) const;
+
+  // Returns the retained frames, oldest first.
+  std::vector<FrameAllocationStats> RetainedFrames() const;
+
+  // Statistics summed over all the frames, with the highest peak.
+  const FrameAllocationStats& totals() const { return totals_; }
+  int64_t num_frames() const { return num_frames_; }
+  // Number of sampled allocations lost because their call sites were evicted
+  // from the full call site table. Non-zero means the top call sites may miss
+  // some samples.
+  uint64_t num_dropped_samples() const;
+  int sampling_interval() const { return sampling_interval_; }
+
+ private:
+  const int sampling_interval_;
+  const int max_retained_frames_;
+  // Ring of the latest frames. Slot num_frames_ % max_retained_frames_ is
+  // overwritten next.
+  std::vector<FrameAllocationStats> frames_;
+  int64_t num_frames_;
+  FrameAllocationStats totals_;
+  // Counters at the beginning of the current frame.
+  uint64_t frame_start_allocations_;
+  uint64_t frame_start_deallocations_;
+  uint64_t frame_start_bytes_allocated_;
+  uint64_t frame_start_bytes_freed_;
+};
+
+namespace internal {
+// Called by the allocation hooks. They are no-ops when no profiler is alive.
+void RecordAllocation(void* pointer);
+void RecordDeallocation(void* pointer);
+
+}  // namespace internal
+}  // namespace wvu
+
+#endif  // ALLOCATION_PROFILER_H_
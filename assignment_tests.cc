@@ -31,13 +31,24 @@
 
 // C headers.
 #define _USE_MATH_DEFINES  // For using M_PI.
-#include <stdlib.h>  // For random.
+#include <stdlib.h>  // For random and getenv.
 #include <math.h>
+#include <errno.h>
+#include <sys/stat.h>  // For mkdir.
 
 // C++ headers.
 #include <algorithm>  // For std::reverse.
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
 #include <numeric>  // For std::accumulate.
+#include <memory>
+#include <mutex>
 #include <random>  // For random operations.
+#include <string>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -47,15 +58,38 @@
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
+#include "allocation_hooks.h"
+#include "allocation_profiler.h"
+#include "bvh.h"
+#include "cpu_profiler.h"
+#include "distributed_renderer.h"
+#include "file_watcher.h"
+#include "frame_arena.h"
+#include "frame_capture.h"
+#include "frame_statistics.h"
+#include "gl_state_cache.h"
+#include "gpu_driven_renderer.h"
+#include "gpu_occlusion_culler.h"
+#include "gpu_program.h"
+#include "gpu_resources.h"
 #include "transformations.h"
+#include "camera_utils.h"
 #include "model.h"
+#include "model_utils.h"
+#include "occlusion_culler.h"
+#include "ray_tracer.h"
+#include "render_context.h"
+#include "resource_registry.h"
+#include "scene_bvh.h"
+#include "shader_permutations.h"
+#include "software_rasterizer.h"
+#include "streaming_buffer.h"
+#include "thread_pool.h"
+#include "tiled_image_renderer.h"
+#include "uniform_block.h"
 
 #define GLEW_STATIC
 #include <GL/glew.h>
-// The header of GLFW. This library is a C-based and light-weight library for
-// creating windows for OpenGL rendering.
-// See http://www.glfw.org/ for more information.
-#include <GLFW/glfw3.h>
 
 // These are unit tests using google gtest library. A binary will be created
 // automatically to run the tests below.
@@ -92,48 +126,74 @@ const std::string fragment_shader_src =
 
 struct ModelTest : public ::testing::Test {
   static void SetUpTestCase() {
-    // Initialize the GLFW library.
-    if (!glfwInit()) {
-      LOG(FATAL) << "GLFW did not initialize correctly";
-    }
-    // Sets properties of windows and have to be set before creation.
-    // GLFW_CONTEXT_VERSION_{MAJOR|MINOR} sets the minimum OpenGL API version
-    // that this program will use.
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    // Sets the OpenGL profile.
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    // Sets the property of resizability of a window.
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
-    // Create a window and its OpenGL context.
-    const std::string window_name = "Hello Triangle";
-    window = glfwCreateWindow(480,
-                              640,
-                              window_name.c_str(),
-                              nullptr,
-                              nullptr);
-    glfwMakeContextCurrent(window);
-    // Initialize GLEW.
-    glewExperimental = GL_TRUE;
-    if (glewInit() != GLEW_OK) {
-      glfwTerminate();
-      LOG(FATAL) << "Glew did not initialize properly!";
+    // Create an invisible window and its OpenGL context. Machines without a
+    // display (e.g., CI) use a headless context instead, which is also used
+    // when the WVU_HEADLESS environment variable is set.
+    RenderContextOptions options;
+    options.width = 480;
+    options.height = 640;
+    options.window_name = "Hello Triangle";
+    options.visible = false;
+    options.headless = getenv("WVU_HEADLESS") != nullptr;
+    context = CreateRenderContext(options);
+    if (context == nullptr && !options.headless) {
+      options.headless = true;
+      context = CreateRenderContext(options);
+    }
+    if (context == nullptr) {
+      LOG(FATAL) << "Could not create an OpenGL context.";
     }
   }
 
   static void TearDownTestCase() {
-    // Destroy window.
-    glfwDestroyWindow(window);
-    // Tear down GLFW library.
-    glfwTerminate();
+    // Destroy the window and the OpenGL context.
+    context.reset();
+  }
+
+  static std::unique_ptr<RenderContext> context;
+};
+
+std::unique_ptr<RenderContext> ModelTest::context;
+
+// Profiles the heap allocations of every test when the environment variable
+// WVU_ALLOCATION_PROFILE holds the filepath of the JSON report.
+class AllocationProfileListener : public ::testing::EmptyTestEventListener {
+ public:
+  explicit AllocationProfileListener(const std::string& filepath)
+      : filepath_(filepath), profiler_(kSamplingInterval, kMaxFrames) {}
+
+  void OnTestStart(const ::testing::TestInfo& /*test_info*/) override {
+    profiler_.BeginFrame();
+  }
+
+  void OnTestEnd(const ::testing::TestInfo& test_info) override {
+    profiler_.EndFrame(test_info.name());
   }
 
-  static GLFWwindow* window;
+  void OnTestProgramEnd(const ::testing::UnitTest& /*unit_test*/) override {
+    profiler_.WriteJson(filepath_);
+  }
+
+ private:
+  static constexpr int kSamplingInterval = 16;
+  // More than the number of tests, so that every test is listed.
+  static constexpr int kMaxFrames = 4096;
+  const std::string filepath_;
+  AllocationProfiler profiler_;
+};
+
+class AllocationProfileEnvironment : public ::testing::Environment {
+ public:
+  void SetUp() override {
+    const char* filepath = getenv("WVU_ALLOCATION_PROFILE");
+    if (filepath == nullptr) return;
+    ::testing::UnitTest::GetInstance()->listeners().Append(
+        new AllocationProfileListener(filepath));
+  }
 };
 
-GLFWwindow* ModelTest::window = nullptr;
+::testing::Environment* const allocation_profile_environment =
+    ::testing::AddGlobalTestEnvironment(new AllocationProfileEnvironment);
 
 }  // namespace
 
@@ -199,6 +259,249 @@ TEST(TransformationsTest, ScalingMatrixInverse) {
   EXPECT_NEAR((scaling1 * scaling2).sum(), 4.0f, 1e-3);
 }
 
+TEST(CameraUtilsTest, ReverseZAndInfiniteProjectionsMapNearAndFar) {
+  const float field_of_view = ConvertDegreesToRadians(45.0f);
+  const float aspect_ratio = 1.5f;
+  const float near = 0.1f;
+  const float far = 1000.0f;
+  // The depth in normalized device coordinates of a point in front of the
+  // camera.
+  const auto compute_depth = [](const Eigen::Matrix4f& projection,
+                                const float distance) {
+    const Eigen::Vector4f clip_position =
+        projection * Eigen::Vector4f(0.0f, 0.0f, -distance, 1.0f);
+    return clip_position.z() / clip_position.w();
+  };
+
+  const Eigen::Matrix4f reverse_z = ComputeReverseZProjectionMatrix(
+      field_of_view, aspect_ratio, near, far);
+  EXPECT_NEAR(compute_depth(reverse_z, near), 1.0f, 1e-5);
+  EXPECT_NEAR(compute_depth(reverse_z, far), 0.0f, 1e-5);
+  const Eigen::Matrix4f infinite_reverse_z =
+      ComputeInfiniteReverseZProjectionMatrix(field_of_view, aspect_ratio,
+                                              near);
+  EXPECT_NEAR(compute_depth(infinite_reverse_z, near), 1.0f, 1e-6);
+  EXPECT_NEAR(compute_depth(infinite_reverse_z, 1e6f), 0.0f, 1e-6);
+  // Distant points still have distinct floating point depths.
+  EXPECT_GT(compute_depth(infinite_reverse_z, 10000.0f),
+            compute_depth(infinite_reverse_z, 10001.0f));
+  const Eigen::Matrix4f infinite = ComputeInfinitePerspectiveProjectionMatrix(
+      field_of_view, aspect_ratio, near);
+  EXPECT_NEAR(compute_depth(infinite, near), -1.0f, 1e-5);
+  EXPECT_NEAR(compute_depth(infinite, 1e6f), 1.0f, 1e-5);
+
+  // The reverse-Z projection has the frustum of the standard one.
+  const Eigen::Matrix4f standard = ComputePerspectiveProjectionMatrix(
+      field_of_view, aspect_ratio, near, far);
+  EXPECT_TRUE(ConvertToStandardDepthProjectionMatrix(
+                  reverse_z, DepthMode::kReverseZ).isApprox(standard, 1e-4f));
+  EXPECT_EQ(ConvertToStandardDepthProjectionMatrix(standard,
+                                                   DepthMode::kStandard),
+            standard);
+}
+
+TEST(CameraUtilsTest, CameraCachesMatricesAndProjectsPoints) {
+  Camera camera;
+  camera.SetPerspective(ConvertDegreesToRadians(60.0f), 1.5f, 0.1f, 100.0f);
+  camera.LookAt(Eigen::Vector3f(0.0f, 0.0f, 5.0f), Eigen::Vector3f::Zero(),
+                Eigen::Vector3f::UnitY());
+  EXPECT_TRUE((camera.view() * Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f))
+                  .isApprox(Eigen::Vector4f(0.0f, 0.0f, -5.0f, 1.0f)));
+  EXPECT_EQ(camera.projection(),
+            ComputePerspectiveProjectionMatrix(ConvertDegreesToRadians(60.0f),
+                                               1.5f, 0.1f, 100.0f));
+  EXPECT_TRUE((camera.view_projection() * camera.inverse_view_projection())
+                  .isIdentity(1e-4f));
+
+  // The cached matrices follow the changes of the lens and the pose.
+  const Eigen::Matrix4f view_projection = camera.view_projection();
+  camera.SetPerspective(ConvertDegreesToRadians(30.0f), 1.5f, 0.1f, 100.0f);
+  EXPECT_NE(camera.view_projection(), view_projection);
+  camera.SetPose(Eigen::Vector3f(1.0f, 0.0f, 0.0f),
+                 Eigen::Quaternionf::Identity());
+  EXPECT_TRUE(camera.inverse_view().col(3).isApprox(
+      Eigen::Vector4f(1.0f, 0.0f, 0.0f, 1.0f)));
+
+  // The batches of points are projected eight at a time and the remainder
+  // one at a time, in both depth modes.
+  std::mt19937 engine(7);
+  std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+  Eigen::Matrix3Xf points(3, 13);
+  for (int i = 0; i < points.cols(); ++i) {
+    points.col(i) << distribution(engine), distribution(engine),
+        -2.0f - 10.0f * (distribution(engine) + 1.0f);
+  }
+  for (const DepthMode depth_mode :
+       {DepthMode::kStandard, DepthMode::kReverseZ}) {
+    camera.set_depth_mode(depth_mode);
+    Eigen::Matrix3Xf ndc_points;
+    camera.ProjectPoints(points, &ndc_points);
+    Eigen::Matrix3Xf unprojected_points;
+    camera.UnprojectPoints(ndc_points, &unprojected_points);
+    for (int i = 0; i < points.cols(); ++i) {
+      const Eigen::Vector4f clip_position =
+          camera.view_projection() * points.col(i).homogeneous();
+      EXPECT_TRUE(ndc_points.col(i).isApprox(
+          clip_position.head<3>() / clip_position.w(), 1e-5f));
+      EXPECT_TRUE(unprojected_points.col(i).isApprox(points.col(i), 1e-3f));
+    }
+    // The frustum planes are those of the standard depth mode.
+    const Eigen::Vector4f* planes = camera.frustum_planes();
+    for (int i = 0; i < 6; ++i) {
+      EXPECT_GE(planes[i].dot(Eigen::Vector4f(1.0f, 0.0f, -5.0f, 1.0f)),
+                0.0f);
+    }
+    EXPECT_LT(planes[4].dot(Eigen::Vector4f(1.0f, 0.0f, 1.0f, 1.0f)), 0.0f);
+    EXPECT_LT(planes[5].dot(Eigen::Vector4f(1.0f, 0.0f, -200.0f, 1.0f)),
+              0.0f);
+  }
+}
+
+TEST(CameraUtilsTest, TilesAreOffAxisRegionsOfTheImage) {
+  // A region of the image is the off-axis frustum through it.
+  const float near = 0.1f;
+  const float top = near * std::tan(ConvertDegreesToRadians(45.0f) / 2.0f);
+  const float right = 2.0f * top;
+  const Eigen::Matrix4f projection = ComputeOffAxisProjectionMatrix(
+      -right, right, -top, top, near, 10.0f);
+  EXPECT_TRUE(projection.isApprox(ComputePerspectiveProjectionMatrix(
+      ConvertDegreesToRadians(45.0f), 2.0f, near, 10.0f)));
+  const Eigen::AlignedBox2f region(Eigen::Vector2f(0.25f, 0.5f),
+                                   Eigen::Vector2f(0.5f, 1.0f));
+  EXPECT_TRUE(ComputeImageRegionProjectionMatrix(projection, region)
+                  .isApprox(ComputeOffAxisProjectionMatrix(
+                      -0.5f * right, 0.0f, 0.0f, top, near, 10.0f)));
+
+  // Every pixel of every tile, including the cropped ones on the edges, maps
+  // to its pixel of the image.
+  TiledImageOptions options;
+  options.width = 50;
+  options.height = 30;
+  options.tile_width = 16;
+  options.tile_height = 16;
+  Camera camera;
+  camera.SetPerspective(ConvertDegreesToRadians(45.0f), 5.0f / 3.0f, near,
+                        10.0f);
+  std::vector<Eigen::Vector2f> tile_origins;
+  const RenderTileFunction render_tile = [&](const Camera& tile_camera,
+                                             uint8_t* pixels) {
+    const Eigen::Vector2f tile_size(options.tile_width, options.tile_height);
+    const Eigen::Vector2f image_size(options.width, options.height);
+    Eigen::Vector2f tile_origin(0.0f, 0.0f);
+    for (int y = 0; y < options.tile_height; ++y) {
+      for (int x = 0; x < options.tile_width; ++x) {
+        const Eigen::Vector2f tile_ndc =
+            2.0f * (Eigen::Vector2f(x, y) + Eigen::Vector2f::Constant(0.5f))
+                       .cwiseQuotient(tile_size) -
+            Eigen::Vector2f::Ones();
+        const Eigen::Vector4f world_position =
+            tile_camera.inverse_view_projection() *
+            Eigen::Vector4f(tile_ndc.x(), tile_ndc.y(), 0.5f, 1.0f);
+        const Eigen::Vector4f clip_position =
+            camera.view_projection() * world_position;
+        const Eigen::Vector2f image_pixel =
+            (clip_position.head<2>() / clip_position.w() +
+             Eigen::Vector2f::Ones())
+                .cwiseProduct(0.5f * image_size) -
+            Eigen::Vector2f(x, y);
+        if (x == 0 && y == 0) tile_origin = image_pixel;
+        EXPECT_TRUE(image_pixel.isApprox(tile_origin, 1e-3f));
+        uint8_t* pixel = pixels + 4 * (y * options.tile_width + x);
+        pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+      }
+    }
+    tile_origins.push_back(tile_origin - Eigen::Vector2f::Constant(0.5f));
+    return true;
+  };
+  const std::string filepath =
+      ::testing::TempDir() + "tiled_image_renderer_test.png";
+  EXPECT_TRUE(RenderTiledImage(options, camera, render_tile, filepath));
+  // The rows of tiles start at the top of the image.
+  ASSERT_EQ(tile_origins.size(), 8);
+  EXPECT_NEAR(tile_origins[0].x(), 0.0f, 1e-3f);
+  EXPECT_NEAR(tile_origins[0].y(), 14.0f, 1e-3f);
+  EXPECT_NEAR(tile_origins[3].x(), 48.0f, 1e-3f);
+  EXPECT_NEAR(tile_origins[7].y(), -2.0f, 1e-3f);
+  std::remove(filepath.c_str());
+}
+
+TEST(DistributedRendererTest, CompositesTilesOfWorkers) {
+  DistributedRendererOptions options;
+  options.width = 50;
+  options.height = 30;
+  options.num_tiles_x = 3;
+  options.num_tiles_y = 2;
+  options.num_workers = 2;
+  options.socket_path = ::testing::TempDir() + "distributed_renderer_test";
+  std::unique_ptr<DistributedRenderer> coordinator(
+      new DistributedRenderer(options));
+  ASSERT_TRUE(coordinator->is_valid());
+
+  // The workers run in threads and write the coordinates of every pixel in
+  // the frame, which they get from the region of their tile.
+  std::vector<std::thread> workers;
+  std::vector<int> num_models(options.num_workers, 0);
+  for (int i = 0; i < options.num_workers; ++i) {
+    workers.emplace_back([&options, &num_models, i]() {
+      const SetModelPosesFunction set_model_poses =
+          [&num_models, i](const std::vector<ModelPose>& model_poses) {
+            num_models[i] = model_poses.size();
+          };
+      const RenderTileFunction render_tile = [&options](
+                                                 const Camera& tile_camera,
+                                                 uint8_t* pixels) {
+        const Eigen::Vector2f tile_origin =
+            tile_camera.image_region().min().cwiseProduct(
+                Eigen::Vector2f(options.width, options.height));
+        for (int y = 0; y < options.tile_height(); ++y) {
+          for (int x = 0; x < options.tile_width(); ++x) {
+            uint8_t* pixel = pixels + 4 * (y * options.tile_width() + x);
+            pixel[0] = std::lround(tile_origin.x()) + x;
+            pixel[1] = std::lround(tile_origin.y()) + y;
+            pixel[2] = 0;
+            pixel[3] = 255;
+          }
+        }
+        return true;
+      };
+      EXPECT_TRUE(RunDistributedWorker(options.socket_path,
+                                       options.tile_width(),
+                                       options.tile_height(),
+                                       set_model_poses, render_tile));
+    });
+  }
+  ASSERT_TRUE(coordinator->ConnectWorkers());
+
+  Camera camera;
+  const std::vector<ModelPose> model_poses(3);
+  for (int frame = 0; frame < 2; ++frame) {
+    ASSERT_TRUE(coordinator->RenderFrame(camera, model_poses));
+    for (int y = 0; y < options.height; ++y) {
+      for (int x = 0; x < options.width; ++x) {
+        const uint8_t* pixel =
+            coordinator->color_buffer() + 4 * (y * options.width + x);
+        EXPECT_EQ(pixel[0], x);
+        EXPECT_EQ(pixel[1], y);
+      }
+    }
+  }
+  // The tiles were measured and split between the workers.
+  for (const float tile_cost : coordinator->tile_costs()) {
+    EXPECT_LT(tile_cost, 1.0f);
+  }
+  for (const float worker_load : coordinator->worker_loads()) {
+    EXPECT_GT(worker_load, 0.0f);
+  }
+
+  // The destruction of the coordinator shuts the workers down.
+  coordinator.reset();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  EXPECT_EQ(num_models[0], 3);
+  EXPECT_EQ(num_models[1], 3);
+}
+
 TEST_F(ModelTest, ComputeModelMatrix) {
   const float angle = M_PI / 8.0f;
   Eigen::Vector3f angle_axis = Eigen::Vector3f::Random();
@@ -243,4 +546,1278 @@ TEST_F(ModelTest, VerifyNonZeroVaoVboAndEboIds) {
   EXPECT_GT(model.element_buffer_object_id(), 0);
 }
 
+TEST_F(ModelTest, ProgramBinaryCacheSkipsCompilation) {
+  ProgramBinaryCache cache(::testing::TempDir() + "program_binary_cache");
+  if (!cache.is_enabled()) GTEST_SKIP();
+  // The sources are unique to this run so the first program misses.
+  ProgramSources sources;
+  sources.vertex = vertex_shader_src + "// " + std::to_string(
+      std::chrono::steady_clock::now().time_since_epoch().count()) + "\n";
+  sources.fragment = fragment_shader_src;
+  std::string error_info_log;
+  GpuProgram compiled_program;
+  ASSERT_TRUE(compiled_program.Create(sources, &cache, &error_info_log))
+      << error_info_log;
+  EXPECT_FALSE(compiled_program.loaded_from_cache());
+  EXPECT_EQ(cache.num_misses(), 1);
+
+  GpuProgram cached_program;
+  ASSERT_TRUE(cached_program.Create(sources, &cache, &error_info_log));
+  EXPECT_TRUE(cached_program.loaded_from_cache());
+  EXPECT_EQ(cache.num_hits(), 1);
+  EXPECT_NE(cached_program.program_id(), compiled_program.program_id());
+
+  // Another source is another program.
+  sources.fragment += "\n";
+  GpuProgram edited_program;
+  ASSERT_TRUE(edited_program.Create(sources, &cache, &error_info_log));
+  EXPECT_FALSE(edited_program.loaded_from_cache());
+  EXPECT_EQ(cache.num_misses(), 2);
+}
+
+TEST_F(ModelTest, GpuProgramsCompileAsynchronously) {
+  EnableParallelShaderCompile();
+  ProgramSources sources;
+  sources.vertex = vertex_shader_src;
+  sources.fragment = fragment_shader_src;
+  ProgramSources broken_sources = sources;
+  broken_sources.fragment += "not glsl";
+  // Both programs are submitted before either is waited for.
+  GpuProgram program;
+  GpuProgram broken_program;
+  program.BeginCreate(sources, nullptr);
+  broken_program.BeginCreate(broken_sources, nullptr);
+  while (!program.IsCreated() || !broken_program.IsCreated()) {
+    std::this_thread::yield();
+  }
+  std::string error_info_log;
+  EXPECT_TRUE(program.EndCreate(&error_info_log)) << error_info_log;
+  EXPECT_NE(program.program_id(), 0);
+  EXPECT_FALSE(broken_program.EndCreate(&error_info_log));
+  EXPECT_FALSE(error_info_log.empty());
+  EXPECT_EQ(broken_program.program_id(), 0);
+}
+
+TEST_F(ModelTest, ShaderPermutationsCompileVariantsLazily) {
+  const uint32_t kRed = 1 << 0;
+  const uint32_t kBroken = 1 << 1;
+  ProgramSources sources;
+  sources.vertex = "#version 330 core\n"
+                   "#include \"position.glsl\"\n"
+                   "void main() {\n"
+                   "gl_Position = vec4(position, 1.0f);\n"
+                   "}\n";
+  sources.fragment = "#version 330 core\n"
+                     "out vec4 color;\n"
+                     "void main() {\n"
+                     "#ifdef RED\n"
+                     "color = vec4(1.0f, 0.0f, 0.0f, 1.0f);\n"
+                     "#else\n"
+                     "color = vec4(1.0f);\n"
+                     "#endif\n"
+                     "#ifdef BROKEN\n"
+                     "not glsl\n"
+                     "#endif\n"
+                     "}\n";
+  ShaderPermutations permutations(sources, {"RED", "BROKEN"}, nullptr);
+  ProgramSources variant_sources;
+  std::string error;
+  EXPECT_FALSE(permutations.PreprocessVariant(kRed, &variant_sources, &error));
+  EXPECT_FALSE(error.empty());
+  // Includes are resolved once and the macros follow the #version directive.
+  permutations.AddInclude("position.glsl",
+                          "#include \"position.glsl\"\n"
+                          "layout (location = 0) in vec3 position;\n");
+  ASSERT_TRUE(permutations.PreprocessVariant(kRed, &variant_sources, &error))
+      << error;
+  EXPECT_EQ(variant_sources.vertex,
+            "#version 330 core\n"
+            "#define RED 1\n"
+            "layout (location = 0) in vec3 position;\n"
+            "void main() {\n"
+            "gl_Position = vec4(position, 1.0f);\n"
+            "}\n");
+  EXPECT_TRUE(variant_sources.compute.empty());
+
+  // Variants are compiled on first use only.
+  EXPECT_EQ(permutations.num_variants(), 0);
+  const GpuProgram* red_program = permutations.GetProgram(kRed);
+  ASSERT_NE(red_program, nullptr);
+  EXPECT_NE(red_program->program_id(), 0);
+  EXPECT_EQ(permutations.GetProgram(kRed), red_program);
+  const GpuProgram* white_program = permutations.GetProgram(0);
+  ASSERT_NE(white_program, nullptr);
+  EXPECT_NE(white_program, red_program);
+  EXPECT_EQ(permutations.GetProgram(kRed | kBroken), nullptr);
+  EXPECT_EQ(permutations.num_variants(), 3);
+  EXPECT_EQ(permutations.used_variants(),
+            std::vector<uint32_t>({kRed, 0, kRed | kBroken}));
+
+  // The usage list prewarms the variants of another run.
+  const std::string usage_filepath =
+      ::testing::TempDir() + "shader_usage_test.txt";
+  ASSERT_TRUE(permutations.WriteUsageList(usage_filepath));
+  ShaderPermutations prewarmed_permutations(sources, {"RED", "BROKEN"},
+                                            nullptr);
+  prewarmed_permutations.AddInclude(
+      "position.glsl", "layout (location = 0) in vec3 position;\n");
+  std::vector<uint32_t> variants;
+  ASSERT_TRUE(
+      prewarmed_permutations.ReadUsageList(usage_filepath, &variants));
+  EXPECT_EQ(variants, permutations.used_variants());
+  variants.pop_back();
+  prewarmed_permutations.Prewarm(variants);
+  EXPECT_EQ(prewarmed_permutations.num_variants(), 2);
+  EXPECT_TRUE(prewarmed_permutations.FinishPrewarm());
+  EXPECT_TRUE(prewarmed_permutations.used_variants().empty());
+  EXPECT_NE(prewarmed_permutations.GetProgram(0), nullptr);
+  std::remove(usage_filepath.c_str());
+}
+
+TEST_F(ModelTest, ShaderPermutationsSwapReloadedVariants) {
+  ProgramSources sources;
+  sources.vertex = vertex_shader_src;
+  sources.fragment = fragment_shader_src;
+  ShaderPermutations permutations(sources, {}, nullptr);
+  const GpuProgram* program = permutations.GetProgram(0);
+  ASSERT_NE(program, nullptr);
+  const GLuint program_id = program->program_id();
+  EXPECT_FALSE(permutations.SwapReloadedVariants());
+
+  // A variant that does not compile keeps its program.
+  ProgramSources broken_sources = sources;
+  broken_sources.fragment += "not glsl";
+  permutations.BeginReload(broken_sources);
+  while (!permutations.SwapReloadedVariants()) std::this_thread::yield();
+  EXPECT_EQ(permutations.GetProgram(0)->program_id(), program_id);
+
+  sources.fragment += "// Edited.\n";
+  permutations.BeginReload(sources);
+  while (!permutations.SwapReloadedVariants()) std::this_thread::yield();
+  ASSERT_NE(permutations.GetProgram(0), nullptr);
+  EXPECT_NE(permutations.GetProgram(0)->program_id(), 0);
+  EXPECT_NE(permutations.GetProgram(0)->program_id(), program_id);
+}
+
+TEST_F(ModelTest, ReflectedUniformsAndStateCache) {
+  ProgramSources sources;
+  sources.vertex = "#version 330 core\n"
+                   "layout (location = 0) in vec3 position;\n"
+                   "uniform mat4 model;\n"
+                   "void main() {\n"
+                   "gl_Position = model * vec4(position, 1.0f);\n"
+                   "}\n";
+  sources.fragment = "#version 330 core\n"
+                     "uniform vec4 tints[2];\n"
+                     "layout (std140) uniform Material {\n"
+                     "  vec4 albedo;\n"
+                     "};\n"
+                     "out vec4 color;\n"
+                     "void main() {\n"
+                     "color = albedo * tints[0] * tints[1];\n"
+                     "}\n";
+  GpuProgram program;
+  std::string error_info_log;
+  ASSERT_TRUE(program.Create(sources, nullptr, &error_info_log))
+      << error_info_log;
+  const GLuint program_id = program.program_id();
+  constexpr uint64_t kModelUniform = HashUniformName("model");
+  EXPECT_EQ(program.uniform_location(kModelUniform),
+            glGetUniformLocation(program_id, "model"));
+  EXPECT_EQ(program.uniform_location(HashUniformName("tints")),
+            glGetUniformLocation(program_id, "tints"));
+  EXPECT_EQ(program.uniform_location(HashUniformName("tints[0]")),
+            glGetUniformLocation(program_id, "tints"));
+  EXPECT_EQ(program.uniform_location(HashUniformName("missing")), -1);
+  EXPECT_EQ(program.uniform_block_index(HashUniformName("Material")),
+            glGetUniformBlockIndex(program_id, "Material"));
+  EXPECT_EQ(program.uniform_block_index(HashUniformName("albedo")), -1);
+
+  GlStateCache state_cache;
+  state_cache.UseProgram(program_id);
+  state_cache.UseProgram(program_id);
+  state_cache.BindTexture2D(0, 0);
+  state_cache.BindTexture2D(0, 0);
+  state_cache.SetCapability(GL_DEPTH_TEST, true);
+  state_cache.SetCapability(GL_DEPTH_TEST, true);
+  state_cache.SetCapability(GL_DEPTH_TEST, false);
+  // Use program, select the unit, bind the texture, enable, disable.
+  EXPECT_EQ(state_cache.num_state_changes(), 5);
+  EXPECT_EQ(state_cache.num_redundant_state_changes(), 3);
+  GLint current_program_id = 0;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &current_program_id);
+  EXPECT_EQ(current_program_id, program_id);
+  EXPECT_FALSE(glIsEnabled(GL_DEPTH_TEST));
+  // The state changed behind the cache is set again once invalidated.
+  glUseProgram(0);
+  state_cache.Invalidate();
+  state_cache.UseProgram(program_id);
+  glGetIntegerv(GL_CURRENT_PROGRAM, &current_program_id);
+  EXPECT_EQ(current_program_id, program_id);
+  glUseProgram(0);
+}
+
+// A block whose fields exercise the alignment rules of std140.
+struct TestUniforms {
+  Eigen::Matrix4f view;
+  Eigen::Vector3f light_direction;
+  float time;
+  Eigen::Vector2f resolution;
+  uint32_t frame;
+  int32_t padding;
+  Eigen::Vector4f tints[2];
+};
+WVU_UNIFORM_BLOCK(TestUniforms, kStd140, view, light_direction, time,
+                  resolution, frame, padding, tints);
+
+TEST_F(ModelTest, UniformBlockMatchesDriverLayout) {
+  ProgramSources sources;
+  sources.vertex = vertex_shader_src;
+  sources.fragment = "#version 330 core\n" +
+                     UniformBlock<TestUniforms>::Declaration() +
+                     "out vec4 color;\n"
+                     "void main() {\n"
+                     "color = view[0] * time * tints[0] * tints[1] +\n"
+                     "    vec4(light_direction, float(frame + uint(padding)))"
+                     " +\n"
+                     "    vec4(resolution, 0.0f, 0.0f);\n"
+                     "}\n";
+  GpuProgram program;
+  std::string error_info_log;
+  ASSERT_TRUE(program.Create(sources, nullptr, &error_info_log))
+      << error_info_log;
+  const GLuint program_id = program.program_id();
+  const GLint block_index =
+      program.uniform_block_index(HashUniformName("TestUniforms"));
+  ASSERT_GE(block_index, 0);
+  GLint block_size = 0;
+  glGetActiveUniformBlockiv(program_id, block_index,
+                            GL_UNIFORM_BLOCK_DATA_SIZE, &block_size);
+  EXPECT_EQ(block_size, UniformBlock<TestUniforms>::kSize);
+  EXPECT_EQ(sizeof(TestUniforms), UniformBlock<TestUniforms>::kSize);
+
+  const char* names[] = {"view",  "light_direction", "time",   "resolution",
+                         "frame", "padding",         "tints[0]"};
+  const GLint expected_offsets[] = {
+      offsetof(TestUniforms, view),    offsetof(TestUniforms, light_direction),
+      offsetof(TestUniforms, time),    offsetof(TestUniforms, resolution),
+      offsetof(TestUniforms, frame),   offsetof(TestUniforms, padding),
+      offsetof(TestUniforms, tints)};
+  GLuint indices[7];
+  glGetUniformIndices(program_id, 7, names, indices);
+  GLint offsets[7];
+  glGetActiveUniformsiv(program_id, 7, indices, GL_UNIFORM_OFFSET, offsets);
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(offsets[i], expected_offsets[i]) << names[i];
+  }
+}
+
+TEST_F(ModelTest, GpuResourcesAreDeletedAfterTheGpuFinishes) {
+  GpuResourcePool pool;
+  std::unique_ptr<Model> model(new Model(Eigen::Vector3f::Zero(),
+                                         Eigen::Vector3f::Zero(),
+                                         Eigen::MatrixXf::Random(3, 3)));
+  model->SetVerticesIntoGpu();
+  const GLuint vertex_array_id = model->vertex_array_object_id();
+  GpuModel scene_model(&pool, nullptr, "pyramid", std::move(model));
+  EXPECT_EQ(pool.num_live_resources(), 2);
+  GLuint texture_id;
+  glGenTextures(1, &texture_id);
+  // Binding the name creates the texture.
+  glBindTexture(GL_TEXTURE_2D, texture_id);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  GpuResource texture(&pool, GpuResourceType::kTexture, texture_id);
+  const GpuHandle texture_handle = texture.handle();
+
+  // Moving transfers the ownership without releasing anything.
+  GpuModel moved_model = std::move(scene_model);
+  EXPECT_EQ(scene_model.get(), nullptr);
+  EXPECT_EQ(moved_model.get()->vertex_array_object_id(), vertex_array_id);
+  GpuResource moved_texture = std::move(texture);
+  EXPECT_EQ(texture.id(), 0);
+  EXPECT_EQ(moved_texture.id(), texture_id);
+  EXPECT_EQ(pool.num_live_resources(), 3);
+
+  // Released objects stay alive until the GPU finishes the frame.
+  moved_model = GpuModel();
+  moved_texture.Reset();
+  EXPECT_FALSE(pool.IsAlive(texture_handle));
+  EXPECT_EQ(pool.num_live_resources(), 0);
+  EXPECT_EQ(pool.num_pending_releases(), 3);
+  EXPECT_TRUE(glIsVertexArray(vertex_array_id));
+  EXPECT_TRUE(glIsTexture(texture_id));
+  pool.EndFrame();
+  glFinish();
+  pool.EndFrame();
+  EXPECT_EQ(pool.num_pending_releases(), 0);
+  EXPECT_FALSE(glIsVertexArray(vertex_array_id));
+  EXPECT_FALSE(glIsTexture(texture_id));
+
+  // A recycled slot does not revive the stale handle.
+  glGenTextures(1, &texture_id);
+  GpuResource new_texture(&pool, GpuResourceType::kTexture, texture_id);
+  EXPECT_EQ(new_texture.handle().index, texture_handle.index);
+  EXPECT_EQ(pool.Get(texture_handle), 0);
+  EXPECT_EQ(new_texture.id(), texture_id);
+  new_texture.Reset();
+  pool.Finish();
+  EXPECT_EQ(pool.num_pending_releases(), 0);
+}
+
+TEST_F(ModelTest, StreamingBufferRecyclesFencedRegions) {
+  const GLsizeiptr alignment = StreamingBuffer::UniformAlignment();
+  const GLsizeiptr frame_capacity = 4 * alignment;
+  StreamingBuffer stream(frame_capacity, 2);
+  ASSERT_TRUE(stream.is_valid());
+  EXPECT_EQ(stream.uniform_alignment(), alignment);
+
+  GLintptr offsets[3];
+  for (int frame = 0; frame < 3; ++frame) {
+    stream.BeginFrame();
+    EXPECT_EQ(stream.bytes_used(), 0);
+    GLintptr offset;
+    uint32_t* data = static_cast<uint32_t*>(
+        stream.Allocate(sizeof(uint32_t), alignment, &offset));
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(offset % alignment, 0);
+    *data = 0xc0ffee00 + frame;
+    // The next allocation skips to the next aligned offset.
+    GLintptr next_offset;
+    ASSERT_NE(stream.Allocate(1, alignment, &next_offset), nullptr);
+    EXPECT_EQ(next_offset, offset + alignment);
+    // The region does not grow beyond its capacity.
+    EXPECT_EQ(stream.Allocate(frame_capacity, 1, &next_offset), nullptr);
+    stream.Flush();
+    offsets[frame] = offset;
+
+    // The GPU reads what the CPU wrote.
+    uint32_t value = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer_id());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, offset, sizeof(value), &value);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    EXPECT_EQ(value, 0xc0ffee00 + frame);
+    stream.EndFrame();
+    glFinish();
+  }
+  // The frames alternate between the two regions.
+  EXPECT_EQ(offsets[1], offsets[0] + frame_capacity);
+  EXPECT_EQ(offsets[2], offsets[0]);
+  // The GPU finished the region before it was reused.
+  EXPECT_EQ(stream.num_stalls(), 0);
+}
+
+TEST_F(ModelTest, ComputeModelMatrix4f) {
+  const float angle = M_PI / 8.0f;
+  Eigen::Vector3f angle_axis = Eigen::Vector3f::Random();
+  angle_axis.normalize();
+  angle_axis *= angle;
+  const Eigen::Vector3f position = Eigen::Vector3f::Random();
+  const Eigen::MatrixXf vertices = Eigen::MatrixXf::Random(3, 3);
+  Model model(angle_axis, position, vertices);
+  const Eigen::MatrixXf expected_model_matrix = model.ComputeModelMatrix();
+  const ScopedAllocationCounter allocations;
+  const Eigen::Matrix4f model_matrix = ComputeModelMatrix4f(model);
+  EXPECT_EQ(allocations.num_allocations(), 0);
+  EXPECT_NEAR((model_matrix - expected_model_matrix).norm(), 0.0f, 1e-5);
+}
+
+TEST_F(ModelTest, FrameCaptureWritesFramesInOrder) {
+  const int kNumFrames = 5;
+  FrameCaptureOptions options;
+  options.filepath = ::testing::TempDir() + "frame_capture_test_%d.ppm";
+  options.num_pixel_buffers = 2;
+  options.num_encoder_threads = 2;
+  FrameCapture capture(options, context->width(), context->height());
+  ASSERT_TRUE(capture.is_valid());
+  // Every frame is cleared to a different shade of red.
+  glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer_id());
+  for (int i = 0; i < kNumFrames; ++i) {
+    glClearColor(i / 255.0f, 0.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    capture.CaptureFrame(context->framebuffer_id());
+  }
+  capture.Finish();
+  EXPECT_EQ(capture.num_frames_captured(), kNumFrames);
+
+  for (int i = 0; i < kNumFrames; ++i) {
+    char filepath[256];
+    snprintf(filepath, sizeof(filepath), options.filepath.c_str(), i);
+    std::ifstream frame_file(filepath, std::ios::binary);
+    ASSERT_TRUE(frame_file.is_open()) << filepath;
+    std::string magic;
+    int width, height, max_value;
+    frame_file >> magic >> width >> height >> max_value;
+    frame_file.get();
+    EXPECT_EQ(magic, "P6");
+    EXPECT_EQ(width, context->width());
+    EXPECT_EQ(height, context->height());
+    char pixel[3];
+    frame_file.read(pixel, 3);
+    EXPECT_EQ(static_cast<uint8_t>(pixel[0]), i);
+    EXPECT_EQ(static_cast<uint8_t>(pixel[1]), 0);
+    EXPECT_EQ(static_cast<uint8_t>(pixel[2]), 255);
+  }
+
+  // Patterns other than one frame number conversion are rejected.
+  for (const char* pattern : {"frame.ppm", "frame_%d_%d.ppm",
+                              "frame_%s.ppm", "100%_%03d.png"}) {
+    options.filepath = ::testing::TempDir() + pattern;
+    EXPECT_FALSE(FrameCapture(options, 1, 1).is_valid()) << pattern;
+  }
+  options.filepath = ::testing::TempDir() + "100%%_%03d.ppm";
+  FrameCapture escaped_capture(options, 1, 1);
+  EXPECT_TRUE(escaped_capture.is_valid());
+}
+
+TEST_F(ModelTest, GpuOcclusionCullerSkipsHiddenBoundingBoxes) {
+  GpuOcclusionCuller culler(3, DepthMode::kStandard);
+  ASSERT_TRUE(culler.is_valid());
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      M_PI / 4.0f, static_cast<float>(context->width()) / context->height(),
+      0.1f, 10.0f);
+  // The depth buffer is cleared to a depth between the boxes, which acts as
+  // an occluder covering the whole framebuffer.
+  glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer_id());
+  glViewport(0, 0, context->width(), context->height());
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_LESS);
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClearDepth(0.9);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // Objects are visible until queried. Queries without draws hide them.
+  culler.BeginFrame();
+  for (int i = 0; i < culler.num_objects(); ++i) {
+    EXPECT_TRUE(culler.IsVisible(i));
+    culler.BeginQuery(i);
+    culler.EndQuery();
+  }
+  glFinish();
+  culler.BeginFrame();
+  for (int i = 0; i < culler.num_objects(); ++i) {
+    EXPECT_FALSE(culler.IsVisible(i));
+  }
+
+  // The first box is behind the occluder, the second in front of it, and
+  // the camera is inside the third.
+  const Eigen::AlignedBox3f bounds[] = {
+      Eigen::AlignedBox3f(Eigen::Vector3f(-1.0f, -1.0f, -9.0f),
+                          Eigen::Vector3f(1.0f, 1.0f, -8.0f)),
+      Eigen::AlignedBox3f(Eigen::Vector3f(-0.1f, -0.1f, -0.6f),
+                          Eigen::Vector3f(0.1f, 0.1f, -0.5f)),
+      Eigen::AlignedBox3f(Eigen::Vector3f(-1.0f, -1.0f, -1.0f),
+                          Eigen::Vector3f(1.0f, 1.0f, 1.0f))};
+  culler.BeginBoundingBoxes(projection);
+  for (int i = 0; i < culler.num_objects(); ++i) {
+    culler.DrawBoundingBox(i, bounds[i]);
+  }
+  culler.EndBoundingBoxes();
+  glUseProgram(0);
+
+  // Every object clears a column of the framebuffer to white under its
+  // conditional rendering. The GPU may ignore the results it does not have
+  // yet, so it finishes the boxes first.
+  glFinish();
+  const int column_width = context->width() / culler.num_objects();
+  glEnable(GL_SCISSOR_TEST);
+  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  for (int i = 0; i < culler.num_objects(); ++i) {
+    glScissor(i * column_width, 0, column_width, context->height());
+    culler.BeginConditionalRender(i);
+    glClear(GL_COLOR_BUFFER_BIT);
+    culler.EndConditionalRender();
+  }
+  glDisable(GL_SCISSOR_TEST);
+  glFinish();
+  for (int i = 0; i < culler.num_objects(); ++i) {
+    uint8_t pixel[4];
+    glReadPixels(i * column_width + column_width / 2, context->height() / 2,
+                 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+    EXPECT_EQ(pixel[0], i == 0 ? 0 : 255) << "Object " << i;
+  }
+
+  culler.BeginFrame();
+  EXPECT_FALSE(culler.IsVisible(0));
+  EXPECT_TRUE(culler.IsVisible(1));
+  EXPECT_TRUE(culler.IsVisible(2));
+  glClearDepth(1.0);
+  glDisable(GL_DEPTH_TEST);
+}
+
+TEST_F(ModelTest, GpuDrivenRendererCullsAgainstFrustumAndHiZ) {
+  if (!GpuDrivenRenderer::IsSupported()) GTEST_SKIP();
+  GpuDrivenRenderer renderer(context->width(), context->height(),
+                             context->depth_format(), DepthMode::kStandard,
+                             8, 1);
+  ASSERT_TRUE(renderer.is_valid());
+  // A square and a triangle in the xy-plane, which face the camera.
+  Eigen::MatrixXf square_vertices(3, 4);
+  square_vertices << -1.0f, 1.0f, 1.0f, -1.0f,
+                     -1.0f, -1.0f, 1.0f, 1.0f,
+                     0.0f, 0.0f, 0.0f, 0.0f;
+  const int square = renderer.AddMesh(square_vertices, {0, 1, 2, 0, 2, 3});
+  const int triangle = renderer.AddMesh(square_vertices.leftCols(3), {});
+  const auto add_instance = [&renderer](const int mesh,
+                                        const Eigen::Vector3f& position,
+                                        const float scale) {
+    Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+    model_matrix.topLeftCorner<3, 3>() *= scale;
+    model_matrix.topRightCorner<3, 1>() = position;
+    const Eigen::Vector3f extent(scale, scale, 0.0f);
+    renderer.AddInstance(mesh, model_matrix,
+                         Eigen::AlignedBox3f(position - extent,
+                                             position + extent),
+                         0);
+  };
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      M_PI / 4.0f, static_cast<float>(context->width()) / context->height(),
+      0.1f, 10.0f);
+
+  // Without a Hi-Z pyramid, only the frustum culls.
+  renderer.BeginFrame();
+  add_instance(square, Eigen::Vector3f(0.0f, 0.0f, -2.0f), 0.5f);
+  add_instance(triangle, Eigen::Vector3f(0.3f, 0.0f, -3.0f), 0.5f);
+  add_instance(square, Eigen::Vector3f(100.0f, 0.0f, -2.0f), 0.5f);
+  add_instance(square, Eigen::Vector3f(0.0f, 0.0f, 5.0f), 0.5f);
+  renderer.Cull(projection);
+  EXPECT_EQ(renderer.ReadNumVisibleInstances(), 2);
+
+  // The depth buffer is 0.5 on its left half and 0.9 on its right half.
+  // Every texel of the pyramid is the farthest depth below it.
+  glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer_id());
+  glDepthMask(GL_TRUE);
+  glClearDepth(0.9);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(0, 0, context->width() / 2, context->height());
+  glClearDepth(0.5);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glDisable(GL_SCISSOR_TEST);
+  glClearDepth(1.0);
+  renderer.BuildHiZ(context->framebuffer_id());
+  EXPECT_NEAR(renderer.ReadHiZDepth(0, 0, 0), 0.5f, 1e-5f);
+  EXPECT_NEAR(renderer.ReadHiZDepth(0, context->width() - 1,
+                                    context->height() - 1),
+              0.9f, 1e-5f);
+  EXPECT_NEAR(renderer.ReadHiZDepth(renderer.num_hi_z_levels() - 1, 0, 0),
+              0.9f, 1e-5f);
+
+  // The squares at z = -0.7 (a depth of 0.87) are behind the left half but
+  // not the right half. The square crossing the near plane is never hidden.
+  renderer.BeginFrame();
+  add_instance(square, Eigen::Vector3f(0.0f, 0.0f, -8.0f), 1.0f);
+  add_instance(square, Eigen::Vector3f(0.0f, 0.0f, -0.6f), 0.05f);
+  add_instance(square, Eigen::Vector3f(-0.1f, 0.0f, -0.7f), 0.02f);
+  add_instance(square, Eigen::Vector3f(0.1f, 0.0f, -0.7f), 0.02f);
+  renderer.AddInstance(square, Eigen::Matrix4f::Identity(),
+                       Eigen::AlignedBox3f(Eigen::Vector3f(-1.0f, -1.0f, -8.0f),
+                                           Eigen::Vector3f(1.0f, 1.0f, 1.0f)),
+                       0);
+  renderer.Cull(projection);
+  EXPECT_EQ(renderer.ReadNumVisibleInstances(), 3);
+
+  // The visible instances are drawn with a white texture.
+  GLuint texture_id;
+  const uint8_t white[] = {255, 255, 255, 255};
+  glGenTextures(1, &texture_id);
+  glBindTexture(GL_TEXTURE_2D, texture_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, white);
+  glViewport(0, 0, context->width(), context->height());
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  renderer.Draw(projection, Eigen::Matrix4f::Identity(), &texture_id);
+  uint8_t pixel[4];
+  glReadPixels(context->width() / 2, context->height() / 2, 1, 1, GL_RGBA,
+               GL_UNSIGNED_BYTE, pixel);
+  EXPECT_EQ(pixel[0], 255);
+  glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+  EXPECT_EQ(pixel[0], 0);
+  glDeleteTextures(1, &texture_id);
+  glUseProgram(0);
+}
+
+TEST(AllocationProfilerTest, CountsAllocationsOfFrame) {
+  // Only one profiler can be alive at a time.
+  if (getenv("WVU_ALLOCATION_PROFILE") != nullptr) GTEST_SKIP();
+  AllocationProfiler profiler(1, 1);
+  profiler.BeginFrame();
+  std::unique_ptr<std::vector<int>> values(new std::vector<int>(1000));
+  values.reset();
+  const FrameAllocationStats& frame = profiler.EndFrame("frame");
+  EXPECT_GE(frame.num_allocations, 2);
+  EXPECT_GE(frame.num_deallocations, 2);
+  EXPECT_GE(frame.bytes_allocated, 1000 * sizeof(int));
+  EXPECT_GE(frame.peak_live_bytes, 1000 * sizeof(int));
+  EXPECT_FALSE(profiler.TopCallSites(1).empty());
+}
+
+TEST(AllocationProfilerTest, KeepsLatestFramesAndTotals) {
+  if (getenv("WVU_ALLOCATION_PROFILE") != nullptr) GTEST_SKIP();
+  AllocationProfiler profiler(1, 2);
+  for (const char* label : {"first", "second", "third"}) {
+    profiler.BeginFrame();
+    std::unique_ptr<int> value(new int(0));
+    profiler.EndFrame(label);
+  }
+  const std::vector<FrameAllocationStats> frames = profiler.RetainedFrames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].label, "second");
+  EXPECT_EQ(frames[1].label, "third");
+  EXPECT_EQ(profiler.num_frames(), 3);
+  EXPECT_GE(profiler.totals().num_allocations, 3);
+}
+
+TEST(CpuProfilerTest, WritesRecordedZonesAsChromeTrace) {
+  const std::string trace_filepath =
+      ::testing::TempDir() + "cpu_profiler_test_trace.json";
+  SetCpuProfilingEnabled(true);
+  {
+    WVU_PROFILE_ZONE("EnabledZone");
+  }
+  SetCpuProfilingEnabled(false);
+  {
+    WVU_PROFILE_ZONE("DisabledZone");
+  }
+  ASSERT_TRUE(WriteChromeTrace(trace_filepath));
+  std::ifstream trace_file(trace_filepath);
+  const std::string trace((std::istreambuf_iterator<char>(trace_file)),
+                          std::istreambuf_iterator<char>());
+  EXPECT_NE(trace.find("\"traceEvents\""), std::string::npos);
+  EXPECT_NE(trace.find("\"EnabledZone\""), std::string::npos);
+  EXPECT_EQ(trace.find("\"DisabledZone\""), std::string::npos);
+}
+
+TEST(FileWatcherTest, ReportsWrittenAndRenamedFiles) {
+  const std::string directory = ::testing::TempDir() + "file_watcher_test";
+  ASSERT_TRUE(mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST);
+  const std::string written_filepath = directory + "/written.glsl";
+  const std::string renamed_filepath = directory + "/renamed.png";
+  std::mutex mutex;
+  std::condition_variable file_changed;
+  std::vector<std::string> changed_filepaths;
+  FileWatcher watcher({written_filepath, renamed_filepath},
+                      [&](const std::string& filepath) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        changed_filepaths.push_back(filepath);
+                        file_changed.notify_one();
+                      });
+  ASSERT_TRUE(watcher.is_valid());
+  const auto wait_for_changes = [&](const int num_changes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return file_changed.wait_for(lock, std::chrono::seconds(5), [&]() {
+      return static_cast<int>(changed_filepaths.size()) >= num_changes;
+    });
+  };
+
+  // Files that are not watched are not reported.
+  std::ofstream(directory + "/other.glsl") << "other";
+  std::ofstream(written_filepath) << "written";
+  ASSERT_TRUE(wait_for_changes(1));
+  // Editors save by renaming a new file over the old one.
+  const std::string temporary_filepath = directory + "/renamed.png.tmp";
+  std::ofstream(temporary_filepath) << "renamed";
+  ASSERT_EQ(std::rename(temporary_filepath.c_str(), renamed_filepath.c_str()),
+            0);
+  ASSERT_TRUE(wait_for_changes(2));
+  std::lock_guard<std::mutex> lock(mutex);
+  EXPECT_EQ(changed_filepaths,
+            std::vector<std::string>({written_filepath, renamed_filepath}));
+}
+
+TEST(FrameStatisticsTest, SummarizesRollingWindow) {
+  FrameStatistics statistics(100);
+  RenderCounters counters;
+  counters.draw_calls = 9;
+  // The first 100 frames fall out of the window.
+  for (int i = 0; i < 100; ++i) statistics.AddCpuFrame(1000.0, counters);
+  for (int i = 1; i <= 100; ++i) statistics.AddCpuFrame(i, counters);
+  const StatisticsSummary summary = statistics.CpuFrameTimeSummary();
+  EXPECT_NEAR(summary.mean, 50.5, 1e-6);
+  EXPECT_EQ(summary.p50, 50.0);
+  EXPECT_EQ(summary.p95, 95.0);
+  EXPECT_EQ(summary.p99, 99.0);
+  EXPECT_EQ(statistics.MeanRenderCounters().draw_calls, 9);
+}
+
+TEST(FrameArenaTest, AllocationsAreAlignedAndRecycled) {
+  FrameArena arena(1024);
+  void* first = arena.Allocate(3, 1);
+  Eigen::Matrix4f* matrices = arena.AllocateArray<Eigen::Matrix4f>(4);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(matrices) % alignof(Eigen::Matrix4f),
+            0);
+  EXPECT_GE(arena.bytes_used(), 3 + 4 * sizeof(Eigen::Matrix4f));
+  arena.Reset();
+  EXPECT_EQ(arena.bytes_used(), 0);
+  EXPECT_EQ(arena.Allocate(3, 1), first);
+}
+
+TEST(FrameArenaTest, GrowsAfterOverflowingFrame) {
+  FrameArena arena(64);
+  arena.Allocate(48);
+  arena.Allocate(48);
+  EXPECT_EQ(arena.num_overflow_allocations(), 1);
+  arena.Reset();
+  EXPECT_GE(arena.capacity(), 96);
+  arena.Allocate(48);
+  arena.Allocate(48);
+  EXPECT_EQ(arena.num_overflow_allocations(), 0);
+}
+
+TEST(FrameArenaTest, SteadyStateFramesDoNotAllocate) {
+  // Warm up the thread arena with a frame larger than its initial capacity.
+  // The arena grows when the next frame begins.
+  BeginFrameArenas();
+  ThreadFrameArena().AllocateArray<float>(1 << 20);
+  BeginFrameArenas();
+  ThreadFrameArena();
+  for (int frame = 0; frame < 10; ++frame) {
+    const ScopedAllocationCounter allocations;
+    BeginFrameArenas();
+    std::vector<float, FrameArenaAllocator<float>> values;
+    values.reserve(1 << 19);
+    values.resize(1 << 19, 1.0f);
+    ThreadFrameArena().AllocateArray<Eigen::Matrix4f>(1024);
+    EXPECT_EQ(allocations.num_allocations(), 0);
+  }
+}
+
+TEST(ResourceRegistryTest, AggregatesCategoriesAndEvictsOverBudget) {
+  EXPECT_EQ(CountMipLevels(256, 64), 9);
+  EXPECT_EQ(ComputeTextureBytes(4, 2, 3, CountMipLevels(4, 2)),
+            (8 + 2 + 1) * 3);
+
+  ResourceRegistry registry;
+  ResourceInfo texture_info;
+  texture_info.name = "large.jpg";
+  texture_info.category = "textures";
+  texture_info.format = GL_RGB8;
+  texture_info.width = 512;
+  texture_info.height = 512;
+  texture_info.num_mip_levels = CountMipLevels(512, 512);
+  texture_info.num_bytes = ComputeTextureBytes(512, 512, 3, 10);
+  ResourceRecord large_texture(&registry, texture_info);
+  texture_info.name = "small.jpg";
+  texture_info.num_bytes = 1000;
+  ResourceRecord small_texture(&registry, texture_info);
+  ResourceInfo vertices_info;
+  vertices_info.name = "pyramid";
+  vertices_info.category = "model vertex copies";
+  vertices_info.domain = MemoryDomain::kCpu;
+  vertices_info.num_bytes = 216;
+  ResourceRecord vertices(&registry, vertices_info);
+  EXPECT_EQ(registry.num_resources(), 3);
+  EXPECT_EQ(registry.num_bytes(MemoryDomain::kGpu),
+            ComputeTextureBytes(512, 512, 3, 10) + 1000);
+  EXPECT_EQ(registry.num_bytes(MemoryDomain::kCpu), 216);
+
+  // The report lists the largest resources first.
+  const std::string report = registry.Report(2);
+  EXPECT_LT(report.find("large.jpg"), report.find("small.jpg"));
+  EXPECT_EQ(report.find("pyramid"), std::string::npos);
+
+  // The eviction function frees the bytes over the budget.
+  uint64_t evicted_bytes = 0;
+  registry.SetBudget("textures", 4096, [&](const uint64_t num_bytes) {
+    evicted_bytes = num_bytes;
+    large_texture.Reset();
+  });
+  EXPECT_TRUE(registry.EnforceBudgets());
+  EXPECT_EQ(evicted_bytes, ComputeTextureBytes(512, 512, 3, 10) + 1000 - 4096);
+  EXPECT_EQ(registry.category_num_bytes("textures"), 1000);
+  // Moving a record keeps the resource registered once.
+  ResourceRecord moved_vertices = std::move(vertices);
+  vertices.Reset();
+  EXPECT_EQ(registry.num_bytes(MemoryDomain::kCpu), 216);
+  moved_vertices.Reset();
+  EXPECT_EQ(registry.num_resources(), 1);
+}
+
+TEST(SoftwareRasterizerTest, CoversEveryPixelExactlyOnce) {
+  // A jittered grid of triangles spanning the viewport. Every triangle is
+  // nearer than the previous ones, so a pixel covered twice is shaded twice.
+  // The vertices are multiples of 1/64, so that many pixel centers fall
+  // exactly on the edges and exercise the fill rule.
+  const int kNumCellsX = 7;
+  const int kNumCellsY = 5;
+  std::mt19937 random_engine(7);
+  std::uniform_int_distribution<int> jitter(-4, 4);
+  Eigen::MatrixXf grid(2, (kNumCellsX + 1) * (kNumCellsY + 1));
+  for (int y = 0; y <= kNumCellsY; ++y) {
+    for (int x = 0; x <= kNumCellsX; ++x) {
+      // The vertices on the border stay on the border of the viewport.
+      const int jitter_x =
+          x == 0 || x == kNumCellsX ? 0 : jitter(random_engine);
+      const int jitter_y =
+          y == 0 || y == kNumCellsY ? 0 : jitter(random_engine);
+      grid.col(y * (kNumCellsX + 1) + x) <<
+          (128 * x / kNumCellsX + jitter_x) / 64.0f - 1.0f,
+          (128 * y / kNumCellsY + jitter_y) / 64.0f - 1.0f;
+    }
+  }
+  const int kNumTriangles = 2 * kNumCellsX * kNumCellsY;
+  Eigen::MatrixXf vertices(3, 3 * kNumTriangles);
+  int triangle = 0;
+  for (int y = 0; y < kNumCellsY; ++y) {
+    for (int x = 0; x < kNumCellsX; ++x) {
+      const int corner = y * (kNumCellsX + 1) + x;
+      const int cells[2][3] = {
+          {corner, corner + 1, corner + kNumCellsX + 2},
+          {corner, corner + kNumCellsX + 2, corner + kNumCellsX + 1}};
+      for (const auto& cell : cells) {
+        const float depth = 0.9f - 0.01f * triangle;
+        for (int i = 0; i < 3; ++i) {
+          vertices.col(3 * triangle + i) << grid.col(cell[i]), depth;
+        }
+        ++triangle;
+      }
+    }
+  }
+  const Model model(Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(),
+                    vertices);
+
+  // The framebuffer is not a multiple of the tile or block sizes.
+  ThreadPool thread_pool(3, "Rasterizer");
+  SoftwareRasterizer rasterizer(100, 75, &thread_pool);
+  rasterizer.Clear(Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
+  const Eigen::Matrix4f identity = Eigen::Matrix4f::Identity();
+  rasterizer.DrawModel(identity, identity, identity, nullptr, model);
+  rasterizer.Flush();
+  EXPECT_EQ(rasterizer.stats().num_triangles, kNumTriangles);
+  EXPECT_EQ(rasterizer.stats().num_triangles_binned, kNumTriangles);
+  EXPECT_EQ(rasterizer.stats().num_pixels_shaded, 100 * 75);
+}
+
+TEST(SoftwareRasterizerTest, InterpolatesTexelsWithPerspective) {
+  // A unit quad seen at a grazing angle, textured with a red and a blue texel.
+  // The vertex shader uses the x and y of the vertices as texels.
+  Eigen::MatrixXf vertices(3, 4);
+  vertices << 0.0f, 1.0f, 1.0f, 0.0f,
+              0.0f, 0.0f, 1.0f, 1.0f,
+              0.0f, 0.0f, 0.0f, 0.0f;
+  const std::vector<GLuint> indices = {0, 1, 2, 0, 2, 3};
+  const Model model(Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(),
+                    vertices, indices);
+  SoftwareTexture texture;
+  texture.width = 2;
+  texture.height = 1;
+  texture.texels = {255, 0, 0, 255, 0, 0, 255, 255};
+
+  const int kWidth = 160;
+  const int kHeight = 120;
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      ConvertDegreesToRadians(60.0f), static_cast<float>(kWidth) / kHeight,
+      0.1f, 10.0f);
+  Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+  model_matrix.block<3, 3>(0, 0) =
+      Eigen::AngleAxisf(ConvertDegreesToRadians(70.0f),
+                        Eigen::Vector3f::UnitY()).toRotationMatrix();
+  model_matrix.block<3, 1>(0, 3) = Eigen::Vector3f(-0.2f, -0.5f, -1.5f);
+  SoftwareRasterizer rasterizer(kWidth, kHeight, nullptr);
+  rasterizer.DrawModel(projection, Eigen::Matrix4f::Identity(), model_matrix,
+                       &texture, model);
+  rasterizer.Flush();
+
+  // The texels left of s = 0.5 are mostly red and those right of it mostly
+  // blue. Affine interpolation would misplace the boundary.
+  const auto color_at = [&](const float s) {
+    const Eigen::Vector4f clip =
+        projection * model_matrix * Eigen::Vector4f(s, 0.5f, 0.0f, 1.0f);
+    const int x = (clip.x() / clip.w() * 0.5f + 0.5f) * kWidth;
+    const int y = (clip.y() / clip.w() * 0.5f + 0.5f) * kHeight;
+    return rasterizer.color_buffer() + 4 * (y * kWidth + x);
+  };
+  for (const float s : {0.3f, 0.45f}) {
+    EXPECT_GT(color_at(s)[0], color_at(s)[2]) << s;
+  }
+  for (const float s : {0.55f, 0.7f}) {
+    EXPECT_LT(color_at(s)[0], color_at(s)[2]) << s;
+  }
+}
+
+TEST(BvhTest, MatchesBruteForceIntersection) {
+  // Small random triangles in a cube, enough of them for the build to split
+  // the top of the tree in parallel and defer the subtrees to tasks.
+  const int kNumTriangles = 5000;
+  std::mt19937 random_engine(11);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  const auto random_vector = [&]() {
+    return Eigen::Vector3f(uniform(random_engine), uniform(random_engine),
+                           uniform(random_engine));
+  };
+  std::vector<Eigen::Vector3f> vertices;
+  for (int i = 0; i < kNumTriangles; ++i) {
+    const Eigen::Vector3f center = random_vector();
+    for (int j = 0; j < 3; ++j) {
+      vertices.push_back(center + 0.1f * random_vector());
+    }
+  }
+  ThreadPool thread_pool(3, "Bvh");
+  Bvh bvh;
+  bvh.Build(vertices, &thread_pool);
+  EXPECT_EQ(bvh.num_triangles(), kNumTriangles);
+
+  // Rays from outside the cube through random points of it, in packets.
+  const int kNumPackets = 64;
+  for (int packet_index = 0; packet_index < kNumPackets; ++packet_index) {
+    RayPacket packet;
+    std::vector<Ray> rays(kRayPacketSize);
+    for (int i = 0; i < kRayPacketSize; ++i) {
+      Ray& ray = rays[i];
+      ray.origin = 3.0f * random_vector().normalized();
+      ray.direction = (random_vector() - ray.origin).normalized();
+      ray.max_distance = 10.0f;
+      for (int axis = 0; axis < 3; ++axis) {
+        packet.origin[axis][i] = ray.origin[axis];
+        packet.direction[axis][i] = ray.direction[axis];
+      }
+      packet.max_distance[i] = ray.max_distance;
+    }
+    RayHit packet_hits[kRayPacketSize];
+    bvh.IntersectPacket(packet, packet_hits);
+
+    for (int i = 0; i < kRayPacketSize; ++i) {
+      const Ray& ray = rays[i];
+      // Moller-Trumbore in double precision over every triangle.
+      int nearest_triangle = -1;
+      double nearest_distance = ray.max_distance;
+      for (int j = 0; j < kNumTriangles; ++j) {
+        const Eigen::Vector3d vertex0 = vertices[3 * j].cast<double>();
+        const Eigen::Vector3d edge1 =
+            vertices[3 * j + 1].cast<double>() - vertex0;
+        const Eigen::Vector3d edge2 =
+            vertices[3 * j + 2].cast<double>() - vertex0;
+        const Eigen::Vector3d direction = ray.direction.cast<double>();
+        const Eigen::Vector3d p = direction.cross(edge2);
+        const double inverse_determinant = 1.0 / edge1.dot(p);
+        const Eigen::Vector3d s = ray.origin.cast<double>() - vertex0;
+        const double u = s.dot(p) * inverse_determinant;
+        const Eigen::Vector3d q = s.cross(edge1);
+        const double v = direction.dot(q) * inverse_determinant;
+        const double distance = edge2.dot(q) * inverse_determinant;
+        if (u >= 0.0 && v >= 0.0 && u + v <= 1.0 && distance > 0.0 &&
+            distance < nearest_distance) {
+          nearest_triangle = j;
+          nearest_distance = distance;
+        }
+      }
+
+      RayHit hit;
+      EXPECT_EQ(bvh.Intersect(ray, &hit), nearest_triangle >= 0);
+      EXPECT_EQ(hit.triangle_index, nearest_triangle);
+      EXPECT_EQ(packet_hits[i].triangle_index, nearest_triangle);
+      if (nearest_triangle >= 0) {
+        EXPECT_NEAR(hit.distance, nearest_distance, 1e-4);
+        EXPECT_NEAR(packet_hits[i].distance, nearest_distance, 1e-4);
+      }
+    }
+  }
+}
+
+TEST(SceneBvhTest, MatchesFlattenedScene) {
+  // Instances of two meshes of random triangles, enough of them for the top
+  // level to be built in parallel.
+  std::mt19937 random_engine(13);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  const auto random_vector = [&]() {
+    return Eigen::Vector3f(uniform(random_engine), uniform(random_engine),
+                           uniform(random_engine));
+  };
+  ThreadPool thread_pool(3, "SceneBvh");
+  SceneBvh scene;
+  for (const int num_triangles : {20, 50}) {
+    std::vector<Eigen::Vector3f> vertices;
+    for (int i = 0; i < num_triangles; ++i) {
+      const Eigen::Vector3f center = random_vector();
+      for (int j = 0; j < 3; ++j) {
+        vertices.push_back(center + 0.3f * random_vector());
+      }
+    }
+    scene.AddMesh(vertices, &thread_pool);
+  }
+  const int kNumInstances = 1000;
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>>
+      model_matrices(kNumInstances, Eigen::Matrix4f::Identity());
+  for (int i = 0; i < kNumInstances; ++i) {
+    Eigen::Matrix4f& model_matrix = model_matrices[i];
+    model_matrix.block<3, 3>(0, 0) =
+        (0.05f + 0.1f * std::abs(uniform(random_engine))) *
+        Eigen::AngleAxisf(3.0f * uniform(random_engine),
+                          random_vector().normalized()).toRotationMatrix();
+    model_matrix.block<3, 1>(0, 3) = 4.0f * random_vector();
+    EXPECT_EQ(scene.AddInstance(i % 2, model_matrix), i);
+  }
+
+  // The scene must find the hits of a BVH over the triangles of the instances
+  // in world coordinates.
+  const auto expect_flattened_hits = [&]() {
+    std::vector<Eigen::Vector3f> world_vertices;
+    std::vector<int> triangle_instances;
+    std::vector<int> triangle_indices;
+    for (int i = 0; i < kNumInstances; ++i) {
+      const std::vector<Eigen::Vector3f>& vertices =
+          scene.mesh_vertices(scene.instance_mesh(i));
+      for (int j = 0; j < static_cast<int>(vertices.size()); ++j) {
+        world_vertices.push_back(
+            model_matrices[i].topLeftCorner<3, 3>() * vertices[j] +
+            model_matrices[i].topRightCorner<3, 1>());
+        if (j % 3 == 0) {
+          triangle_instances.push_back(i);
+          triangle_indices.push_back(j / 3);
+        }
+      }
+    }
+    Bvh flattened_bvh;
+    flattened_bvh.Build(world_vertices, nullptr);
+    for (int packet_index = 0; packet_index < 32; ++packet_index) {
+      RayPacket packet;
+      std::vector<Ray> rays(kRayPacketSize);
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        Ray& ray = rays[i];
+        ray.origin = 8.0f * random_vector().normalized();
+        ray.direction = (4.0f * random_vector() - ray.origin).normalized();
+        ray.max_distance = 20.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+          packet.origin[axis][i] = ray.origin[axis];
+          packet.direction[axis][i] = ray.direction[axis];
+        }
+        packet.max_distance[i] = ray.max_distance;
+      }
+      SceneHit packet_hits[kRayPacketSize];
+      scene.IntersectPacket(packet, packet_hits);
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        RayHit flattened_hit;
+        const bool is_hit = flattened_bvh.Intersect(rays[i], &flattened_hit);
+        const int instance_index =
+            is_hit ? triangle_instances[flattened_hit.triangle_index] : -1;
+        const int triangle_index =
+            is_hit ? triangle_indices[flattened_hit.triangle_index] : -1;
+        SceneHit hit;
+        EXPECT_EQ(scene.Intersect(rays[i], &hit), is_hit);
+        for (const SceneHit& scene_hit : {hit, packet_hits[i]}) {
+          EXPECT_EQ(scene_hit.instance_index, instance_index);
+          EXPECT_EQ(scene_hit.triangle_index, triangle_index);
+          if (is_hit) {
+            EXPECT_NEAR(scene_hit.distance, flattened_hit.distance, 1e-3);
+          }
+        }
+      }
+    }
+  };
+  scene.BuildTopLevel(&thread_pool);
+  expect_flattened_hits();
+
+  // A third of the instances move a little, which the refit follows.
+  for (int i = 0; i < kNumInstances; i += 3) {
+    model_matrices[i].block<3, 1>(0, 3) += 0.5f * random_vector();
+    scene.SetInstanceModelMatrix(i, model_matrices[i]);
+  }
+  scene.RefitTopLevel(&thread_pool);
+  expect_flattened_hits();
+  scene.BuildTopLevel(nullptr);
+  expect_flattened_hits();
+
+  // The camera at the origin looks down the negative z-axis. The instances
+  // with a vertex in view are visible, and those behind the camera are not.
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      ConvertDegreesToRadians(60.0f), 1.0f, 0.1f, 10.0f);
+  std::vector<int> visible_instances(kNumInstances);
+  const int num_visible_instances =
+      scene.CullFrustum(projection, visible_instances.data());
+  visible_instances.resize(num_visible_instances);
+  EXPECT_TRUE(
+      std::is_sorted(visible_instances.begin(), visible_instances.end()));
+  EXPECT_GT(num_visible_instances, 0);
+  EXPECT_LT(num_visible_instances, kNumInstances / 2);
+  const std::unordered_set<int> visible_instance_set(
+      visible_instances.begin(), visible_instances.end());
+  for (int i = 0; i < kNumInstances; ++i) {
+    if (scene.instance_bounds(i).min().z() > 0.0f) {
+      EXPECT_EQ(visible_instance_set.count(i), 0) << i;
+    }
+    for (const Eigen::Vector3f& vertex :
+         scene.mesh_vertices(scene.instance_mesh(i))) {
+      const Eigen::Vector4f clip =
+          projection * model_matrices[i] * vertex.homogeneous();
+      if ((clip.head<3>().array().abs() < clip.w()).all()) {
+        EXPECT_EQ(visible_instance_set.count(i), 1) << i;
+        break;
+      }
+    }
+  }
+
+  // A single instance is a top level without inner nodes.
+  scene.ClearInstances();
+  scene.AddInstance(0, Eigen::Matrix4f::Identity());
+  scene.BuildTopLevel(&thread_pool);
+  EXPECT_EQ(scene.CullFrustum(Eigen::Matrix4f::Identity(),
+                              visible_instances.data()), 1);
+  Ray ray;
+  const std::vector<Eigen::Vector3f>& vertices = scene.mesh_vertices(0);
+  ray.origin = (vertices[0] + vertices[1] + vertices[2]) / 3.0f +
+               Eigen::Vector3f(0.0f, 0.0f, 5.0f);
+  ray.direction = -Eigen::Vector3f::UnitZ();
+  ray.max_distance = 10.0f;
+  SceneHit hit;
+  EXPECT_TRUE(scene.Intersect(ray, &hit));
+  EXPECT_EQ(hit.instance_index, 0);
+}
+
+TEST(OcclusionCullerTest, DepthIsConservativeAndCullsHiddenBoxes) {
+  // A buffer whose sides are not multiples of the tiles.
+  const int kWidth = 100;
+  const int kHeight = 50;
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      ConvertDegreesToRadians(60.0f), static_cast<float>(kWidth) / kHeight,
+      0.1f, 10.0f);
+  ThreadPool thread_pool(2, "OcclusionCuller");
+  OcclusionCuller occlusion_culler(kWidth, kHeight, &thread_pool);
+
+  // Random triangles, some of them crossing the near plane. The depth of
+  // every pixel must not be nearer than that of the software rasterizer.
+  std::mt19937 random_engine(17);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  Eigen::MatrixXf vertices(3, 60);
+  for (int i = 0; i < vertices.cols(); ++i) {
+    vertices.col(i) =
+        Eigen::Vector3f(2.0f * uniform(random_engine),
+                        uniform(random_engine),
+                        -2.5f + 2.0f * uniform(random_engine));
+  }
+  const Model model(Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(),
+                    vertices);
+  const std::vector<Eigen::Vector3f> triangle_vertices =
+      GetTriangleVertices(model);
+  SoftwareRasterizer rasterizer(kWidth, kHeight, nullptr);
+  rasterizer.Clear(Eigen::Vector4f::Zero());
+  rasterizer.DrawModel(projection, Eigen::Matrix4f::Identity(),
+                       Eigen::Matrix4f::Identity(), nullptr, model);
+  rasterizer.Flush();
+  occlusion_culler.BeginFrame(projection);
+  occlusion_culler.AddOccluder(Eigen::Matrix4f::Identity(),
+                               &triangle_vertices);
+  occlusion_culler.RenderOccluders();
+  EXPECT_EQ(occlusion_culler.stats().num_occluder_triangles, 20);
+  int num_covered_pixels = 0;
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      const float depth = occlusion_culler.GetPixelDepth(x, y);
+      EXPECT_GE(depth,
+                rasterizer.depth_buffer()[y * rasterizer.depth_buffer_stride() +
+                                          x] - 1e-5f)
+          << x << ", " << y;
+      num_covered_pixels += depth <= 1.0f;
+    }
+  }
+  EXPECT_GT(num_covered_pixels, kWidth * kHeight / 4);
+
+  // A wall of two triangles 2 units away.
+  const std::vector<Eigen::Vector3f> wall = {
+      Eigen::Vector3f(-1.0f, -0.5f, -2.0f), Eigen::Vector3f(1.0f, -0.5f, -2.0f),
+      Eigen::Vector3f(1.0f, 0.5f, -2.0f), Eigen::Vector3f(-1.0f, -0.5f, -2.0f),
+      Eigen::Vector3f(1.0f, 0.5f, -2.0f), Eigen::Vector3f(-1.0f, 0.5f, -2.0f)};
+  occlusion_culler.BeginFrame(projection);
+  occlusion_culler.AddOccluder(Eigen::Matrix4f::Identity(), &wall);
+  occlusion_culler.RenderOccluders();
+  const auto box = [](const Eigen::Vector3f& center, const float size) {
+    return Eigen::AlignedBox3f(center - Eigen::Vector3f::Constant(size),
+                               center + Eigen::Vector3f::Constant(size));
+  };
+  // A dense grid of boxes behind the wall is hidden.
+  for (int y = -2; y <= 2; ++y) {
+    for (int x = -4; x <= 4; ++x) {
+      EXPECT_TRUE(occlusion_culler.IsOccluded(
+          box(Eigen::Vector3f(0.2f * x, 0.15f * y, -4.0f), 0.05f)))
+          << x << ", " << y;
+    }
+  }
+  // Boxes in front of the wall, beside it, or crossing the near plane are
+  // not.
+  EXPECT_FALSE(occlusion_culler.IsOccluded(
+      box(Eigen::Vector3f(0.0f, 0.0f, -1.5f), 0.1f)));
+  EXPECT_FALSE(occlusion_culler.IsOccluded(
+      box(Eigen::Vector3f(2.5f, 0.0f, -4.0f), 0.1f)));
+  EXPECT_FALSE(occlusion_culler.IsOccluded(
+      box(Eigen::Vector3f(0.0f, 0.0f, 0.0f), 0.5f)));
+}
+
+TEST(RayTracerTest, MatchesSoftwareRasterizer) {
+  // A textured grid seen at a grazing angle in front of a perpendicular one.
+  Eigen::MatrixXf vertices(3, 9);
+  vertices << 0.0f, 0.5f, 1.0f, 0.0f, 0.5f, 1.0f, 0.0f, 0.5f, 1.0f,
+              0.0f, 0.0f, 0.0f, 0.5f, 0.5f, 0.5f, 1.0f, 1.0f, 1.0f,
+              0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f;
+  std::vector<GLuint> indices;
+  for (const GLuint corner : {0, 1, 3, 4}) {
+    indices.insert(indices.end(), {corner, corner + 1, corner + 4, corner,
+                                   corner + 4, corner + 3});
+  }
+  const Model model(Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(),
+                    vertices, indices);
+  SoftwareTexture texture;
+  texture.width = 4;
+  texture.height = 4;
+  for (int i = 0; i < 16; ++i) {
+    const uint8_t value = (i + i / 4) % 2 ? 255 : 0;
+    texture.texels.insert(texture.texels.end(), {value, 128, 0, 255});
+  }
+  Eigen::Matrix4f grazing_model_matrix = Eigen::Matrix4f::Identity();
+  grazing_model_matrix.block<3, 3>(0, 0) =
+      Eigen::AngleAxisf(ConvertDegreesToRadians(65.0f),
+                        Eigen::Vector3f::UnitY()).toRotationMatrix();
+  grazing_model_matrix.block<3, 1>(0, 3) = Eigen::Vector3f(-0.4f, -0.6f, -1.5f);
+  Eigen::Matrix4f back_model_matrix = Eigen::Matrix4f::Identity();
+  back_model_matrix.block<3, 3>(0, 0) *= 4.0f;
+  back_model_matrix.block<3, 1>(0, 3) = Eigen::Vector3f(-2.0f, -2.0f, -3.0f);
+
+  const int kWidth = 120;
+  const int kHeight = 90;
+  const Eigen::Matrix4f projection = ComputePerspectiveProjectionMatrix(
+      ConvertDegreesToRadians(60.0f), static_cast<float>(kWidth) / kHeight,
+      0.1f, 10.0f);
+  const Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+  const Eigen::Vector4f background_color(0.0f, 0.0f, 1.0f, 1.0f);
+  SoftwareRasterizer rasterizer(kWidth, kHeight, nullptr);
+  rasterizer.Clear(background_color);
+  ThreadPool thread_pool(2, "RayTracer");
+  RayTracer ray_tracer(kWidth, kHeight, &thread_pool);
+  SceneBvh scene;
+  const int mesh_index =
+      scene.AddMesh(GetTriangleVertices(model), &thread_pool);
+  EXPECT_EQ(scene.mesh_bvh(mesh_index).num_triangles(), 8);
+  for (const Eigen::Matrix4f* model_matrix :
+       {&back_model_matrix, &grazing_model_matrix}) {
+    rasterizer.DrawModel(projection, view, *model_matrix, &texture, model);
+    scene.AddInstance(mesh_index, *model_matrix);
+  }
+  rasterizer.Flush();
+  scene.BuildTopLevel(&thread_pool);
+  const SoftwareTexture* instance_textures[] = {&texture, &texture};
+
+  // Both sample the same texels at the pixel centers, up to the pixels on the
+  // edges of the triangles and rounding. The packets and the single rays find
+  // the same hits.
+  for (const bool use_ray_packets : {true, false}) {
+    ray_tracer.set_use_ray_packets(use_ray_packets);
+    ray_tracer.Render(scene, instance_textures, projection, view,
+                      background_color);
+    EXPECT_EQ(ray_tracer.stats().num_rays, kWidth * kHeight);
+    EXPECT_GT(ray_tracer.stats().num_hits, kWidth * kHeight / 2);
+    EXPECT_LT(ray_tracer.stats().num_hits, kWidth * kHeight);
+    int num_different_pixels = 0;
+    for (int i = 0; i < 4 * kWidth * kHeight; i += 4) {
+      for (int channel = 0; channel < 4; ++channel) {
+        if (std::abs(rasterizer.color_buffer()[i + channel] -
+                     ray_tracer.color_buffer()[i + channel]) > 4) {
+          ++num_different_pixels;
+          break;
+        }
+      }
+    }
+    EXPECT_LT(num_different_pixels, kWidth * kHeight / 100)
+        << use_ray_packets;
+  }
+}
+
 }  // namespace wvu
@@ -0,0 +1,856 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "bvh.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WVU_BVH_SIMD
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+#include "cpu_utils.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+// The most bins per axis. Ranges of fewer triangles have one bin per triangle.
+constexpr int kNumBins = 16;
+// Ranges of at most this many triangles become leaves.
+constexpr int kMaxLeafSize = 4;
+// Deeper ranges are split at their median, which bounds the depth of the tree
+// to kMaxSahDepth + 31.
+constexpr int kMaxSahDepth = 40;
+// A node pushes at most three nodes more than the one popped.
+constexpr int kStackSize = 3 * (kMaxSahDepth + 32) + 1;
+// Ranges of fewer triangles are processed by a single thread.
+constexpr int kMinTrianglesPerTask = 1024;
+// Direction components closer to zero are clamped, so that their inverses
+// are finite.
+constexpr float kMinDirection = 1e-20f;
+
+// Half the surface area of a box, which is proportional to the probability
+// of a random ray hitting it.
+float ComputeHalfSurfaceArea(const Eigen::AlignedBox3f& box) {
+  if (box.isEmpty()) return 0.0f;
+  const Eigen::Vector3f sizes = box.sizes();
+  return sizes.x() * sizes.y() + sizes.y() * sizes.z() +
+         sizes.z() * sizes.x();
+}
+
+// A range of the triangles being built and its bounds.
+struct BuildRange {
+  int size() const { return end - begin; }
+
+  int begin;
+  int end;
+  Eigen::AlignedBox3f bounds;
+  Eigen::AlignedBox3f centroid_bounds;
+};
+
+// The bounds and number of the triangles whose centroids fall into every bin
+// of every axis.
+struct Bins {
+  // Adds the triangles of other bins.
+  void Merge(const Bins& other) {
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int bin = 0; bin < kNumBins; ++bin) {
+        bounds[axis][bin].extend(other.bounds[axis][bin]);
+        centroid_bounds[axis][bin].extend(other.centroid_bounds[axis][bin]);
+        counts[axis][bin] += other.counts[axis][bin];
+      }
+    }
+  }
+
+  Eigen::AlignedBox3f bounds[3][kNumBins];
+  Eigen::AlignedBox3f centroid_bounds[3][kNumBins];
+  int counts[3][kNumBins] = {};
+};
+
+// A split of a range between the triangles in the bins [0, bin] of an axis
+// and the rest, along with the bounds of both sides. An axis of -1 splits the
+// range at its median.
+struct Split {
+  int axis;
+  int bin;
+  Eigen::AlignedBox3f left_bounds;
+  Eigen::AlignedBox3f left_centroid_bounds;
+  Eigen::AlignedBox3f right_bounds;
+  Eigen::AlignedBox3f right_centroid_bounds;
+};
+
+inline int ComputeNumBins(const BuildRange& range) {
+  return std::min(kNumBins, range.size());
+}
+
+// Maps a centroid coordinate to its bin.
+inline int ComputeBin(const float value,
+                      const float min,
+                      const float scale,
+                      const int num_bins) {
+  return std::min(num_bins - 1, static_cast<int>((value - min) * scale));
+}
+
+// The scale of ComputeBin() for an axis of a range, or zero if the centroids
+// of the range do not spread along it.
+inline float ComputeBinScale(const BuildRange& range, const int axis) {
+  const float extent =
+      range.centroid_bounds.max()[axis] - range.centroid_bounds.min()[axis];
+  return extent > 0.0f ? ComputeNumBins(range) / extent : 0.0f;
+}
+
+#ifdef WVU_BVH_SIMD
+// Computes a coordinate of the cross products of eight pairs of vectors,
+// stored as one register per coordinate.
+__attribute__((target("avx2,fma")))
+inline __m256 Cross8(const __m256* a, const __m256* b, const int axis) {
+  const int next = (axis + 1) % 3;
+  const int previous = (axis + 2) % 3;
+  return _mm256_fmsub_ps(a[next], b[previous],
+                         _mm256_mul_ps(a[previous], b[next]));
+}
+
+// Computes the dot products of eight pairs of vectors.
+__attribute__((target("avx2,fma")))
+inline __m256 Dot8(const __m256* a, const __m256* b) {
+  return _mm256_fmadd_ps(
+      a[0], b[0], _mm256_fmadd_ps(a[1], b[1], _mm256_mul_ps(a[2], b[2])));
+}
+#endif  // WVU_BVH_SIMD
+
+}  // namespace
+
+// A node of the tree. The bounds of the four children are stored as slabs,
+// so that a ray is tested against the four of them at once.
+struct Bvh::Node {
+  // The rows are the minimum x, maximum x, minimum y, maximum y, minimum z
+  // and maximum z of the children. Unused children have empty bounds.
+  alignas(16) float bounds[6][4];
+  // The index of the node of an inner child or of the first triangle of a
+  // leaf; -1 for unused children.
+  int children[4];
+  // The number of triangles of a leaf; zero for inner children.
+  int num_triangles[4];
+};
+
+// A triangle prepared for the Moller-Trumbore intersection test.
+struct Bvh::Triangle {
+  // Intersects the triangle with a ray and, if it is hit nearer than the
+  // distance, updates the distance and the barycentric coordinates.
+  bool Intersect(const Eigen::Vector3f& origin,
+                 const Eigen::Vector3f& direction,
+                 float* distance,
+                 float* u,
+                 float* v) const {
+    const Eigen::Vector3f p = direction.cross(edge2);
+    const float determinant = edge1.dot(p);
+    if (determinant == 0.0f) return false;
+    const float inverse_determinant = 1.0f / determinant;
+    const Eigen::Vector3f s = origin - vertex0;
+    const float hit_u = s.dot(p) * inverse_determinant;
+    if (hit_u < 0.0f || hit_u > 1.0f) return false;
+    const Eigen::Vector3f q = s.cross(edge1);
+    const float hit_v = direction.dot(q) * inverse_determinant;
+    if (hit_v < 0.0f || hit_u + hit_v > 1.0f) return false;
+    const float hit_distance = edge2.dot(q) * inverse_determinant;
+    if (!(hit_distance > 0.0f && hit_distance < *distance)) return false;
+    *distance = hit_distance;
+    *u = hit_u;
+    *v = hit_v;
+    return true;
+  }
+
+  Eigen::Vector3f vertex0;
+  Eigen::Vector3f edge1;
+  Eigen::Vector3f edge2;
+  // Index of the triangle in the vertices given to Build().
+  int index;
+};
+
+// Splits the triangles into the nodes of the tree. The triangles are referred
+// to by a list of indices that every split partitions in place, so that the
+// triangles of a subtree end up contiguous.
+class Bvh::Builder {
+ public:
+  Builder(const std::vector<Eigen::Vector3f>& vertices,
+          ThreadPool* thread_pool)
+      : vertices_(vertices), thread_pool_(thread_pool) {}
+
+  // Builds the nodes and returns the indices of the triangles in the order of
+  // the leaves.
+  const std::vector<int>& Build(std::vector<Node>* nodes,
+                                Eigen::AlignedBox3f* bounds);
+
+ private:
+  // A range deferred to a thread and the child of the node it becomes.
+  struct Task {
+    BuildRange range;
+    Split split;
+    int depth;
+    int parent;
+    int child;
+  };
+
+  // Computes the bounds of the triangles in [begin, end) of the indices.
+  BuildRange MakeRange(const int begin,
+                       const int end,
+                       ThreadPool* thread_pool) const;
+  // Adds the triangles in [begin, end) of the indices to the bins.
+  void AddToBins(const BuildRange& range,
+                 const int begin,
+                 const int end,
+                 Bins* bins) const;
+  // Finds the split of a range with the lowest cost. Returns false if the
+  // range is small enough to be a leaf.
+  bool FindSplit(const BuildRange& range,
+                 const int depth,
+                 ThreadPool* thread_pool,
+                 Split* split) const;
+  // Partitions a range in two.
+  void Partition(const BuildRange& range,
+                 const Split& split,
+                 ThreadPool* thread_pool,
+                 BuildRange* left,
+                 BuildRange* right);
+  // Builds the node of a range by splitting it in up to four children, and
+  // the subtrees of the children recursively. If tasks is not null, the
+  // ranges are split with the help of the thread pool and the children of at
+  // most max_task_size_ triangles are deferred to tasks instead. Returns the
+  // index of the node.
+  int BuildNode(const BuildRange& range,
+                const bool can_split,
+                const Split& split,
+                const int depth,
+                std::vector<Node>* nodes,
+                std::vector<Task>* tasks);
+
+  const std::vector<Eigen::Vector3f>& vertices_;
+  ThreadPool* thread_pool_;
+  std::vector<Eigen::AlignedBox3f> triangle_bounds_;
+  std::vector<Eigen::Vector3f> centroids_;
+  std::vector<int> indices_;
+  int max_task_size_;
+};
+
+const std::vector<int>& Bvh::Builder::Build(std::vector<Node>* nodes,
+                                            Eigen::AlignedBox3f* bounds) {
+  const int num_triangles = vertices_.size() / 3;
+  triangle_bounds_.resize(num_triangles);
+  centroids_.resize(num_triangles);
+  ParallelForChunks(thread_pool_, num_triangles, kMinTrianglesPerTask,
+                    [this](const int, const int begin, const int end) {
+    for (int i = begin; i < end; ++i) {
+      Eigen::AlignedBox3f& triangle_bounds = triangle_bounds_[i];
+      triangle_bounds.setEmpty();
+      for (int j = 0; j < 3; ++j) triangle_bounds.extend(vertices_[3 * i + j]);
+      centroids_[i] = triangle_bounds.center();
+    }
+  });
+  indices_.resize(num_triangles);
+  std::iota(indices_.begin(), indices_.end(), 0);
+
+  const BuildRange root = MakeRange(0, num_triangles, thread_pool_);
+  *bounds = root.bounds;
+  std::vector<Task> tasks;
+  max_task_size_ =
+      thread_pool_ == nullptr
+          ? num_triangles
+          : std::max(kMinTrianglesPerTask,
+                     num_triangles / (4 * (thread_pool_->num_threads() + 1)));
+  Split split;
+  const bool can_split = FindSplit(root, 0, thread_pool_, &split);
+  BuildNode(root, can_split, split, 0, nodes,
+            thread_pool_ == nullptr ? nullptr : &tasks);
+  if (tasks.empty()) return indices_;
+
+  // The subtrees are built into their own lists of nodes and appended to the
+  // tree afterwards.
+  std::vector<std::vector<Node>> task_nodes(tasks.size());
+  thread_pool_->ParallelFor(tasks.size(), [&](const int i) {
+    const Task& task = tasks[i];
+    BuildNode(task.range, true, task.split, task.depth, &task_nodes[i],
+              nullptr);
+  });
+  for (int i = 0; i < static_cast<int>(tasks.size()); ++i) {
+    const int first_node = nodes->size();
+    for (Node node : task_nodes[i]) {
+      for (int child = 0; child < 4; ++child) {
+        if (node.children[child] >= 0 && node.num_triangles[child] == 0) {
+          node.children[child] += first_node;
+        }
+      }
+      nodes->push_back(node);
+    }
+    (*nodes)[tasks[i].parent].children[tasks[i].child] = first_node;
+  }
+  return indices_;
+}
+
+BuildRange Bvh::Builder::MakeRange(const int begin,
+                                   const int end,
+                                   ThreadPool* thread_pool) const {
+  BuildRange range;
+  range.begin = begin;
+  range.end = end;
+  const int num_chunks =
+      ComputeNumChunks(thread_pool, end - begin, kMinTrianglesPerTask);
+  if (num_chunks == 1) {
+    for (int i = begin; i < end; ++i) {
+      range.bounds.extend(triangle_bounds_[indices_[i]]);
+      range.centroid_bounds.extend(centroids_[indices_[i]]);
+    }
+    return range;
+  }
+  std::vector<BuildRange> chunk_ranges(num_chunks);
+  ParallelForChunks(thread_pool, end - begin, kMinTrianglesPerTask,
+                    [&](const int chunk,
+                        const int chunk_begin,
+                        const int chunk_end) {
+    BuildRange& chunk_range = chunk_ranges[chunk];
+    for (int i = begin + chunk_begin; i < begin + chunk_end; ++i) {
+      chunk_range.bounds.extend(triangle_bounds_[indices_[i]]);
+      chunk_range.centroid_bounds.extend(centroids_[indices_[i]]);
+    }
+  });
+  for (const BuildRange& chunk_range : chunk_ranges) {
+    range.bounds.extend(chunk_range.bounds);
+    range.centroid_bounds.extend(chunk_range.centroid_bounds);
+  }
+  return range;
+}
+
+void Bvh::Builder::AddToBins(const BuildRange& range,
+                             const int begin,
+                             const int end,
+                             Bins* bins) const {
+  const int num_bins = ComputeNumBins(range);
+  float scales[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    scales[axis] = ComputeBinScale(range, axis);
+  }
+  for (int i = begin; i < end; ++i) {
+    const int index = indices_[i];
+    for (int axis = 0; axis < 3; ++axis) {
+      if (scales[axis] == 0.0f) continue;
+      const int bin =
+          ComputeBin(centroids_[index][axis],
+                     range.centroid_bounds.min()[axis], scales[axis],
+                     num_bins);
+      bins->bounds[axis][bin].extend(triangle_bounds_[index]);
+      bins->centroid_bounds[axis][bin].extend(centroids_[index]);
+      ++bins->counts[axis][bin];
+    }
+  }
+}
+
+bool Bvh::Builder::FindSplit(const BuildRange& range,
+                             const int depth,
+                             ThreadPool* thread_pool,
+                             Split* split) const {
+  if (range.size() <= kMaxLeafSize) return false;
+  split->axis = -1;
+  if (depth >= kMaxSahDepth) return true;
+
+  Bins bins;
+  const int num_chunks =
+      ComputeNumChunks(thread_pool, range.size(), kMinTrianglesPerTask);
+  if (num_chunks == 1) {
+    AddToBins(range, range.begin, range.end, &bins);
+  } else {
+    std::vector<Bins> chunk_bins(num_chunks);
+    ParallelForChunks(thread_pool, range.size(), kMinTrianglesPerTask,
+                      [&](const int chunk,
+                          const int chunk_begin,
+                          const int chunk_end) {
+      AddToBins(range, range.begin + chunk_begin, range.begin + chunk_end,
+                &chunk_bins[chunk]);
+    });
+    for (const Bins& chunk_bin : chunk_bins) bins.Merge(chunk_bin);
+  }
+
+  // The cost of a split is proportional to the sum over both sides of their
+  // surface area times their number of triangles.
+  const int num_bins = ComputeNumBins(range);
+  float best_cost = kInfinity;
+  for (int axis = 0; axis < 3; ++axis) {
+    if (ComputeBinScale(range, axis) == 0.0f) continue;
+    // The costs of the bins (bin, num_bins).
+    float right_costs[kNumBins];
+    Eigen::AlignedBox3f right_bounds;
+    int right_count = 0;
+    for (int bin = num_bins - 1; bin > 0; --bin) {
+      right_bounds.extend(bins.bounds[axis][bin]);
+      right_count += bins.counts[axis][bin];
+      right_costs[bin - 1] =
+          right_count == 0
+              ? kInfinity
+              : ComputeHalfSurfaceArea(right_bounds) * right_count;
+    }
+    Eigen::AlignedBox3f left_bounds;
+    int left_count = 0;
+    for (int bin = 0; bin < num_bins - 1; ++bin) {
+      left_bounds.extend(bins.bounds[axis][bin]);
+      left_count += bins.counts[axis][bin];
+      if (left_count == 0) continue;
+      const float cost =
+          ComputeHalfSurfaceArea(left_bounds) * left_count + right_costs[bin];
+      if (cost < best_cost) {
+        best_cost = cost;
+        split->axis = axis;
+        split->bin = bin;
+      }
+    }
+  }
+  // The centroids coincide, so only a median split separates the triangles.
+  if (split->axis < 0) return true;
+  split->left_bounds.setEmpty();
+  split->left_centroid_bounds.setEmpty();
+  split->right_bounds.setEmpty();
+  split->right_centroid_bounds.setEmpty();
+  for (int bin = 0; bin < num_bins; ++bin) {
+    const bool is_left = bin <= split->bin;
+    (is_left ? split->left_bounds : split->right_bounds)
+        .extend(bins.bounds[split->axis][bin]);
+    (is_left ? split->left_centroid_bounds : split->right_centroid_bounds)
+        .extend(bins.centroid_bounds[split->axis][bin]);
+  }
+  return true;
+}
+
+void Bvh::Builder::Partition(const BuildRange& range,
+                             const Split& split,
+                             ThreadPool* thread_pool,
+                             BuildRange* left,
+                             BuildRange* right) {
+  int* first = indices_.data() + range.begin;
+  int* last = indices_.data() + range.end;
+  int* middle = first;
+  if (split.axis >= 0) {
+    const float min = range.centroid_bounds.min()[split.axis];
+    const float scale = ComputeBinScale(range, split.axis);
+    middle = std::partition(first, last, [&](const int index) {
+      return ComputeBin(centroids_[index][split.axis], min, scale,
+                        ComputeNumBins(range)) <= split.bin;
+    });
+  }
+  const int middle_index = middle - indices_.data();
+  if (middle != first && middle != last) {
+    // The bins bound both sides.
+    *left = {range.begin, middle_index, split.left_bounds,
+             split.left_centroid_bounds};
+    *right = {middle_index, range.end, split.right_bounds,
+              split.right_centroid_bounds};
+    return;
+  }
+
+  // The median along the axis on which the centroids spread the most.
+  int axis;
+  range.centroid_bounds.sizes().maxCoeff(&axis);
+  middle = first + range.size() / 2;
+  std::nth_element(first, middle, last, [&](const int a, const int b) {
+    return centroids_[a][axis] < centroids_[b][axis];
+  });
+  *left = MakeRange(range.begin, range.begin + range.size() / 2, thread_pool);
+  *right = MakeRange(range.begin + range.size() / 2, range.end, thread_pool);
+}
+
+int Bvh::Builder::BuildNode(const BuildRange& range,
+                            const bool can_split,
+                            const Split& split,
+                            const int depth,
+                            std::vector<Node>* nodes,
+                            std::vector<Task>* tasks) {
+  ThreadPool* thread_pool = tasks == nullptr ? nullptr : thread_pool_;
+  // Split the child with the largest surface area until there are four.
+  BuildRange children[4] = {range};
+  bool can_split_children[4] = {can_split};
+  Split splits[4] = {split};
+  int num_children = 1;
+  while (num_children < 4) {
+    int largest_child = -1;
+    float largest_area = -1.0f;
+    for (int i = 0; i < num_children; ++i) {
+      const float area = ComputeHalfSurfaceArea(children[i].bounds);
+      if (can_split_children[i] && area > largest_area) {
+        largest_child = i;
+        largest_area = area;
+      }
+    }
+    if (largest_child < 0) break;
+    const BuildRange parent = children[largest_child];
+    BuildRange& left = children[largest_child];
+    BuildRange& right = children[num_children];
+    Partition(parent, splits[largest_child], thread_pool, &left, &right);
+    can_split_children[largest_child] =
+        FindSplit(left, depth + 1, thread_pool, &splits[largest_child]);
+    can_split_children[num_children] =
+        FindSplit(right, depth + 1, thread_pool, &splits[num_children]);
+    ++num_children;
+  }
+
+  const int node_index = nodes->size();
+  nodes->emplace_back();
+  Node& node = nodes->back();
+  for (int i = 0; i < 4; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      node.bounds[2 * axis][i] =
+          i < num_children ? children[i].bounds.min()[axis] : kInfinity;
+      node.bounds[2 * axis + 1][i] =
+          i < num_children ? children[i].bounds.max()[axis] : -kInfinity;
+    }
+    node.children[i] = -1;
+    node.num_triangles[i] = 0;
+    if (i < num_children && !can_split_children[i]) {
+      node.children[i] = children[i].begin;
+      node.num_triangles[i] = children[i].size();
+    }
+  }
+  // The node is not referenced past this point, since building the children
+  // may reallocate the nodes.
+  for (int i = 0; i < num_children; ++i) {
+    if (!can_split_children[i]) continue;
+    if (tasks != nullptr && children[i].size() <= max_task_size_) {
+      tasks->push_back({children[i], splits[i], depth + 1, node_index, i});
+      continue;
+    }
+    const int child = BuildNode(children[i], true, splits[i], depth + 1,
+                                nodes, tasks);
+    (*nodes)[node_index].children[i] = child;
+  }
+  return node_index;
+}
+
+#ifdef WVU_BVH_SIMD
+// Traces the rays of a packet eight at a time with AVX2.
+struct Bvh::PacketTraversal {
+  __attribute__((target("avx2,fma")))
+  static void Intersect(const Bvh& bvh,
+                        const RayPacket& packet,
+                        RayHit* hits) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 origin[3];
+    __m256 direction[3];
+    __m256 inverse_direction[3];
+    for (int axis = 0; axis < 3; ++axis) {
+      origin[axis] = _mm256_loadu_ps(packet.origin[axis]);
+      direction[axis] = _mm256_loadu_ps(packet.direction[axis]);
+      inverse_direction[axis] = _mm256_div_ps(one, direction[axis]);
+    }
+    __m256 distance = _mm256_loadu_ps(packet.max_distance);
+    __m256 hit_u = zero;
+    __m256 hit_v = zero;
+    __m256 hit_index = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+    int stack[kStackSize];
+    int stack_size = 1;
+    stack[0] = 0;
+    while (stack_size > 0) {
+      const Node& node = bvh.nodes_[stack[--stack_size]];
+      // The inner children hit, sorted from the farthest to the nearest.
+      int inner_children[4];
+      float inner_distances[4];
+      int num_inner_children = 0;
+      for (int child = 0; child < 4; ++child) {
+        if (node.children[child] < 0) continue;
+        __m256 entry = zero;
+        __m256 exit = distance;
+        for (int axis = 0; axis < 3; ++axis) {
+          const __m256 near = _mm256_mul_ps(
+              _mm256_sub_ps(_mm256_set1_ps(node.bounds[2 * axis][child]),
+                            origin[axis]),
+              inverse_direction[axis]);
+          const __m256 far = _mm256_mul_ps(
+              _mm256_sub_ps(_mm256_set1_ps(node.bounds[2 * axis + 1][child]),
+                            origin[axis]),
+              inverse_direction[axis]);
+          entry = _mm256_max_ps(entry, _mm256_min_ps(near, far));
+          exit = _mm256_min_ps(exit, _mm256_max_ps(near, far));
+        }
+        const __m256 box_hits = _mm256_cmp_ps(entry, exit, _CMP_LE_OQ);
+        if (_mm256_movemask_ps(box_hits) == 0) continue;
+
+        if (node.num_triangles[child] == 0) {
+          // The nearest entry of the rays that hit the box.
+          const __m256 entries = _mm256_blendv_ps(_mm256_set1_ps(kInfinity),
+                                                  entry, box_hits);
+          __m128 nearest = _mm_min_ps(_mm256_castps256_ps128(entries),
+                                      _mm256_extractf128_ps(entries, 1));
+          nearest = _mm_min_ps(nearest, _mm_movehl_ps(nearest, nearest));
+          nearest = _mm_min_ss(nearest, _mm_shuffle_ps(nearest, nearest, 1));
+          const float nearest_entry = _mm_cvtss_f32(nearest);
+          int i = num_inner_children++;
+          for (; i > 0 && inner_distances[i - 1] < nearest_entry; --i) {
+            inner_children[i] = inner_children[i - 1];
+            inner_distances[i] = inner_distances[i - 1];
+          }
+          inner_children[i] = node.children[child];
+          inner_distances[i] = nearest_entry;
+          continue;
+        }
+
+        const int end = node.children[child] + node.num_triangles[child];
+        for (int i = node.children[child]; i < end; ++i) {
+          const Triangle& triangle = bvh.triangles_[i];
+          __m256 vertex0[3];
+          __m256 edge1[3];
+          __m256 edge2[3];
+          for (int axis = 0; axis < 3; ++axis) {
+            vertex0[axis] = _mm256_set1_ps(triangle.vertex0[axis]);
+            edge1[axis] = _mm256_set1_ps(triangle.edge1[axis]);
+            edge2[axis] = _mm256_set1_ps(triangle.edge2[axis]);
+          }
+          const __m256 p[3] = {Cross8(direction, edge2, 0),
+                               Cross8(direction, edge2, 1),
+                               Cross8(direction, edge2, 2)};
+          const __m256 inverse_determinant =
+              _mm256_div_ps(one, Dot8(edge1, p));
+          const __m256 s[3] = {_mm256_sub_ps(origin[0], vertex0[0]),
+                               _mm256_sub_ps(origin[1], vertex0[1]),
+                               _mm256_sub_ps(origin[2], vertex0[2])};
+          const __m256 u = _mm256_mul_ps(Dot8(s, p), inverse_determinant);
+          const __m256 q[3] = {Cross8(s, edge1, 0), Cross8(s, edge1, 1),
+                               Cross8(s, edge1, 2)};
+          const __m256 v =
+              _mm256_mul_ps(Dot8(direction, q), inverse_determinant);
+          const __m256 t = _mm256_mul_ps(Dot8(edge2, q), inverse_determinant);
+          // The comparisons are false for the NaNs of parallel rays.
+          const __m256 hits_triangle = _mm256_and_ps(
+              _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+                            _mm256_cmp_ps(v, zero, _CMP_GE_OQ)),
+              _mm256_and_ps(
+                  _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ),
+                  _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GT_OQ),
+                                _mm256_cmp_ps(t, distance, _CMP_LT_OQ))));
+          distance = _mm256_blendv_ps(distance, t, hits_triangle);
+          hit_u = _mm256_blendv_ps(hit_u, u, hits_triangle);
+          hit_v = _mm256_blendv_ps(hit_v, v, hits_triangle);
+          hit_index = _mm256_blendv_ps(
+              hit_index, _mm256_castsi256_ps(_mm256_set1_epi32(i)),
+              hits_triangle);
+        }
+      }
+      for (int i = 0; i < num_inner_children; ++i) {
+        stack[stack_size++] = inner_children[i];
+      }
+    }
+
+    alignas(32) float distances[kRayPacketSize];
+    alignas(32) float us[kRayPacketSize];
+    alignas(32) float vs[kRayPacketSize];
+    alignas(32) int indices[kRayPacketSize];
+    _mm256_store_ps(distances, distance);
+    _mm256_store_ps(us, hit_u);
+    _mm256_store_ps(vs, hit_v);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(indices),
+                       _mm256_castps_si256(hit_index));
+    for (int i = 0; i < kRayPacketSize; ++i) {
+      RayHit& hit = hits[i];
+      hit.triangle_index =
+          indices[i] < 0 ? -1 : bvh.triangles_[indices[i]].index;
+      hit.distance = distances[i];
+      hit.u = us[i];
+      hit.v = vs[i];
+    }
+  }
+};
+#endif  // WVU_BVH_SIMD
+
+Bvh::Bvh() : use_avx2_(internal::CpuSupportsAvx2()) {}
+
+Bvh::~Bvh() {}
+
+void Bvh::Build(const std::vector<Eigen::Vector3f>& vertices,
+                ThreadPool* thread_pool) {
+  WVU_PROFILE_ZONE("Bvh::Build");
+  CHECK_EQ(vertices.size() % 3, 0);
+  nodes_.clear();
+  triangles_.clear();
+  bounds_.setEmpty();
+  const int num_triangles = vertices.size() / 3;
+  if (num_triangles == 0) return;
+
+  Builder builder(vertices, thread_pool);
+  const std::vector<int>& triangle_order = builder.Build(&nodes_, &bounds_);
+  triangles_.resize(num_triangles);
+  ParallelForChunks(thread_pool, num_triangles, kMinTrianglesPerTask,
+                    [&](const int, const int begin, const int end) {
+    for (int i = begin; i < end; ++i) {
+      const int index = triangle_order[i];
+      Triangle& triangle = triangles_[i];
+      triangle.vertex0 = vertices[3 * index];
+      triangle.edge1 = vertices[3 * index + 1] - triangle.vertex0;
+      triangle.edge2 = vertices[3 * index + 2] - triangle.vertex0;
+      triangle.index = index;
+    }
+  });
+}
+
+bool Bvh::Intersect(const Ray& ray, RayHit* hit) const {
+  hit->triangle_index = -1;
+  if (nodes_.empty()) return false;
+  float inverse_direction[3];
+  // The rows of the node bounds the ray enters and exits the slabs through.
+  int near_rows[3];
+  int far_rows[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    float direction = ray.direction[axis];
+    if (std::abs(direction) < kMinDirection) {
+      direction = direction < 0.0f ? -kMinDirection : kMinDirection;
+    }
+    inverse_direction[axis] = 1.0f / direction;
+    near_rows[axis] = 2 * axis + (direction < 0.0f);
+    far_rows[axis] = 2 * axis + (direction >= 0.0f);
+  }
+#ifdef WVU_BVH_SIMD
+  __m128 origin[3];
+  __m128 inverse[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    origin[axis] = _mm_set1_ps(ray.origin[axis]);
+    inverse[axis] = _mm_set1_ps(inverse_direction[axis]);
+  }
+#endif
+
+  float distance = ray.max_distance;
+  int hit_triangle = -1;
+  int stack[kStackSize];
+  int stack_size = 1;
+  stack[0] = 0;
+  while (stack_size > 0) {
+    const Node& node = nodes_[stack[--stack_size]];
+    // Intersect the four boxes of the children.
+    float entries[4];
+    int box_hits = 0;
+#ifdef WVU_BVH_SIMD
+    __m128 entry = _mm_setzero_ps();
+    __m128 exit = _mm_set1_ps(distance);
+    for (int axis = 0; axis < 3; ++axis) {
+      const __m128 near = _mm_load_ps(node.bounds[near_rows[axis]]);
+      const __m128 far = _mm_load_ps(node.bounds[far_rows[axis]]);
+      entry = _mm_max_ps(
+          entry, _mm_mul_ps(_mm_sub_ps(near, origin[axis]), inverse[axis]));
+      exit = _mm_min_ps(
+          exit, _mm_mul_ps(_mm_sub_ps(far, origin[axis]), inverse[axis]));
+    }
+    _mm_storeu_ps(entries, entry);
+    box_hits = _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+#else
+    for (int child = 0; child < 4; ++child) {
+      float exit = distance;
+      entries[child] = 0.0f;
+      for (int axis = 0; axis < 3; ++axis) {
+        entries[child] = std::max(
+            entries[child], (node.bounds[near_rows[axis]][child] -
+                             ray.origin[axis]) * inverse_direction[axis]);
+        exit = std::min(exit, (node.bounds[far_rows[axis]][child] -
+                               ray.origin[axis]) * inverse_direction[axis]);
+      }
+      if (entries[child] <= exit) box_hits |= 1 << child;
+    }
+#endif
+
+    // The leaves are tested right away and the inner children are visited
+    // from the nearest to the farthest.
+    int inner_children[4];
+    float inner_distances[4];
+    int num_inner_children = 0;
+    for (; box_hits != 0; box_hits &= box_hits - 1) {
+      const int child = __builtin_ctz(box_hits);
+      if (node.num_triangles[child] == 0) {
+        int i = num_inner_children++;
+        for (; i > 0 && inner_distances[i - 1] < entries[child]; --i) {
+          inner_children[i] = inner_children[i - 1];
+          inner_distances[i] = inner_distances[i - 1];
+        }
+        inner_children[i] = node.children[child];
+        inner_distances[i] = entries[child];
+        continue;
+      }
+      const int end = node.children[child] + node.num_triangles[child];
+      for (int i = node.children[child]; i < end; ++i) {
+        if (triangles_[i].Intersect(ray.origin, ray.direction, &distance,
+                                    &hit->u, &hit->v)) {
+          hit_triangle = i;
+        }
+      }
+    }
+    for (int i = 0; i < num_inner_children; ++i) {
+      if (inner_distances[i] < distance) {
+        stack[stack_size++] = inner_children[i];
+      }
+    }
+  }
+  if (hit_triangle < 0) return false;
+  hit->triangle_index = triangles_[hit_triangle].index;
+  hit->distance = distance;
+  return true;
+}
+
+int Bvh::num_triangles() const { return triangles_.size(); }
+
+int Bvh::num_nodes() const { return nodes_.size(); }
+
+void Bvh::IntersectPacket(const RayPacket& packet, RayHit* hits) const {
+#ifdef WVU_BVH_SIMD
+  if (use_avx2_ && !nodes_.empty()) {
+    PacketTraversal::Intersect(*this, packet, hits);
+    return;
+  }
+#endif
+  for (int i = 0; i < kRayPacketSize; ++i) {
+    Ray ray;
+    ray.origin = Eigen::Vector3f(packet.origin[0][i], packet.origin[1][i],
+                                 packet.origin[2][i]);
+    ray.direction =
+        Eigen::Vector3f(packet.direction[0][i], packet.direction[1][i],
+                        packet.direction[2][i]);
+    ray.max_distance = packet.max_distance[i];
+    Intersect(ray, &hits[i]);
+  }
+}
+
+}  // namespace wvu
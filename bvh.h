@@ -0,0 +1,133 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "thread_pool.h"
+
+namespace wvu {
+// The ray origin + t * direction for t in (0, max_distance).
+struct Ray {
+  Eigen::Vector3f origin;
+  Eigen::Vector3f direction;
+  float max_distance;
+};
+
+// The nearest intersection of a ray with the triangles of a BVH.
+struct RayHit {
+  // Index of the triangle hit, or -1 if the ray missed every triangle.
+  int triangle_index = -1;
+  // The t of the ray at the hit.
+  float distance = 0.0f;
+  // Barycentric coordinates of the hit, which is at
+  // (1 - u - v) * v0 + u * v1 + v * v2.
+  float u = 0.0f;
+  float v = 0.0f;
+};
+
+// Number of rays traced together by Bvh::IntersectPacket().
+constexpr int kRayPacketSize = 8;
+
+// Coherent rays, e.g., the primary rays of neighboring pixels, stored as a
+// structure of arrays.
+struct RayPacket {
+  float origin[3][kRayPacketSize];
+  float direction[3][kRayPacketSize];
+  float max_distance[kRayPacketSize];
+};
+
+// A bounding volume hierarchy of triangles with four children per node.
+//
+// Build() splits the triangles top-down with the surface area heuristic
+// evaluated over 16 bins per axis. The top of the tree is split by the
+// calling thread, binning the largest ranges in parallel, and the subtrees
+// below are built in parallel.
+//
+// Intersect() tests a ray against the four boxes of a node at once with SSE.
+// IntersectPacket() traces 8 rays together with AVX2 when the CPU supports
+// it, testing every box and triangle against the 8 rays at once, and falls
+// back to tracing the rays one at a time.
+class Bvh {
+ public:
+  Bvh();
+  ~Bvh();
+
+  // Builds the hierarchy over a set of triangles, replacing the previous one.
+  // Params:
+  //   vertices  The vertices of the triangles, three consecutive per
+  //     triangle. A triangle is referred to by its position in this list.
+  //   thread_pool  The threads building the hierarchy, along with the calling
+  //     thread. If null, the hierarchy is built by the calling thread.
+  void Build(const std::vector<Eigen::Vector3f>& vertices,
+             ThreadPool* thread_pool);
+
+  // Finds the nearest triangle hit by a ray. Returns true if there is one.
+  bool Intersect(const Ray& ray, RayHit* hit) const;
+
+  // Finds the nearest triangles hit by the rays of a packet.
+  // Params:
+  //   packet  The rays.
+  //   hits  The kRayPacketSize hits of the rays, in the order of the rays.
+  void IntersectPacket(const RayPacket& packet, RayHit* hits) const;
+
+  // The bounding box of the triangles.
+  const Eigen::AlignedBox3f& bounds() const { return bounds_; }
+  int num_triangles() const;
+  int num_nodes() const;
+  // Whether packets are traced with AVX2.
+  bool uses_avx2() const { return use_avx2_; }
+
+ private:
+  struct Node;
+  struct Triangle;
+  class Builder;
+  struct PacketTraversal;
+
+  const bool use_avx2_;
+  // The root is the first node.
+  std::vector<Node> nodes_;
+  // The triangles in the order of the leaves.
+  std::vector<Triangle> triangles_;
+  Eigen::AlignedBox3f bounds_;
+};
+
+}  // namespace wvu
+
+#endif  // BVH_H_
@@ -34,11 +34,19 @@
 
 #include "camera_utils.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WVU_CAMERA_SIMD
+#endif
+
 #define _USE_MATH_DEFINES  // For using M_PI.
 #include <cmath>
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <GL/glew.h>
 
+#include "cpu_utils.h"
+
 namespace wvu {
 namespace {
 // Mathematical constants. The right way to get PI in C++ is to use the
@@ -57,6 +65,69 @@ inline GLfloat ComputeCotangent(const GLfloat angle) {
   return tan(kHalfPi - angle);
 }
 
+// Transforms a point by a projective matrix and divides it by its w.
+inline void TransformPoint(const Eigen::Matrix4f& matrix,
+                           const float* point,
+                           float* transformed_point) {
+  const Eigen::Vector4f result =
+      matrix * Eigen::Vector4f(point[0], point[1], point[2], 1.0f);
+  for (int axis = 0; axis < 3; ++axis) {
+    transformed_point[axis] = result[axis] / result.w();
+  }
+}
+
+#ifdef WVU_CAMERA_SIMD
+// TransformPoint() for eight consecutive points at once. The coordinates of
+// the interleaved points are gathered into a register per axis.
+__attribute__((target("avx2,fma")))
+void TransformEightPointsAvx2(const Eigen::Matrix4f& matrix,
+                              const float* points,
+                              float* transformed_points) {
+  const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256 x = _mm256_i32gather_ps(points, offsets, 4);
+  const __m256 y = _mm256_i32gather_ps(points + 1, offsets, 4);
+  const __m256 z = _mm256_i32gather_ps(points + 2, offsets, 4);
+  __m256 rows[4];
+  for (int row = 0; row < 4; ++row) {
+    rows[row] = _mm256_fmadd_ps(
+        _mm256_set1_ps(matrix(row, 0)), x,
+        _mm256_fmadd_ps(_mm256_set1_ps(matrix(row, 1)), y,
+                        _mm256_fmadd_ps(_mm256_set1_ps(matrix(row, 2)), z,
+                                        _mm256_set1_ps(matrix(row, 3)))));
+  }
+  alignas(32) float coordinates[3][8];
+  for (int axis = 0; axis < 3; ++axis) {
+    _mm256_store_ps(coordinates[axis], _mm256_div_ps(rows[axis], rows[3]));
+  }
+  for (int i = 0; i < 8; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      transformed_points[3 * i + axis] = coordinates[axis][i];
+    }
+  }
+}
+#endif  // WVU_CAMERA_SIMD
+
+// Transforms the points by a projective matrix and divides them by their w.
+void TransformPoints(const Eigen::Matrix4f& matrix,
+                     const Eigen::Matrix3Xf& points,
+                     Eigen::Matrix3Xf* transformed_points) {
+  const int num_points = points.cols();
+  transformed_points->resize(3, num_points);
+  const float* input = points.data();
+  float* output = transformed_points->data();
+  int i = 0;
+#ifdef WVU_CAMERA_SIMD
+  if (internal::CpuSupportsAvx2()) {
+    for (; i + 8 <= num_points; i += 8) {
+      TransformEightPointsAvx2(matrix, input + 3 * i, output + 3 * i);
+    }
+  }
+#endif
+  for (; i < num_points; ++i) {
+    TransformPoint(matrix, input + 3 * i, output + 3 * i);
+  }
+}
+
 }  // namespace
 
 // Computes the perspective camera projection metrix.
@@ -85,5 +156,272 @@ Eigen::Matrix4f ComputePerspectiveProjectionMatrix(const GLfloat field_of_view,
   return projection_matrix;
 }
 
+Eigen::Matrix4f ComputeInfinitePerspectiveProjectionMatrix(
+    const GLfloat field_of_view,
+    const GLfloat aspect_ratio,
+    const GLfloat near) {
+  // The limit of the standard projection when the far plane goes to
+  // infinity.
+  const GLfloat y_scale = ComputeCotangent(0.5f * field_of_view);
+  const GLfloat x_scale = y_scale / aspect_ratio;
+  Eigen::Matrix4f projection_matrix;
+  projection_matrix << x_scale, 0.0f, 0.0f, 0.0f,
+      0.0f, y_scale, 0.0f, 0.0f,
+      0.0f, 0.0f, -1.0f, -2.0f * near,
+      0.0f, 0.0f, -1.0f, 0.0f;
+  return projection_matrix;
+}
+
+Eigen::Matrix4f ComputeReverseZProjectionMatrix(const GLfloat field_of_view,
+                                                const GLfloat aspect_ratio,
+                                                const GLfloat near,
+                                                const GLfloat far) {
+  // The depth (z_scale * z + homogeneous_scale) / -z is 1 at z = -near and 0
+  // at z = -far.
+  const GLfloat y_scale = ComputeCotangent(0.5f * field_of_view);
+  const GLfloat x_scale = y_scale / aspect_ratio;
+  const GLfloat planes_distance = far - near;
+  const GLfloat z_scale = near / planes_distance;
+  const GLfloat homogeneous_scale = near * far / planes_distance;
+  Eigen::Matrix4f projection_matrix;
+  projection_matrix << x_scale, 0.0f, 0.0f, 0.0f,
+      0.0f, y_scale, 0.0f, 0.0f,
+      0.0f, 0.0f, z_scale, homogeneous_scale,
+      0.0f, 0.0f, -1.0f, 0.0f;
+  return projection_matrix;
+}
+
+Eigen::Matrix4f ComputeInfiniteReverseZProjectionMatrix(
+    const GLfloat field_of_view,
+    const GLfloat aspect_ratio,
+    const GLfloat near) {
+  // The limit of the reverse-Z projection when the far plane goes to
+  // infinity.
+  const GLfloat y_scale = ComputeCotangent(0.5f * field_of_view);
+  const GLfloat x_scale = y_scale / aspect_ratio;
+  Eigen::Matrix4f projection_matrix;
+  projection_matrix << x_scale, 0.0f, 0.0f, 0.0f,
+      0.0f, y_scale, 0.0f, 0.0f,
+      0.0f, 0.0f, 0.0f, near,
+      0.0f, 0.0f, -1.0f, 0.0f;
+  return projection_matrix;
+}
+
+Eigen::Matrix4f ComputeOffAxisProjectionMatrix(const GLfloat left,
+                                               const GLfloat right,
+                                               const GLfloat bottom,
+                                               const GLfloat top,
+                                               const GLfloat near,
+                                               const GLfloat far) {
+  const GLfloat width = right - left;
+  const GLfloat height = top - bottom;
+  const GLfloat planes_distance = far - near;
+  Eigen::Matrix4f projection_matrix;
+  projection_matrix << 2.0f * near / width, 0.0f, (right + left) / width, 0.0f,
+      0.0f, 2.0f * near / height, (top + bottom) / height, 0.0f,
+      0.0f, 0.0f, -(far + near) / planes_distance,
+      -2.0f * far * near / planes_distance,
+      0.0f, 0.0f, -1.0f, 0.0f;
+  return projection_matrix;
+}
+
+Eigen::Matrix4f ComputeImageRegionProjectionMatrix(
+    const Eigen::Matrix4f& projection,
+    const Eigen::AlignedBox2f& region) {
+  // The region in normalized device coordinates is scaled and translated to
+  // [-1, 1] x [-1, 1] in clip space, i.e., multiplying the offsets by w.
+  const Eigen::Vector2f ndc_min =
+      2.0f * region.min() - Eigen::Vector2f::Ones();
+  const Eigen::Vector2f ndc_max =
+      2.0f * region.max() - Eigen::Vector2f::Ones();
+  const Eigen::Vector2f ndc_size = ndc_max - ndc_min;
+  Eigen::Matrix4f region_matrix = Eigen::Matrix4f::Identity();
+  for (int axis = 0; axis < 2; ++axis) {
+    region_matrix(axis, axis) = 2.0f / ndc_size[axis];
+    region_matrix(axis, 3) = -(ndc_min[axis] + ndc_max[axis]) / ndc_size[axis];
+  }
+  return region_matrix * projection;
+}
+
+Eigen::Matrix4f ConvertToStandardDepthProjectionMatrix(
+    const Eigen::Matrix4f& projection,
+    const DepthMode depth_mode) {
+  if (depth_mode == DepthMode::kStandard) return projection;
+  // The reverse-Z clip depth z in [0, w] maps to w - 2 * z in [-w, w], from
+  // the near plane to the far plane.
+  Eigen::Matrix4f standard_projection = projection;
+  standard_projection.row(2) = projection.row(3) - 2.0f * projection.row(2);
+  return standard_projection;
+}
+
+void ComputeFrustumPlanes(const Eigen::Matrix4f& view_projection,
+                          Eigen::Vector4f* planes) {
+  for (int row = 0; row < 3; ++row) {
+    planes[2 * row] =
+        (view_projection.row(3) + view_projection.row(row)).transpose();
+    planes[2 * row + 1] =
+        (view_projection.row(3) - view_projection.row(row)).transpose();
+  }
+}
+
+Camera::Camera()
+    : position_(Eigen::Vector3f::Zero()),
+      orientation_(Eigen::Quaternionf::Identity()),
+      field_of_view_(0.25f * static_cast<float>(M_PI)),
+      aspect_ratio_(1.0f),
+      near_(0.1f),
+      far_(10.0f),
+      depth_mode_(DepthMode::kStandard),
+      image_region_(Eigen::Vector2f::Zero(), Eigen::Vector2f::Ones()),
+      view_dirty_(true),
+      projection_dirty_(true),
+      view_projection_dirty_(true) {}
+
+void Camera::SetPose(const Eigen::Vector3f& position,
+                     const Eigen::Quaternionf& orientation) {
+  position_ = position;
+  orientation_ = orientation.normalized();
+  view_dirty_ = true;
+}
+
+void Camera::LookAt(const Eigen::Vector3f& eye,
+                    const Eigen::Vector3f& target,
+                    const Eigen::Vector3f& up) {
+  // The camera looks down its negative z-axis.
+  const Eigen::Vector3f backward = (eye - target).normalized();
+  const Eigen::Vector3f right = up.cross(backward).normalized();
+  Eigen::Matrix3f rotation;
+  rotation.col(0) = right;
+  rotation.col(1) = backward.cross(right);
+  rotation.col(2) = backward;
+  SetPose(eye, Eigen::Quaternionf(rotation));
+}
+
+void Camera::SetPerspective(const float field_of_view,
+                            const float aspect_ratio,
+                            const float near,
+                            const float far) {
+  field_of_view_ = field_of_view;
+  aspect_ratio_ = aspect_ratio;
+  near_ = near;
+  far_ = far;
+  projection_dirty_ = true;
+}
+
+void Camera::set_depth_mode(const DepthMode depth_mode) {
+  depth_mode_ = depth_mode;
+  projection_dirty_ = true;
+}
+
+void Camera::SetImageRegion(const Eigen::AlignedBox2f& image_region) {
+  image_region_ = image_region;
+  projection_dirty_ = true;
+}
+
+bool Camera::has_infinite_far_plane() const { return std::isinf(far_); }
+
+const Eigen::Matrix4f& Camera::view() const {
+  UpdateView();
+  return view_;
+}
+
+const Eigen::Matrix4f& Camera::inverse_view() const {
+  UpdateView();
+  return inverse_view_;
+}
+
+const Eigen::Matrix4f& Camera::projection() const {
+  UpdateProjection();
+  return projection_;
+}
+
+const Eigen::Matrix4f& Camera::inverse_projection() const {
+  UpdateProjection();
+  return inverse_projection_;
+}
+
+const Eigen::Matrix4f& Camera::view_projection() const {
+  UpdateViewProjection();
+  return view_projection_;
+}
+
+const Eigen::Matrix4f& Camera::inverse_view_projection() const {
+  UpdateViewProjection();
+  return inverse_view_projection_;
+}
+
+const Eigen::Matrix4f& Camera::standard_view_projection() const {
+  UpdateViewProjection();
+  return standard_view_projection_;
+}
+
+const Eigen::Vector4f* Camera::frustum_planes() const {
+  UpdateViewProjection();
+  return frustum_planes_;
+}
+
+void Camera::Update() const { UpdateViewProjection(); }
+
+void Camera::ProjectPoints(const Eigen::Matrix3Xf& points,
+                           Eigen::Matrix3Xf* ndc_points) const {
+  TransformPoints(view_projection(), points, ndc_points);
+}
+
+void Camera::UnprojectPoints(const Eigen::Matrix3Xf& ndc_points,
+                             Eigen::Matrix3Xf* points) const {
+  TransformPoints(inverse_view_projection(), ndc_points, points);
+}
+
+void Camera::UpdateView() const {
+  if (!view_dirty_) return;
+  // The view matrix is the inverse of the rigid transformation of the pose.
+  const Eigen::Matrix3f rotation = orientation_.toRotationMatrix();
+  inverse_view_.setIdentity();
+  inverse_view_.topLeftCorner<3, 3>() = rotation;
+  inverse_view_.topRightCorner<3, 1>() = position_;
+  view_.setIdentity();
+  view_.topLeftCorner<3, 3>() = rotation.transpose();
+  view_.topRightCorner<3, 1>() = -(rotation.transpose() * position_);
+  view_dirty_ = false;
+  view_projection_dirty_ = true;
+}
+
+void Camera::UpdateProjection() const {
+  if (!projection_dirty_) return;
+  const bool infinite_far_plane = has_infinite_far_plane();
+  if (depth_mode_ == DepthMode::kReverseZ) {
+    projection_ = infinite_far_plane
+                      ? ComputeInfiniteReverseZProjectionMatrix(
+                            field_of_view_, aspect_ratio_, near_)
+                      : ComputeReverseZProjectionMatrix(
+                            field_of_view_, aspect_ratio_, near_, far_);
+  } else {
+    projection_ = infinite_far_plane
+                      ? ComputeInfinitePerspectiveProjectionMatrix(
+                            field_of_view_, aspect_ratio_, near_)
+                      : ComputePerspectiveProjectionMatrix(
+                            field_of_view_, aspect_ratio_, near_, far_);
+  }
+  if (!image_region_.min().isZero() || !image_region_.max().isOnes()) {
+    projection_ =
+        ComputeImageRegionProjectionMatrix(projection_, image_region_);
+  }
+  inverse_projection_ = projection_.inverse();
+  projection_dirty_ = false;
+  view_projection_dirty_ = true;
+}
+
+void Camera::UpdateViewProjection() const {
+  UpdateView();
+  UpdateProjection();
+  if (!view_projection_dirty_) return;
+  view_projection_ = projection_ * view_;
+  inverse_view_projection_ = inverse_view_ * inverse_projection_;
+  standard_view_projection_ =
+      ConvertToStandardDepthProjectionMatrix(projection_, depth_mode_) * view_;
+  ComputeFrustumPlanes(standard_view_projection_, frustum_planes_);
+  view_projection_dirty_ = false;
+}
+
 }  // namespace wvu
 
@@ -36,9 +36,24 @@
 #define CAMERA_UTILS_H_
 
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <GL/glew.h>
 
 namespace wvu {
+// How the depth of the projections is stored in the depth buffer.
+enum class DepthMode {
+  // The OpenGL convention: the near plane maps to -1 and the far plane to 1
+  // in normalized device coordinates, the depth test is GL_LESS and the depth
+  // buffer is cleared to 1. Most of the precision is spent near the camera.
+  kStandard,
+  // Reverse-Z: with glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE), the near
+  // plane maps to 1 and the far plane to 0, the depth test is GL_GREATER and
+  // the depth buffer is cleared to 0. With a floating point depth buffer, the
+  // exponent cancels the hyperbolic distribution of the depth, so the
+  // precision is nearly uniform from the near plane to infinity.
+  kReverseZ,
+};
+
 // Computes the perspective camera projection metrix.
 // Params:
 //   field_of_view  The field of view angle in degrees.
@@ -49,6 +64,230 @@ Eigen::Matrix4f ComputePerspectiveProjectionMatrix(const GLfloat field_of_view,
                                                    const GLfloat aspect_ratio,
                                                    const GLfloat near,
                                                    const GLfloat far);
+
+// Computes the perspective projection matrix of a camera without a far plane,
+// in the standard depth mode. The depth tends to 1 at infinity.
+// Params:
+//   field_of_view  The field of view angle in radians.
+//   aspect_ratio  The width / height ratio of the window dimensions.
+//   near  The near distance plane.
+Eigen::Matrix4f ComputeInfinitePerspectiveProjectionMatrix(
+    const GLfloat field_of_view,
+    const GLfloat aspect_ratio,
+    const GLfloat near);
+
+// Computes the perspective projection matrix of the reverse-Z depth mode,
+// which maps the near plane to a depth of 1 and the far plane to 0.
+// Params:
+//   field_of_view  The field of view angle in radians.
+//   aspect_ratio  The width / height ratio of the window dimensions.
+//   near  The near distance plane.
+//   far  The far distance plane.
+Eigen::Matrix4f ComputeReverseZProjectionMatrix(const GLfloat field_of_view,
+                                                const GLfloat aspect_ratio,
+                                                const GLfloat near,
+                                                const GLfloat far);
+
+// Computes the perspective projection matrix of the reverse-Z depth mode
+// without a far plane. The depth is near / distance, which tends to 0 at
+// infinity.
+// Params:
+//   field_of_view  The field of view angle in radians.
+//   aspect_ratio  The width / height ratio of the window dimensions.
+//   near  The near distance plane.
+Eigen::Matrix4f ComputeInfiniteReverseZProjectionMatrix(
+    const GLfloat field_of_view,
+    const GLfloat aspect_ratio,
+    const GLfloat near);
+
+// Computes the perspective projection matrix of an off-axis frustum, whose
+// apex is not necessarily centered on the image, as glFrustum() does. The
+// left, right, bottom and top planes are given by their coordinates on the
+// near plane, in camera coordinates.
+// Params:
+//   left  The x of the left plane on the near plane.
+//   right  The x of the right plane on the near plane.
+//   bottom  The y of the bottom plane on the near plane.
+//   top  The y of the top plane on the near plane.
+//   near  The near distance plane.
+//   far  The far distance plane.
+Eigen::Matrix4f ComputeOffAxisProjectionMatrix(const GLfloat left,
+                                               const GLfloat right,
+                                               const GLfloat bottom,
+                                               const GLfloat top,
+                                               const GLfloat near,
+                                               const GLfloat far);
+
+// Restricts a projection matrix to a region of its image, which then fills
+// the whole viewport. The result is the off-axis projection of the region,
+// e.g., of a tile of an image rendered in tiles, in any depth mode.
+// Params:
+//   projection  The projection matrix of the whole image.
+//   region  The region of the image, where (0, 0) is the bottom left corner
+//     of the image and (1, 1) its top right corner. The region may extend
+//     past the image.
+Eigen::Matrix4f ComputeImageRegionProjectionMatrix(
+    const Eigen::Matrix4f& projection,
+    const Eigen::AlignedBox2f& region);
+
+// Converts a projection matrix of a depth mode into the equivalent matrix of
+// the standard depth mode, whose clip space is what the CPU culling and
+// rasterizers expect. Both matrices have the same frustum.
+// Params:
+//   projection  The projection matrix.
+//   depth_mode  The depth mode of the projection matrix.
+Eigen::Matrix4f ConvertToStandardDepthProjectionMatrix(
+    const Eigen::Matrix4f& projection,
+    const DepthMode depth_mode);
+
+// Computes the six planes of the view frustum in world coordinates, i.e., the
+// planes of the clip space of the standard depth mode, -w <= x, y, z <= w,
+// transformed by the view projection. A point p is inside the frustum when
+// plane.head<3>().dot(p) + plane.w() >= 0 for every plane. The planes are not
+// normalized, since the far plane of an infinite projection has no normal.
+// Params:
+//   view_projection  The projection times the view matrix, in the standard
+//     depth mode.
+//   planes  The left, right, bottom, top, near and far planes.
+void ComputeFrustumPlanes(const Eigen::Matrix4f& view_projection,
+                          Eigen::Vector4f* planes);
+
+// A perspective camera: its pose, its lens, and the matrices and the frustum
+// derived from them. The derived quantities are computed when they are first
+// read after a change of the pose or the lens, and cached until the next
+// change, so the consumers of a frame share them instead of recomputing them
+// on every call.
+//
+//   Camera camera;
+//   camera.SetPerspective(field_of_view, aspect_ratio, near, far);
+//   camera.LookAt(eye, target, up);
+//   scene_bvh.CullFrustum(camera, visible_instances);
+//   DrawModel(program, camera.projection(), camera.view(), ...);
+//
+// The cache is updated by the const accessors, so a camera read by several
+// threads must be updated first, e.g., with Update().
+class Camera {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // A camera at the origin looking down the negative z-axis, with a field of
+  // view of 45 degrees, a square aspect ratio, near and far planes at 0.1
+  // and 10, and the standard depth mode.
+  Camera();
+
+  // Sets the pose of the camera.
+  // Params:
+  //   position  The position of the camera in world coordinates.
+  //   orientation  The rotation from the camera to the world coordinates.
+  //     The camera looks down its negative z-axis and its y-axis is up.
+  void SetPose(const Eigen::Vector3f& position,
+               const Eigen::Quaternionf& orientation);
+
+  // Places the camera at eye looking at target.
+  // Params:
+  //   eye  The position of the camera in world coordinates.
+  //   target  The point the camera looks at, other than eye.
+  //   up  The direction of the world that is up in the image, which must not
+  //     be parallel to target - eye.
+  void LookAt(const Eigen::Vector3f& eye,
+              const Eigen::Vector3f& target,
+              const Eigen::Vector3f& up);
+
+  // Sets the lens of the camera.
+  // Params:
+  //   field_of_view  The vertical field of view angle in radians.
+  //   aspect_ratio  The width / height ratio of the image.
+  //   near  The near distance plane.
+  //   far  The far distance plane, or infinity for a projection without a
+  //     far plane.
+  void SetPerspective(const float field_of_view,
+                      const float aspect_ratio,
+                      const float near,
+                      const float far);
+
+  // Sets the depth mode of the projection.
+  void set_depth_mode(const DepthMode depth_mode);
+
+  // Restricts the projection to a region of the image, see
+  // ComputeImageRegionProjectionMatrix(). Defaults to the whole image,
+  // [0, 1] x [0, 1].
+  void SetImageRegion(const Eigen::AlignedBox2f& image_region);
+
+  const Eigen::Vector3f& position() const { return position_; }
+  const Eigen::Quaternionf& orientation() const { return orientation_; }
+  float field_of_view() const { return field_of_view_; }
+  float aspect_ratio() const { return aspect_ratio_; }
+  float near_plane() const { return near_; }
+  float far_plane() const { return far_; }
+  bool has_infinite_far_plane() const;
+  DepthMode depth_mode() const { return depth_mode_; }
+  const Eigen::AlignedBox2f& image_region() const { return image_region_; }
+
+  // The matrices derived from the pose and the lens.
+  const Eigen::Matrix4f& view() const;
+  const Eigen::Matrix4f& inverse_view() const;
+  const Eigen::Matrix4f& projection() const;
+  const Eigen::Matrix4f& inverse_projection() const;
+  const Eigen::Matrix4f& view_projection() const;
+  const Eigen::Matrix4f& inverse_view_projection() const;
+  // The view projection matrix in the standard depth mode, whose clip space
+  // is the one the CPU culling and rasterizers expect.
+  const Eigen::Matrix4f& standard_view_projection() const;
+  // The six planes of the frustum, see ComputeFrustumPlanes().
+  const Eigen::Vector4f* frustum_planes() const;
+
+  // Computes every derived quantity that is out of date.
+  void Update() const;
+
+  // Projects points in world coordinates to normalized device coordinates.
+  // The points must be in front of the camera. The points are processed
+  // eight at a time with AVX2 when the CPU supports it.
+  // Params:
+  //   points  The 3xN points in world coordinates.
+  //   ndc_points  The 3xN points in normalized device coordinates, whose
+  //     depth follows the depth mode.
+  void ProjectPoints(const Eigen::Matrix3Xf& points,
+                     Eigen::Matrix3Xf* ndc_points) const;
+
+  // Unprojects points in normalized device coordinates to world coordinates,
+  // e.g., to find the point under the cursor given its depth. The far depth
+  // of a projection without a far plane unprojects to infinity.
+  // Params:
+  //   ndc_points  The 3xN points in normalized device coordinates, whose
+  //     depth follows the depth mode.
+  //   points  The 3xN points in world coordinates.
+  void UnprojectPoints(const Eigen::Matrix3Xf& ndc_points,
+                       Eigen::Matrix3Xf* points) const;
+
+ private:
+  void UpdateView() const;
+  void UpdateProjection() const;
+  void UpdateViewProjection() const;
+
+  // The pose and the lens.
+  Eigen::Vector3f position_;
+  Eigen::Quaternionf orientation_;
+  float field_of_view_;
+  float aspect_ratio_;
+  float near_;
+  float far_;
+  DepthMode depth_mode_;
+  Eigen::AlignedBox2f image_region_;
+
+  // The cache of the derived quantities, and whether they are out of date.
+  mutable bool view_dirty_;
+  mutable bool projection_dirty_;
+  mutable bool view_projection_dirty_;
+  mutable Eigen::Matrix4f view_;
+  mutable Eigen::Matrix4f inverse_view_;
+  mutable Eigen::Matrix4f projection_;
+  mutable Eigen::Matrix4f inverse_projection_;
+  mutable Eigen::Matrix4f view_projection_;
+  mutable Eigen::Matrix4f inverse_view_projection_;
+  mutable Eigen::Matrix4f standard_view_projection_;
+  mutable Eigen::Vector4f frustum_planes_[6];
+};
+
 }  // namespace wvu
 
 #endif  // CAMERA_UTILS_H_
@@ -0,0 +1,194 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "json_utils.h"
+
+namespace wvu {
+namespace internal {
+
+std::atomic<bool> cpu_profiling_enabled(false);
+
+}  // namespace internal
+
+namespace {
+// Number of zones each thread keeps. When a thread records more zones between
+// two exports, the oldest ones are overwritten. Must be a power of two.
+constexpr uint64_t kRingBufferSize = 1 << 16;
+
+struct ZoneEvent {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// The zones of a thread. The owner thread is the only writer, and the export
+// is the only reader, so the buffer only needs atomic indices.
+struct ThreadZoneBuffer {
+  int thread_id = 0;
+  // Protected by the registry mutex.
+  std::string thread_name;
+  std::atomic<uint64_t> write_index{0};
+  // Index of the first zone that was not exported yet.
+  uint64_t read_index = 0;
+  ZoneEvent events[kRingBufferSize];
+};
+
+// The buffers of all the threads that recorded zones. Buffers are never
+// deleted since the zones of a thread that exited may still be exported.
+std::mutex registry_mutex;
+std::vector<ThreadZoneBuffer*>* registry = new std::vector<ThreadZoneBuffer*>;
+
+thread_local ThreadZoneBuffer* thread_buffer = nullptr;
+
+ThreadZoneBuffer* GetThreadBuffer() {
+  if (thread_buffer == nullptr) {
+    ThreadZoneBuffer* buffer = new ThreadZoneBuffer;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    buffer->thread_id = registry->size() + 1;
+    registry->push_back(buffer);
+    thread_buffer = buffer;
+  }
+  return thread_buffer;
+}
+
+// A point in time measured with both the timestamp counter and the steady
+// clock. Two of them give the frequency of the timestamp counter.
+struct ClockSample {
+  ClockSample()
+      : ticks(ReadTimestamp()),
+        nanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count()) {}
+
+  uint64_t ticks;
+  int64_t nanoseconds;
+};
+
+// The origin of the exported timestamps.
+const ClockSample clock_origin;
+
+}  // namespace
+
+namespace internal {
+
+void RecordZone(const char* name, const uint64_t begin, const uint64_t end) {
+  ThreadZoneBuffer* buffer = GetThreadBuffer();
+  const uint64_t index = buffer->write_index.load(std::memory_order_relaxed);
+  ZoneEvent& event = buffer->events[index & (kRingBufferSize - 1)];
+  event.name = name;
+  event.begin = begin;
+  event.end = end;
+  buffer->write_index.store(index + 1, std::memory_order_release);
+}
+
+}  // namespace internal
+
+void SetCpuProfilingEnabled(const bool enabled) {
+  internal::cpu_profiling_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void SetProfilerThreadName(const char* name) {
+  ThreadZoneBuffer* buffer = GetThreadBuffer();
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  buffer->thread_name = name;
+}
+
+bool WriteChromeTrace(const std::string& filepath) {
+  std::ofstream stream(filepath);
+  if (!stream.is_open()) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+
+  // Calibrate the timestamp counter against the steady clock over the whole
+  // lifetime of the process.
+  const ClockSample now;
+  const double nanoseconds_per_tick =
+      now.ticks > clock_origin.ticks
+          ? static_cast<double>(now.nanoseconds - clock_origin.nanoseconds) /
+                static_cast<double>(now.ticks - clock_origin.ticks)
+          : 1.0;
+  // Chrome traces are in microseconds.
+  const auto to_microseconds = [&](const int64_t ticks) {
+    return 1e-3 * nanoseconds_per_tick * static_cast<double>(ticks);
+  };
+
+  stream.precision(3);
+  stream << std::fixed << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  bool first_event = true;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  for (ThreadZoneBuffer* buffer : *registry) {
+    stream << (first_event ? "\n" : ",\n")
+           << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+           << "\"tid\": " << buffer->thread_id << ", \"args\": {\"name\": "
+           << ToJsonString(buffer->thread_name.empty()
+                               ? "Thread " + std::to_string(buffer->thread_id)
+                               : buffer->thread_name)
+           << "}}";
+    first_event = false;
+
+    const uint64_t end_index =
+        buffer->write_index.load(std::memory_order_acquire);
+    const uint64_t begin_index =
+        std::max(buffer->read_index,
+                 end_index > kRingBufferSize ? end_index - kRingBufferSize : 0);
+    for (uint64_t i = begin_index; i < end_index; ++i) {
+      const ZoneEvent& event = buffer->events[i & (kRingBufferSize - 1)];
+      stream << ",\n{\"name\": " << ToJsonString(event.name)
+             << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->thread_id
+             << ", \"ts\": "
+             << to_microseconds(static_cast<int64_t>(event.begin -
+                                                     clock_origin.ticks))
+             << ", \"dur\": " << to_microseconds(event.end - event.begin)
+             << "}";
+    }
+    buffer->read_index = end_index;
+  }
+  stream << "\n]}\n";
+  return stream.good();
+}
+
+}  // namespace wvu
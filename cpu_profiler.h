@@ -0,0 +1,125 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef CPU_PROFILER_H_
+#define CPU_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace wvu {
+// Lightweight CPU profiler. Code is instrumented with scoped zones:
+//
+//   void RenderScene(...) {
+//     WVU_PROFILE_ZONE("RenderScene");
+//     ...
+//   }
+//
+// Every zone records its name and its begin and end timestamps into a
+// lock-free ring buffer owned by the calling thread, so zones can be used from
+// any thread without contention. The recorded zones are exported in the Chrome
+// trace event format, which chrome://tracing and https://ui.perfetto.dev load.
+// Zones are only recorded while profiling is enabled; otherwise a zone costs an
+// atomic load.
+
+// Returns a timestamp in ticks of the fastest clock available, i.e., the time
+// stamp counter on x86 CPUs. The exported traces convert the ticks to time.
+inline uint64_t ReadTimestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Enables or disables the recording of zones.
+void SetCpuProfilingEnabled(const bool enabled);
+
+// Names the calling thread in the exported traces.
+void SetProfilerThreadName(const char* name);
+
+// Writes the zones recorded by all the threads as a Chrome trace JSON file and
+// clears them. Returns true upon success.
+bool WriteChromeTrace(const std::string& filepath);
+
+namespace internal {
+extern std::atomic<bool> cpu_profiling_enabled;
+// Appends a zone to the ring buffer of the calling thread. The name must be a
+// string literal or outlive the profiler.
+void RecordZone(const char* name, const uint64_t begin, const uint64_t end);
+
+}  // namespace internal
+
+inline bool IsCpuProfilingEnabled() {
+  return internal::cpu_profiling_enabled.load(std::memory_order_relaxed);
+}
+
+// Records the time between its construction and its destruction (or the call
+// to End()) as a zone. See WVU_PROFILE_ZONE.
+class ProfileZone {
+ public:
+  explicit ProfileZone(const char* name)
+      : name_(name), begin_(IsCpuProfilingEnabled() ? ReadTimestamp() : 0) {}
+  ~ProfileZone() { End(); }
+
+  ProfileZone(const ProfileZone&) = delete;
+  ProfileZone& operator=(const ProfileZone&) = delete;
+
+  // Ends the zone before the end of the scope.
+  void End() {
+    if (begin_ == 0) return;
+    internal::RecordZone(name_, begin_, ReadTimestamp());
+    begin_ = 0;
+  }
+
+ private:
+  const char* name_;
+  uint64_t begin_;
+};
+
+}  // namespace wvu
+
+#define WVU_PROFILE_ZONE_CONCAT_IMPL(x, y) x##y
+#define WVU_PROFILE_ZONE_CONCAT(x, y) WVU_PROFILE_ZONE_CONCAT_IMPL(x, y)
+// Profiles the rest of the enclosing scope as a zone with the given name.
+#define WVU_PROFILE_ZONE(name) \
+  ::wvu::ProfileZone WVU_PROFILE_ZONE_CONCAT(profile_zone_, __LINE__)(name)
+
+#endif  // CPU_PROFILER_H_
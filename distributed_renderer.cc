@@ -0,0 +1,557 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "distributed_renderer.h"
+
+#include <errno.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+extern char** environ;
+
+namespace wvu {
+namespace {
+constexpr int kNumChannels = 4;
+// How long the coordinator waits for the workers to connect and for a tile,
+// in milliseconds.
+constexpr int kConnectTimeout = 30000;
+constexpr int kTileTimeout = 30000;
+// How many times, and how often in milliseconds, a worker tries to connect.
+constexpr int kNumConnectAttempts = 100;
+constexpr int kConnectRetryInterval = 50;
+
+// The messages between the coordinator and the workers are a header followed
+// by a payload of the given size.
+enum class MessageType : uint32_t { kHello, kFrame, kTile, kShutdown };
+
+struct MessageHeader {
+  MessageType type;
+  uint32_t size;
+};
+
+// Sent by a worker once connected.
+struct HelloMessage {
+  int32_t tile_width;
+  int32_t tile_height;
+};
+
+// Starts the payload of a frame, followed by num_models ModelPoseMessage and
+// num_tiles TileAssignment.
+struct FrameMessage {
+  float camera_position[3];
+  // The quaternion as x, y, z, w.
+  float camera_orientation[4];
+  float field_of_view;
+  float aspect_ratio;
+  float near_plane;
+  float far_plane;
+  int32_t depth_mode;
+  int32_t num_models;
+  int32_t num_tiles;
+};
+
+struct ModelPoseMessage {
+  float position[3];
+  float orientation[3];
+};
+
+struct TileAssignment {
+  int32_t tile_index;
+  // The region of the image, see Camera::SetImageRegion().
+  float region_min[2];
+  float region_max[2];
+};
+
+// Starts the payload of a tile, followed by its RGBA pixels.
+struct TileMessage {
+  int32_t tile_index;
+  float render_time;
+};
+
+bool WriteAll(const int socket, const void* data, const size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  size_t num_bytes_written = 0;
+  while (num_bytes_written < size) {
+    // A closed peer is reported as an error rather than a SIGPIPE.
+    const ssize_t result = send(socket, bytes + num_bytes_written,
+                                size - num_bytes_written, MSG_NOSIGNAL);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    num_bytes_written += result;
+  }
+  return true;
+}
+
+bool ReadAll(const int socket, void* data, const size_t size) {
+  uint8_t* bytes = static_cast<uint8_t*>(data);
+  size_t num_bytes_read = 0;
+  while (num_bytes_read < size) {
+    const ssize_t result =
+        recv(socket, bytes + num_bytes_read, size - num_bytes_read, 0);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) return false;
+    num_bytes_read += result;
+  }
+  return true;
+}
+
+bool SendMessage(const int socket,
+                 const MessageType type,
+                 const void* payload,
+                 const size_t size) {
+  const MessageHeader header = {type, static_cast<uint32_t>(size)};
+  return WriteAll(socket, &header, sizeof(header)) &&
+         WriteAll(socket, payload, size);
+}
+
+// Reads the header of a message and checks its type and size.
+bool ReceiveHeader(const int socket,
+                   const MessageType type,
+                   const size_t size) {
+  MessageHeader header;
+  return ReadAll(socket, &header, sizeof(header)) && header.type == type &&
+         header.size == size;
+}
+
+// Fills the address of a Unix domain socket. Returns false if the path is too
+// long.
+bool GetSocketAddress(const std::string& socket_path, sockaddr_un* address) {
+  std::memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (socket_path.empty() ||
+      socket_path.size() >= sizeof(address->sun_path)) {
+    LOG(ERROR) << "Invalid socket path: " << socket_path;
+    return false;
+  }
+  std::memcpy(address->sun_path, socket_path.c_str(), socket_path.size());
+  return true;
+}
+
+// Appends a value to a message.
+template <typename T>
+void AppendToMessage(const T& value, std::vector<uint8_t>* message) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  message->insert(message->end(), bytes, bytes + sizeof(value));
+}
+
+}  // namespace
+
+DistributedRenderer::DistributedRenderer(
+    const DistributedRendererOptions& options)
+    : options_(options), listen_socket_(-1) {
+  if (options_.width <= 0 || options_.height <= 0 ||
+      options_.num_tiles_x <= 0 || options_.num_tiles_y <= 0 ||
+      options_.num_workers <= 0) {
+    LOG(ERROR) << "Invalid distributed renderer of " << options_.width << "x"
+               << options_.height << " pixels, " << options_.num_tiles_x
+               << "x" << options_.num_tiles_y << " tiles and "
+               << options_.num_workers << " workers.";
+    return;
+  }
+  sockaddr_un address;
+  if (!GetSocketAddress(options_.socket_path, &address)) return;
+  const int listen_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_socket < 0) {
+    LOG(ERROR) << "Could not create a socket: " << std::strerror(errno);
+    return;
+  }
+  // A socket left by a previous run would make bind() fail.
+  unlink(options_.socket_path.c_str());
+  if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_socket, options_.num_workers) != 0) {
+    LOG(ERROR) << "Could not listen on " << options_.socket_path << ": "
+               << std::strerror(errno);
+    close(listen_socket);
+    return;
+  }
+  listen_socket_ = listen_socket;
+
+  const int num_tiles = options_.num_tiles_x * options_.num_tiles_y;
+  color_buffer_.resize(static_cast<size_t>(options_.width) * options_.height *
+                       kNumChannels);
+  tile_pixels_.resize(static_cast<size_t>(options_.tile_width()) *
+                      options_.tile_height() * kNumChannels);
+  // Every tile costs the same until it is measured.
+  tile_costs_.resize(num_tiles, 1.0f);
+  tile_order_.resize(num_tiles);
+  std::iota(tile_order_.begin(), tile_order_.end(), 0);
+  tile_workers_.resize(num_tiles, 0);
+  worker_loads_.resize(options_.num_workers, 0.0f);
+}
+
+DistributedRenderer::~DistributedRenderer() {
+  DisconnectWorkers();
+  for (const pid_t worker_process : worker_processes_) {
+    int status;
+    waitpid(worker_process, &status, 0);
+  }
+  if (listen_socket_ >= 0) {
+    close(listen_socket_);
+    unlink(options_.socket_path.c_str());
+  }
+}
+
+bool DistributedRenderer::ConnectWorkers() {
+  WVU_PROFILE_ZONE("DistributedRenderer::ConnectWorkers");
+  CHECK(is_valid());
+  if (!options_.worker_command.empty()) {
+    std::vector<char*> arguments;
+    for (const std::string& argument : options_.worker_command) {
+      arguments.push_back(const_cast<char*>(argument.c_str()));
+    }
+    arguments.push_back(nullptr);
+    for (int i = 0; i < options_.num_workers; ++i) {
+      pid_t worker_process;
+      const int result =
+          posix_spawn(&worker_process, arguments[0], nullptr, nullptr,
+                      arguments.data(), environ);
+      if (result != 0) {
+        LOG(ERROR) << "Could not start " << arguments[0] << ": "
+                   << std::strerror(result);
+        return false;
+      }
+      worker_processes_.push_back(worker_process);
+    }
+  }
+
+  while (static_cast<int>(worker_sockets_.size()) < options_.num_workers) {
+    pollfd listen_poll_fd = {listen_socket_, POLLIN, 0};
+    const int result = poll(&listen_poll_fd, 1, kConnectTimeout);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) {
+      LOG(ERROR) << "Only " << worker_sockets_.size() << " of "
+                 << options_.num_workers << " workers connected to "
+                 << options_.socket_path;
+      return false;
+    }
+    const int worker_socket = accept4(listen_socket_, nullptr, nullptr,
+                                      SOCK_CLOEXEC);
+    if (worker_socket < 0) {
+      LOG(ERROR) << "Could not accept a worker: " << std::strerror(errno);
+      return false;
+    }
+    worker_sockets_.push_back(worker_socket);
+    worker_poll_fds_.push_back({worker_socket, POLLIN, 0});
+    HelloMessage hello;
+    if (!ReceiveHeader(worker_socket, MessageType::kHello, sizeof(hello)) ||
+        !ReadAll(worker_socket, &hello, sizeof(hello))) {
+      LOG(ERROR) << "A worker disconnected before rendering.";
+      return false;
+    }
+    if (hello.tile_width != options_.tile_width() ||
+        hello.tile_height != options_.tile_height()) {
+      LOG(ERROR) << "A worker renders tiles of " << hello.tile_width << "x"
+                 << hello.tile_height << " pixels instead of "
+                 << options_.tile_width() << "x" << options_.tile_height();
+      return false;
+    }
+  }
+  return true;
+}
+
+void DistributedRenderer::AssignTiles() {
+  // The order of the ties is fixed so the assignment is deterministic.
+  std::sort(tile_order_.begin(), tile_order_.end(),
+            [this](const int tile1, const int tile2) {
+              if (tile_costs_[tile1] != tile_costs_[tile2]) {
+                return tile_costs_[tile1] > tile_costs_[tile2];
+              }
+              return tile1 < tile2;
+            });
+  std::fill(worker_loads_.begin(), worker_loads_.end(), 0.0f);
+  for (const int tile_index : tile_order_) {
+    const int worker_index =
+        std::min_element(worker_loads_.begin(), worker_loads_.end()) -
+        worker_loads_.begin();
+    tile_workers_[tile_index] = worker_index;
+    worker_loads_[worker_index] += tile_costs_[tile_index];
+  }
+}
+
+bool DistributedRenderer::RenderFrame(
+    const Camera& camera,
+    const std::vector<ModelPose>& model_poses) {
+  WVU_PROFILE_ZONE("DistributedRenderer::RenderFrame");
+  CHECK_EQ(static_cast<int>(worker_sockets_.size()), options_.num_workers)
+      << "ConnectWorkers() must succeed before rendering.";
+  AssignTiles();
+
+  // Every worker gets the camera, the scene and its tiles.
+  FrameMessage frame;
+  Eigen::Map<Eigen::Vector3f>(frame.camera_position) = camera.position();
+  Eigen::Map<Eigen::Vector4f>(frame.camera_orientation) =
+      camera.orientation().coeffs();
+  frame.field_of_view = camera.field_of_view();
+  frame.aspect_ratio = camera.aspect_ratio();
+  frame.near_plane = camera.near_plane();
+  frame.far_plane = camera.far_plane();
+  frame.depth_mode = static_cast<int32_t>(camera.depth_mode());
+  frame.num_models = model_poses.size();
+  const Eigen::Vector2f image_size(options_.width, options_.height);
+  const Eigen::Vector2f tile_size(options_.tile_width(),
+                                  options_.tile_height());
+  for (int worker_index = 0; worker_index < options_.num_workers;
+       ++worker_index) {
+    frame.num_tiles = std::count(tile_workers_.begin(), tile_workers_.end(),
+                                 worker_index);
+    message_.clear();
+    AppendToMessage(frame, &message_);
+    for (const ModelPose& model_pose : model_poses) {
+      ModelPoseMessage model_pose_message;
+      Eigen::Map<Eigen::Vector3f>(model_pose_message.position) =
+          model_pose.position;
+      Eigen::Map<Eigen::Vector3f>(model_pose_message.orientation) =
+          model_pose.orientation;
+      AppendToMessage(model_pose_message, &message_);
+    }
+    for (int tile_index = 0; tile_index < num_tiles(); ++tile_index) {
+      if (tile_workers_[tile_index] != worker_index) continue;
+      // The tiles on the right and top edges extend past the frame.
+      const Eigen::Vector2f tile_min =
+          Eigen::Vector2f(tile_index % options_.num_tiles_x,
+                          tile_index / options_.num_tiles_x)
+              .cwiseProduct(tile_size);
+      TileAssignment tile;
+      tile.tile_index = tile_index;
+      Eigen::Map<Eigen::Vector2f>(tile.region_min) =
+          tile_min.cwiseQuotient(image_size);
+      Eigen::Map<Eigen::Vector2f>(tile.region_max) =
+          (tile_min + tile_size).cwiseQuotient(image_size);
+      AppendToMessage(tile, &message_);
+    }
+    if (!SendMessage(worker_sockets_[worker_index], MessageType::kFrame,
+                     message_.data(), message_.size())) {
+      LOG(ERROR) << "Could not send a frame to worker " << worker_index;
+      return false;
+    }
+  }
+
+  // The tiles are composited in the order they are finished.
+  int num_pending_tiles = num_tiles();
+  while (num_pending_tiles > 0) {
+    const int result =
+        poll(worker_poll_fds_.data(), worker_poll_fds_.size(), kTileTimeout);
+    if (result < 0 && errno == EINTR) continue;
+    if (result <= 0) {
+      LOG(ERROR) << "Timed out waiting for " << num_pending_tiles
+                 << " tiles.";
+      return false;
+    }
+    for (int worker_index = 0; worker_index < options_.num_workers;
+         ++worker_index) {
+      if (worker_poll_fds_[worker_index].revents == 0) continue;
+      if (!ReceiveTile(worker_index)) {
+        LOG(ERROR) << "Could not receive a tile from worker "
+                   << worker_index;
+        return false;
+      }
+      --num_pending_tiles;
+    }
+  }
+  return true;
+}
+
+bool DistributedRenderer::ReceiveTile(const int worker_index) {
+  WVU_PROFILE_ZONE("DistributedRenderer::ReceiveTile");
+  const int worker_socket = worker_sockets_[worker_index];
+  TileMessage tile;
+  if (!ReceiveHeader(worker_socket, MessageType::kTile,
+                     sizeof(tile) + tile_pixels_.size()) ||
+      !ReadAll(worker_socket, &tile, sizeof(tile)) ||
+      tile.tile_index < 0 || tile.tile_index >= num_tiles() ||
+      tile_workers_[tile.tile_index] != worker_index ||
+      !ReadAll(worker_socket, tile_pixels_.data(), tile_pixels_.size())) {
+    return false;
+  }
+  float& tile_cost = tile_costs_[tile.tile_index];
+  tile_cost += options_.cost_smoothing * (tile.render_time - tile_cost);
+
+  // Copies the rows of the tile inside the frame.
+  const int tile_width = options_.tile_width();
+  const int tile_height = options_.tile_height();
+  const int first_column = (tile.tile_index % options_.num_tiles_x) *
+                           tile_width;
+  const int first_row = (tile.tile_index / options_.num_tiles_x) * tile_height;
+  const int num_columns = std::min(tile_width, options_.width - first_column);
+  const int num_rows = std::min(tile_height, options_.height - first_row);
+  for (int row = 0; row < num_rows; ++row) {
+    std::memcpy(color_buffer_.data() +
+                    (static_cast<size_t>(first_row + row) * options_.width +
+                     first_column) * kNumChannels,
+                tile_pixels_.data() +
+                    static_cast<size_t>(row) * tile_width * kNumChannels,
+                num_columns * kNumChannels);
+  }
+  return true;
+}
+
+void DistributedRenderer::DisconnectWorkers() {
+  for (const int worker_socket : worker_sockets_) {
+    SendMessage(worker_socket, MessageType::kShutdown, nullptr, 0);
+    close(worker_socket);
+  }
+  worker_sockets_.clear();
+  worker_poll_fds_.clear();
+}
+
+bool RunDistributedWorker(const std::string& socket_path,
+                          const int tile_width,
+                          const int tile_height,
+                          const SetModelPosesFunction& set_model_poses,
+                          const RenderTileFunction& render_tile) {
+  sockaddr_un address;
+  if (!GetSocketAddress(socket_path, &address)) return false;
+  const int coordinator_socket =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (coordinator_socket < 0) {
+    LOG(ERROR) << "Could not create a socket: " << std::strerror(errno);
+    return false;
+  }
+  // The coordinator may not listen yet when the worker is started by hand.
+  int num_attempts = 0;
+  while (connect(coordinator_socket,
+                 reinterpret_cast<const sockaddr*>(&address),
+                 sizeof(address)) != 0) {
+    if (++num_attempts == kNumConnectAttempts) {
+      LOG(ERROR) << "Could not connect to " << socket_path << ": "
+                 << std::strerror(errno);
+      close(coordinator_socket);
+      return false;
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(kConnectRetryInterval));
+  }
+
+  const HelloMessage hello = {tile_width, tile_height};
+  bool shut_down = false;
+  bool succeeded =
+      SendMessage(coordinator_socket, MessageType::kHello, &hello,
+                  sizeof(hello));
+  std::vector<uint8_t> message;
+  std::vector<ModelPose> model_poses;
+  std::vector<uint8_t> tile_message(
+      sizeof(TileMessage) +
+      static_cast<size_t>(tile_width) * tile_height * kNumChannels);
+  Camera camera;
+  while (succeeded && !shut_down) {
+    MessageHeader header;
+    if (!ReadAll(coordinator_socket, &header, sizeof(header))) {
+      LOG(ERROR) << "The coordinator disconnected.";
+      succeeded = false;
+      break;
+    }
+    if (header.type == MessageType::kShutdown) {
+      shut_down = true;
+      break;
+    }
+    message.resize(header.size);
+    FrameMessage frame;
+    if (header.type != MessageType::kFrame || header.size < sizeof(frame) ||
+        !ReadAll(coordinator_socket, message.data(), message.size())) {
+      LOG(ERROR) << "Invalid message from the coordinator.";
+      succeeded = false;
+      break;
+    }
+    std::memcpy(&frame, message.data(), sizeof(frame));
+    const size_t expected_size = sizeof(frame) +
+                                 frame.num_models * sizeof(ModelPoseMessage) +
+                                 frame.num_tiles * sizeof(TileAssignment);
+    if (frame.num_models < 0 || frame.num_tiles < 0 ||
+        header.size != expected_size) {
+      LOG(ERROR) << "Invalid frame from the coordinator.";
+      succeeded = false;
+      break;
+    }
+    const uint8_t* payload = message.data() + sizeof(frame);
+    model_poses.resize(frame.num_models);
+    for (ModelPose& model_pose : model_poses) {
+      ModelPoseMessage model_pose_message;
+      std::memcpy(&model_pose_message, payload, sizeof(model_pose_message));
+      payload += sizeof(model_pose_message);
+      model_pose.position =
+          Eigen::Map<const Eigen::Vector3f>(model_pose_message.position);
+      model_pose.orientation =
+          Eigen::Map<const Eigen::Vector3f>(model_pose_message.orientation);
+    }
+    set_model_poses(model_poses);
+    camera.SetPose(Eigen::Map<const Eigen::Vector3f>(frame.camera_position),
+                   Eigen::Quaternionf(Eigen::Map<const Eigen::Vector4f>(
+                       frame.camera_orientation)));
+    camera.SetPerspective(frame.field_of_view, frame.aspect_ratio,
+                          frame.near_plane, frame.far_plane);
+    camera.set_depth_mode(static_cast<DepthMode>(frame.depth_mode));
+
+    for (int i = 0; i < frame.num_tiles && succeeded; ++i) {
+      WVU_PROFILE_ZONE("RenderDistributedTile");
+      TileAssignment tile;
+      std::memcpy(&tile, payload + i * sizeof(tile), sizeof(tile));
+      camera.SetImageRegion(Eigen::AlignedBox2f(
+          Eigen::Map<const Eigen::Vector2f>(tile.region_min),
+          Eigen::Map<const Eigen::Vector2f>(tile.region_max)));
+      const auto start_time = std::chrono::steady_clock::now();
+      uint8_t* tile_pixels = tile_message.data() + sizeof(TileMessage);
+      if (!render_tile(camera, tile_pixels)) {
+        LOG(ERROR) << "Could not render the tile " << tile.tile_index;
+        succeeded = false;
+        break;
+      }
+      TileMessage tile_header;
+      tile_header.tile_index = tile.tile_index;
+      tile_header.render_time =
+          std::chrono::duration<float, std::milli>(
+              std::chrono::steady_clock::now() - start_time).count();
+      std::memcpy(tile_message.data(), &tile_header, sizeof(tile_header));
+      succeeded = SendMessage(coordinator_socket, MessageType::kTile,
+                              tile_message.data(), tile_message.size());
+    }
+  }
+  close(coordinator_socket);
+  return succeeded && shut_down;
+}
+
+}  // namespace wvu
@@ -0,0 +1,173 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef DISTRIBUTED_RENDERER_H_
+#define DISTRIBUTED_RENDERER_H_
+
+#include <poll.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "camera_utils.h"
+#include "tiled_image_renderer.h"
+
+namespace wvu {
+// The pose of a model of the scene, as sent to the workers every frame.
+struct ModelPose {
+  Eigen::Vector3f position;
+  Eigen::Vector3f orientation;
+};
+
+// Options of a distributed renderer.
+struct DistributedRendererOptions {
+  // Dimensions of the frame in pixels.
+  int width = 0;
+  int height = 0;
+  // The frame is split into num_tiles_x x num_tiles_y tiles. There should be
+  // a few tiles per worker so the tiles can be balanced between them.
+  int num_tiles_x = 4;
+  int num_tiles_y = 4;
+  int num_workers = 0;
+  // Path of the Unix domain socket the workers connect to.
+  std::string socket_path;
+  // The command line of a worker process, whose first argument is the
+  // executable. It must make the worker connect to socket_path with
+  // RunDistributedWorker() and render tiles of tile_width() x tile_height()
+  // pixels. If empty, the workers are started by other means.
+  std::vector<std::string> worker_command;
+  // Weight of the last frame in the running average of the cost of a tile.
+  float cost_smoothing = 0.5f;
+
+  int tile_width() const { return (width + num_tiles_x - 1) / num_tiles_x; }
+  int tile_height() const { return (height + num_tiles_y - 1) / num_tiles_y; }
+};
+
+// Renders frames sort-first across worker processes on the same machine.
+// The frame is split into screen tiles, each rendered by a worker with an
+// off-axis projection of the camera (see Camera::SetImageRegion()). Every
+// frame, the coordinator sends the camera, the model poses and the tiles
+// assigned to every worker over a Unix domain socket, then composites the
+// tiles as the workers return them.
+//
+// The tiles are balanced dynamically: the workers report how long every tile
+// took, and the next frame assigns the most expensive tiles first, each to
+// the least loaded worker (longest processing time first scheduling).
+class DistributedRenderer {
+ public:
+  // Creates the socket. See is_valid().
+  explicit DistributedRenderer(const DistributedRendererOptions& options);
+  // Shuts the workers down and waits for the processes it started.
+  ~DistributedRenderer();
+
+  DistributedRenderer(const DistributedRenderer&) = delete;
+  DistributedRenderer& operator=(const DistributedRenderer&) = delete;
+
+  // Returns false if the socket could not be created.
+  bool is_valid() const { return listen_socket_ >= 0; }
+
+  // Starts the worker processes, if any, and waits until every worker has
+  // connected. Returns true upon success.
+  bool ConnectWorkers();
+
+  // Renders a frame with the workers into color_buffer(). Returns false if a
+  // worker failed or disconnected.
+  // Params:
+  //   camera  The camera of the whole frame.
+  //   model_poses  The pose of every model of the scene.
+  bool RenderFrame(const Camera& camera,
+                   const std::vector<ModelPose>& model_poses);
+
+  // The last frame, RGBA and bottom row first as read by glReadPixels().
+  const uint8_t* color_buffer() const { return color_buffer_.data(); }
+  int width() const { return options_.width; }
+  int height() const { return options_.height; }
+  int num_tiles() const { return tile_costs_.size(); }
+  // The estimated cost of every tile in milliseconds, from the previous
+  // frames.
+  const std::vector<float>& tile_costs() const { return tile_costs_; }
+  // The estimated time of every worker in the last frame, in milliseconds.
+  const std::vector<float>& worker_loads() const { return worker_loads_; }
+
+ private:
+  // Assigns the tiles to the workers by decreasing cost.
+  void AssignTiles();
+  // Receives a tile from a worker and copies it into the color buffer.
+  bool ReceiveTile(const int worker_index);
+  void DisconnectWorkers();
+
+  const DistributedRendererOptions options_;
+  int listen_socket_;
+  std::vector<int> worker_sockets_;
+  std::vector<pollfd> worker_poll_fds_;
+  std::vector<pid_t> worker_processes_;
+  std::vector<uint8_t> color_buffer_;
+  std::vector<uint8_t> tile_pixels_;
+  std::vector<float> tile_costs_;
+  std::vector<float> worker_loads_;
+  // The tiles sorted by decreasing cost, and the worker of every tile.
+  std::vector<int> tile_order_;
+  std::vector<int> tile_workers_;
+  // Buffer of the messages to the workers.
+  std::vector<uint8_t> message_;
+};
+
+// Updates the scene of a worker with the poses of the models.
+using SetModelPosesFunction =
+    std::function<void(const std::vector<ModelPose>& model_poses)>;
+
+// Runs a worker of a DistributedRenderer: connects to its socket and renders
+// the tiles it is assigned every frame until the coordinator shuts it down.
+// Returns true if the worker was shut down, false upon failure.
+// Params:
+//   socket_path  The socket of the coordinator.
+//   tile_width  Width of the tiles, i.e., DistributedRendererOptions::
+//     tile_width().
+//   tile_height  Height of the tiles.
+//   set_model_poses  Updates the scene before the tiles of a frame.
+//   render_tile  Renders a tile.
+bool RunDistributedWorker(const std::string& socket_path,
+                          const int tile_width,
+                          const int tile_height,
+                          const SetModelPosesFunction& set_model_poses,
+                          const RenderTileFunction& render_tile);
+
+}  // namespace wvu
+
+#endif  // DISTRIBUTED_RENDERER_H_
@@ -7,9 +7,20 @@
 // Include first C-Headers.
 #define _USE_MATH_DEFINES  // For using M_PI.
 #include <cmath>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
 // Include second C++-Headers.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 // Include library headers.
@@ -26,21 +37,41 @@
 // OpenGL implementation uses are not available.
 #define GLEW_STATIC
 #include <GL/glew.h>
-// The header of GLFW. This library is a C-based and light-weight library for
-// creating windows for OpenGL rendering.
-// See http://www.glfw.org/ for more information.
-#include <GLFW/glfw3.h>
-
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 // Include system headers.
-#include "shader_program.h"
+#include "allocation_hooks.h"
+#include "allocation_profiler.h"
 #include "camera_utils.h"
+#include "cpu_profiler.h"
+#include "distributed_renderer.h"
+#include "file_watcher.h"
+#include "frame_capture.h"
+#include "frame_arena.h"
+#include "frame_statistics.h"
+#include "gl_state_cache.h"
+#include "gpu_driven_renderer.h"
+#include "gpu_occlusion_culler.h"
+#include "gpu_profiler.h"
+#include "gpu_program.h"
+#include "gpu_resources.h"
 #include "model.h"
+#include "model_utils.h"
+#include "occlusion_culler.h"
+#include "ray_tracer.h"
+#include "render_context.h"
+#include "resource_registry.h"
+#include "scene_bvh.h"
+#include "shader_permutations.h"
+#include "software_rasterizer.h"
+#include "streaming_buffer.h"
+#include "thread_pool.h"
+#include "tiled_image_renderer.h"
 #include "transformations.h"
+#include "uniform_block.h"
 
 
 // Google flags.
@@ -54,6 +85,15 @@ DEFINE_string(vertex_shader_filepath, "vertex_shader.glsl",
               "Filepath of the vertex shader.");
 DEFINE_string(fragment_shader_filepath, "fragment_shader.glsl",
               "Filepath of the fragment shader.");
+DEFINE_string(shader_cache_directory, "",
+              "Directory where the linked shader programs are cached, so "
+              "later runs skip the compilation. Empty disables the cache.");
+DEFINE_string(shader_usage_filepath, "",
+              "File recording the shader variants the scene used. Its "
+              "variants are compiled at startup, and it is rewritten at "
+              "exit. Empty compiles the variants of the scene materials.");
+DEFINE_bool(hot_reload, false,
+            "Reloads the shaders and the textures when their files change.");
 DEFINE_string(texture1_filepath, "texture1.jpg",
               "Filepath of the texture.");
 DEFINE_string(texture2_filepath, "texture2.jpg",
@@ -62,13 +102,180 @@ DEFINE_string(texture3_filepath, "texture3.jpg",
               "Filepath of the texture.");
 DEFINE_string(texture4_filepath, "texture4.jpg",
               "Filepath of the texture.");
+DEFINE_int32(texture_memory_budget_mb, 0,
+             "Budget of the textures in the GPU, in MiB. The textures over "
+             "it are reloaded at lower resolutions. Zero disables the "
+             "budget.");
+DEFINE_bool(memory_report, false,
+            "Logs the memory of the buffers, textures and vertex copies of "
+            "the scene at exit. SIGUSR1 logs it at any time.");
+DEFINE_bool(headless, false,
+            "Renders offscreen without a window, e.g., on machines without a "
+            "display server or a GPU.");
+DEFINE_int32(num_frames, 0,
+             "Number of frames to render before exiting. Zero renders until "
+             "the window is closed. Headless runs render 100 frames by "
+             "default.");
+DEFINE_bool(check_frame_allocations, false,
+            "Logs the frames of the steady-state loop that heap allocate.");
+DEFINE_string(allocation_profile_filepath, "",
+              "If set, profiles the heap allocations of the start-up and of "
+              "every frame, and writes the report as JSON to this file.");
+DEFINE_int32(allocation_sampling_interval, 64,
+             "Records the call stack of 1 in N allocations when profiling.");
+DEFINE_int32(allocation_profile_max_frames, 4096,
+             "Number of latest frames listed in the heap allocation report. "
+             "Older frames only count towards the totals.");
+DEFINE_string(trace_filepath, "",
+              "If set, records CPU profiling zones and writes them to this "
+              "file in the Chrome trace format (chrome://tracing, Perfetto).");
+DEFINE_int32(trace_first_frame, 0,
+             "First frame traced. Frame 0 also traces the start-up.");
+DEFINE_int32(trace_num_frames, 100, "Number of frames traced.");
+DEFINE_bool(frame_stats, false,
+            "Measures the GPU time of every pass with timer queries and logs "
+            "rolling frame statistics.");
+DEFINE_int32(frame_stats_interval, 120,
+             "Number of frames between two frame statistics reports.");
+// The frame index is taken modulo the interval and the number of retained
+// allocation frames, so both must be positive.
+static bool ValidatePositiveFlag(const char* flag_name, const int32_t value) {
+  if (value > 0) return true;
+  std::cerr << "--" << flag_name << " must be positive." << std::endl;
+  return false;
+}
+static const bool frame_stats_interval_validator_registered =
+    GLUTILS_GFLAGS_NAMESPACE::RegisterFlagValidator(
+        &FLAGS_frame_stats_interval, &ValidatePositiveFlag);
+static const bool allocation_profile_max_frames_validator_registered =
+    GLUTILS_GFLAGS_NAMESPACE::RegisterFlagValidator(
+        &FLAGS_allocation_profile_max_frames, &ValidatePositiveFlag);
+DEFINE_string(frame_stats_filepath, "",
+              "If set, writes the frame statistics as JSON to this file at "
+              "every report. Implies --frame_stats.");
+DEFINE_int32(window_width, 640, "Width of the window or framebuffer.");
+DEFINE_int32(window_height, 480, "Height of the window or framebuffer.");
+DEFINE_string(capture_filepath, "",
+              "If set, writes every frame to disk. The extension selects the "
+              "format: .png and .ppm take a printf pattern of the frame "
+              "number (e.g., frame_%05d.png), .y4m writes a single video.");
+DEFINE_int32(capture_encoder_threads, 0,
+             "Number of threads encoding captured frames. Zero uses one "
+             "thread per core.");
+DEFINE_bool(software_rasterizer, false,
+            "Renders the scene on the CPU and copies the frames to the "
+            "window, e.g., on machines without a GPU.");
+DEFINE_int32(software_rasterizer_threads, 0,
+             "Number of threads of the software rasterizer besides the render "
+             "thread. Zero uses one per core.");
+DEFINE_bool(occlusion_culling, false,
+            "Skips the models hidden behind the occluders of the scene, the "
+            "pyramid and the ground, which are rasterized into a "
+            "low-resolution depth buffer on the CPU every frame.");
+DEFINE_int32(occlusion_buffer_width, 256,
+             "Width of the depth buffer of the occlusion culling.");
+DEFINE_int32(occlusion_buffer_height, 128,
+             "Height of the depth buffer of the occlusion culling.");
+DEFINE_int32(occlusion_culling_threads, 0,
+             "Number of threads rasterizing the occluders besides the render "
+             "thread. Zero uses one per core.");
+DEFINE_bool(occlusion_queries, false,
+            "Skips the models hidden in the last frame with hardware "
+            "occlusion queries on their bounding boxes and conditional "
+            "rendering. Only applies to the OpenGL renderer.");
+DEFINE_bool(gpu_culling, false,
+            "Culls the models on the GPU against the view frustum and a "
+            "hierarchical depth buffer of the last frame, and draws them "
+            "with indirect multi-draws. Requires OpenGL 4.3 and takes "
+            "precedence over the other culling flags.");
+DEFINE_string(depth_mode, "standard",
+              "Depth mode of the projection: standard, or reverse_z, which "
+              "maps the near plane to 1 and the far plane to 0 with "
+              "glClipControl(). Reverse-Z requires OpenGL 4.5 or "
+              "ARB_clip_control and is best paired with --float_depth.");
+DEFINE_bool(infinite_far_plane, false,
+            "Uses a projection without a far plane, so nothing is clipped in "
+            "the distance.");
+DEFINE_bool(float_depth, false,
+            "Renders with a 32-bit floating point depth buffer.");
+DEFINE_double(near_plane, 0.1, "Distance to the near plane of the camera.");
+DEFINE_double(far_plane, 10.0,
+              "Distance to the far plane of the camera. Ignored with "
+              "--infinite_far_plane.");
+DEFINE_bool(ray_tracer, false,
+            "Renders the scene with the CPU ray tracer and copies the frames "
+            "to the window. Takes precedence over --software_rasterizer.");
+DEFINE_int32(ray_tracer_threads, 0,
+             "Number of threads of the ray tracer besides the render thread. "
+             "Zero uses one per core.");
+DEFINE_string(poster_filepath, "",
+              "Renders a single image of --poster_width x --poster_height "
+              "pixels in tiles of the size of the framebuffer, writes it to "
+              "this PNG file and exits.");
+DEFINE_int32(poster_width, 8192, "Width of the poster in pixels.");
+DEFINE_int32(poster_height, 8192, "Height of the poster in pixels.");
+DEFINE_int32(distributed_workers, 0,
+             "Renders the frames with this many worker processes, each "
+             "drawing screen tiles with the backend selected by the other "
+             "flags. Zero renders in this process.");
+DEFINE_int32(distributed_tiles_x, 4,
+             "Number of tiles across the frame of the distributed renderer.");
+DEFINE_int32(distributed_tiles_y, 4,
+             "Number of tiles down the frame of the distributed renderer.");
+DEFINE_string(distributed_socket_path, "",
+              "Unix domain socket the workers connect to. Defaults to "
+              "/tmp/draw_scene_<pid>.sock.");
+DEFINE_string(distributed_worker_socket, "",
+              "Runs as a worker of the distributed renderer listening on this "
+              "socket. Set by the coordinator when it starts the workers.");
 // Annonymous namespace for constants and helper functions.
 namespace {
 using wvu::Model;
 
-// Window dimensions.
-constexpr int kWindowWidth = 640;
-constexpr int kWindowHeight = 480;
+// Number of frames a headless run renders unless --num_frames says otherwise.
+constexpr int kDefaultNumHeadlessFrames = 100;
+
+// Number of frames before the frame loop reaches a steady state, i.e., before
+// the frame arena and the driver have grown their buffers.
+constexpr int kNumWarmUpFrames = 3;
+
+// Number of frames the rolling frame statistics are computed over.
+constexpr int kFrameStatisticsWindowSize = 600;
+
+// The features of the scene shaders select between sampling the texture of a
+// model and passing its vertex colors through (see wvu::ShaderPermutations).
+enum SceneShaderFeature : uint32_t {
+  kTexturedShaderFeature = 1 << 0,
+};
+const std::vector<std::string> kSceneShaderFeatureNames = {"TEXTURED"};
+
+// The data of the scene shaders that changes once per frame. It is written
+// into the uniform stream once per frame.
+struct SceneUniforms {
+  Eigen::Matrix4f view;
+  Eigen::Matrix4f projection;
+};
+WVU_UNIFORM_BLOCK(SceneUniforms, kStd140, view, projection);
+
+// The data of the scene shaders that changes with every draw. The blocks of
+// all the draws of a frame are written into the uniform stream up front, and
+// each draw binds the range of its own.
+struct DrawUniforms {
+  Eigen::Matrix4f model;
+};
+WVU_UNIFORM_BLOCK(DrawUniforms, kStd140, model);
+
+// The GL_UNIFORM_BUFFER binding points of the blocks.
+constexpr GLuint kSceneUniformsBinding = 0;
+constexpr GLuint kDrawUniformsBinding = 1;
+
+// Number of frames the GPU may read the uniform stream behind the CPU.
+constexpr int kNumUniformStreamFrames = 3;
+
+// The transformations shared by the stages of the scene shaders.
+const std::string scene_transforms_src =
+    wvu::UniformBlock<SceneUniforms>::Declaration() +
+    wvu::UniformBlock<DrawUniforms>::Declaration();
 
 // GLSL shaders.
 // Every shader should declare its version.
@@ -83,18 +290,22 @@ constexpr int kWindowHeight = 480;
     const std::string vertex_shader_src =
             "#version 330 core\n"
                     "layout (location = 0) in vec3 position;\n"
-                    "layout (location = 0) in vec3 passed_color;\n"
+                    "#ifdef TEXTURED\n"
                     "layout (location = 0) in vec2 passed_texel;\n"
-                    "uniform mat4 model;\n"
-                    "uniform mat4 view;\n"
-                    "uniform mat4 projection;\n"
-                    "\n"
-                    "out vec4 vertex_color;\n"
                     "out vec2 texel;\n"
+                    "#else\n"
+                    "layout (location = 0) in vec3 passed_color;\n"
+                    "out vec4 vertex_color;\n"
+                    "#endif\n"
+                    "#include \"scene_transforms.glsl\"\n"
+                    "\n"
                     "void main() {\n"
                     "gl_Position = projection * view * model * vec4(position, 1.0f);\n"
-                    "vertex_color = vec4(passed_color, 1.0f);\n"
+                    "#ifdef TEXTURED\n"
                     "texel = passed_texel;\n"
+                    "#else\n"
+                    "vertex_color = vec4(passed_color, 1.0f);\n"
+                    "#endif\n"
                     "}\n";
 
 // Fragment shader follows standard 3.3.0. The goal of the fragment shader is to
@@ -103,97 +314,105 @@ constexpr int kWindowHeight = 480;
 // shader sets the output color to a (1.0, 0.5, 0.2, 1.0) using an RGBA format.
 const std::string fragment_shader_src =
       "#version 330 core\n"
-     "in vec4 vertex_color;\n"
     "out vec4 color;\n"
+    "#ifdef TEXTURED\n"
     "in vec2 texel;\n"
-
     "uniform sampler2D texture_sampler;\n"
+    "#else\n"
+     "in vec4 vertex_color;\n"
+    "#endif\n"
                     "void main() {\n"
+                    "#ifdef TEXTURED\n"
                     "color = texture(texture_sampler, texel);\n"
+                    "#else\n"
+                    "color = vertex_color;\n"
+                    "#endif\n"
                     "}\n";
 
-// Error callback function. This function follows the required signature of
-// GLFW. See http://www.glfw.org/docs/3.0/group__error.html for more
-// information.
-static void ErrorCallback(int error, const char* description) {
-  std::cerr << "ERROR: " << description << std::endl;
-}
-
-// Key callback. This function follows the required signature of GLFW. See
-// http://www.glfw.org/docs/latest/input_guide.html fore more information.
-static void KeyCallback(GLFWwindow* window,
-                        int key,
-                        int scancode,
-                        int action,
-                        int mods) {
-  if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-    glfwSetWindowShouldClose(window, GL_TRUE);
-  }
-}
-
-// Configures glfw.
-void SetWindowHints() {
-  // Sets properties of windows and have to be set before creation.
-  // GLFW_CONTEXT_VERSION_{MAJOR|MINOR} sets the minimum OpenGL API version
-  // that this program will use.
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-  // Sets the OpenGL profile.
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  // Sets the property of resizability of a window.
-  glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-}
-
-
-
 // Configures the view port.
 // Note: All the OpenGL functions begin with gl, and all the GLFW functions
 // begin with glfw. This is because they are C-functions -- C does not have
 // namespaces.
-void ConfigureViewPort(GLFWwindow* window) {
-  int width;
-  int height;
-  // We get the frame buffer dimensions and store them in width and height.
-  glfwGetFramebufferSize(window, &width, &height);
-  // Tells OpenGL the dimensions of the window and we specify the coordinates
-  // of the lower left corner.
-  glViewport(0, 0, width, height);
+void ConfigureViewPort(const wvu::RenderContext& context) {
+  // Tells OpenGL the dimensions of the frame buffer and we specify the
+  // coordinates of the lower left corner.
+  glViewport(0, 0, context.width(), context.height());
 }
 
-// Clears the frame buffer.
-    void ClearTheFrameBuffer() {
+// Clears the frame buffer, and sets the depth test of the depth mode: the
+// farthest depth is 1 in the standard mode and 0 in reverse-Z.
+    void ClearTheFrameBuffer(const wvu::DepthMode depth_mode) {
         // Sets the initial color of the framebuffer in the RGBA, R = Red, G = Green,
         // B = Blue, and A = alpha.
-        glEnable(GL_DEPTH_TEST);
+        wvu::GlStateCache& state_cache = wvu::ThreadGlStateCache();
+        state_cache.SetCapability(GL_DEPTH_TEST, true);
+        const bool reverse_z = depth_mode == wvu::DepthMode::kReverseZ;
+        state_cache.SetDepthFunc(reverse_z ? GL_GREATER : GL_LESS);
+        glClearDepth(reverse_z ? 0.0 : 1.0);
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         // Tells OpenGL to clear the Color buffer.
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     }
-    bool CreateShaderProgram(wvu::ShaderProgram* shader_program) {
-        if (shader_program == nullptr) return false;
-        shader_program->LoadVertexShaderFromString(vertex_shader_src);
-        shader_program->LoadFragmentShaderFromString(fragment_shader_src);
-        std::string error_info_log;
-        if (!shader_program->Create(&error_info_log)) {
-            std::cout << "ERROR: " << error_info_log << "\n";
-        }
-        if (!shader_program->shader_program_id()) {
-            std::cerr << "ERROR: Could not create a shader program.\n";
-            return false;
-        }
-        return true;
-    }
-    GLuint LoadTexture(const std::string& texture_filepath) {
+// Reads the source of a shader from a file, or returns the embedded source if
+// the file cannot be read.
+std::string LoadShaderSource(const std::string& filepath,
+                             const std::string& embedded_source) {
+  std::ifstream file(filepath);
+  if (!file) return embedded_source;
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+    // A texture decoded in the interleaved layout OpenGL expects.
+    struct DecodedTexture {
+        int width = 0;
+        int height = 0;
         cimg_library::CImg<unsigned char> image;
-        image.load(texture_filepath.c_str());
-        const int width = image.width();
-        const int height = image.height();
+    };
+    DecodedTexture DecodeTexture(const std::string& texture_filepath) {
+        WVU_PROFILE_ZONE("DecodeTexture");
+        DecodedTexture texture;
+        texture.image.load(texture_filepath.c_str());
+        texture.width = texture.image.width();
+        texture.height = texture.image.height();
         // OpenGL expects to have the pixel values interleaved (e.g., RGBD, ...). CImg
         // flatens out the planes. To have them interleaved, CImg has to re-arrange
         // the values.
         // Also, OpenGL has the y-axis of the texture flipped.
-        image.permute_axes("cxyz");
+        texture.image.permute_axes("cxyz");
+        return texture;
+    }
+    // Sends a decoded texture to the GPU. A texture of the same size is
+    // updated in place, so reloading it does not reallocate its storage.
+    void UploadTexture(const DecodedTexture& texture, const GLuint texture_id) {
+        WVU_PROFILE_ZONE("UploadTexture");
+        glBindTexture(GL_TEXTURE_2D, texture_id);
+        GLint width = 0;
+        GLint height = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        // The RGB rows are tightly packed, so their width need not be a
+        // multiple of the default alignment of 4 bytes.
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (width > 0 && width == texture.width && height == texture.height) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB,
+                            GL_UNSIGNED_BYTE, texture.image.data());
+        } else {
+            /// Sending the texture information to the GPU.
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture.width,
+                         texture.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                         texture.image.data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        // Generate a mipmap.
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    // Loads a texture into a new texture object owned by the pool.
+    wvu::GpuResource LoadTexture(wvu::GpuResourcePool* pool,
+                                 const std::string& texture_filepath) {
+        WVU_PROFILE_ZONE("LoadTexture");
+        const DecodedTexture texture = DecodeTexture(texture_filepath);
         GLuint texture_id;
         glGenTextures(1, &texture_id);
         glBindTexture(GL_TEXTURE_2D, texture_id);
@@ -203,73 +422,646 @@ void ConfigureViewPort(GLFWwindow* window) {
         // Define the interpolation behavior for this texture.
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        /// Sending the texture information to the GPU.
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-                     0, GL_RGB, GL_UNSIGNED_BYTE, image.data());
-        // Generate a mipmap.
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        return texture_id;
+        UploadTexture(texture, texture_id);
+        return wvu::GpuResource(pool, wvu::GpuResourceType::kTexture,
+                                texture_id);
+    }
+// Loads a texture for the software rasterizer. The rows are kept in the
+// order LoadTexture() sends them to OpenGL.
+wvu::SoftwareTexture LoadSoftwareTexture(const std::string& texture_filepath) {
+  WVU_PROFILE_ZONE("LoadSoftwareTexture");
+  cimg_library::CImg<unsigned char> image;
+  image.load(texture_filepath.c_str());
+  wvu::SoftwareTexture texture;
+  texture.width = image.width();
+  texture.height = image.height();
+  texture.texels.resize(4 * texture.width * texture.height);
+  for (int y = 0; y < texture.height; ++y) {
+    for (int x = 0; x < texture.width; ++x) {
+      unsigned char* texel = &texture.texels[4 * (y * texture.width + x)];
+      // Grayscale images repeat their only channel.
+      for (int channel = 0; channel < 3; ++channel) {
+        texel[channel] =
+            image(x, y, 0, std::min(channel, image.spectrum() - 1));
+      }
+      texel[3] = 255;
+    }
+  }
+  return texture;
+}
+
+// Number of textures of the scene (see GetTextureIndex()).
+constexpr int kNumTextures = 4;
+
+// Number of resources listed by the memory report.
+constexpr int kNumReportedResources = 10;
+
+// Set by SIGUSR1 to log the memory report at the end of the frame.
+volatile std::sig_atomic_t memory_report_requested = 0;
+
+void RequestMemoryReport(int) { memory_report_requested = 1; }
+
+// Returns the filepath of the texture at the given index.
+const std::string& GetTextureFilepath(const int texture_index) {
+  const std::string* const texture_filepaths[] = {
+      &FLAGS_texture1_filepath, &FLAGS_texture2_filepath,
+      &FLAGS_texture3_filepath, &FLAGS_texture4_filepath};
+  return *texture_filepaths[texture_index];
+}
+
+// Records the memory of a texture of the scene, which UploadTexture() stores
+// as RGB texels with a full mip chain.
+wvu::ResourceRecord RecordTextureMemory(wvu::ResourceRegistry* registry,
+                                        const std::string& filepath,
+                                        const GLuint texture_id) {
+  glBindTexture(GL_TEXTURE_2D, texture_id);
+  GLint width = 0;
+  GLint height = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  wvu::ResourceInfo info;
+  info.name = filepath;
+  info.category = "textures";
+  info.domain = wvu::MemoryDomain::kGpu;
+  info.format = GL_RGB8;
+  info.width = width;
+  info.height = height;
+  info.num_mip_levels = wvu::CountMipLevels(width, height);
+  info.num_bytes =
+      wvu::ComputeTextureBytes(width, height, 3, info.num_mip_levels);
+  return wvu::ResourceRecord(registry, info);
+}
+
+// Halves the resolution of the largest textures of the scene until they free
+// num_bytes. This is the eviction function of the texture budget.
+// Params:
+//   num_bytes  The bytes to free.
+//   texture_ids  The kNumTextures textures of the scene.
+//   registry  The registry of the memory of the scene.
+//   texture_memory  The records of the kNumTextures textures.
+void ShrinkTextures(const uint64_t num_bytes,
+                    const GLuint* texture_ids,
+                    wvu::ResourceRegistry* registry,
+                    wvu::ResourceRecord* texture_memory) {
+  const uint64_t initial_num_bytes = registry->category_num_bytes("textures");
+  while (initial_num_bytes - registry->category_num_bytes("textures") <
+         num_bytes) {
+    int largest_texture = -1;
+    GLint largest_width = 0;
+    GLint largest_height = 0;
+    for (int i = 0; i < kNumTextures; ++i) {
+      GLint width = 0;
+      GLint height = 0;
+      glBindTexture(GL_TEXTURE_2D, texture_ids[i]);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+      if (width * height > largest_width * largest_height) {
+        largest_texture = i;
+        largest_width = width;
+        largest_height = height;
+      }
     }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (largest_texture < 0 || largest_width * largest_height <= 1) return;
+    const std::string& filepath = GetTextureFilepath(largest_texture);
+    DecodedTexture texture = DecodeTexture(filepath);
+    if (texture.width == 0) return;
+    texture.width = std::max(largest_width / 2, 1);
+    texture.height = std::max(largest_height / 2, 1);
+    // The axes are permuted to channels, x, y. Averages the texels.
+    texture.image.resize(-100, texture.width, texture.height, -100, 2);
+    UploadTexture(texture, texture_ids[largest_texture]);
+    texture_memory[largest_texture] = RecordTextureMemory(
+        registry, filepath, texture_ids[largest_texture]);
+    LOG(INFO) << "Reduced texture " << largest_texture + 1 << " to "
+              << texture.width << "x" << texture.height
+              << " to fit the texture budget.";
+  }
+}
+
+// The assets the file watcher thread reloaded, waiting for the frame loop to
+// swap them in at the start of the next frame.
+struct ReloadedAssets {
+  std::mutex mutex;
+  bool has_shader_sources = false;
+  wvu::ProgramSources shader_sources;
+  // The changed textures by index. The textures of the software renderers
+  // are loaded instead of the ones of OpenGL when they are in use.
+  std::unique_ptr<DecodedTexture> textures[kNumTextures];
+  std::unique_ptr<wvu::SoftwareTexture> software_textures[kNumTextures];
+};
+
+// Reads the changed shaders or decodes the changed texture. Runs in the file
+// watcher thread, so the frame loop only uploads the results.
+// Params:
+//   filepath  The changed file.
+//   software_textures  Whether the scene is rendered with software textures.
+//   assets  The assets waiting to be swapped in.
+void ReloadChangedFile(const std::string& filepath,
+                       const bool software_textures,
+                       ReloadedAssets* assets) {
+  if (filepath == FLAGS_vertex_shader_filepath ||
+      filepath == FLAGS_fragment_shader_filepath) {
+    wvu::ProgramSources shader_sources;
+    shader_sources.vertex =
+        LoadShaderSource(FLAGS_vertex_shader_filepath, vertex_shader_src);
+    shader_sources.fragment =
+        LoadShaderSource(FLAGS_fragment_shader_filepath, fragment_shader_src);
+    std::lock_guard<std::mutex> lock(assets->mutex);
+    assets->shader_sources = std::move(shader_sources);
+    assets->has_shader_sources = true;
+  }
+  for (int i = 0; i < kNumTextures; ++i) {
+    if (filepath != GetTextureFilepath(i)) continue;
+    if (software_textures) {
+      std::unique_ptr<wvu::SoftwareTexture> texture(
+          new wvu::SoftwareTexture(LoadSoftwareTexture(filepath)));
+      std::lock_guard<std::mutex> lock(assets->mutex);
+      assets->software_textures[i] = std::move(texture);
+    } else {
+      std::unique_ptr<DecodedTexture> texture(
+          new DecodedTexture(DecodeTexture(filepath)));
+      std::lock_guard<std::mutex> lock(assets->mutex);
+      assets->textures[i] = std::move(texture);
+    }
+  }
+}
+
+// Swaps in the assets reloaded since the last frame: uploads the textures,
+// starts recompiling the shaders, and replaces the shader variants once the
+// driver has compiled all of them. Must be called between frames.
+// Params:
+//   assets  The assets waiting to be swapped in.
+//   scene_shaders  The shaders of the scene.
+//   texture_ids  The kNumTextures textures of the scene.
+//   registry  The registry of the memory of the scene.
+//   texture_memory  The records of the kNumTextures textures.
+//   software_textures  The textures of the software renderers, if in use.
+void SwapReloadedAssets(ReloadedAssets* assets,
+                        wvu::ShaderPermutations* scene_shaders,
+                        const GLuint* texture_ids,
+                        wvu::ResourceRegistry* registry,
+                        wvu::ResourceRecord* texture_memory,
+                        std::vector<wvu::SoftwareTexture>* software_textures) {
+  bool has_shader_sources = false;
+  wvu::ProgramSources shader_sources;
+  std::unique_ptr<DecodedTexture> textures[kNumTextures];
+  std::unique_ptr<wvu::SoftwareTexture> reloaded_software_textures[kNumTextures];
+  {
+    std::lock_guard<std::mutex> lock(assets->mutex);
+    if (assets->has_shader_sources) {
+      has_shader_sources = true;
+      shader_sources = std::move(assets->shader_sources);
+      assets->has_shader_sources = false;
+    }
+    for (int i = 0; i < kNumTextures; ++i) {
+      textures[i] = std::move(assets->textures[i]);
+      reloaded_software_textures[i] = std::move(assets->software_textures[i]);
+    }
+  }
+  if (has_shader_sources) {
+    LOG(INFO) << "Recompiling the shaders.";
+    scene_shaders->BeginReload(shader_sources);
+  }
+  for (int i = 0; i < kNumTextures; ++i) {
+    if (textures[i] != nullptr) {
+      LOG(INFO) << "Reloaded texture " << i + 1 << ".";
+      UploadTexture(*textures[i], texture_ids[i]);
+      texture_memory[i] =
+          RecordTextureMemory(registry, GetTextureFilepath(i), texture_ids[i]);
+    }
+    if (reloaded_software_textures[i] != nullptr &&
+        i < static_cast<int>(software_textures->size())) {
+      LOG(INFO) << "Reloaded texture " << i + 1 << ".";
+      (*software_textures)[i] = std::move(*reloaded_software_textures[i]);
+    }
+  }
+  if (scene_shaders->SwapReloadedVariants()) {
+    LOG(INFO) << "Reloaded the shaders.";
+  }
+}
+// A model to draw in the current frame along with its model matrix and the
+// index (0 to 3) of its texture. The draw list of a frame lives in the frame
+// arena.
+struct DrawItem {
+  const Model* model;
+  Eigen::Matrix4f model_matrix;
+  int texture_index;
+  // The features of the variant of the scene shaders the material needs.
+  uint32_t shader_features;
+  // The offset of the DrawUniforms of the item in the uniform stream.
+  GLintptr draw_uniforms_offset;
+};
+
+// Animates the model at the given index of the scene (see ConstructModels())
+// by a frame.
+void AnimateModel(const int model_index, Model* model) {
+  if (model_index == 0) {
+    // The pyramid rotates around the y-axis.
+    model->set_orientation(model->orientation() +
+                           Eigen::Vector3f(0.0f, 0.0002f, 0.0f));
+  } else if (model_index == 2) {
+    // The sky rotates around the z-axis.
+    model->set_orientation(model->orientation() +
+                           Eigen::Vector3f(0.0f, 0.0f, 0.001f));
+  } else if (model_index >= 3 && model_index <= 8) {
+    // The cacti slide to the left. The ground is static.
+    model->set_position(model->position() -
+                        Eigen::Vector3f(0.0002f, 0.0f, 0.0f));
+  }
+}
+
+// Animates the models of the scene by a frame.
+void AnimateScene(std::vector<Model*>* models_to_draw) {
+  WVU_PROFILE_ZONE("AnimateScene");
+  const int num_models = models_to_draw->size();
+  for (int i = 0; i < num_models; ++i) {
+    AnimateModel(i, (*models_to_draw)[i]);
+  }
+}
+
+// Returns the index (0 to 3) of the texture the model at the given index of
+// the scene is drawn with, or -1 if the model is not drawn.
+int GetTextureIndex(const int model_index) {
+  if (model_index == 0) return 0;
+  if (model_index == 1) return 2;
+  if (model_index == 2) return 1;
+  if (model_index <= 8) return 3;
+  return -1;
+}
+
+// Returns the features of the cheapest scene shader that draws a material with
+// the texture of the given index, or with vertex colors if it is negative.
+uint32_t GetShaderFeatures(const int texture_index) {
+  return texture_index >= 0 ? kTexturedShaderFeature : 0u;
+}
+
+// Collects the draw list of the current frame. The models are placed as the
+// instances of the scene BVH, whose meshes are the models in the same order,
+// and its top level is rebuilt. The draw list and the instances are in the
+// same order. Returns the number of items of the draw list.
+// Params:
+//   models_to_draw  The models of the scene.
+//   thread_pool  The threads building the top level. May be null.
+//   scene_bvh  The scene BVH.
+//   draw_items  The draw list, allocated in the frame arena.
+int BuildDrawList(const std::vector<Model*>& models_to_draw,
+                  wvu::ThreadPool* thread_pool,
+                  wvu::SceneBvh* scene_bvh,
+                  DrawItem** draw_items) {
+  WVU_PROFILE_ZONE("BuildDrawList");
+  // The draw list and the model matrices are transient, so they go in the
+  // frame arena to keep the frame loop free of heap allocations.
+  const int num_models = models_to_draw.size();
+  *draw_items = wvu::ThreadFrameArena().AllocateArray<DrawItem>(num_models);
+  scene_bvh->ClearInstances();
+  int num_draw_items = 0;
+  for (int i = 0; i < num_models; ++i) {
+    const int texture_index = GetTextureIndex(i);
+    if (texture_index < 0) continue;
+    DrawItem& draw_item = (*draw_items)[num_draw_items];
+    draw_item.model = models_to_draw[i];
+    draw_item.texture_index = texture_index;
+    draw_item.shader_features = GetShaderFeatures(texture_index);
+    draw_item.model_matrix = wvu::ComputeModelMatrix4f(*draw_item.model);
+    scene_bvh->AddInstance(i, draw_item.model_matrix);
+    ++num_draw_items;
+  }
+  scene_bvh->BuildTopLevel(thread_pool);
+  return num_draw_items;
+}
+
+// Returns true if the model at the given index of the scene (see
+// ConstructModels()) hides other models, i.e., if it is rendered into the
+// depth buffer of the occlusion culling.
+bool IsOccluder(const int model_index) {
+  // The pyramid and the ground.
+  return model_index == 0 || model_index == 1;
+}
+
+// Parses the name of a depth mode. Returns false and logs an error if the name
+// is unknown.
+bool ParseDepthMode(const std::string& name, wvu::DepthMode* depth_mode) {
+  if (name == "standard") {
+    *depth_mode = wvu::DepthMode::kStandard;
+  } else if (name == "reverse_z") {
+    *depth_mode = wvu::DepthMode::kReverseZ;
+  } else {
+    LOG(ERROR) << "Unknown depth mode: " << name;
+    return false;
+  }
+  return true;
+}
+
+// Finds the items of the draw list inside the view frustum and, if there is
+// an occlusion culler, not hidden by the occluders. Returns the number of
+// visible items, whose indices are allocated in the frame arena.
+// Params:
+//   camera  The camera.
+//   scene_bvh  The scene BVH as built by BuildDrawList().
+//   occlusion_culler  The occlusion culler. May be null.
+//   visible_items  The indices of the visible items of the draw list.
+int CullScene(const wvu::Camera& camera,
+              const wvu::SceneBvh& scene_bvh,
+              wvu::OcclusionCuller* occlusion_culler,
+              int** visible_items) {
+  WVU_PROFILE_ZONE("CullScene");
+  *visible_items =
+      wvu::ThreadFrameArena().AllocateArray<int>(scene_bvh.num_instances());
+  const int num_visible_items =
+      scene_bvh.CullFrustum(camera, *visible_items);
+  if (occlusion_culler == nullptr) return num_visible_items;
+
+  // The occluders in view are rasterized, then the bounds of the other
+  // models are tested against them. The culler expects the clip space of the
+  // standard depth mode.
+  occlusion_culler->BeginFrame(camera.standard_view_projection());
+  for (int i = 0; i < num_visible_items; ++i) {
+    const int instance_index = (*visible_items)[i];
+    const int mesh_index = scene_bvh.instance_mesh(instance_index);
+    if (IsOccluder(mesh_index)) {
+      occlusion_culler->AddOccluder(
+          scene_bvh.instance_model_matrix(instance_index),
+          &scene_bvh.mesh_vertices(mesh_index));
+    }
+  }
+  occlusion_culler->RenderOccluders();
+  int num_unoccluded_items = 0;
+  for (int i = 0; i < num_visible_items; ++i) {
+    const int instance_index = (*visible_items)[i];
+    if (IsOccluder(scene_bvh.instance_mesh(instance_index)) ||
+        !occlusion_culler->IsOccluded(
+            scene_bvh.instance_bounds(instance_index))) {
+      (*visible_items)[num_unoccluded_items++] = instance_index;
+    }
+  }
+  wvu::CountOccludedObjects(num_visible_items - num_unoccluded_items);
+  return num_unoccluded_items;
+}
+
+// Returns the alignment of the uniform blocks in the uniform stream: the one
+// glBindBufferRange() requires, raised to the alignment of the Eigen matrices
+// the CPU writes into them.
+GLsizeiptr GetUniformBlockAlignment(const GLsizeiptr uniform_alignment) {
+  return std::max<GLsizeiptr>(
+      {uniform_alignment, alignof(SceneUniforms), alignof(DrawUniforms)});
+}
+
+// Returns the bytes of the uniform stream that a frame of RenderScene() needs
+// to draw the given number of models.
+GLsizeiptr ComputeUniformStreamCapacity(const int num_models) {
+  const GLsizeiptr alignment =
+      GetUniformBlockAlignment(wvu::StreamingBuffer::UniformAlignment());
+  const GLsizeiptr block_size =
+      std::max(sizeof(SceneUniforms), sizeof(DrawUniforms));
+  const GLsizeiptr aligned_block_size =
+      (block_size + alignment - 1) / alignment * alignment;
+  // One block more for the SceneUniforms and the padding of the region start.
+  return (num_models + 1) * aligned_block_size + alignment;
+}
+
+// Writes the uniform blocks of a frame into the uniform stream and binds the
+// SceneUniforms. The CPU writes straight into the buffer the GPU reads, so the
+// frame neither maps nor copies a buffer.
+// Params:
+//   camera  The camera of the frame.
+//   num_draw_items  The number of items of the draw list.
+//   draw_items  The draw list. Receives the offsets of the DrawUniforms.
+//   uniform_stream  The uniform stream, sized by
+//     ComputeUniformStreamCapacity().
+void WriteSceneUniforms(const wvu::Camera& camera,
+                        const int num_draw_items,
+                        DrawItem* draw_items,
+                        wvu::StreamingBuffer* uniform_stream) {
+  WVU_PROFILE_ZONE("WriteSceneUniforms");
+  uniform_stream->BeginFrame();
+  const GLsizeiptr alignment =
+      GetUniformBlockAlignment(uniform_stream->uniform_alignment());
+  GLintptr scene_uniforms_offset;
+  SceneUniforms* scene_uniforms =
+      static_cast<SceneUniforms*>(uniform_stream->Allocate(
+          sizeof(SceneUniforms), alignment, &scene_uniforms_offset));
+  CHECK(scene_uniforms != nullptr) << "The uniform stream is full.";
+  scene_uniforms->view = camera.view();
+  scene_uniforms->projection = camera.projection();
+  for (int i = 0; i < num_draw_items; ++i) {
+    DrawUniforms* draw_uniforms =
+        static_cast<DrawUniforms*>(uniform_stream->Allocate(
+            sizeof(DrawUniforms), alignment,
+            &draw_items[i].draw_uniforms_offset));
+    CHECK(draw_uniforms != nullptr) << "The uniform stream is full.";
+    draw_uniforms->model = draw_items[i].model_matrix;
+  }
+  uniform_stream->Flush();
+  glBindBufferRange(GL_UNIFORM_BUFFER, kSceneUniformsBinding,
+                    uniform_stream->buffer_id(), scene_uniforms_offset,
+                    sizeof(SceneUniforms));
+  wvu::CountStateChanges(1);
+}
+
 // Renders the scene.
-void RenderScene(const wvu::ShaderProgram& shader_program,
-                     const Eigen::Matrix4f& projection,
-                     const Eigen::Matrix4f& view,
-                     std::vector<Model*>* models_to_draw,
-                     const GLuint texture_id1,
-                     const GLuint texture_id2,
-                     const GLuint texture_id3,
-                     const GLuint texture_id4,
-                     GLFWwindow* window) {
+void RenderScene(wvu::ShaderPermutations* scene_shaders,
+                 wvu::StreamingBuffer* uniform_stream,
+                 const wvu::Camera& camera,
+                 const std::vector<Model*>& models_to_draw,
+                 const GLuint texture_id1,
+                 const GLuint texture_id2,
+                 const GLuint texture_id3,
+                 const GLuint texture_id4,
+                 wvu::SceneBvh* scene_bvh,
+                 wvu::OcclusionCuller* occlusion_culler,
+                 wvu::GpuOcclusionCuller* gpu_occlusion_culler,
+                 wvu::GpuDrivenRenderer* gpu_driven_renderer,
+                 wvu::GpuProfiler* gpu_profiler) {
+  WVU_PROFILE_ZONE("RenderScene");
+  // The state may have changed since the last frame, e.g., by the frame
+  // capture or by uploading a texture.
+  wvu::GlStateCache& state_cache = wvu::ThreadGlStateCache();
+  state_cache.Invalidate();
   // Clear the buffer.
-  ClearTheFrameBuffer();
-  // Let OpenGL know that we want to use our shader program.
-  shader_program.Use();
+  {
+    const wvu::ScopedGpuPass clear_pass(gpu_profiler, "Clear");
+    ClearTheFrameBuffer(camera.depth_mode());
+  }
   // Render the models in a wireframe mode.
-  glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  // Draw the models.
- 
-  // TODO: For every model in models_to_draw, call its Draw() method, passing
-    
-
-    Eigen::Vector3f rotate = (*models_to_draw)[2]->orientation();
-
-    for(std::vector<Model*>::iterator it = models_to_draw->begin(); it != models_to_draw->end(); ++it) 
+  state_cache.SetPolygonMode(GL_LINE);
+
+  DrawItem* draw_items;
+  const int num_draw_items =
+      BuildDrawList(models_to_draw, nullptr, scene_bvh, &draw_items);
+  const GLuint texture_ids[] = {texture_id1, texture_id2, texture_id3,
+                                texture_id4};
+  // Draws an item with the variant of the scene shaders its material needs.
+  // The state cache switches programs only when the variant changes.
+  const auto draw = [&](const DrawItem& draw_item) {
+    const wvu::GpuProgram* program =
+        scene_shaders->GetProgram(draw_item.shader_features);
+    if (program == nullptr) return;
+    // Let OpenGL know that we want to use this shader program.
+    state_cache.UseProgram(program->program_id());
+    glBindBufferRange(GL_UNIFORM_BUFFER, kDrawUniformsBinding,
+                      uniform_stream->buffer_id(),
+                      draw_item.draw_uniforms_offset,
+                      wvu::UniformBlock<DrawUniforms>::kSize);
+    wvu::CountStateChanges(1);
+    const GLuint texture_id =
+        draw_item.texture_index >= 0 ? texture_ids[draw_item.texture_index]
+                                     : 0;
+    wvu::DrawModel(texture_id, *draw_item.model);
+  };
+  if (gpu_driven_renderer != nullptr) {
+    // Every model goes to the GPU, which culls and draws them.
+    gpu_driven_renderer->BeginFrame();
+    for (int i = 0; i < num_draw_items; ++i) {
+      gpu_driven_renderer->AddInstance(
+          scene_bvh->instance_mesh(i), draw_items[i].model_matrix,
+          scene_bvh->instance_bounds(i), draw_items[i].texture_index);
+    }
     {
-    if((*it) == (*models_to_draw)[2]){
-    (*it)->set_orientation(Eigen::Vector3f(rotate[0],rotate[1],rotate[2]+0.001));
-    (*it)->Draw(shader_program,projection,view,texture_id2);
+      const wvu::ScopedGpuPass cull_pass(gpu_profiler, "Cull");
+      gpu_driven_renderer->Cull(camera.view_projection());
     }
-     if((*it) == (*models_to_draw)[1]){
-    (*it)->Draw(shader_program,projection,view,texture_id3);
+    const wvu::ScopedGpuPass draw_pass(gpu_profiler, "Draw");
+    gpu_driven_renderer->Draw(camera.projection(), camera.view(),
+                              texture_ids);
+    return;
+  }
+  WriteSceneUniforms(camera, num_draw_items, draw_items, uniform_stream);
+  int* visible_items;
+  const int num_visible_items =
+      CullScene(camera, *scene_bvh, occlusion_culler, &visible_items);
+
+  // Draw the models.
+  const wvu::ScopedGpuPass draw_pass(gpu_profiler, "Draw");
+  if (gpu_occlusion_culler == nullptr) {
+    for (int i = 0; i < num_visible_items; ++i) {
+      draw(draw_items[visible_items[i]]);
+    }
+  } else {
+    // The models visible in the last frame fill the depth buffer, then the
+    // others are drawn only if their bounding boxes pass its depth test.
+    gpu_occlusion_culler->BeginFrame();
+    int* hidden_items =
+        wvu::ThreadFrameArena().AllocateArray<int>(num_visible_items);
+    int num_hidden_items = 0;
+    for (int i = 0; i < num_visible_items; ++i) {
+      const int item_index = visible_items[i];
+      if (!gpu_occlusion_culler->IsVisible(item_index)) {
+        hidden_items[num_hidden_items++] = item_index;
+        continue;
+      }
+      gpu_occlusion_culler->BeginQuery(item_index);
+      draw(draw_items[item_index]);
+      gpu_occlusion_culler->EndQuery();
     }
-     if((*it) == (*models_to_draw)[3] 
-      or (*it) == (*models_to_draw)[4] 
-      or (*it) == (*models_to_draw)[5]
-      or (*it) == (*models_to_draw)[6]
-      or (*it) == (*models_to_draw)[7]
-      or (*it) == (*models_to_draw)[8]){
-    Eigen::Vector3f pos = (*it)->position();
-    (*it)->set_position(Eigen::Vector3f(pos[0]-.0002,pos[1],pos[2]));
-    (*it)->Draw(shader_program,projection,view,texture_id4);
+    if (num_hidden_items > 0) {
+      gpu_occlusion_culler->BeginBoundingBoxes(camera.view_projection());
+      for (int i = 0; i < num_hidden_items; ++i) {
+        gpu_occlusion_culler->DrawBoundingBox(
+            hidden_items[i], scene_bvh->instance_bounds(hidden_items[i]));
+      }
+      gpu_occlusion_culler->EndBoundingBoxes();
+      // The bounding boxes replaced the program and the polygon mode.
+      state_cache.Invalidate();
+      state_cache.SetPolygonMode(GL_LINE);
+      for (int i = 0; i < num_hidden_items; ++i) {
+        gpu_occlusion_culler->BeginConditionalRender(hidden_items[i]);
+        draw(draw_items[hidden_items[i]]);
+        gpu_occlusion_culler->EndConditionalRender();
+      }
     }
-     if((*it) == (*models_to_draw)[0]){
-    Eigen::Vector3f rot = (*it)->orientation();
-    (*it)->set_orientation(Eigen::Vector3f(rot[0],rot[1]+.0002,rot[2]));
-    (*it)->Draw(shader_program,projection,view,texture_id1);
+    wvu::CountOccludedObjects(num_hidden_items);
   }
 
+  // Let OpenGL know that we are done with our vertex array object.
+  state_cache.BindVertexArray(0);
+  state_cache.BindTexture2D(0, 0);
+  uniform_stream->EndFrame();
+}
+
+// Renders the scene with the software rasterizer.
+void RenderSceneInSoftware(const wvu::Camera& camera,
+                           const std::vector<Model*>& models_to_draw,
+                           const wvu::SoftwareTexture* textures,
+                           wvu::ThreadPool* thread_pool,
+                           wvu::SceneBvh* scene_bvh,
+                           wvu::OcclusionCuller* occlusion_culler,
+                           wvu::SoftwareRasterizer* rasterizer) {
+  WVU_PROFILE_ZONE("RenderSceneInSoftware");
+  DrawItem* draw_items;
+  BuildDrawList(models_to_draw, thread_pool, scene_bvh, &draw_items);
+  int* visible_items;
+  const int num_visible_items =
+      CullScene(camera, *scene_bvh, occlusion_culler, &visible_items);
+  rasterizer->Clear(Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
+  for (int i = 0; i < num_visible_items; ++i) {
+    const DrawItem& draw_item = draw_items[visible_items[i]];
+    rasterizer->DrawModel(camera, draw_item.model_matrix,
+                          &textures[draw_item.texture_index],
+                          *draw_item.model);
   }
-  // the view and projection matrices.
+  rasterizer->Flush();
+  wvu::CountDrawCall(rasterizer->stats().num_triangles);
+}
 
+// Renders the scene with the ray tracer. Only the top level of the scene BVH
+// is rebuilt every frame; the BVHs of the models do not change.
+void RenderSceneWithRayTracer(const wvu::Camera& camera,
+                              const std::vector<Model*>& models_to_draw,
+                              const wvu::SoftwareTexture* textures,
+                              wvu::ThreadPool* thread_pool,
+                              wvu::SceneBvh* scene_bvh,
+                              wvu::RayTracer* ray_tracer) {
+  WVU_PROFILE_ZONE("RenderSceneWithRayTracer");
+  DrawItem* draw_items;
+  const int num_draw_items =
+      BuildDrawList(models_to_draw, thread_pool, scene_bvh, &draw_items);
+  const wvu::SoftwareTexture** instance_textures =
+      wvu::ThreadFrameArena().AllocateArray<const wvu::SoftwareTexture*>(
+          num_draw_items);
+  int num_triangles = 0;
+  for (int i = 0; i < num_draw_items; ++i) {
+    instance_textures[i] = &textures[draw_items[i].texture_index];
+    num_triangles +=
+        scene_bvh->mesh_bvh(scene_bvh->instance_mesh(i)).num_triangles();
+  }
+  ray_tracer->Render(*scene_bvh, instance_textures, camera,
+                     Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
+  wvu::CountDrawCall(num_triangles);
+}
 
-  // Let OpenGL know that we are done with our vertex array object.
-  glBindVertexArray(0);
+// Copies an image rendered on the CPU to the framebuffer of the context
+// through a texture attached to a framebuffer object.
+// Params:
+//   color_buffer  The RGBA image, bottom row first.
+//   width  Width of the image.
+//   height  Height of the image.
+//   texture_id  The texture the image is uploaded to.
+//   read_framebuffer_id  The framebuffer object of the texture.
+//   framebuffer_id  The framebuffer of the context.
+void PresentSoftwareFrame(const uint8_t* color_buffer,
+                          const int width,
+                          const int height,
+                          const GLuint texture_id,
+                          const GLuint read_framebuffer_id,
+                          const GLuint framebuffer_id) {
+  WVU_PROFILE_ZONE("PresentSoftwareFrame");
+  glBindTexture(GL_TEXTURE_2D, texture_id);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+                  GL_UNSIGNED_BYTE, color_buffer);
   glBindTexture(GL_TEXTURE_2D, 0);
-
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer_id);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer_id);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);
+  wvu::CountStateChanges(4);
 }
 
 void ConstructModels(std::vector<Model*>* models_to_draw) {
+  WVU_PROFILE_ZONE("ConstructModels");
   // TODO: Prepare your models here.
   // 1. Construct models by setting their vertices and poses.
   // 2. Create your models in the heap and add the pointers to models_to_draw.
@@ -422,107 +1214,638 @@ float rightPos = 0.09;
   // }
 }
 
-void DeleteModels(std::vector<Model*>* models_to_draw) {
-  // TODO: Implement me!
+// Starts recording CPU profiling zones if the frame is the first one traced.
+void BeginTracedFrame(const int frame_index) {
+  if (!FLAGS_trace_filepath.empty() &&
+      frame_index == FLAGS_trace_first_frame) {
+    wvu::SetCpuProfilingEnabled(true);
+  }
+}
+
+// Writes the trace if the frame is the last one traced.
+void EndTracedFrame(const int frame_index) {
+  if (!FLAGS_trace_filepath.empty() &&
+      frame_index == FLAGS_trace_first_frame + FLAGS_trace_num_frames - 1) {
+    wvu::SetCpuProfilingEnabled(false);
+    wvu::WriteChromeTrace(FLAGS_trace_filepath);
+  }
+}
+
+// Takes ownership of the models of the scene and of their OpenGL objects,
+// and records their memory.
+std::vector<wvu::GpuModel> OwnModels(wvu::GpuResourcePool* pool,
+                                     wvu::ResourceRegistry* registry,
+                                     const std::vector<Model*>& models) {
+  std::vector<wvu::GpuModel> owned_models;
+  owned_models.reserve(models.size());
+  for (int i = 0; i < static_cast<int>(models.size()); ++i) {
+    owned_models.emplace_back(pool, registry, "model " + std::to_string(i),
+                              std::unique_ptr<Model>(models[i]));
+  }
+  return owned_models;
+}
+
+// Deletes the models of the scene. Their OpenGL objects are deleted once the
+// GPU finishes the frames that draw them.
+void DeleteModels(std::vector<wvu::GpuModel>* scene_models,
+                  std::vector<Model*>* models_to_draw) {
   models_to_draw->clear();
-  // Call delete on each models to draw.
+  scene_models->clear();
 }
 
 }  // namespace
 
 int main(int argc, char** argv) {
-  // Initialize the GLFW library.
+  // The workers of the distributed renderer get the same flags.
+  const std::vector<std::string> command_line(argv, argv + argc);
   GLUTILS_GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
-  if (!glfwInit()) {
-    return -1;
-  }
-
-
-
-  // Setting Window hints.
-  SetWindowHints();
-
-  // Create a window and its OpenGL context.
-  const std::string window_name = "Assignment 4";
-  GLFWwindow* window = glfwCreateWindow(kWindowWidth,
-                                        kWindowHeight,
-                                        window_name.c_str(),
-                                        nullptr,
-                                        nullptr);
-  if (!window) {
-    glfwTerminate();
-    return -1;
+  wvu::SetProfilerThreadName("Main");
+  if (FLAGS_trace_first_frame == 0) BeginTracedFrame(0);
+  wvu::ProfileZone startup_zone("Startup");
+  std::unique_ptr<wvu::AllocationProfiler> allocation_profiler;
+  if (!FLAGS_allocation_profile_filepath.empty()) {
+    allocation_profiler.reset(
+        new wvu::AllocationProfiler(FLAGS_allocation_sampling_interval,
+                                    FLAGS_allocation_profile_max_frames));
   }
 
-  // Make the window's context current.
-  glfwMakeContextCurrent(window);
-  glfwSwapInterval(1);
-  glfwSetKeyCallback(window, KeyCallback);
-
-  // Initialize GLEW.
-  glewExperimental = GL_TRUE;
-  if (glewInit() != GLEW_OK) {
-    std::cerr << "Glew did not initialize properly!" << std::endl;
-    glfwTerminate();
+  // Create a window (or an offscreen framebuffer) and its OpenGL context.
+  wvu::RenderContextOptions context_options;
+  context_options.width = FLAGS_window_width;
+  context_options.height = FLAGS_window_height;
+  context_options.window_name = "Assignment 4";
+  context_options.headless = FLAGS_headless;
+  context_options.float_depth = FLAGS_float_depth;
+  std::unique_ptr<wvu::RenderContext> context =
+      wvu::CreateRenderContext(context_options);
+  if (context == nullptr) {
     return -1;
   }
+  const int num_frames =
+      FLAGS_num_frames == 0 && FLAGS_headless ? kDefaultNumHeadlessFrames
+                                              : FLAGS_num_frames;
 
   // Configure View Port.
-  ConfigureViewPort(window);
-
-  // Compile shaders and create shader program.
-    const std::string vertex_shader_filepath =
-            FLAGS_vertex_shader_filepath;
-    const std::string fragment_shader_filepath =
-            FLAGS_fragment_shader_filepath;
-    wvu::ShaderProgram shader_program;
-    shader_program.LoadVertexShaderFromFile(vertex_shader_filepath);
-    shader_program.LoadFragmentShaderFromFile(fragment_shader_filepath);
-  if (!CreateShaderProgram(&shader_program)) {
-    return -1;
+  ConfigureViewPort(*context);
+
+  // Accounts for the memory of the scene. It outlives the owners of the
+  // resources it records.
+  wvu::ResourceRegistry resource_registry;
+  std::signal(SIGUSR1, RequestMemoryReport);
+  // Owns the OpenGL objects of the scene and deletes them once the GPU is done
+  // with them.
+  wvu::GpuResourcePool gpu_resources;
+
+  // Compile shaders and create the shader variants. The shader files replace
+  // the embedded sources when they exist, and every variant is compiled once.
+  wvu::ProgramSources shader_sources;
+  shader_sources.vertex =
+      LoadShaderSource(FLAGS_vertex_shader_filepath, vertex_shader_src);
+  shader_sources.fragment =
+      LoadShaderSource(FLAGS_fragment_shader_filepath, fragment_shader_src);
+  std::unique_ptr<wvu::ProgramBinaryCache> program_binary_cache;
+  if (!FLAGS_shader_cache_directory.empty()) {
+    program_binary_cache.reset(
+        new wvu::ProgramBinaryCache(FLAGS_shader_cache_directory));
   }
+  wvu::ShaderPermutations scene_shaders(
+      shader_sources, kSceneShaderFeatureNames, program_binary_cache.get());
+  scene_shaders.AddInclude("scene_transforms.glsl", scene_transforms_src);
+  scene_shaders.SetUniformBlockBinding(
+      wvu::UniformBlock<SceneUniforms>::name(), kSceneUniformsBinding);
+  scene_shaders.SetUniformBlockBinding(
+      wvu::UniformBlock<DrawUniforms>::name(), kDrawUniformsBinding);
 
   // Construct the models to draw in the scene.
   std::vector<Model*> models_to_draw;
   ConstructModels(&models_to_draw);
+  std::vector<wvu::GpuModel> scene_models =
+      OwnModels(&gpu_resources, &resource_registry, models_to_draw);
+
+  // The uniform blocks of the frames, written straight into a buffer the GPU
+  // reads a few frames behind.
+  wvu::StreamingBuffer uniform_stream(
+      ComputeUniformStreamCapacity(models_to_draw.size()),
+      kNumUniformStreamFrames);
+  if (!uniform_stream.is_valid()) {
+    LOG(ERROR) << "Could not create the uniform stream.";
+    return -1;
+  }
+  wvu::ResourceInfo uniform_stream_info;
+  uniform_stream_info.name = "uniform stream";
+  uniform_stream_info.category = "streaming buffers";
+  uniform_stream_info.num_bytes =
+      uniform_stream.frame_capacity() * kNumUniformStreamFrames;
+  const wvu::ResourceRecord uniform_stream_memory(&resource_registry,
+                                                  uniform_stream_info);
+
+  // The driver compiles the variants the scene used last time, or the ones of
+  // its materials, in the background, if it can, while the textures load. The
+  // other variants are compiled when first drawn.
+  wvu::EnableParallelShaderCompile();
+  std::vector<uint32_t> shader_variants;
+  if (FLAGS_shader_usage_filepath.empty() ||
+      !scene_shaders.ReadUsageList(FLAGS_shader_usage_filepath,
+                                   &shader_variants)) {
+    for (int i = 0; i < static_cast<int>(models_to_draw.size()); ++i) {
+      const int texture_index = GetTextureIndex(i);
+      if (texture_index >= 0) {
+        shader_variants.push_back(GetShaderFeatures(texture_index));
+      }
+    }
+  }
+  scene_shaders.Prewarm(shader_variants);
 
   //textures
-  const GLuint texture_id1 = LoadTexture(FLAGS_texture1_filepath);
-  const GLuint texture_id2 = LoadTexture(FLAGS_texture2_filepath);
-  const GLuint texture_id3 = LoadTexture(FLAGS_texture3_filepath);
-  const GLuint texture_id4 = LoadTexture(FLAGS_texture4_filepath);
+  wvu::GpuResource textures[kNumTextures] = {
+      LoadTexture(&gpu_resources, FLAGS_texture1_filepath),
+      LoadTexture(&gpu_resources, FLAGS_texture2_filepath),
+      LoadTexture(&gpu_resources, FLAGS_texture3_filepath),
+      LoadTexture(&gpu_resources, FLAGS_texture4_filepath)};
+  const GLuint texture_id1 = textures[0].id();
+  const GLuint texture_id2 = textures[1].id();
+  const GLuint texture_id3 = textures[2].id();
+  const GLuint texture_id4 = textures[3].id();
+  const GLuint texture_ids[kNumTextures] = {texture_id1, texture_id2,
+                                            texture_id3, texture_id4};
+  wvu::ResourceRecord texture_memory[kNumTextures];
+  for (int i = 0; i < kNumTextures; ++i) {
+    texture_memory[i] = RecordTextureMemory(
+        &resource_registry, GetTextureFilepath(i), texture_ids[i]);
+  }
+  if (FLAGS_texture_memory_budget_mb > 0) {
+    resource_registry.SetBudget(
+        "textures",
+        static_cast<uint64_t>(FLAGS_texture_memory_budget_mb) << 20,
+        [&texture_ids, &resource_registry,
+         &texture_memory](const uint64_t num_bytes) {
+          ShrinkTextures(num_bytes, texture_ids, &resource_registry,
+                         texture_memory);
+        });
+    resource_registry.EnforceBudgets();
+  }
 
+  if (!scene_shaders.FinishPrewarm()) {
+    std::cerr << "ERROR: Could not create the shader programs.\n";
+    return -1;
+  }
+  if (program_binary_cache != nullptr &&
+      program_binary_cache->num_hits() > 0) {
+    LOG(INFO) << "Loaded " << program_binary_cache->num_hits()
+              << " shader programs from " << FLAGS_shader_cache_directory;
+  }
 
+  // The software rasterizer and the ray tracer draw in main memory, and so
+  // does the coordinator of a distributed renderer composite the tiles of its
+  // workers. Their frames reach the framebuffer of the context through a
+  // texture. The coordinator leaves the rendering to the workers.
+  const bool distributed = FLAGS_distributed_workers > 0;
+  const bool present_cpu_frames =
+      distributed || FLAGS_ray_tracer || FLAGS_software_rasterizer;
+  std::unique_ptr<wvu::ThreadPool> software_threads;
+  std::unique_ptr<wvu::SoftwareRasterizer> software_rasterizer;
+  std::unique_ptr<wvu::RayTracer> ray_tracer;
+  std::vector<wvu::SoftwareTexture> software_textures;
+  GLuint software_frame_texture_id = 0;
+  GLuint software_frame_framebuffer_id = 0;
+  if (distributed) {
+    // The workers render with the backend of the flags.
+  } else if (FLAGS_ray_tracer) {
+    software_threads.reset(
+        new wvu::ThreadPool(FLAGS_ray_tracer_threads, "RayTracer"));
+    ray_tracer.reset(new wvu::RayTracer(context->width(), context->height(),
+                                        software_threads.get()));
+  } else if (FLAGS_software_rasterizer) {
+    software_threads.reset(new wvu::ThreadPool(
+        FLAGS_software_rasterizer_threads, "Rasterizer"));
+    software_rasterizer.reset(new wvu::SoftwareRasterizer(
+        context->width(), context->height(), software_threads.get()));
+  }
+  if (software_threads != nullptr) {
+    for (const std::string& texture_filepath :
+         {FLAGS_texture1_filepath, FLAGS_texture2_filepath,
+          FLAGS_texture3_filepath, FLAGS_texture4_filepath}) {
+      software_textures.push_back(LoadSoftwareTexture(texture_filepath));
+    }
+  }
+  if (present_cpu_frames) {
+    glGenTextures(1, &software_frame_texture_id);
+    glBindTexture(GL_TEXTURE_2D, software_frame_texture_id);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, context->width(),
+                 context->height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &software_frame_framebuffer_id);
+    glBindFramebuffer(GL_FRAMEBUFFER, software_frame_framebuffer_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, software_frame_texture_id, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer_id());
+  }
+
+  // The CPU renderers only implement the standard depth mode with a far
+  // plane.
+  wvu::DepthMode depth_mode;
+  if (!ParseDepthMode(FLAGS_depth_mode, &depth_mode)) return -1;
+  bool infinite_far_plane = FLAGS_infinite_far_plane;
+  if ((FLAGS_ray_tracer || FLAGS_software_rasterizer) &&
+      (depth_mode != wvu::DepthMode::kStandard || infinite_far_plane)) {
+    LOG(WARNING) << "The CPU renderers use the standard depth mode and a far "
+                 << "plane.";
+    depth_mode = wvu::DepthMode::kStandard;
+    infinite_far_plane = false;
+  }
+  if (depth_mode == wvu::DepthMode::kReverseZ) {
+    if (!GLEW_VERSION_4_5 && !GLEW_ARB_clip_control) {
+      LOG(ERROR) << "Reverse-Z requires OpenGL 4.5 or ARB_clip_control.";
+      return -1;
+    }
+    // The depth of the clip volume is [0, w] instead of [-w, w], so the
+    // depth is not remapped to [0, 1] with a loss of precision.
+    glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+  }
+
+  // The scene BVH has a mesh per model. The frustum culling and the ray tracer
+  // query it.
+  wvu::SceneBvh scene_bvh;
+  for (const Model* model : models_to_draw) {
+    scene_bvh.AddMesh(wvu::GetTriangleVertices(*model),
+                      software_threads.get());
+  }
+  // The ray tracer does not need occlusion culling.
+  std::unique_ptr<wvu::ThreadPool> occlusion_threads;
+  std::unique_ptr<wvu::OcclusionCuller> occlusion_culler;
+  if (FLAGS_occlusion_culling && ray_tracer == nullptr) {
+    occlusion_threads.reset(new wvu::ThreadPool(
+        FLAGS_occlusion_culling_threads, "OcclusionCuller"));
+    occlusion_culler.reset(new wvu::OcclusionCuller(
+        FLAGS_occlusion_buffer_width, FLAGS_occlusion_buffer_height,
+        occlusion_threads.get()));
+  }
+  // The hardware occlusion queries have an object per instance of the scene
+  // BVH, i.e., per model.
+  std::unique_ptr<wvu::GpuOcclusionCuller> gpu_occlusion_culler;
+  if (FLAGS_occlusion_queries && !present_cpu_frames &&
+      !FLAGS_gpu_culling) {
+    gpu_occlusion_culler.reset(
+        new wvu::GpuOcclusionCuller(models_to_draw.size(), depth_mode));
+    if (!gpu_occlusion_culler->is_valid()) return -1;
+  }
+  // The GPU-driven renderer has a copy of every model in its buffers.
+  std::unique_ptr<wvu::GpuDrivenRenderer> gpu_driven_renderer;
+  if (FLAGS_gpu_culling && !present_cpu_frames) {
+    if (!wvu::GpuDrivenRenderer::IsSupported()) {
+      LOG(ERROR) << "GPU culling requires OpenGL 4.3.";
+      return -1;
+    }
+    gpu_driven_renderer.reset(new wvu::GpuDrivenRenderer(
+        context->width(), context->height(), context->depth_format(),
+        depth_mode, models_to_draw.size(), 4));
+    if (!gpu_driven_renderer->is_valid()) return -1;
+    for (const Model* model : models_to_draw) {
+      gpu_driven_renderer->AddMesh(model->vertices(), model->indices());
+    }
+  }
 
-  // Construct the camera projection matrix.
+
+  // Construct the camera at the origin. Its matrices are computed once and
+  // cached for every frame.
   const float field_of_view = wvu::ConvertDegreesToRadians(45.0f);
-  const float aspect_ratio = static_cast<float>(kWindowWidth / kWindowHeight);
-  const float near_plane = 0.1f;
-  const float far_plane = 10.0f;
-  const Eigen::Matrix4f& projection =
-  wvu::ComputePerspectiveProjectionMatrix(field_of_view, aspect_ratio,
-                                              near_plane, far_plane);
-  const Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+  const float aspect_ratio =
+      static_cast<float>(context->width()) / context->height();
+  const float near_plane = FLAGS_near_plane;
+  const float far_plane = infinite_far_plane
+                              ? std::numeric_limits<float>::infinity()
+                              : static_cast<float>(FLAGS_far_plane);
+  wvu::Camera camera;
+  camera.SetPerspective(field_of_view, aspect_ratio, near_plane, far_plane);
+  camera.set_depth_mode(depth_mode);
+  camera.Update();
+
+  if (allocation_profiler != nullptr) {
+    allocation_profiler->EndFrame("startup");
+  }
+  startup_zone.End();
+
+  // The GPU profiler feeds the frame statistics with the GPU time of every
+  // pass.
+  const bool collect_frame_statistics =
+      FLAGS_frame_stats || !FLAGS_frame_stats_filepath.empty();
+  wvu::FrameStatistics frame_statistics(kFrameStatisticsWindowSize);
+  std::unique_ptr<wvu::GpuProfiler> gpu_profiler;
+  if (collect_frame_statistics) {
+    gpu_profiler.reset(new wvu::GpuProfiler(&frame_statistics));
+  }
+  // Frames are read back asynchronously and encoded off the render thread.
+  std::unique_ptr<wvu::FrameCapture> frame_capture;
+  if (!FLAGS_capture_filepath.empty()) {
+    wvu::FrameCaptureOptions capture_options;
+    capture_options.filepath = FLAGS_capture_filepath;
+    capture_options.num_encoder_threads = FLAGS_capture_encoder_threads;
+    frame_capture.reset(new wvu::FrameCapture(capture_options,
+                                              context->width(),
+                                              context->height()));
+    if (!frame_capture->is_valid()) return -1;
+  }
+  // The frames are rendered in tiles by worker processes, which run this
+  // program headless with the same flags.
+  std::unique_ptr<wvu::DistributedRenderer> distributed_renderer;
+  std::vector<wvu::ModelPose> model_poses;
+  if (distributed) {
+    wvu::DistributedRendererOptions distributed_options;
+    distributed_options.width = context->width();
+    distributed_options.height = context->height();
+    distributed_options.num_tiles_x = FLAGS_distributed_tiles_x;
+    distributed_options.num_tiles_y = FLAGS_distributed_tiles_y;
+    distributed_options.num_workers = FLAGS_distributed_workers;
+    distributed_options.socket_path =
+        FLAGS_distributed_socket_path.empty()
+            ? "/tmp/draw_scene_" + std::to_string(getpid()) + ".sock"
+            : FLAGS_distributed_socket_path;
+    // The last occurrence of a flag wins, so the flags of the worker follow
+    // the ones of the coordinator.
+    std::vector<std::string>& worker_command =
+        distributed_options.worker_command;
+    worker_command.push_back("/proc/self/exe");
+    worker_command.insert(worker_command.end(), command_line.begin() + 1,
+                          command_line.end());
+    worker_command.insert(
+        worker_command.end(),
+        {"--headless", "--distributed_workers=0",
+         "--distributed_worker_socket=" + distributed_options.socket_path,
+         "--window_width=" + std::to_string(distributed_options.tile_width()),
+         "--window_height=" +
+             std::to_string(distributed_options.tile_height()),
+         "--capture_filepath=", "--poster_filepath=", "--trace_filepath=",
+         "--frame_stats=false", "--frame_stats_filepath=",
+         "--allocation_profile_filepath=", "--check_frame_allocations=false"});
+    distributed_renderer.reset(
+        new wvu::DistributedRenderer(distributed_options));
+    if (!distributed_renderer->is_valid() ||
+        !distributed_renderer->ConnectWorkers()) {
+      return -1;
+    }
+    model_poses.resize(models_to_draw.size());
+  }
+
+  // Posters and the workers of a distributed renderer draw tiles of the size
+  // of the framebuffer. The GPU culling is skipped since it relies on the
+  // depth of the previous frame, i.e., of another tile.
+  const size_t tile_size =
+      static_cast<size_t>(context->width()) * context->height() * 4;
+  const auto render_tile = [&](const wvu::Camera& tile_camera,
+                               uint8_t* pixels) {
+    wvu::BeginFrameArenas();
+    if (ray_tracer != nullptr) {
+      RenderSceneWithRayTracer(tile_camera, models_to_draw,
+                               software_textures.data(),
+                               software_threads.get(), &scene_bvh,
+                               ray_tracer.get());
+      std::memcpy(pixels, ray_tracer->color_buffer(), tile_size);
+    } else if (software_rasterizer != nullptr) {
+      RenderSceneInSoftware(tile_camera, models_to_draw,
+                            software_textures.data(),
+                            software_threads.get(), &scene_bvh,
+                            occlusion_culler.get(),
+                            software_rasterizer.get());
+      std::memcpy(pixels, software_rasterizer->color_buffer(), tile_size);
+    } else {
+      RenderScene(&scene_shaders, &uniform_stream, tile_camera,
+                  models_to_draw, texture_id1, texture_id2, texture_id3,
+                  texture_id4, &scene_bvh, occlusion_culler.get(), nullptr,
+                  nullptr, nullptr);
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, context->framebuffer_id());
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, context->width(), context->height(), GL_RGBA,
+                   GL_UNSIGNED_BYTE, pixels);
+    }
+    return true;
+  };
+  // A poster is rendered once, tile by tile, instead of the frames, and so
+  // are the tiles of a worker.
+  const bool render_poster = !FLAGS_poster_filepath.empty();
+  const bool run_worker = !FLAGS_distributed_worker_socket.empty();
+  bool succeeded = true;
+  if (render_poster) {
+    wvu::TiledImageOptions poster_options;
+    poster_options.width = FLAGS_poster_width;
+    poster_options.height = FLAGS_poster_height;
+    poster_options.tile_width = context->width();
+    poster_options.tile_height = context->height();
+    wvu::Camera poster_camera = camera;
+    poster_camera.SetPerspective(
+        field_of_view,
+        static_cast<float>(FLAGS_poster_width) / FLAGS_poster_height,
+        near_plane, far_plane);
+    succeeded = wvu::RenderTiledImage(poster_options, poster_camera,
+                                      render_tile, FLAGS_poster_filepath);
+    if (succeeded) {
+      LOG(INFO) << "Rendered a " << FLAGS_poster_width << "x"
+                << FLAGS_poster_height << " poster to "
+                << FLAGS_poster_filepath;
+    }
+  } else if (run_worker) {
+    const auto set_model_poses =
+        [&models_to_draw](const std::vector<wvu::ModelPose>& model_poses) {
+          const int num_models =
+              std::min(models_to_draw.size(), model_poses.size());
+          for (int i = 0; i < num_models; ++i) {
+            models_to_draw[i]->set_position(model_poses[i].position);
+            models_to_draw[i]->set_orientation(model_poses[i].orientation);
+          }
+        };
+    succeeded = wvu::RunDistributedWorker(
+        FLAGS_distributed_worker_socket, context->width(), context->height(),
+        set_model_poses, render_tile);
+  }
+
+  // The file watcher thread reads the changed shaders and decodes the changed
+  // textures, and the frame loop swaps them in.
+  ReloadedAssets reloaded_assets;
+  std::unique_ptr<wvu::FileWatcher> file_watcher;
+  if (FLAGS_hot_reload && !render_poster && !run_worker) {
+    const bool software_textures_in_use = !software_textures.empty();
+    file_watcher.reset(new wvu::FileWatcher(
+        {FLAGS_vertex_shader_filepath, FLAGS_fragment_shader_filepath,
+         FLAGS_texture1_filepath, FLAGS_texture2_filepath,
+         FLAGS_texture3_filepath, FLAGS_texture4_filepath},
+        [&reloaded_assets,
+         software_textures_in_use](const std::string& filepath) {
+          ReloadChangedFile(filepath, software_textures_in_use,
+                            &reloaded_assets);
+        }));
+    if (!file_watcher->is_valid()) file_watcher.reset();
+  }
+  auto frame_start_time = std::chrono::steady_clock::now();
 
   // Loop until the user closes the window.
-  while (!glfwWindowShouldClose(window)) {
+  int frame_index = 0;
+  while (!render_poster && !run_worker && !context->ShouldClose() &&
+         (num_frames <= 0 || frame_index < num_frames)) {
+    // The reloaded assets are swapped in between frames.
+    if (file_watcher != nullptr) {
+      SwapReloadedAssets(&reloaded_assets, &scene_shaders, texture_ids,
+                         &resource_registry, texture_memory,
+                         &software_textures);
+      // A reloaded texture may be larger than the one it replaced.
+      resource_registry.EnforceBudgets();
+    }
+    const wvu::ScopedAllocationCounter frame_allocations;
+    if (allocation_profiler != nullptr) {
+      allocation_profiler->BeginFrame();
+    }
+    BeginTracedFrame(frame_index);
+    wvu::ProfileZone frame_zone("Frame");
+    // Recycle the transient memory of the previous frame.
+    wvu::BeginFrameArenas();
+    wvu::FrameRenderCounters() = wvu::RenderCounters();
+    if (gpu_profiler != nullptr) gpu_profiler->BeginFrame();
+
     // Render the scene!
-    RenderScene(shader_program, projection, view, &models_to_draw,texture_id1,texture_id2,texture_id3,texture_id4, window);
+    AnimateScene(&models_to_draw);
+    if (distributed_renderer != nullptr) {
+      for (int i = 0; i < static_cast<int>(models_to_draw.size()); ++i) {
+        model_poses[i].position = models_to_draw[i]->position();
+        model_poses[i].orientation = models_to_draw[i]->orientation();
+      }
+      if (!distributed_renderer->RenderFrame(camera, model_poses)) {
+        succeeded = false;
+        break;
+      }
+      const wvu::ScopedGpuPass present_pass(gpu_profiler.get(), "Present");
+      PresentSoftwareFrame(distributed_renderer->color_buffer(),
+                           distributed_renderer->width(),
+                           distributed_renderer->height(),
+                           software_frame_texture_id,
+                           software_frame_framebuffer_id,
+                           context->framebuffer_id());
+    } else if (ray_tracer != nullptr) {
+      RenderSceneWithRayTracer(camera, models_to_draw,
+                               software_textures.data(),
+                               software_threads.get(), &scene_bvh,
+                               ray_tracer.get());
+      const wvu::ScopedGpuPass present_pass(gpu_profiler.get(), "Present");
+      PresentSoftwareFrame(ray_tracer->color_buffer(), ray_tracer->width(),
+                           ray_tracer->height(), software_frame_texture_id,
+                           software_frame_framebuffer_id,
+                           context->framebuffer_id());
+    } else if (software_rasterizer != nullptr) {
+      RenderSceneInSoftware(camera, models_to_draw,
+                            software_textures.data(),
+                            software_threads.get(), &scene_bvh,
+                            occlusion_culler.get(),
+                            software_rasterizer.get());
+      const wvu::ScopedGpuPass present_pass(gpu_profiler.get(), "Present");
+      PresentSoftwareFrame(
+          software_rasterizer->color_buffer(), software_rasterizer->width(),
+          software_rasterizer->height(), software_frame_texture_id,
+          software_frame_framebuffer_id, context->framebuffer_id());
+    } else {
+      RenderScene(&scene_shaders, &uniform_stream, camera,
+                  models_to_draw, texture_id1, texture_id2, texture_id3,
+                  texture_id4, &scene_bvh, occlusion_culler.get(),
+                  gpu_occlusion_culler.get(), gpu_driven_renderer.get(),
+                  gpu_profiler.get());
+      // The depth of this frame culls the next one.
+      if (gpu_driven_renderer != nullptr) {
+        const wvu::ScopedGpuPass hi_z_pass(gpu_profiler.get(), "HiZ");
+        gpu_driven_renderer->BuildHiZ(context->framebuffer_id());
+      }
+    }
+
+    // Capture the frame before the back buffer is swapped.
+    if (frame_capture != nullptr) {
+      const wvu::ScopedGpuPass capture_pass(gpu_profiler.get(), "Capture");
+      frame_capture->CaptureFrame(context->framebuffer_id());
+    }
 
     // Swap front and back buffers.
-    glfwSwapBuffers(window);
+    {
+      WVU_PROFILE_ZONE("SwapBuffers");
+      const wvu::ScopedGpuPass swap_pass(gpu_profiler.get(), "Swap");
+      context->SwapBuffers();
+    }
+    if (gpu_profiler != nullptr) gpu_profiler->EndFrame();
+    gpu_resources.EndFrame();
+    if (memory_report_requested) {
+      memory_report_requested = 0;
+      LOG(INFO) << resource_registry.Report(kNumReportedResources);
+    }
 
     // Poll for and process events.
-    glfwPollEvents();
+    context->PollEvents();
+    frame_zone.End();
+    EndTracedFrame(frame_index);
+
+    if (FLAGS_check_frame_allocations && frame_index >= kNumWarmUpFrames &&
+        frame_allocations.num_allocations() > 0) {
+      LOG(WARNING) << "Frame " << frame_index << " made "
+                   << frame_allocations.num_allocations()
+                   << " heap allocations.";
+    }
+    if (allocation_profiler != nullptr) {
+      allocation_profiler->EndFrame("frame");
+    }
+
+    // The frame time includes the wait for the vertical synchronization.
+    const auto frame_end_time = std::chrono::steady_clock::now();
+    if (collect_frame_statistics) {
+      frame_statistics.AddCpuFrame(
+          std::chrono::duration<double, std::milli>(frame_end_time -
+                                                    frame_start_time).count(),
+          wvu::FrameRenderCounters());
+      if ((frame_index + 1) % FLAGS_frame_stats_interval == 0) {
+        LOG(INFO) << frame_statistics.ToLogString();
+        if (!FLAGS_frame_stats_filepath.empty()) {
+          frame_statistics.WriteJson(FLAGS_frame_stats_filepath);
+        }
+      }
+    }
+    frame_start_time = frame_end_time;
+    ++frame_index;
+  }
+
+  if (frame_capture != nullptr) {
+    frame_capture->Finish();
+    LOG(INFO) << "Captured " << frame_capture->num_frames_captured()
+              << " frames to " << FLAGS_capture_filepath;
+    frame_capture.reset();
+  }
+  if (allocation_profiler != nullptr) {
+    allocation_profiler->WriteJson(FLAGS_allocation_profile_filepath);
+  }
+  if (uniform_stream.num_stalls() > 0) {
+    LOG(WARNING) << "The uniform stream waited for the GPU "
+                 << uniform_stream.num_stalls() << " times.";
+  }
+  // The window was closed before the last traced frame.
+  if (wvu::IsCpuProfilingEnabled()) {
+    wvu::SetCpuProfilingEnabled(false);
+    wvu::WriteChromeTrace(FLAGS_trace_filepath);
+  }
+
+  if (FLAGS_memory_report) {
+    LOG(INFO) << resource_registry.Report(kNumReportedResources);
   }
 
   // Cleaning up tasks.
-  DeleteModels(&models_to_draw);
-  // Destroy window.
-  glfwDestroyWindow(window);
-  // Tear down GLFW library.
-  glfwTerminate();
+  if (!FLAGS_shader_usage_filepath.empty()) {
+    scene_shaders.WriteUsageList(FLAGS_shader_usage_filepath);
+  }
+  distributed_renderer.reset();
+  if (present_cpu_frames) {
+    glDeleteFramebuffers(1, &software_frame_framebuffer_id);
+    glDeleteTextures(1, &software_frame_texture_id);
+  }
+  gpu_driven_renderer.reset();
+  gpu_occlusion_culler.reset();
+  DeleteModels(&scene_models, &models_to_draw);
+  for (int i = 0; i < kNumTextures; ++i) {
+    textures[i].Reset();
+    texture_memory[i].Reset();
+  }
+  gpu_resources.Finish();
+  // Destroy the window and the OpenGL context.
+  context.reset();
 
-  return 0;
+  return succeeded ? 0 : -1;
 }
@@ -0,0 +1,164 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "file_watcher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+namespace {
+
+constexpr uint32_t kWatchedEvents = IN_CLOSE_WRITE | IN_MOVED_TO;
+
+// Splits a path into its directory, or "." if it has none, and its name.
+void SplitFilepath(const std::string& filepath,
+                   std::string* directory,
+                   std::string* name) {
+  const size_t separator = filepath.rfind('/');
+  if (separator == std::string::npos) {
+    *directory = ".";
+    *name = filepath;
+  } else {
+    *directory = separator == 0 ? "/" : filepath.substr(0, separator);
+    *name = filepath.substr(separator + 1);
+  }
+}
+
+}  // namespace
+
+FileWatcher::FileWatcher(const std::vector<std::string>& filepaths,
+                         const FileChangedFunction& file_changed)
+    : file_changed_(file_changed), inotify_fd_(-1), stop_pipe_fds_{-1, -1} {
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    LOG(ERROR) << "Could not initialize inotify: " << std::strerror(errno);
+    return;
+  }
+  if (pipe2(stop_pipe_fds_, O_CLOEXEC) != 0) {
+    LOG(ERROR) << "Could not create a pipe: " << std::strerror(errno);
+    return;
+  }
+  for (const std::string& filepath : filepaths) {
+    std::string directory;
+    std::string name;
+    SplitFilepath(filepath, &directory, &name);
+    // Watching a directory twice returns the same descriptor.
+    const int watch_descriptor =
+        inotify_add_watch(inotify_fd_, directory.c_str(), kWatchedEvents);
+    if (watch_descriptor < 0) {
+      LOG(WARNING) << "Could not watch " << directory << ": "
+                   << std::strerror(errno);
+      continue;
+    }
+    directories_[watch_descriptor] = directory;
+    filepaths_[directory + "/" + name] = filepath;
+  }
+  if (directories_.empty()) return;
+  thread_ = std::thread(&FileWatcher::Watch, this);
+}
+
+FileWatcher::~FileWatcher() {
+  if (thread_.joinable()) {
+    const char stop = 0;
+    if (write(stop_pipe_fds_[1], &stop, 1) != 1) {
+      LOG(ERROR) << "Could not stop the file watcher: "
+                 << std::strerror(errno);
+    }
+    thread_.join();
+  }
+  for (const int fd : {inotify_fd_, stop_pipe_fds_[0], stop_pipe_fds_[1]}) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void FileWatcher::Watch() {
+  SetProfilerThreadName("FileWatcher");
+  // Large enough for the longest event, as inotify(7) recommends.
+  alignas(inotify_event) char events[4096];
+  std::vector<std::string> changed_filepaths;
+  while (true) {
+    pollfd poll_fds[] = {{inotify_fd_, POLLIN, 0},
+                         {stop_pipe_fds_[0], POLLIN, 0}};
+    if (poll(poll_fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      LOG(ERROR) << "Could not wait for file events: " << std::strerror(errno);
+      return;
+    }
+    if (poll_fds[1].revents != 0) return;
+
+    // Saving a file may generate several events, so the files are reported
+    // once per batch of events.
+    changed_filepaths.clear();
+    ssize_t events_size;
+    while ((events_size = read(inotify_fd_, events, sizeof(events))) > 0) {
+      for (char* event_data = events; event_data < events + events_size;) {
+        const inotify_event* event =
+            reinterpret_cast<const inotify_event*>(event_data);
+        event_data += sizeof(inotify_event) + event->len;
+        const auto directory = directories_.find(event->wd);
+        if (event->len == 0 || directory == directories_.end()) continue;
+        const auto filepath =
+            filepaths_.find(directory->second + "/" + event->name);
+        if (filepath == filepaths_.end()) continue;
+        if (std::find(changed_filepaths.begin(), changed_filepaths.end(),
+                      filepath->second) == changed_filepaths.end()) {
+          changed_filepaths.push_back(filepath->second);
+        }
+      }
+    }
+    if (events_size < 0 && errno != EAGAIN) {
+      LOG(ERROR) << "Could not read file events: " << std::strerror(errno);
+      return;
+    }
+    for (const std::string& filepath : changed_filepaths) {
+      WVU_PROFILE_ZONE("FileChanged");
+      file_changed_(filepath);
+    }
+  }
+}
+
+}  // namespace wvu
@@ -0,0 +1,88 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef FILE_WATCHER_H_
+#define FILE_WATCHER_H_
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace wvu {
+
+// Called in the thread of a FileWatcher with the path of a changed file, as
+// given to the watcher.
+using FileChangedFunction = std::function<void(const std::string& filepath)>;
+
+// Watches files with inotify and reports the files that change from a
+// background thread, which is also where the callers do the work of reloading
+// them, e.g., decoding an image. The directories of the files are watched
+// rather than the files, so the files that editors save by renaming a new file
+// over the old one, and the files that do not exist yet, are still reported.
+// A file is reported when it is closed after being written or moved in place.
+class FileWatcher {
+ public:
+  // Starts watching the files. See is_valid().
+  FileWatcher(const std::vector<std::string>& filepaths,
+              const FileChangedFunction& file_changed);
+  // Stops the thread, waiting for the callback to return.
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // Returns false if inotify is not available or no directory could be
+  // watched.
+  bool is_valid() const { return thread_.joinable(); }
+
+ private:
+  // Reads the events of the watched directories until Stop() is called.
+  void Watch();
+
+  const FileChangedFunction file_changed_;
+  int inotify_fd_;
+  // Writing to the pipe wakes up the thread to stop it.
+  int stop_pipe_fds_[2];
+  // The directories by watch descriptor.
+  std::unordered_map<int, std::string> directories_;
+  // The paths given to the watcher by directory and file name.
+  std::unordered_map<std::string, std::string> filepaths_;
+  std::thread thread_;
+};
+
+}  // namespace wvu
+
+#endif  // FILE_WATCHER_H_
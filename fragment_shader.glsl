@@ -40,15 +40,20 @@
 
 #version 330 core
 
-// uniform vec4 vertex_color;
-// This was an example on how to pass variables from shader to shader.
-in vec4 vertex_color;
+// The TEXTURED feature selects between sampling the texture and passing the
+// vertex color through (see ShaderPermutations).
 out vec4 color;
+#ifdef TEXTURED
 in vec2 texel;
-
 uniform sampler2D texture_sampler;
+#else
+in vec4 vertex_color;
+#endif
 
 void main() {
-  // color = vertex_color;
+#ifdef TEXTURED
   color = texture(texture_sampler, texel);
+#else
+  color = vertex_color;
+#endif
 }
@@ -0,0 +1,134 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+namespace wvu {
+namespace {
+// Initial capacity of the thread-local arenas. The arenas grow to the peak
+// usage of a frame, so this only needs to be a sensible starting point.
+constexpr size_t kDefaultThreadArenaCapacity = 256 * 1024;
+
+// Global frame counter used to reset the thread-local arenas lazily.
+std::atomic<uint64_t> frame_counter(0);
+
+inline size_t AlignUp(const size_t value, const size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Allocates a block suitable for any alignment used by the arena.
+inline uint8_t* AllocateBlock(const size_t num_bytes) {
+  return static_cast<uint8_t*>(
+      ::operator new(num_bytes, std::align_val_t(alignof(std::max_align_t))));
+}
+
+inline void FreeBlock(void* block) {
+  ::operator delete(block, std::align_val_t(alignof(std::max_align_t)));
+}
+
+}  // namespace
+
+FrameArena::FrameArena(const size_t capacity)
+    : buffer_(AllocateBlock(capacity)),
+      capacity_(capacity),
+      offset_(0),
+      high_water_mark_(0),
+      overflow_bytes_(0) {}
+
+FrameArena::~FrameArena() {
+  ReleaseOverflowBlocks();
+  FreeBlock(buffer_);
+}
+
+void* FrameArena::Allocate(const size_t num_bytes, const size_t alignment) {
+  // Align the address rather than the offset, since the alignment requested
+  // may be larger than the alignment of the buffer itself.
+  const uintptr_t base = reinterpret_cast<uintptr_t>(buffer_);
+  const size_t aligned_offset = AlignUp(base + offset_, alignment) - base;
+  if (aligned_offset + num_bytes <= capacity_) {
+    offset_ = aligned_offset + num_bytes;
+    return buffer_ + aligned_offset;
+  }
+
+  // The arena is exhausted. Serve the request from the heap for this frame.
+  void* block = ::operator new(num_bytes, std::align_val_t(alignment));
+  overflow_blocks_.emplace_back(block, alignment);
+  // Account for the worst-case padding so the grown buffer always fits.
+  overflow_bytes_ += num_bytes + alignment;
+  return block;
+}
+
+void FrameArena::Reset() {
+  high_water_mark_ = std::max(high_water_mark_, bytes_used());
+  if (!overflow_blocks_.empty()) {
+    ReleaseOverflowBlocks();
+    // Grow the buffer so the next frame fits in a single block.
+    FreeBlock(buffer_);
+    capacity_ = std::max(2 * capacity_, high_water_mark_);
+    buffer_ = AllocateBlock(capacity_);
+  }
+  offset_ = 0;
+}
+
+void FrameArena::ReleaseOverflowBlocks() {
+  for (const auto& block : overflow_blocks_) {
+    ::operator delete(block.first, std::align_val_t(block.second));
+  }
+  overflow_blocks_.clear();
+  overflow_bytes_ = 0;
+}
+
+void BeginFrameArenas() {
+  frame_counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameArena& ThreadFrameArena() {
+  thread_local std::unique_ptr<FrameArena> arena(
+      new FrameArena(kDefaultThreadArenaCapacity));
+  thread_local uint64_t arena_frame = 0;
+  const uint64_t current_frame = frame_counter.load(std::memory_order_relaxed);
+  if (arena_frame != current_frame) {
+    arena->Reset();
+    arena_frame = current_frame;
+  }
+  return *arena;
+}
+
+}  // namespace wvu
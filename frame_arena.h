@@ -0,0 +1,160 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef FRAME_ARENA_H_
+#define FRAME_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace wvu {
+// A linear (bump) allocator for data that only lives during a single frame.
+// Allocating is a pointer increment and all the memory is released at once by
+// Reset(). When a frame needs more memory than the capacity, the arena serves
+// the request from the heap and grows its buffer on the next Reset() so that
+// the following frames fit in a single block again. Hence, once the frame loop
+// reaches a steady state, the arena does not call malloc at all.
+//
+// Objects allocated in the arena must be trivially destructible since their
+// destructors are never called.
+class FrameArena {
+ public:
+  // Params:
+  //   capacity  The initial size of the arena in bytes.
+  explicit FrameArena(const size_t capacity);
+  ~FrameArena();
+
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  // Allocates num_bytes bytes aligned to alignment, which must be a power of
+  // two. The memory is valid until the next call to Reset().
+  void* Allocate(const size_t num_bytes,
+                 const size_t alignment = alignof(std::max_align_t));
+
+  // Allocates an uninitialized array of count elements of type T.
+  template <typename T>
+  T* AllocateArray(const size_t count) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Frame arena objects are never destroyed.");
+    return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Constructs an object of type T in the arena.
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "Frame arena objects are never destroyed.");
+    return new (Allocate(sizeof(T), alignof(T)))
+        T(static_cast<Args&&>(args)...);
+  }
+
+  // Releases all the allocations at once. If the last frame overflowed the
+  // arena, the buffer is grown to the peak usage of that frame.
+  void Reset();
+
+  size_t capacity() const { return capacity_; }
+  size_t bytes_used() const { return offset_ + overflow_bytes_; }
+  // Largest number of bytes used in a single frame.
+  size_t high_water_mark() const { return high_water_mark_; }
+  // Number of allocations served from the heap since the last Reset().
+  size_t num_overflow_allocations() const { return overflow_blocks_.size(); }
+
+ private:
+  void ReleaseOverflowBlocks();
+
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t offset_;
+  size_t high_water_mark_;
+  // Heap blocks (and their alignment) used when the buffer is exhausted. They
+  // are freed on Reset().
+  std::vector<std::pair<void*, size_t>> overflow_blocks_;
+  size_t overflow_bytes_;
+};
+
+// Advances the global frame counter. Every thread-local arena is reset lazily
+// the first time its thread requests it after this call, so worker threads do
+// not need to be synchronized with the frame loop to recycle their memory.
+void BeginFrameArenas();
+
+// Returns the frame arena of the calling thread. The arena is created on the
+// first call of each thread and is reset once per frame (see
+// BeginFrameArenas()).
+FrameArena& ThreadFrameArena();
+
+// Standard allocator that places containers in the frame arena of the calling
+// thread, e.g., std::vector<int, FrameArenaAllocator<int>>. Deallocation is a
+// no-op; the memory is recycled when the arena is reset.
+template <typename T>
+class FrameArenaAllocator {
+ public:
+  using value_type = T;
+
+  FrameArenaAllocator() : arena_(&ThreadFrameArena()) {}
+  explicit FrameArenaAllocator(FrameArena* arena) : arena_(arena) {}
+  template <typename U>
+  FrameArenaAllocator(const FrameArenaAllocator<U>& other)  // NOLINT
+      : arena_(other.arena()) {}
+
+  T* allocate(const size_t count) {
+    return static_cast<T*>(arena_->Allocate(count * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  FrameArena* arena() const { return arena_; }
+
+ private:
+  FrameArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const FrameArenaAllocator<T>& lhs,
+                const FrameArenaAllocator<U>& rhs) {
+  return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const FrameArenaAllocator<T>& lhs,
+                const FrameArenaAllocator<U>& rhs) {
+  return !(lhs == rhs);
+}
+
+}  // namespace wvu
+
+#endif  // FRAME_ARENA_H_
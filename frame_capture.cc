@@ -0,0 +1,255 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "frame_capture.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+namespace {
+constexpr int kNumChannels = 4;
+// How long the read back waits for a fence before warning, in nanoseconds.
+constexpr GLuint64 kFenceWarningTimeout = 1000000000;
+
+bool HasExtension(const std::string& filepath, const std::string& extension) {
+  return filepath.size() > extension.size() &&
+         filepath.compare(filepath.size() - extension.size(),
+                          extension.size(), extension) == 0;
+}
+
+// Returns true if the pattern has exactly one frame number conversion, %d or
+// %0Nd, and escapes every other percent sign as %%. The pattern is passed to
+// snprintf, so any other conversion would read arguments that do not exist.
+bool IsValidFramePattern(const std::string& pattern) {
+  int num_conversions = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    if (pattern[i] != '%') continue;
+    ++i;
+    if (i < pattern.size() && pattern[i] == '%') continue;
+    if (i < pattern.size() && pattern[i] == '0') {
+      while (i < pattern.size() && std::isdigit(pattern[i])) ++i;
+    }
+    if (i == pattern.size() || pattern[i] != 'd') return false;
+    ++num_conversions;
+  }
+  return num_conversions == 1;
+}
+
+}  // namespace
+
+FrameCapture::FrameCapture(const FrameCaptureOptions& options,
+                           const int width,
+                           const int height)
+    : options_(options),
+      width_(width),
+      height_(height),
+      frame_size_(static_cast<size_t>(width) * height * kNumChannels),
+      format_(Format::kInvalid),
+      next_pixel_buffer_(0),
+      num_frames_captured_(0),
+      next_y4m_frame_(0) {
+  if (HasExtension(options_.filepath, ".png") ||
+      HasExtension(options_.filepath, ".ppm")) {
+    if (IsValidFramePattern(options_.filepath)) {
+      format_ = HasExtension(options_.filepath, ".png") ? Format::kPng
+                                                         : Format::kPpm;
+    } else {
+      LOG(ERROR) << "Invalid capture pattern: " << options_.filepath
+                 << ". Use exactly one %d or %0Nd and escape % as %%.";
+    }
+  } else if (HasExtension(options_.filepath, ".y4m")) {
+    if (y4m_writer_.Open(options_.filepath, width_, height_,
+                         options_.frame_rate)) {
+      format_ = Format::kY4m;
+    }
+  } else {
+    LOG(ERROR) << "Unknown capture format: " << options_.filepath
+               << ". Use .png, .ppm or .y4m.";
+  }
+  if (!is_valid()) return;
+
+  pixel_buffers_.resize(std::max(options_.num_pixel_buffers, 1));
+  for (PixelBuffer& pixel_buffer : pixel_buffers_) {
+    glGenBuffers(1, &pixel_buffer.buffer_id);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer.buffer_id);
+    glBufferData(GL_PIXEL_PACK_BUFFER, frame_size_, nullptr, GL_STREAM_READ);
+    pixel_buffer.fence = nullptr;
+    pixel_buffer.frame_index = -1;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  encoders_.reset(new ThreadPool(options_.num_encoder_threads, "Encoder"));
+  // Enough images to keep every encoder busy while the render thread fills
+  // the next ones, so it rarely waits for a free image.
+  const int num_images =
+      2 * encoders_->num_threads() + static_cast<int>(pixel_buffers_.size());
+  for (int i = 0; i < num_images; ++i) {
+    images_.emplace_back(new std::vector<uint8_t>(frame_size_));
+    free_images_.push_back(images_.back().get());
+  }
+}
+
+FrameCapture::~FrameCapture() {
+  if (!is_valid()) return;
+  Finish();
+  for (PixelBuffer& pixel_buffer : pixel_buffers_) {
+    glDeleteBuffers(1, &pixel_buffer.buffer_id);
+  }
+  if (format_ == Format::kY4m) y4m_writer_.Close();
+}
+
+void FrameCapture::CaptureFrame(const GLuint framebuffer_id) {
+  if (!is_valid()) return;
+  WVU_PROFILE_ZONE("CaptureFrame");
+  PixelBuffer* pixel_buffer = &pixel_buffers_[next_pixel_buffer_];
+  // The ring wrapped around: the frame in this buffer was read back
+  // num_pixel_buffers frames ago and is ready to be mapped.
+  if (pixel_buffer->fence != nullptr) ReadBack(pixel_buffer);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_id);
+  glReadBuffer(framebuffer_id == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer->buffer_id);
+  // With a pack buffer bound, the pointer is an offset into it and the call
+  // returns without waiting for the GPU.
+  glReadPixels(0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  pixel_buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pixel_buffer->frame_index = num_frames_captured_++;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  next_pixel_buffer_ = (next_pixel_buffer_ + 1) % pixel_buffers_.size();
+}
+
+void FrameCapture::Finish() {
+  if (!is_valid()) return;
+  // Read back in capture order, starting at the oldest buffer in the ring.
+  for (size_t i = 0; i < pixel_buffers_.size(); ++i) {
+    PixelBuffer* pixel_buffer =
+        &pixel_buffers_[(next_pixel_buffer_ + i) % pixel_buffers_.size()];
+    if (pixel_buffer->fence != nullptr) ReadBack(pixel_buffer);
+  }
+  encoders_->Wait();
+}
+
+void FrameCapture::ReadBack(PixelBuffer* pixel_buffer) {
+  WVU_PROFILE_ZONE("ReadBack");
+  if (glClientWaitSync(pixel_buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                       kFenceWarningTimeout) == GL_TIMEOUT_EXPIRED) {
+    LOG(WARNING) << "Frame " << pixel_buffer->frame_index
+                 << " took over a second to read back.";
+    glClientWaitSync(pixel_buffer->fence, 0, GL_TIMEOUT_IGNORED);
+  }
+  glDeleteSync(pixel_buffer->fence);
+  pixel_buffer->fence = nullptr;
+
+  std::vector<uint8_t>* image = AcquireImage();
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_buffer->buffer_id);
+  const void* pixels =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frame_size_, GL_MAP_READ_BIT);
+  if (pixels != nullptr) {
+    memcpy(image->data(), pixels, frame_size_);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    LOG(ERROR) << "Could not map the pixels of frame "
+               << pixel_buffer->frame_index;
+    memset(image->data(), 0, frame_size_);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  const int frame_index = pixel_buffer->frame_index;
+  encoders_->Schedule(
+      [this, frame_index, image]() { EncodeFrame(frame_index, image); });
+}
+
+void FrameCapture::EncodeFrame(const int frame_index,
+                               std::vector<uint8_t>* pixels) {
+  WVU_PROFILE_ZONE("EncodeFrame");
+  ImageView image;
+  image.pixels = pixels->data();
+  image.width = width_;
+  image.height = height_;
+  image.num_channels = kNumChannels;
+  // OpenGL reads the rows from the bottom of the framebuffer up.
+  image.bottom_up = true;
+
+  if (format_ == Format::kY4m) {
+    // Each encoder thread converts into its own planes, reused across frames.
+    thread_local std::vector<uint8_t> planes;
+    Y4mWriter::ConvertFrame(image, &planes);
+    ReleaseImage(pixels);
+    std::unique_lock<std::mutex> lock(y4m_mutex_);
+    y4m_frame_written_.wait(
+        lock, [this, frame_index]() { return next_y4m_frame_ == frame_index; });
+    if (!y4m_writer_.WriteConvertedFrame(planes)) {
+      LOG(ERROR) << "Could not write frame " << frame_index << " to "
+                 << options_.filepath;
+    }
+    ++next_y4m_frame_;
+    y4m_frame_written_.notify_all();
+    return;
+  }
+
+  char filepath[1024];
+  snprintf(filepath, sizeof(filepath), options_.filepath.c_str(), frame_index);
+  const bool written = format_ == Format::kPng ? WritePng(filepath, image)
+                                               : WritePpm(filepath, image);
+  if (!written) LOG(ERROR) << "Could not write " << filepath;
+  ReleaseImage(pixels);
+}
+
+std::vector<uint8_t>* FrameCapture::AcquireImage() {
+  std::unique_lock<std::mutex> lock(free_images_mutex_);
+  image_released_.wait(lock, [this]() { return !free_images_.empty(); });
+  std::vector<uint8_t>* image = free_images_.back();
+  free_images_.pop_back();
+  return image;
+}
+
+void FrameCapture::ReleaseImage(std::vector<uint8_t>* image) {
+  {
+    std::lock_guard<std::mutex> lock(free_images_mutex_);
+    free_images_.push_back(image);
+  }
+  image_released_.notify_one();
+}
+
+}  // namespace wvu
@@ -0,0 +1,145 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef FRAME_CAPTURE_H_
+#define FRAME_CAPTURE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "image_writer.h"
+#include "thread_pool.h"
+
+namespace wvu {
+// Options of a frame capture.
+struct FrameCaptureOptions {
+  // Where the frames are written. The extension selects the format. For .png
+  // and .ppm, the filepath is a printf pattern of the frame number, e.g.,
+  // "frames/frame_%05d.png", with exactly one %d or %0Nd and any other percent
+  // sign escaped as %%. For .y4m, all the frames go into one video file.
+  std::string filepath;
+  // Number of pixel buffer objects in the ring, i.e., how many frames later a
+  // frame is mapped. Three hides the read-back latency on most drivers.
+  int num_pixel_buffers = 3;
+  // Number of threads encoding frames. Zero uses one thread per core.
+  int num_encoder_threads = 0;
+  // Frame rate written in Y4M headers.
+  int frame_rate = 30;
+};
+
+// Captures rendered frames to disk without stalling the render thread. Every
+// frame is read into a pixel buffer object (PBO) from a ring, and a fence marks
+// when the copy finishes. The PBO is only mapped when the ring wraps around,
+// num_pixel_buffers frames later, so the GPU has finished the copy by then and
+// mapping does not wait. The pixels are then handed to a pool of threads that
+// encode them off the render thread.
+//
+// The capture requires a current OpenGL context and must be used from the
+// thread that owns it.
+class FrameCapture {
+ public:
+  FrameCapture(const FrameCaptureOptions& options,
+               const int width,
+               const int height);
+  // Writes the pending frames.
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture&) = delete;
+  FrameCapture& operator=(const FrameCapture&) = delete;
+
+  // Returns false if the output could not be created.
+  bool is_valid() const { return format_ != Format::kInvalid; }
+
+  // Starts reading back the color buffer of the framebuffer (zero for the
+  // default framebuffer of the window, whose back buffer is read).
+  void CaptureFrame(const GLuint framebuffer_id);
+
+  // Reads back the frames in flight and waits until every frame is written.
+  void Finish();
+
+  int num_frames_captured() const { return num_frames_captured_; }
+
+ private:
+  enum class Format { kInvalid, kPng, kPpm, kY4m };
+
+  struct PixelBuffer {
+    GLuint buffer_id;
+    GLsync fence;
+    int frame_index;
+  };
+
+  // Maps a pixel buffer, waiting for its fence, and schedules the encoding.
+  void ReadBack(PixelBuffer* pixel_buffer);
+  // Encodes a frame. Runs in the encoder threads.
+  void EncodeFrame(const int frame_index, std::vector<uint8_t>* pixels);
+  // Returns an image buffer that is not being encoded, waiting for the
+  // encoders if all of them are in use.
+  std::vector<uint8_t>* AcquireImage();
+  void ReleaseImage(std::vector<uint8_t>* image);
+
+  const FrameCaptureOptions options_;
+  const int width_;
+  const int height_;
+  const size_t frame_size_;
+  Format format_;
+  std::vector<PixelBuffer> pixel_buffers_;
+  int next_pixel_buffer_;
+  int num_frames_captured_;
+
+  // The CPU copies of the frames, recycled between the encoder tasks.
+  std::vector<std::unique_ptr<std::vector<uint8_t>>> images_;
+  std::vector<std::vector<uint8_t>*> free_images_;
+  std::mutex free_images_mutex_;
+  std::condition_variable image_released_;
+
+  // Y4M frames are converted in parallel but appended in order.
+  Y4mWriter y4m_writer_;
+  int next_y4m_frame_;
+  std::mutex y4m_mutex_;
+  std::condition_variable y4m_frame_written_;
+
+  // Declared last so the encoders finish before the members they use are
+  // destroyed.
+  std::unique_ptr<ThreadPool> encoders_;
+};
+
+}  // namespace wvu
+
+#endif  // FRAME_CAPTURE_H_
@@ -0,0 +1,224 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "frame_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "json_utils.h"
+
+namespace wvu {
+namespace {
+
+RenderCounters frame_render_counters;
+
+// Returns the value at the given percentile (in [0, 1]) of the sorted values
+// using the nearest-rank method.
+double ComputePercentile(const std::vector<double>& sorted_values,
+                         const double percentile) {
+  const int rank = static_cast<int>(
+      std::ceil(percentile * static_cast<double>(sorted_values.size())));
+  return sorted_values[std::max(rank, 1) - 1];
+}
+
+void WriteSummaryJson(const StatisticsSummary& summary, std::ostream* stream) {
+  *stream << "{\"mean\": " << summary.mean << ", \"p50\": " << summary.p50
+          << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99
+          << "}";
+}
+
+}  // namespace
+
+RenderCounters& FrameRenderCounters() {
+  return frame_render_counters;
+}
+
+FrameStatistics::RollingSeries::RollingSeries(const int window_size)
+    : values_(window_size, 0.0), next_index_(0), size_(0) {}
+
+void FrameStatistics::RollingSeries::Add(const double value) {
+  values_[next_index_] = value;
+  next_index_ = (next_index_ + 1) % values_.size();
+  size_ = std::min(size_ + 1, static_cast<int>(values_.size()));
+}
+
+StatisticsSummary FrameStatistics::RollingSeries::Summarize() const {
+  StatisticsSummary summary;
+  if (size_ == 0) return summary;
+  // The order of the values in the window does not matter for the summary.
+  std::vector<double> sorted_values(values_.begin(), values_.begin() + size_);
+  std::sort(sorted_values.begin(), sorted_values.end());
+  for (const double value : sorted_values) summary.mean += value;
+  summary.mean /= size_;
+  summary.p50 = ComputePercentile(sorted_values, 0.50);
+  summary.p95 = ComputePercentile(sorted_values, 0.95);
+  summary.p99 = ComputePercentile(sorted_values, 0.99);
+  return summary;
+}
+
+FrameStatistics::FrameStatistics(const int window_size)
+    : window_size_(window_size),
+      cpu_frame_milliseconds_(window_size),
+      gpu_frame_milliseconds_(window_size),
+      draw_calls_(window_size),
+      triangles_(window_size),
+      state_changes_(window_size),
+      redundant_state_changes_(window_size),
+      occluded_objects_(window_size),
+      num_frames_(0) {
+  passes_.reserve(GpuFrameTiming::kMaxPasses);
+}
+
+void FrameStatistics::AddCpuFrame(const double frame_milliseconds,
+                                  const RenderCounters& counters) {
+  cpu_frame_milliseconds_.Add(frame_milliseconds);
+  draw_calls_.Add(counters.draw_calls);
+  triangles_.Add(counters.triangles);
+  state_changes_.Add(counters.state_changes);
+  redundant_state_changes_.Add(counters.redundant_state_changes);
+  occluded_objects_.Add(counters.occluded_objects);
+  ++num_frames_;
+}
+
+void FrameStatistics::AddGpuFrame(const GpuFrameTiming& timing) {
+  gpu_frame_milliseconds_.Add(timing.total_milliseconds);
+  for (int i = 0; i < timing.num_passes; ++i) {
+    auto pass = std::find_if(passes_.begin(), passes_.end(),
+                             [&](const PassSeries& series) {
+                               return strcmp(series.name,
+                                             timing.pass_names[i]) == 0;
+                             });
+    if (pass == passes_.end()) {
+      passes_.push_back({timing.pass_names[i], RollingSeries(window_size_)});
+      pass = passes_.end() - 1;
+    }
+    pass->milliseconds.Add(timing.pass_milliseconds[i]);
+  }
+}
+
+StatisticsSummary FrameStatistics::CpuFrameTimeSummary() const {
+  return cpu_frame_milliseconds_.Summarize();
+}
+
+StatisticsSummary FrameStatistics::GpuFrameTimeSummary() const {
+  return gpu_frame_milliseconds_.Summarize();
+}
+
+RenderCounters FrameStatistics::MeanRenderCounters() const {
+  RenderCounters counters;
+  counters.draw_calls = std::llround(draw_calls_.Summarize().mean);
+  counters.triangles = std::llround(triangles_.Summarize().mean);
+  counters.state_changes = std::llround(state_changes_.Summarize().mean);
+  counters.redundant_state_changes =
+      std::llround(redundant_state_changes_.Summarize().mean);
+  counters.occluded_objects =
+      std::llround(occluded_objects_.Summarize().mean);
+  return counters;
+}
+
+std::string FrameStatistics::ToLogString() const {
+  const StatisticsSummary cpu = CpuFrameTimeSummary();
+  const StatisticsSummary gpu = GpuFrameTimeSummary();
+  const RenderCounters counters = MeanRenderCounters();
+  char line[256];
+  snprintf(line, sizeof(line),
+           "Frame %.2f ms (p50 %.2f, p95 %.2f, p99 %.2f) | GPU %.3f ms "
+           "(p50 %.3f, p95 %.3f, p99 %.3f) | %llu draws, %llu tris, "
+           "%llu state changes (%llu redundant skipped), %llu occluded",
+           cpu.mean, cpu.p50, cpu.p95, cpu.p99, gpu.mean, gpu.p50, gpu.p95,
+           gpu.p99, static_cast<unsigned long long>(counters.draw_calls),
+           static_cast<unsigned long long>(counters.triangles),
+           static_cast<unsigned long long>(counters.state_changes),
+           static_cast<unsigned long long>(counters.redundant_state_changes),
+           static_cast<unsigned long long>(counters.occluded_objects));
+  std::string log_string = line;
+  for (const PassSeries& pass : passes_) {
+    snprintf(line, sizeof(line), " | %s %.3f ms", pass.name,
+             pass.milliseconds.Summarize().mean);
+    log_string += line;
+  }
+  return log_string;
+}
+
+bool FrameStatistics::WriteJson(const std::string& filepath) const {
+  std::ostringstream json;
+  const RenderCounters counters = MeanRenderCounters();
+  json << "{\n\"frames\": " << num_frames_
+       << ",\n\"window_size\": " << cpu_frame_milliseconds_.size()
+       << ",\n\"frame_time_ms\": ";
+  WriteSummaryJson(CpuFrameTimeSummary(), &json);
+  json << ",\n\"gpu_time_ms\": ";
+  WriteSummaryJson(GpuFrameTimeSummary(), &json);
+  json << ",\n\"gpu_passes_ms\": {";
+  for (size_t i = 0; i < passes_.size(); ++i) {
+    json << (i == 0 ? "\n  " : ",\n  ") << ToJsonString(passes_[i].name)
+         << ": ";
+    WriteSummaryJson(passes_[i].milliseconds.Summarize(), &json);
+  }
+  json << "},\n\"draw_calls\": " << counters.draw_calls
+       << ",\n\"triangles\": " << counters.triangles
+       << ",\n\"state_changes\": " << counters.state_changes
+       << ",\n\"redundant_state_changes\": "
+       << counters.redundant_state_changes
+       << ",\n\"occluded_objects\": " << counters.occluded_objects
+       << "\n}\n";
+
+  // Write to a temporary file and rename it so readers never see a partially
+  // written file.
+  const std::string temporary_filepath = filepath + ".tmp";
+  {
+    std::ofstream stream(temporary_filepath);
+    if (!stream.is_open() || !(stream << json.str())) {
+      LOG(ERROR) << "Could not write " << temporary_filepath;
+      return false;
+    }
+  }
+  if (std::rename(temporary_filepath.c_str(), filepath.c_str()) != 0) {
+    LOG(ERROR) << "Could not rename " << temporary_filepath << " to "
+               << filepath;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace wvu
@@ -0,0 +1,161 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef FRAME_STATISTICS_H_
+#define FRAME_STATISTICS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wvu {
+// Work submitted to OpenGL during a frame.
+struct RenderCounters {
+  uint64_t draw_calls = 0;
+  uint64_t triangles = 0;
+  // Number of bind and enable calls, e.g., glBindTexture or glUseProgram.
+  uint64_t state_changes = 0;
+  // Bind and enable calls the GlStateCache skipped because they would not
+  // have changed the state.
+  uint64_t redundant_state_changes = 0;
+  // Objects in the view frustum that were not drawn because they were
+  // occluded.
+  uint64_t occluded_objects = 0;
+};
+
+// Returns the counters of the frame being rendered. The draw path updates
+// them and the frame loop resets them at the beginning of every frame.
+RenderCounters& FrameRenderCounters();
+
+inline void CountDrawCall(const uint64_t num_triangles) {
+  RenderCounters& counters = FrameRenderCounters();
+  ++counters.draw_calls;
+  counters.triangles += num_triangles;
+}
+
+inline void CountStateChanges(const uint64_t num_state_changes) {
+  FrameRenderCounters().state_changes += num_state_changes;
+}
+
+inline void CountRedundantStateChanges(
+    const uint64_t num_redundant_state_changes) {
+  FrameRenderCounters().redundant_state_changes +=
+      num_redundant_state_changes;
+}
+
+inline void CountOccludedObjects(const uint64_t num_occluded_objects) {
+  FrameRenderCounters().occluded_objects += num_occluded_objects;
+}
+
+// Mean and percentiles of a series of values.
+struct StatisticsSummary {
+  double mean = 0.0;
+  double p50 = 0.0;
+  double p95 = 0.0;
+  double p99 = 0.0;
+};
+
+// GPU time of the passes of a frame measured by the GpuProfiler.
+struct GpuFrameTiming {
+  static constexpr int kMaxPasses = 16;
+
+  int num_passes = 0;
+  const char* pass_names[kMaxPasses];
+  double pass_milliseconds[kMaxPasses];
+  // Time between the beginning of the first pass and the end of the last one.
+  double total_milliseconds = 0.0;
+};
+
+// Rolling statistics of the last frames: CPU frame time, GPU time per pass
+// and the render counters. Adding a frame does not allocate memory, so the
+// statistics can be collected every frame.
+class FrameStatistics {
+ public:
+  // Params:
+  //   window_size  Number of frames the statistics are computed over.
+  explicit FrameStatistics(const int window_size);
+
+  // Adds the CPU time of a frame and its counters.
+  void AddCpuFrame(const double frame_milliseconds,
+                   const RenderCounters& counters);
+  // Adds the GPU timing of a frame. GPU timings arrive a few frames late.
+  void AddGpuFrame(const GpuFrameTiming& timing);
+
+  StatisticsSummary CpuFrameTimeSummary() const;
+  StatisticsSummary GpuFrameTimeSummary() const;
+  // Mean counters per frame.
+  RenderCounters MeanRenderCounters() const;
+
+  // Returns a one-line summary for the log.
+  std::string ToLogString() const;
+
+  // Writes the statistics as JSON. The file is written atomically, so it can
+  // be polled by other processes. Returns true upon success.
+  bool WriteJson(const std::string& filepath) const;
+
+ private:
+  // A fixed-size window of the latest values of a series.
+  class RollingSeries {
+   public:
+    explicit RollingSeries(const int window_size);
+    void Add(const double value);
+    StatisticsSummary Summarize() const;
+    int size() const { return size_; }
+
+   private:
+    std::vector<double> values_;
+    int next_index_;
+    int size_;
+  };
+
+  struct PassSeries {
+    const char* name;
+    RollingSeries milliseconds;
+  };
+
+  const int window_size_;
+  RollingSeries cpu_frame_milliseconds_;
+  RollingSeries gpu_frame_milliseconds_;
+  RollingSeries draw_calls_;
+  RollingSeries triangles_;
+  RollingSeries state_changes_;
+  RollingSeries redundant_state_changes_;
+  RollingSeries occluded_objects_;
+  std::vector<PassSeries> passes_;
+  uint64_t num_frames_;
+};
+
+}  // namespace wvu
+
+#endif  // FRAME_STATISTICS_H_
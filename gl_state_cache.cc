@@ -0,0 +1,131 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gl_state_cache.h"
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "frame_statistics.h"
+
+namespace wvu {
+
+GlStateCache::GlStateCache()
+    : num_state_changes_(0), num_redundant_state_changes_(0) {
+  Invalidate();
+}
+
+void GlStateCache::Invalidate() {
+  program_id_ = kUnknown;
+  active_texture_unit_ = kUnknown;
+  for (int64_t& texture_id : texture_ids_) texture_id = kUnknown;
+  vertex_array_id_ = kUnknown;
+  depth_function_ = kUnknown;
+  polygon_mode_ = kUnknown;
+  for (int64_t& capability_state : capability_states_) {
+    capability_state = kUnknown;
+  }
+  num_capabilities_ = 0;
+}
+
+bool GlStateCache::Update(const int64_t value, int64_t* cached_value) {
+  if (*cached_value == value) {
+    ++num_redundant_state_changes_;
+    CountRedundantStateChanges(1);
+    return false;
+  }
+  *cached_value = value;
+  ++num_state_changes_;
+  CountStateChanges(1);
+  return true;
+}
+
+void GlStateCache::UseProgram(const GLuint program_id) {
+  if (Update(program_id, &program_id_)) glUseProgram(program_id);
+}
+
+void GlStateCache::BindTexture2D(const int unit, const GLuint texture_id) {
+  DCHECK_GE(unit, 0);
+  DCHECK_LT(unit, kMaxTextureUnits);
+  // A texture already bound to the unit does not need the unit selected.
+  if (texture_ids_[unit] == texture_id) {
+    Update(texture_id, &texture_ids_[unit]);
+    return;
+  }
+  if (Update(unit, &active_texture_unit_)) glActiveTexture(GL_TEXTURE0 + unit);
+  if (Update(texture_id, &texture_ids_[unit])) {
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+  }
+}
+
+void GlStateCache::BindVertexArray(const GLuint vertex_array_id) {
+  if (Update(vertex_array_id, &vertex_array_id_)) {
+    glBindVertexArray(vertex_array_id);
+  }
+}
+
+void GlStateCache::SetCapability(const GLenum capability, const bool enabled) {
+  int index = 0;
+  while (index < num_capabilities_ && capabilities_[index] != capability) {
+    ++index;
+  }
+  if (index == num_capabilities_) {
+    if (num_capabilities_ == kMaxCapabilities) {
+      // Untracked capabilities always reach OpenGL.
+      enabled ? glEnable(capability) : glDisable(capability);
+      ++num_state_changes_;
+      CountStateChanges(1);
+      return;
+    }
+    capabilities_[num_capabilities_++] = capability;
+  }
+  if (Update(enabled, &capability_states_[index])) {
+    enabled ? glEnable(capability) : glDisable(capability);
+  }
+}
+
+void GlStateCache::SetDepthFunc(const GLenum function) {
+  if (Update(function, &depth_function_)) glDepthFunc(function);
+}
+
+void GlStateCache::SetPolygonMode(const GLenum mode) {
+  if (Update(mode, &polygon_mode_)) glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+GlStateCache& ThreadGlStateCache() {
+  thread_local GlStateCache state_cache;
+  return state_cache;
+}
+
+}  // namespace wvu
@@ -0,0 +1,107 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GL_STATE_CACHE_H_
+#define GL_STATE_CACHE_H_
+
+#include <cstdint>
+
+#include <GL/glew.h>
+
+namespace wvu {
+
+// Tracks the OpenGL state set through it and skips the bind and enable calls
+// that would not change it, e.g., binding the texture of the previous draw
+// again. The calls that reach OpenGL are counted as state changes and the
+// skipped ones as redundant state changes (see RenderCounters).
+//
+// The cache only knows the state set through it. Code that changes the same
+// state directly, e.g., another renderer or a texture upload, must be followed
+// by Invalidate().
+class GlStateCache {
+ public:
+  static constexpr int kMaxTextureUnits = 16;
+  static constexpr int kMaxCapabilities = 8;
+
+  GlStateCache();
+
+  // Forgets the tracked state, so the next call of every kind reaches OpenGL.
+  void Invalidate();
+
+  void UseProgram(const GLuint program_id);
+  // Binds a 2D texture to a texture unit, selecting the unit only if needed.
+  void BindTexture2D(const int unit, const GLuint texture_id);
+  void BindVertexArray(const GLuint vertex_array_id);
+  // Calls glEnable() or glDisable() on the capability, e.g., GL_DEPTH_TEST.
+  void SetCapability(const GLenum capability, const bool enabled);
+  void SetDepthFunc(const GLenum function);
+  // Sets the polygon mode of the front and back faces.
+  void SetPolygonMode(const GLenum mode);
+
+  // Number of calls that reached OpenGL and that were skipped since the cache
+  // was created.
+  uint64_t num_state_changes() const { return num_state_changes_; }
+  uint64_t num_redundant_state_changes() const {
+    return num_redundant_state_changes_;
+  }
+
+ private:
+  // The state is unknown until it is set through the cache.
+  static constexpr int64_t kUnknown = -1;
+
+  // Returns true if the value differs from the cached one, which it replaces.
+  // Counts the call as a state change or as a redundant one.
+  bool Update(const int64_t value, int64_t* cached_value);
+
+  int64_t program_id_;
+  int64_t active_texture_unit_;
+  int64_t texture_ids_[kMaxTextureUnits];
+  int64_t vertex_array_id_;
+  int64_t depth_function_;
+  int64_t polygon_mode_;
+  // The capabilities set so far, in the order they were first set.
+  int num_capabilities_;
+  GLenum capabilities_[kMaxCapabilities];
+  int64_t capability_states_[kMaxCapabilities];
+  uint64_t num_state_changes_;
+  uint64_t num_redundant_state_changes_;
+};
+
+// Returns the state cache of the calling thread, i.e., of the OpenGL context
+// current in it. The cache is created on the first call of each thread.
+GlStateCache& ThreadGlStateCache();
+
+}  // namespace wvu
+
+#endif  // GL_STATE_CACHE_H_
@@ -0,0 +1,647 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gpu_driven_renderer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "camera_utils.h"
+#include "cpu_profiler.h"
+#include "frame_statistics.h"
+#include "gpu_program.h"
+
+namespace wvu {
+namespace {
+constexpr int kCullGroupSize = 64;
+constexpr int kHiZGroupSize = 8;
+
+// The uniforms of the programs.
+constexpr uint64_t kViewProjectionUniform = HashUniformName("view_projection");
+constexpr uint64_t kNumInstancesUniform = HashUniformName("num_instances");
+constexpr uint64_t kMaxNumInstancesUniform = HashUniformName("max_num_instances");
+constexpr uint64_t kHasHiZUniform = HashUniformName("has_hi_z");
+constexpr uint64_t kNumHiZLevelsUniform = HashUniformName("num_hi_z_levels");
+constexpr uint64_t kHiZUniform = HashUniformName("hi_z");
+constexpr uint64_t kReverseZUniform = HashUniformName("reverse_z");
+constexpr uint64_t kViewUniform = HashUniformName("view");
+constexpr uint64_t kProjectionUniform = HashUniformName("projection");
+constexpr uint64_t kDepthUniform = HashUniformName("depth");
+
+// The layouts below match the std430 structs of the shaders.
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+// The culling pass. Every invocation tests an instance and, if it is
+// visible, appends its draw command to the commands of its texture.
+const char kCullShaderSrc[] =
+    "#version 430 core\n"
+    "layout (local_size_x = 64) in;\n"
+    "struct Instance {\n"
+    "  mat4 model;\n"
+    "  vec4 bounds_min;\n"
+    "  vec4 bounds_max;\n"
+    "  uvec4 mesh_texture;\n"
+    "};\n"
+    "struct Mesh {\n"
+    "  uint count;\n"
+    "  uint first_index;\n"
+    "  int base_vertex;\n"
+    "  uint padding;\n"
+    "};\n"
+    "struct DrawCommand {\n"
+    "  uint count;\n"
+    "  uint instance_count;\n"
+    "  uint first_index;\n"
+    "  int base_vertex;\n"
+    "  uint base_instance;\n"
+    "};\n"
+    "layout (std430, binding = 0) readonly buffer Instances {\n"
+    "  Instance instances[];\n"
+    "};\n"
+    "layout (std430, binding = 1) readonly buffer Meshes {\n"
+    "  Mesh meshes[];\n"
+    "};\n"
+    "layout (std430, binding = 2) writeonly buffer Commands {\n"
+    "  DrawCommand commands[];\n"
+    "};\n"
+    "layout (std430, binding = 3) buffer Counters {\n"
+    "  uint counters[];\n"
+    "};\n"
+    "uniform mat4 view_projection;\n"
+    "uniform uint num_instances;\n"
+    "uniform uint max_num_instances;\n"
+    "uniform bool has_hi_z;\n"
+    "uniform int num_hi_z_levels;\n"
+    "uniform sampler2D hi_z;\n"
+    "uniform bool reverse_z;\n"
+    "\n"
+    "// Returns false if the bounds are outside a plane of the frustum or\n"
+    "// behind the farthest depth of the Hi-Z pyramid under them.\n"
+    "bool IsVisible(vec3 bounds_min, vec3 bounds_max) {\n"
+    "  // Number of corners outside every plane of the frustum.\n"
+    "  ivec3 num_below = ivec3(0);\n"
+    "  ivec3 num_above = ivec3(0);\n"
+    "  bool crosses_near_plane = false;\n"
+    "  vec3 ndc_min = vec3(1.0f);\n"
+    "  vec3 ndc_max = vec3(-1.0f);\n"
+    "  for (int i = 0; i < 8; ++i) {\n"
+    "    vec3 corner = mix(bounds_min, bounds_max,\n"
+    "                      vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));\n"
+    "    vec4 clip = view_projection * vec4(corner, 1.0f);\n"
+    "    // The depth of the clip volume is [0, w] in reverse-Z.\n"
+    "    vec3 clip_min = vec3(-clip.w, -clip.w, reverse_z ? 0.0f : -clip.w);\n"
+    "    num_below += ivec3(lessThan(clip.xyz, clip_min));\n"
+    "    num_above += ivec3(greaterThan(clip.xyz, vec3(clip.w)));\n"
+    "    if (reverse_z ? clip.z > clip.w : clip.z < -clip.w) {\n"
+    "      crosses_near_plane = true;\n"
+    "    } else {\n"
+    "      ndc_min = min(ndc_min, clip.xyz / clip.w);\n"
+    "      ndc_max = max(ndc_max, clip.xyz / clip.w);\n"
+    "    }\n"
+    "  }\n"
+    "  if (any(equal(num_below, ivec3(8))) ||\n"
+    "      any(equal(num_above, ivec3(8)))) {\n"
+    "    return false;\n"
+    "  }\n"
+    "  if (!has_hi_z || crosses_near_plane) return true;\n"
+    "\n"
+    "  // The level where the bounds span at most 2x2 texels.\n"
+    "  ivec2 size = textureSize(hi_z, 0);\n"
+    "  vec2 pixel_min = clamp(ndc_min.xy * 0.5f + 0.5f, 0.0f, 1.0f) * size;\n"
+    "  vec2 pixel_max = clamp(ndc_max.xy * 0.5f + 0.5f, 0.0f, 1.0f) * size;\n"
+    "  vec2 extent = max(pixel_max - pixel_min, vec2(1.0f));\n"
+    "  int level = clamp(int(ceil(log2(max(extent.x, extent.y)))), 0,\n"
+    "                    num_hi_z_levels - 1);\n"
+    "  // The size of the level is not queried with textureSize(), which\n"
+    "  // llvmpipe gets wrong when the level varies across invocations.\n"
+    "  ivec2 level_max = max(size >> level, ivec2(1)) - 1;\n"
+    "  ivec2 texel_min = clamp(ivec2(pixel_min) >> level, ivec2(0),\n"
+    "                          level_max);\n"
+    "  ivec2 texel_max = clamp(ivec2(pixel_max) >> level, ivec2(0),\n"
+    "                          level_max);\n"
+    "  float farthest_depth = reverse_z ? 1.0f : 0.0f;\n"
+    "  for (int y = texel_min.y; y <= texel_max.y; ++y) {\n"
+    "    for (int x = texel_min.x; x <= texel_max.x; ++x) {\n"
+    "      float depth = texelFetch(hi_z, ivec2(x, y), level).r;\n"
+    "      farthest_depth = reverse_z ? min(farthest_depth, depth) :\n"
+    "                                   max(farthest_depth, depth);\n"
+    "    }\n"
+    "  }\n"
+    "  // The depth of the normalized device coordinates is already the depth\n"
+    "  // of the window in reverse-Z, and the nearest depth is the largest.\n"
+    "  if (reverse_z) return ndc_max.z >= farthest_depth;\n"
+    "  return ndc_min.z * 0.5f + 0.5f <= farthest_depth;\n"
+    "}\n"
+    "\n"
+    "void main() {\n"
+    "  uint index = gl_GlobalInvocationID.x;\n"
+    "  if (index >= num_instances) return;\n"
+    "  Instance instance = instances[index];\n"
+    "  if (!IsVisible(instance.bounds_min.xyz, instance.bounds_max.xyz)) {\n"
+    "    return;\n"
+    "  }\n"
+    "  uint texture_index = instance.mesh_texture.y;\n"
+    "  uint slot = atomicAdd(counters[texture_index], 1u);\n"
+    "  Mesh mesh = meshes[instance.mesh_texture.x];\n"
+    "  commands[texture_index * max_num_instances + slot] = DrawCommand(\n"
+    "      mesh.count, 1u, mesh.first_index, mesh.base_vertex, index);\n"
+    "}\n";
+
+// Copies the depth buffer into the first level of the Hi-Z pyramid.
+const char kHiZCopyShaderSrc[] =
+    "#version 430 core\n"
+    "layout (local_size_x = 8, local_size_y = 8) in;\n"
+    "layout (r32f, binding = 0) writeonly uniform image2D destination;\n"
+    "uniform sampler2D depth;\n"
+    "void main() {\n"
+    "  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "  if (any(greaterThanEqual(texel, imageSize(destination)))) return;\n"
+    "  imageStore(destination, texel, texelFetch(depth, texel, 0));\n"
+    "}\n";
+
+// Reduces a level of the Hi-Z pyramid into the next one. A texel is the
+// farthest of the 2x2 texels below it, and of the extra row or column of the
+// level below when its size is odd, so no texel is left out. The farthest
+// depth is the smallest one in reverse-Z.
+const char kHiZReduceShaderSrc[] =
+    "#version 430 core\n"
+    "layout (local_size_x = 8, local_size_y = 8) in;\n"
+    "layout (r32f, binding = 0) readonly uniform image2D source;\n"
+    "layout (r32f, binding = 1) writeonly uniform image2D destination;\n"
+    "uniform bool reverse_z;\n"
+    "void main() {\n"
+    "  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "  ivec2 size = imageSize(destination);\n"
+    "  if (any(greaterThanEqual(texel, size))) return;\n"
+    "  ivec2 source_max = imageSize(source) - 1;\n"
+    "  ivec2 last = min(2 * texel + 1, source_max);\n"
+    "  if (texel.x == size.x - 1) last.x = source_max.x;\n"
+    "  if (texel.y == size.y - 1) last.y = source_max.y;\n"
+    "  float depth = reverse_z ? 1.0f : 0.0f;\n"
+    "  for (int y = 2 * texel.y; y <= last.y; ++y) {\n"
+    "    for (int x = 2 * texel.x; x <= last.x; ++x) {\n"
+    "      float source_depth = imageLoad(source, ivec2(x, y)).r;\n"
+    "      depth = reverse_z ? min(depth, source_depth) :\n"
+    "                          max(depth, source_depth);\n"
+    "    }\n"
+    "  }\n"
+    "  imageStore(destination, texel, vec4(depth));\n"
+    "}\n";
+
+// Draws the instances like the shaders of the scene: the texel is the x and
+// y of the vertex position. The instance comes from the base instance of the
+// draw command through an instanced attribute.
+const char kDrawVertexShaderSrc[] =
+    "#version 430 core\n"
+    "layout (location = 0) in vec3 position;\n"
+    "layout (location = 1) in uint instance;\n"
+    "struct Instance {\n"
+    "  mat4 model;\n"
+    "  vec4 bounds_min;\n"
+    "  vec4 bounds_max;\n"
+    "  uvec4 mesh_texture;\n"
+    "};\n"
+    "layout (std430, binding = 0) readonly buffer Instances {\n"
+    "  Instance instances[];\n"
+    "};\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 projection;\n"
+    "out vec2 texel;\n"
+    "void main() {\n"
+    "  gl_Position = projection * view * instances[instance].model *\n"
+    "                vec4(position, 1.0f);\n"
+    "  texel = position.xy;\n"
+    "}\n";
+const char kDrawFragmentShaderSrc[] =
+    "#version 430 core\n"
+    "in vec2 texel;\n"
+    "out vec4 color;\n"
+    "uniform sampler2D texture_sampler;\n"
+    "void main() {\n"
+    "  color = texture(texture_sampler, texel);\n"
+    "}\n";
+
+// Returns the number of work groups covering a number of invocations.
+GLuint NumGroups(const int num_invocations, const int group_size) {
+  return (num_invocations + group_size - 1) / group_size;
+}
+
+}  // namespace
+
+struct GpuDrivenRenderer::GpuMesh {
+  GLuint count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint padding;
+};
+
+struct GpuDrivenRenderer::GpuInstance {
+  GLfloat model[16];
+  GLfloat bounds_min[4];
+  GLfloat bounds_max[4];
+  GLuint mesh_texture[4];
+};
+
+bool GpuDrivenRenderer::IsSupported() {
+  return GLEW_VERSION_4_3;
+}
+
+GpuDrivenRenderer::GpuDrivenRenderer(const int width,
+                                     const int height,
+                                     const GLenum depth_format,
+                                     const DepthMode depth_mode,
+                                     const int max_num_instances,
+                                     const int num_textures)
+    : width_(width),
+      height_(height),
+      depth_format_(depth_format),
+      depth_mode_(depth_mode),
+      max_num_instances_(max_num_instances),
+      num_textures_(num_textures),
+      num_hi_z_levels_(1),
+      has_hi_z_(false),
+      meshes_uploaded_(false),
+      cull_program_id_(0),
+      hi_z_copy_program_id_(0),
+      hi_z_reduce_program_id_(0),
+      draw_program_id_(0) {
+  WVU_PROFILE_ZONE("GpuDrivenRenderer");
+  instances_.reserve(max_num_instances_);
+  while (std::max(width_, height_) >> num_hi_z_levels_ > 0) {
+    ++num_hi_z_levels_;
+  }
+
+  // The programs compile while the buffers and textures are created.
+  ProgramSources cull_sources;
+  cull_sources.compute = kCullShaderSrc;
+  cull_program_.BeginCreate(cull_sources, nullptr);
+  ProgramSources hi_z_copy_sources;
+  hi_z_copy_sources.compute = kHiZCopyShaderSrc;
+  hi_z_copy_program_.BeginCreate(hi_z_copy_sources, nullptr);
+  ProgramSources hi_z_reduce_sources;
+  hi_z_reduce_sources.compute = kHiZReduceShaderSrc;
+  hi_z_reduce_program_.BeginCreate(hi_z_reduce_sources, nullptr);
+  ProgramSources draw_sources;
+  draw_sources.vertex = kDrawVertexShaderSrc;
+  draw_sources.fragment = kDrawFragmentShaderSrc;
+  draw_program_.BeginCreate(draw_sources, nullptr);
+
+  glGenVertexArrays(1, &vertex_array_id_);
+  glGenBuffers(1, &vertex_buffer_id_);
+  glGenBuffers(1, &index_buffer_id_);
+  glGenBuffers(1, &instance_id_buffer_id_);
+  glGenBuffers(1, &mesh_buffer_id_);
+  glGenBuffers(1, &instance_buffer_id_);
+  glGenBuffers(1, &command_buffer_id_);
+  glGenBuffers(1, &counter_buffer_id_);
+
+  std::vector<GLuint> instance_ids(max_num_instances_);
+  for (int i = 0; i < max_num_instances_; ++i) instance_ids[i] = i;
+  glBindBuffer(GL_ARRAY_BUFFER, instance_id_buffer_id_);
+  glBufferData(GL_ARRAY_BUFFER, instance_ids.size() * sizeof(GLuint),
+               instance_ids.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instance_buffer_id_);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               max_num_instances_ * sizeof(GpuInstance), nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer_id_);
+  glBufferData(GL_SHADER_STORAGE_BUFFER,
+               num_textures_ * max_num_instances_ *
+                   sizeof(DrawElementsIndirectCommand),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_id_);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, num_textures_ * sizeof(GLuint),
+               nullptr, GL_DYNAMIC_COPY);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  // The depth buffer is copied into a texture the Hi-Z copy pass samples.
+  glGenTextures(1, &depth_texture_id_);
+  glBindTexture(GL_TEXTURE_2D, depth_texture_id_);
+  glTexStorage2D(GL_TEXTURE_2D, 1, depth_format_, width_, height_);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glGenFramebuffers(1, &depth_framebuffer_id_);
+  glBindFramebuffer(GL_FRAMEBUFFER, depth_framebuffer_id_);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                         GL_TEXTURE_2D, depth_texture_id_, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glGenTextures(1, &hi_z_texture_id_);
+  glBindTexture(GL_TEXTURE_2D, hi_z_texture_id_);
+  glTexStorage2D(GL_TEXTURE_2D, num_hi_z_levels_, GL_R32F, width_, height_);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  for (const std::pair<GpuProgram*, const char*>& program :
+       {std::make_pair(&cull_program_, "culling"),
+        std::make_pair(&hi_z_copy_program_, "Hi-Z copy"),
+        std::make_pair(&hi_z_reduce_program_, "Hi-Z reduction"),
+        std::make_pair(&draw_program_, "draw")}) {
+    std::string error_info_log;
+    if (!program.first->EndCreate(&error_info_log)) {
+      LOG(ERROR) << "Could not create the " << program.second
+                 << " program: " << error_info_log;
+    }
+  }
+  cull_program_id_ = cull_program_.program_id();
+  hi_z_copy_program_id_ = hi_z_copy_program_.program_id();
+  hi_z_reduce_program_id_ = hi_z_reduce_program_.program_id();
+  draw_program_id_ = draw_program_.program_id();
+}
+
+GpuDrivenRenderer::~GpuDrivenRenderer() {
+  glDeleteTextures(1, &hi_z_texture_id_);
+  glDeleteFramebuffers(1, &depth_framebuffer_id_);
+  glDeleteTextures(1, &depth_texture_id_);
+  glDeleteBuffers(1, &counter_buffer_id_);
+  glDeleteBuffers(1, &command_buffer_id_);
+  glDeleteBuffers(1, &instance_buffer_id_);
+  glDeleteBuffers(1, &mesh_buffer_id_);
+  glDeleteBuffers(1, &instance_id_buffer_id_);
+  glDeleteBuffers(1, &index_buffer_id_);
+  glDeleteBuffers(1, &vertex_buffer_id_);
+  glDeleteVertexArrays(1, &vertex_array_id_);
+}
+
+bool GpuDrivenRenderer::is_valid() const {
+  return cull_program_id_ != 0 && hi_z_copy_program_id_ != 0 &&
+         hi_z_reduce_program_id_ != 0 && draw_program_id_ != 0;
+}
+
+int GpuDrivenRenderer::num_meshes() const {
+  return meshes_.size();
+}
+
+int GpuDrivenRenderer::num_instances() const {
+  return instances_.size();
+}
+
+int GpuDrivenRenderer::AddMesh(const Eigen::MatrixXf& vertices,
+                               const std::vector<GLuint>& indices) {
+  CHECK(!meshes_uploaded_) << "Meshes must be added before the first frame.";
+  GpuMesh mesh;
+  mesh.first_index = mesh_indices_.size();
+  mesh.base_vertex = mesh_vertices_.size() / 3;
+  mesh.padding = 0;
+  mesh_vertices_.insert(mesh_vertices_.end(), vertices.data(),
+                        vertices.data() + vertices.size());
+  if (indices.empty()) {
+    for (int i = 0; i < vertices.cols(); ++i) mesh_indices_.push_back(i);
+  } else {
+    mesh_indices_.insert(mesh_indices_.end(), indices.begin(), indices.end());
+  }
+  mesh.count = mesh_indices_.size() - mesh.first_index;
+  meshes_.push_back(mesh);
+  return meshes_.size() - 1;
+}
+
+void GpuDrivenRenderer::UploadMeshes() {
+  WVU_PROFILE_ZONE("UploadMeshes");
+  glBindVertexArray(vertex_array_id_);
+  glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_id_);
+  glBufferData(GL_ARRAY_BUFFER, mesh_vertices_.size() * sizeof(GLfloat),
+               mesh_vertices_.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
+                        nullptr);
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_id_buffer_id_);
+  glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+  glVertexAttribDivisor(1, 1);
+  glEnableVertexAttribArray(1);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer_id_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh_indices_.size() * sizeof(GLuint),
+               mesh_indices_.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh_buffer_id_);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, meshes_.size() * sizeof(GpuMesh),
+               meshes_.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  // The geometry lives in the GPU from now on.
+  std::vector<GLfloat>().swap(mesh_vertices_);
+  std::vector<GLuint>().swap(mesh_indices_);
+  meshes_uploaded_ = true;
+}
+
+void GpuDrivenRenderer::BeginFrame() {
+  instances_.clear();
+}
+
+void GpuDrivenRenderer::AddInstance(const int mesh,
+                                    const Eigen::Matrix4f& model_matrix,
+                                    const Eigen::AlignedBox3f& bounds,
+                                    const int texture_index) {
+  DCHECK_LT(mesh, num_meshes());
+  DCHECK_LT(texture_index, num_textures_);
+  CHECK_LT(num_instances(), max_num_instances_) << "Too many instances.";
+  instances_.emplace_back();
+  GpuInstance& instance = instances_.back();
+  Eigen::Map<Eigen::Matrix4f>(instance.model) = model_matrix;
+  Eigen::Map<Eigen::Vector4f>(instance.bounds_min) =
+      bounds.min().homogeneous();
+  Eigen::Map<Eigen::Vector4f>(instance.bounds_max) =
+      bounds.max().homogeneous();
+  instance.mesh_texture[0] = mesh;
+  instance.mesh_texture[1] = texture_index;
+  instance.mesh_texture[2] = 0;
+  instance.mesh_texture[3] = 0;
+}
+
+void GpuDrivenRenderer::Cull(const Eigen::Matrix4f& view_projection) {
+  WVU_PROFILE_ZONE("GpuDrivenRenderer::Cull");
+  if (!meshes_uploaded_) UploadMeshes();
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instance_buffer_id_);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                  instances_.size() * sizeof(GpuInstance), instances_.data());
+  // Zeroed commands draw nothing.
+  const GLuint zero = 0;
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer_id_);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_id_);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                    GL_UNSIGNED_INT, &zero);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  if (instances_.empty()) return;
+
+  glUseProgram(cull_program_id_);
+  glUniformMatrix4fv(cull_program_.uniform_location(kViewProjectionUniform),
+                     1, GL_FALSE, view_projection.data());
+  glUniform1ui(cull_program_.uniform_location(kNumInstancesUniform),
+               instances_.size());
+  glUniform1ui(cull_program_.uniform_location(kMaxNumInstancesUniform),
+               max_num_instances_);
+  glUniform1i(cull_program_.uniform_location(kHasHiZUniform), has_hi_z_);
+  glUniform1i(cull_program_.uniform_location(kNumHiZLevelsUniform),
+              num_hi_z_levels_);
+  glUniform1i(cull_program_.uniform_location(kHiZUniform), 0);
+  glUniform1i(cull_program_.uniform_location(kReverseZUniform),
+              depth_mode_ == DepthMode::kReverseZ);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hi_z_texture_id_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_buffer_id_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mesh_buffer_id_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, command_buffer_id_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, counter_buffer_id_);
+  glDispatchCompute(NumGroups(instances_.size(), kCullGroupSize), 1, 1);
+  // The draws read the commands and their counts written by the pass.
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  CountStateChanges(7);
+}
+
+void GpuDrivenRenderer::Draw(const Eigen::Matrix4f& projection,
+                             const Eigen::Matrix4f& view,
+                             const GLuint* texture_ids) {
+  WVU_PROFILE_ZONE("GpuDrivenRenderer::Draw");
+  if (!meshes_uploaded_) UploadMeshes();
+  draw_program_.Use();
+  glUniformMatrix4fv(draw_program_.uniform_location(kViewUniform), 1,
+                     GL_FALSE, view.data());
+  glUniformMatrix4fv(draw_program_.uniform_location(kProjectionUniform), 1,
+                     GL_FALSE, projection.data());
+  glBindVertexArray(vertex_array_id_);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instance_buffer_id_);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_id_);
+  const bool has_draw_counts = GLEW_ARB_indirect_parameters;
+  if (has_draw_counts) {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, counter_buffer_id_);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  CountStateChanges(4);
+  for (int i = 0; i < num_textures_; ++i) {
+    glBindTexture(GL_TEXTURE_2D, texture_ids[i]);
+    const GLintptr commands_offset =
+        i * max_num_instances_ * sizeof(DrawElementsIndirectCommand);
+    if (has_draw_counts) {
+      glMultiDrawElementsIndirectCountARB(
+          GL_TRIANGLES, GL_UNSIGNED_INT,
+          reinterpret_cast<const void*>(commands_offset), i * sizeof(GLuint),
+          max_num_instances_, 0);
+    } else {
+      glMultiDrawElementsIndirect(
+          GL_TRIANGLES, GL_UNSIGNED_INT,
+          reinterpret_cast<const void*>(commands_offset), max_num_instances_,
+          0);
+    }
+    // The number of triangles drawn is only known by the GPU.
+    CountDrawCall(0);
+    CountStateChanges(1);
+  }
+  if (has_draw_counts) glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  CountStateChanges(2);
+}
+
+void GpuDrivenRenderer::BuildHiZ(const GLuint framebuffer_id) {
+  WVU_PROFILE_ZONE("GpuDrivenRenderer::BuildHiZ");
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_id);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_framebuffer_id_);
+  glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);
+
+  glUseProgram(hi_z_copy_program_id_);
+  glUniform1i(hi_z_copy_program_.uniform_location(kDepthUniform), 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, depth_texture_id_);
+  glBindImageTexture(0, hi_z_texture_id_, 0, GL_FALSE, 0, GL_WRITE_ONLY,
+                     GL_R32F);
+  glDispatchCompute(NumGroups(width_, kHiZGroupSize),
+                    NumGroups(height_, kHiZGroupSize), 1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glUseProgram(hi_z_reduce_program_id_);
+  glUniform1i(hi_z_reduce_program_.uniform_location(kReverseZUniform),
+              depth_mode_ == DepthMode::kReverseZ);
+  for (int level = 1; level < num_hi_z_levels_; ++level) {
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(0, hi_z_texture_id_, level - 1, GL_FALSE, 0,
+                       GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, hi_z_texture_id_, level, GL_FALSE, 0,
+                       GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute(NumGroups(std::max(width_ >> level, 1), kHiZGroupSize),
+                      NumGroups(std::max(height_ >> level, 1), kHiZGroupSize),
+                      1);
+  }
+  // The culling pass samples the pyramid.
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  has_hi_z_ = true;
+  CountStateChanges(6);
+}
+
+int GpuDrivenRenderer::ReadNumVisibleInstances() const {
+  std::vector<GLuint> counters(num_textures_);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, counter_buffer_id_);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+                     counters.size() * sizeof(GLuint), counters.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  int num_visible_instances = 0;
+  for (const GLuint counter : counters) num_visible_instances += counter;
+  return num_visible_instances;
+}
+
+float GpuDrivenRenderer::ReadHiZDepth(const int level,
+                                      const int x,
+                                      const int y) const {
+  const int level_width = std::max(width_ >> level, 1);
+  const int level_height = std::max(height_ >> level, 1);
+  std::vector<GLfloat> depths(level_width * level_height);
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, hi_z_texture_id_);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, depths.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+  return depths[y * level_width + x];
+}
+
+}  // namespace wvu
@@ -0,0 +1,221 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GPU_DRIVEN_RENDERER_H_
+#define GPU_DRIVEN_RENDERER_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <GL/glew.h>
+
+#include "camera_utils.h"
+#include "gpu_program.h"
+
+namespace wvu {
+// Culls and draws the instances of a scene on the GPU, so the CPU cost of a
+// frame does not grow with the number of instances.
+//
+// The meshes share one vertex buffer and one index buffer. Every frame, the
+// instances are uploaded to a shader storage buffer, and a compute pass tests
+// their bounds against the view frustum and a hierarchical-Z (Hi-Z) pyramid,
+// i.e., the mipmaps of the farthest depth of the last frame. An instance whose
+// nearest depth is behind the farthest depth under its bounds is hidden. The
+// visible instances are appended to a compacted buffer of draw commands per
+// texture, which glMultiDrawElementsIndirect() consumes without the CPU ever
+// reading it. When ARB_indirect_parameters is available, the number of
+// commands is read from the GPU as well; otherwise the unused commands are
+// zeroed and draw nothing.
+//
+// The Hi-Z pyramid comes from the last frame, so an instance that was hidden
+// and whose occluders move away reappears one frame late.
+//
+//   GpuDrivenRenderer renderer(width, height, depth_format, depth_mode,
+//                              max_num_instances, 4);
+//   renderer.AddMesh(vertices, indices);
+//   while (...) {
+//     renderer.BeginFrame();
+//     renderer.AddInstance(mesh, model_matrix, bounds, texture_index);
+//     renderer.Cull(projection * view);
+//     renderer.Draw(projection, view, texture_ids);
+//     renderer.BuildHiZ(framebuffer_id);
+//   }
+//
+// The renderer requires a current OpenGL 4.3 context, see IsSupported().
+class GpuDrivenRenderer {
+ public:
+  // Returns true if the current context has compute shaders, shader storage
+  // buffers and indirect multi-draws, i.e., OpenGL 4.3.
+  static bool IsSupported();
+
+  // Params:
+  //   width  Width of the framebuffer whose depth feeds the Hi-Z pyramid.
+  //   height  Height of the framebuffer.
+  //   depth_format  Internal format of the depth buffer of the framebuffer.
+  //   depth_mode  The depth mode of the projections and the depth test.
+  //   max_num_instances  Maximum number of instances of a frame.
+  //   num_textures  Number of textures the instances are drawn with.
+  GpuDrivenRenderer(const int width,
+                    const int height,
+                    const GLenum depth_format,
+                    const DepthMode depth_mode,
+                    const int max_num_instances,
+                    const int num_textures);
+  ~GpuDrivenRenderer();
+
+  GpuDrivenRenderer(const GpuDrivenRenderer&) = delete;
+  GpuDrivenRenderer& operator=(const GpuDrivenRenderer&) = delete;
+
+  // Returns false if a shader program did not compile.
+  bool is_valid() const;
+
+  // Adds a mesh to the shared buffers and returns its index. The meshes must
+  // be added before the first frame.
+  // Params:
+  //   vertices  The 3xN vertices of the mesh, whose x and y are also the
+  //     texel, as in the vertex shader of the scene.
+  //   indices  The indices of the triangles. If empty, every three
+  //     consecutive vertices make a triangle.
+  int AddMesh(const Eigen::MatrixXf& vertices,
+              const std::vector<GLuint>& indices);
+
+  // Starts a frame without instances.
+  void BeginFrame();
+
+  // Adds an instance to the current frame.
+  // Params:
+  //   mesh  The index of the mesh.
+  //   model_matrix  The model matrix of the instance.
+  //   bounds  The bounds of the instance in world coordinates.
+  //   texture_index  The index of the texture passed to Draw().
+  void AddInstance(const int mesh,
+                   const Eigen::Matrix4f& model_matrix,
+                   const Eigen::AlignedBox3f& bounds,
+                   const int texture_index);
+
+  // Uploads the instances and culls them on the GPU against the frustum and
+  // the Hi-Z pyramid of the last BuildHiZ(), writing the draw commands.
+  // Params:
+  //   view_projection  The projection matrix times the view matrix.
+  void Cull(const Eigen::Matrix4f& view_projection);
+
+  // Draws the instances that survived Cull() with a multi-draw per texture.
+  // The caller sets the depth test and the polygon mode.
+  // Params:
+  //   projection  The projection matrix.
+  //   view  The view matrix.
+  //   texture_ids  The num_textures() textures.
+  void Draw(const Eigen::Matrix4f& projection,
+            const Eigen::Matrix4f& view,
+            const GLuint* texture_ids);
+
+  // Builds the Hi-Z pyramid the next frame is culled against from the depth
+  // buffer of a framebuffer, which must be width() x height() and have a
+  // depth and stencil buffer of the depth format.
+  void BuildHiZ(const GLuint framebuffer_id);
+
+  // Reads back the number of instances the last Cull() found visible. This
+  // waits for the GPU and is meant for tests and debugging.
+  int ReadNumVisibleInstances() const;
+
+  // Returns the farthest depth of a texel of a level of the Hi-Z pyramid.
+  // This waits for the GPU and is meant for tests and debugging.
+  float ReadHiZDepth(const int level, const int x, const int y) const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int num_hi_z_levels() const { return num_hi_z_levels_; }
+  int num_textures() const { return num_textures_; }
+  int num_meshes() const;
+  int num_instances() const;
+
+ private:
+  struct GpuMesh;
+  struct GpuInstance;
+
+  // Uploads the meshes added since the last upload.
+  void UploadMeshes();
+
+  const int width_;
+  const int height_;
+  const GLenum depth_format_;
+  const DepthMode depth_mode_;
+  const int max_num_instances_;
+  const int num_textures_;
+  int num_hi_z_levels_;
+  // False until the first BuildHiZ(), in which case only the frustum culls.
+  bool has_hi_z_;
+  bool meshes_uploaded_;
+
+  // The meshes in the shared buffers, and their vertices and indices until
+  // they are uploaded.
+  std::vector<GpuMesh> meshes_;
+  std::vector<GLfloat> mesh_vertices_;
+  std::vector<GLuint> mesh_indices_;
+  // The instances of the current frame.
+  std::vector<GpuInstance> instances_;
+
+  GpuProgram cull_program_;
+  GpuProgram hi_z_copy_program_;
+  GpuProgram hi_z_reduce_program_;
+  GpuProgram draw_program_;
+  GLuint cull_program_id_;
+  GLuint hi_z_copy_program_id_;
+  GLuint hi_z_reduce_program_id_;
+  GLuint draw_program_id_;
+
+  GLuint vertex_array_id_;
+  GLuint vertex_buffer_id_;
+  GLuint index_buffer_id_;
+  // The index of every instance, read by the vertex shader through the base
+  // instance of the draw commands.
+  GLuint instance_id_buffer_id_;
+  GLuint mesh_buffer_id_;
+  GLuint instance_buffer_id_;
+  // num_textures * max_num_instances draw commands, and a counter per
+  // texture.
+  GLuint command_buffer_id_;
+  GLuint counter_buffer_id_;
+
+  // The copy of the depth buffer and its framebuffer object, and the Hi-Z
+  // pyramid.
+  GLuint depth_texture_id_;
+  GLuint depth_framebuffer_id_;
+  GLuint hi_z_texture_id_;
+};
+
+}  // namespace wvu
+
+#endif  // GPU_DRIVEN_RENDERER_H_
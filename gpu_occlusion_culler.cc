@@ -0,0 +1,246 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gpu_occlusion_culler.h"
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "camera_utils.h"
+#include "frame_statistics.h"
+#include "gpu_program.h"
+
+namespace wvu {
+namespace {
+// The bounding box shader stretches the unit cube over the box.
+const char kBoxVertexShaderSrc[] =
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 position;\n"
+    "uniform mat4 view_projection;\n"
+    "uniform vec3 box_min;\n"
+    "uniform vec3 box_max;\n"
+    "void main() {\n"
+    "  gl_Position =\n"
+    "      view_projection * vec4(mix(box_min, box_max, position), 1.0f);\n"
+    "}\n";
+const char kBoxFragmentShaderSrc[] =
+    "#version 330 core\n"
+    "out vec4 color;\n"
+    "void main() {\n"
+    "  color = vec4(1.0f);\n"
+    "}\n";
+
+// The corners of the unit cube and its 12 triangles.
+constexpr GLfloat kCubeVertices[] = {
+    0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+    1.0f, 1.0f, 0.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,
+    0.0f, 1.0f, 1.0f,  1.0f, 1.0f, 1.0f};
+constexpr GLuint kCubeIndices[] = {
+    0, 2, 1, 1, 2, 3,  // z = 0.
+    4, 5, 6, 5, 7, 6,  // z = 1.
+    0, 1, 4, 1, 5, 4,  // y = 0.
+    2, 6, 3, 3, 6, 7,  // y = 1.
+    0, 4, 2, 2, 4, 6,  // x = 0.
+    1, 3, 5, 3, 7, 5   // x = 1.
+};
+constexpr int kNumCubeIndices = sizeof(kCubeIndices) / sizeof(GLuint);
+
+// Returns true if a corner of the box is in front of the near plane, i.e., if
+// the camera may be inside the box, whose faces would then be clipped.
+bool CrossesNearPlane(const Eigen::Matrix4f& view_projection,
+                      const Eigen::AlignedBox3f& bounds) {
+  for (int i = 0; i < 8; ++i) {
+    const Eigen::Vector3f corner =
+        bounds.corner(static_cast<Eigen::AlignedBox3f::CornerType>(i));
+    const Eigen::Vector4f clip_position =
+        view_projection * corner.homogeneous();
+    if (clip_position.z() < -clip_position.w()) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+GpuOcclusionCuller::GpuOcclusionCuller(const int num_objects,
+                                       const DepthMode depth_mode)
+    : objects_(num_objects),
+      frame_(0),
+      current_object_(-1),
+      depth_mode_(depth_mode),
+      view_projection_(Eigen::Matrix4f::Identity()),
+      box_program_id_(0),
+      box_view_projection_location_(-1),
+      box_min_location_(-1),
+      box_max_location_(-1),
+      box_vertex_array_id_(0),
+      box_vertex_buffer_id_(0),
+      box_element_buffer_id_(0) {
+  for (ObjectQuery& object : objects_) {
+    glGenQueries(1, &object.query);
+    object.visible = true;
+    object.pending = false;
+    object.bounding_box_frame = -1;
+  }
+
+  ProgramSources box_sources;
+  box_sources.vertex = kBoxVertexShaderSrc;
+  box_sources.fragment = kBoxFragmentShaderSrc;
+  std::string error_info_log;
+  if (!box_program_.Create(box_sources, nullptr, &error_info_log)) {
+    LOG(ERROR) << "Could not create the bounding box program: "
+               << error_info_log;
+  }
+  box_program_id_ = box_program_.program_id();
+  box_view_projection_location_ =
+      box_program_.uniform_location(HashUniformName("view_projection"));
+  box_min_location_ = box_program_.uniform_location(HashUniformName("box_min"));
+  box_max_location_ = box_program_.uniform_location(HashUniformName("box_max"));
+
+  glGenVertexArrays(1, &box_vertex_array_id_);
+  glGenBuffers(1, &box_vertex_buffer_id_);
+  glGenBuffers(1, &box_element_buffer_id_);
+  glBindVertexArray(box_vertex_array_id_);
+  glBindBuffer(GL_ARRAY_BUFFER, box_vertex_buffer_id_);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(kCubeVertices), kCubeVertices,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, box_element_buffer_id_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kCubeIndices), kCubeIndices,
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat),
+                        nullptr);
+  glEnableVertexAttribArray(0);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GpuOcclusionCuller::~GpuOcclusionCuller() {
+  for (ObjectQuery& object : objects_) {
+    glDeleteQueries(1, &object.query);
+  }
+  glDeleteBuffers(1, &box_element_buffer_id_);
+  glDeleteBuffers(1, &box_vertex_buffer_id_);
+  glDeleteVertexArrays(1, &box_vertex_array_id_);
+}
+
+void GpuOcclusionCuller::BeginFrame() {
+  DCHECK_EQ(current_object_, -1) << "The frame began inside a query.";
+  ++frame_;
+  for (ObjectQuery& object : objects_) {
+    if (!object.pending) continue;
+    GLint available = 0;
+    glGetQueryObjectiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) continue;
+    GLuint num_samples = 0;
+    glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &num_samples);
+    object.visible = num_samples > 0;
+    object.pending = false;
+  }
+}
+
+void GpuOcclusionCuller::BeginQuery(const int object) {
+  DCHECK_EQ(current_object_, -1) << "Occlusion queries cannot be nested.";
+  ObjectQuery& object_query = objects_[object];
+  if (object_query.pending) return;
+  glBeginQuery(GL_SAMPLES_PASSED, object_query.query);
+  object_query.pending = true;
+  current_object_ = object;
+}
+
+void GpuOcclusionCuller::EndQuery() {
+  if (current_object_ == -1) return;
+  glEndQuery(GL_SAMPLES_PASSED);
+  current_object_ = -1;
+}
+
+void GpuOcclusionCuller::BeginBoundingBoxes(
+    const Eigen::Matrix4f& view_projection) {
+  view_projection_ =
+      ConvertToStandardDepthProjectionMatrix(view_projection, depth_mode_);
+  glUseProgram(box_program_id_);
+  glUniformMatrix4fv(box_view_projection_location_, 1, GL_FALSE,
+                     view_projection.data());
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glBindVertexArray(box_vertex_array_id_);
+  CountStateChanges(5);
+}
+
+void GpuOcclusionCuller::DrawBoundingBox(const int object,
+                                         const Eigen::AlignedBox3f& bounds) {
+  ObjectQuery& object_query = objects_[object];
+  if (object_query.pending) return;
+  // The faces of the box are clipped when the camera is inside it, so the
+  // object is assumed visible and drawn unconditionally.
+  if (CrossesNearPlane(view_projection_, bounds)) {
+    object_query.visible = true;
+    return;
+  }
+  glUniform3fv(box_min_location_, 1, bounds.min().data());
+  glUniform3fv(box_max_location_, 1, bounds.max().data());
+  glBeginQuery(GL_SAMPLES_PASSED, object_query.query);
+  glDrawElements(GL_TRIANGLES, kNumCubeIndices, GL_UNSIGNED_INT, nullptr);
+  glEndQuery(GL_SAMPLES_PASSED);
+  object_query.pending = true;
+  object_query.bounding_box_frame = frame_;
+}
+
+void GpuOcclusionCuller::EndBoundingBoxes() {
+  glBindVertexArray(0);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  CountStateChanges(3);
+}
+
+void GpuOcclusionCuller::BeginConditionalRender(const int object) {
+  DCHECK_EQ(current_object_, -1) << "Conditional renders cannot be nested.";
+  const ObjectQuery& object_query = objects_[object];
+  // Without a bounding box in this frame, the object is drawn.
+  if (object_query.bounding_box_frame != frame_) return;
+  glBeginConditionalRender(object_query.query, GL_QUERY_NO_WAIT);
+  current_object_ = object;
+}
+
+void GpuOcclusionCuller::EndConditionalRender() {
+  if (current_object_ == -1) return;
+  glEndConditionalRender();
+  current_object_ = -1;
+}
+
+}  // namespace wvu
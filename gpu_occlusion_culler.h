@@ -0,0 +1,167 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GPU_OCCLUSION_CULLER_H_
+#define GPU_OCCLUSION_CULLER_H_
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <GL/glew.h>
+
+#include "camera_utils.h"
+#include "gpu_program.h"
+
+namespace wvu {
+// Skips the draws of objects hidden behind the rest of the scene with hardware
+// occlusion queries, never waiting for their results (see Bittner et al.,
+// "Coherent Hierarchical Culling", 2004, and Mattausch et al., "CHC++", 2008).
+//
+// Visibility is temporally coherent, so the culler trusts the last result of
+// every object. The objects visible in the last result are drawn first, each
+// inside a query that tells if it is still visible. The bounding boxes of the
+// hidden objects are then rendered into the depth buffer of the visible ones
+// with color and depth writes disabled, each inside a query. Finally, the
+// hidden objects are drawn with conditional rendering on the query of their
+// box, so the GPU itself discards the draws of the boxes that passed no
+// sample. The query results are read a frame later, when they are available,
+// and a result that is not available yet keeps the last visibility.
+//
+//   GpuOcclusionCuller culler(num_objects, depth_mode);
+//   while (...) {
+//     culler.BeginFrame();
+//     for (visible objects) {
+//       culler.BeginQuery(object);
+//       <draw object>
+//       culler.EndQuery();
+//     }
+//     culler.BeginBoundingBoxes(projection * view);
+//     for (hidden objects) culler.DrawBoundingBox(object, bounds);
+//     culler.EndBoundingBoxes();
+//     for (hidden objects) {
+//       culler.BeginConditionalRender(object);
+//       <draw object>
+//       culler.EndConditionalRender();
+//     }
+//   }
+//
+// The culler requires a current OpenGL context.
+class GpuOcclusionCuller {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // Params:
+  //   num_objects  Number of objects, which are identified by their index.
+  //     The same index must refer to the same object every frame.
+  //   depth_mode  The depth mode of the projections and the depth test.
+  GpuOcclusionCuller(const int num_objects, const DepthMode depth_mode);
+  ~GpuOcclusionCuller();
+
+  GpuOcclusionCuller(const GpuOcclusionCuller&) = delete;
+  GpuOcclusionCuller& operator=(const GpuOcclusionCuller&) = delete;
+
+  // Returns false if the shader program of the bounding boxes did not
+  // compile.
+  bool is_valid() const { return box_program_id_ != 0; }
+
+  // Reads the results of the queries the GPU has finished and starts a new
+  // frame.
+  void BeginFrame();
+
+  // Returns true if the last result of the object found it visible. Objects
+  // never queried are visible.
+  bool IsVisible(const int object) const { return objects_[object].visible; }
+
+  // Counts the samples of the draws of a visible object until EndQuery().
+  // Nothing is counted if the previous query of the object is still in
+  // flight. Queries cannot be nested.
+  void BeginQuery(const int object);
+  void EndQuery();
+
+  // Renders the bounding boxes of the hidden objects, each inside a query.
+  // BeginBoundingBoxes() uses the program of the boxes, disables the color
+  // and depth writes and fills the polygons. EndBoundingBoxes() enables the
+  // writes again; the caller restores its program and polygon mode.
+  // Params:
+  //   view_projection  The projection matrix times the view matrix.
+  void BeginBoundingBoxes(const Eigen::Matrix4f& view_projection);
+  // Params:
+  //   object  The hidden object.
+  //   bounds  The bounds of the object in world coordinates.
+  void DrawBoundingBox(const int object, const Eigen::AlignedBox3f& bounds);
+  void EndBoundingBoxes();
+
+  // The draws until EndConditionalRender() are discarded by the GPU if the
+  // bounding box of the object passed no sample in this frame. The GPU draws
+  // them if the result is not ready yet, so the CPU never waits.
+  void BeginConditionalRender(const int object);
+  void EndConditionalRender();
+
+  int num_objects() const { return objects_.size(); }
+
+ private:
+  struct ObjectQuery {
+    GLuint query;
+    // Result of the last query read.
+    bool visible;
+    // True while the GPU has not finished the last query.
+    bool pending;
+    // Frame of the last bounding box query, which only the conditional
+    // rendering of the same frame can use.
+    int bounding_box_frame;
+  };
+
+  std::vector<ObjectQuery> objects_;
+  int frame_;
+  // The object of the current query or conditional rendering, or -1.
+  int current_object_;
+  const DepthMode depth_mode_;
+  // The view projection matrix of the boxes, in the standard depth mode.
+  Eigen::Matrix4f view_projection_;
+
+  // A unit cube drawn for the bounding boxes, and its shader program.
+  GpuProgram box_program_;
+  GLuint box_program_id_;
+  GLint box_view_projection_location_;
+  GLint box_min_location_;
+  GLint box_max_location_;
+  GLuint box_vertex_array_id_;
+  GLuint box_vertex_buffer_id_;
+  GLuint box_element_buffer_id_;
+};
+
+}  // namespace wvu
+
+#endif  // GPU_OCCLUSION_CULLER_H_
@@ -0,0 +1,139 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gpu_profiler.h"
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "frame_statistics.h"
+
+namespace wvu {
+namespace {
+constexpr double kMillisecondsPerNanosecond = 1e-6;
+
+}  // namespace
+
+GpuProfiler::GpuProfiler(FrameStatistics* statistics)
+    : statistics_(statistics),
+      current_frame_(0),
+      inside_pass_(false),
+      num_dropped_frames_(0) {
+  for (FrameQueries& frame : frames_) {
+    glGenQueries(2 * GpuFrameTiming::kMaxPasses, frame.queries);
+    frame.num_passes = 0;
+    frame.pending = false;
+  }
+}
+
+GpuProfiler::~GpuProfiler() {
+  for (FrameQueries& frame : frames_) {
+    glDeleteQueries(2 * GpuFrameTiming::kMaxPasses, frame.queries);
+  }
+}
+
+void GpuProfiler::BeginFrame() {
+  // Resolve the frames in flight from the oldest to the newest, so the
+  // statistics receive them in order.
+  for (int i = 1; i <= kNumFramesInFlight; ++i) {
+    FrameQueries& frame = frames_[(current_frame_ + i) % kNumFramesInFlight];
+    if (frame.pending && !ResolveFrame(&frame)) break;
+  }
+
+  current_frame_ = (current_frame_ + 1) % kNumFramesInFlight;
+  FrameQueries& frame = frames_[current_frame_];
+  if (frame.pending) {
+    // The GPU is more than kNumFramesInFlight frames behind. Reusing the
+    // queries discards their results.
+    ++num_dropped_frames_;
+    frame.pending = false;
+  }
+  frame.num_passes = 0;
+}
+
+void GpuProfiler::EndFrame() {
+  DCHECK(!inside_pass_) << "The frame ended inside a pass.";
+  FrameQueries& frame = frames_[current_frame_];
+  frame.pending = frame.num_passes > 0;
+}
+
+void GpuProfiler::BeginPass(const char* name) {
+  DCHECK(!inside_pass_) << "GPU passes cannot be nested.";
+  FrameQueries& frame = frames_[current_frame_];
+  if (frame.num_passes == GpuFrameTiming::kMaxPasses) return;
+  frame.pass_names[frame.num_passes] = name;
+  glQueryCounter(frame.queries[2 * frame.num_passes], GL_TIMESTAMP);
+  inside_pass_ = true;
+}
+
+void GpuProfiler::EndPass() {
+  if (!inside_pass_) return;
+  FrameQueries& frame = frames_[current_frame_];
+  glQueryCounter(frame.queries[2 * frame.num_passes + 1], GL_TIMESTAMP);
+  ++frame.num_passes;
+  inside_pass_ = false;
+}
+
+bool GpuProfiler::ResolveFrame(FrameQueries* frame) {
+  // Queries complete in order, so the last one tells if the frame finished.
+  GLint available = 0;
+  glGetQueryObjectiv(frame->queries[2 * frame->num_passes - 1],
+                     GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) return false;
+
+  GpuFrameTiming timing;
+  timing.num_passes = frame->num_passes;
+  GLuint64 first_timestamp = 0;
+  GLuint64 last_timestamp = 0;
+  for (int i = 0; i < frame->num_passes; ++i) {
+    GLuint64 begin_timestamp = 0;
+    GLuint64 end_timestamp = 0;
+    glGetQueryObjectui64v(frame->queries[2 * i], GL_QUERY_RESULT,
+                          &begin_timestamp);
+    glGetQueryObjectui64v(frame->queries[2 * i + 1], GL_QUERY_RESULT,
+                          &end_timestamp);
+    timing.pass_names[i] = frame->pass_names[i];
+    timing.pass_milliseconds[i] =
+        kMillisecondsPerNanosecond * (end_timestamp - begin_timestamp);
+    if (i == 0) first_timestamp = begin_timestamp;
+    last_timestamp = end_timestamp;
+  }
+  timing.total_milliseconds =
+      kMillisecondsPerNanosecond * (last_timestamp - first_timestamp);
+  frame->pending = false;
+  if (statistics_ != nullptr) statistics_->AddGpuFrame(timing);
+  return true;
+}
+
+}  // namespace wvu
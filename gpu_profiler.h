@@ -0,0 +1,124 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GPU_PROFILER_H_
+#define GPU_PROFILER_H_
+
+#include <GL/glew.h>
+
+#include "frame_statistics.h"
+
+namespace wvu {
+// Measures the GPU time of the passes of every frame with timestamp queries.
+// The queries of a frame are read a few frames later, once the GPU has
+// finished it, so the profiler never stalls the CPU. If the results of a frame
+// are still not available when its queries are needed again, the frame is
+// dropped from the statistics instead of waiting for the GPU.
+//
+//   GpuProfiler gpu_profiler(&frame_statistics);
+//   while (...) {
+//     gpu_profiler.BeginFrame();
+//     {
+//       ScopedGpuPass pass(&gpu_profiler, "Draw");
+//       ...
+//     }
+//     gpu_profiler.EndFrame();
+//   }
+//
+// The profiler requires a current OpenGL context.
+class GpuProfiler {
+ public:
+  // Number of frames the GPU may lag behind before results are dropped.
+  static constexpr int kNumFramesInFlight = 4;
+
+  // Params:
+  //   statistics  Receives the timing of every frame. Not owned.
+  explicit GpuProfiler(FrameStatistics* statistics);
+  ~GpuProfiler();
+
+  GpuProfiler(const GpuProfiler&) = delete;
+  GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+  // Collects the results of the finished frames and starts a new frame.
+  void BeginFrame();
+  void EndFrame();
+
+  // Starts and ends a pass of the current frame. Passes cannot be nested. The
+  // name must be a string literal.
+  void BeginPass(const char* name);
+  void EndPass();
+
+  int num_dropped_frames() const { return num_dropped_frames_; }
+
+ private:
+  struct FrameQueries {
+    // Two timestamp queries per pass: its beginning and its end.
+    GLuint queries[2 * GpuFrameTiming::kMaxPasses];
+    const char* pass_names[GpuFrameTiming::kMaxPasses];
+    int num_passes;
+    bool pending;
+  };
+
+  // Reads the results of a frame if the GPU finished it. Returns false if the
+  // results are not available yet.
+  bool ResolveFrame(FrameQueries* frame);
+
+  FrameStatistics* statistics_;
+  FrameQueries frames_[kNumFramesInFlight];
+  int current_frame_;
+  bool inside_pass_;
+  int num_dropped_frames_;
+};
+
+// Measures the GPU time of a scope as a pass.
+class ScopedGpuPass {
+ public:
+  // The profiler may be null, in which case nothing is measured.
+  ScopedGpuPass(GpuProfiler* profiler, const char* name) : profiler_(profiler) {
+    if (profiler_ != nullptr) profiler_->BeginPass(name);
+  }
+  ~ScopedGpuPass() {
+    if (profiler_ != nullptr) profiler_->EndPass();
+  }
+
+  ScopedGpuPass(const ScopedGpuPass&) = delete;
+  ScopedGpuPass& operator=(const ScopedGpuPass&) = delete;
+
+ private:
+  GpuProfiler* profiler_;
+};
+
+}  // namespace wvu
+
+#endif  // GPU_PROFILER_H_
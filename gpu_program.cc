@@ -0,0 +1,412 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gpu_program.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+namespace {
+constexpr uint32_t kCacheFileMagic = 0x42505657;  // "WVPB"
+constexpr uint32_t kCacheFileVersion = 1;
+
+// The header of the file of a binary, followed by the binary.
+struct CacheFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t binary_format;
+  uint32_t binary_size;
+};
+
+// FNV-1a hash of a string, preceded by its size so consecutive strings cannot
+// be confused.
+uint64_t HashString(const std::string& text, uint64_t hash) {
+  const uint64_t size = text.size();
+  const uint8_t* size_bytes = reinterpret_cast<const uint8_t*>(&size);
+  for (size_t i = 0; i < sizeof(size); ++i) {
+    hash ^= size_bytes[i];
+    hash *= 1099511628211ull;
+  }
+  for (const char character : text) {
+    hash ^= static_cast<uint8_t>(character);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string GetGlString(const GLenum name) {
+  const GLubyte* value = glGetString(name);
+  return value == nullptr ? "" : reinterpret_cast<const char*>(value);
+}
+
+// Starts compiling a shader and attaches it to the program. Returns the
+// shader, or zero if the source is empty.
+GLuint AttachShader(const GLenum type,
+                    const std::string& source,
+                    const GLuint program_id) {
+  if (source.empty()) return 0;
+  const GLuint shader = glCreateShader(type);
+  const char* source_data = source.c_str();
+  glShaderSource(shader, 1, &source_data, nullptr);
+  glCompileShader(shader);
+  glAttachShader(program_id, shader);
+  return shader;
+}
+
+bool HasParallelShaderCompile() {
+  return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+}  // namespace
+
+bool EnableParallelShaderCompile() {
+  if (!HasParallelShaderCompile()) return false;
+  // The maximum value lets the driver pick the number of threads. Both
+  // extensions share GL_COMPLETION_STATUS but name the entry point apart.
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  } else {
+    glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+  }
+  return true;
+}
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& directory)
+    : directory_(directory),
+      enabled_(false),
+      driver_key_(14695981039346656037ull),
+      num_hits_(0),
+      num_misses_(0) {
+  GLint num_binary_formats = 0;
+  if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_binary_formats);
+  }
+  if (num_binary_formats == 0) {
+    LOG(WARNING) << "The driver cannot store program binaries.";
+    return;
+  }
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOG(WARNING) << "Could not create " << directory_ << ": "
+                 << std::strerror(errno);
+    return;
+  }
+  for (const GLenum name :
+       {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION}) {
+    driver_key_ = HashString(GetGlString(name), driver_key_);
+  }
+  enabled_ = true;
+}
+
+uint64_t ProgramBinaryCache::ComputeKey(const ProgramSources& sources) const {
+  uint64_t key = driver_key_;
+  key = HashString(sources.vertex, key);
+  key = HashString(sources.fragment, key);
+  key = HashString(sources.compute, key);
+  return key;
+}
+
+std::string ProgramBinaryCache::GetFilepath(const uint64_t key) const {
+  char filename[32];
+  std::snprintf(filename, sizeof(filename), "%016" PRIx64 ".bin", key);
+  return directory_ + "/" + filename;
+}
+
+bool ProgramBinaryCache::Load(const ProgramSources& sources,
+                              const GLuint program_id) {
+  WVU_PROFILE_ZONE("ProgramBinaryCache::Load");
+  if (!enabled_) return false;
+  const uint64_t key = ComputeKey(sources);
+  FILE* file = std::fopen(GetFilepath(key).c_str(), "rb");
+  if (file == nullptr) {
+    ++num_misses_;
+    return false;
+  }
+  CacheFileHeader header;
+  std::vector<uint8_t> binary;
+  bool valid = std::fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic == kCacheFileMagic &&
+               header.version == kCacheFileVersion && header.key == key;
+  if (valid) {
+    binary.resize(header.binary_size);
+    valid = std::fread(binary.data(), 1, binary.size(), file) == binary.size();
+  }
+  std::fclose(file);
+  GLint success = GL_FALSE;
+  if (valid) {
+    glProgramBinary(program_id, header.binary_format, binary.data(),
+                    binary.size());
+    glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+  }
+  if (!success) {
+    ++num_misses_;
+    return false;
+  }
+  ++num_hits_;
+  return true;
+}
+
+bool ProgramBinaryCache::Store(const ProgramSources& sources,
+                               const GLuint program_id) {
+  WVU_PROFILE_ZONE("ProgramBinaryCache::Store");
+  if (!enabled_) return false;
+  GLint binary_size = 0;
+  glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+  if (binary_size <= 0) return false;
+  std::vector<uint8_t> binary(binary_size);
+  GLenum binary_format;
+  glGetProgramBinary(program_id, binary_size, &binary_size, &binary_format,
+                     binary.data());
+
+  CacheFileHeader header;
+  header.magic = kCacheFileMagic;
+  header.version = kCacheFileVersion;
+  header.key = ComputeKey(sources);
+  header.binary_format = binary_format;
+  header.binary_size = binary_size;
+  const std::string filepath = GetFilepath(header.key);
+  const std::string temporary_filepath =
+      filepath + "." + std::to_string(getpid()) + ".tmp";
+  FILE* file = std::fopen(temporary_filepath.c_str(), "wb");
+  if (file == nullptr) {
+    LOG(WARNING) << "Could not create " << temporary_filepath;
+    return false;
+  }
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 std::fwrite(binary.data(), 1, binary_size, file) ==
+                     static_cast<size_t>(binary_size);
+  written = std::fclose(file) == 0 && written;
+  if (!written ||
+      std::rename(temporary_filepath.c_str(), filepath.c_str()) != 0) {
+    LOG(WARNING) << "Could not write " << filepath;
+    std::remove(temporary_filepath.c_str());
+    return false;
+  }
+  return true;
+}
+
+GpuProgram::GpuProgram()
+    : program_id_(0),
+      loaded_from_cache_(false),
+      pending_(false),
+      pending_cache_(nullptr) {}
+
+GpuProgram::~GpuProgram() {
+  Delete();
+}
+
+bool GpuProgram::Create(const ProgramSources& sources,
+                        ProgramBinaryCache* cache,
+                        std::string* error_info_log) {
+  BeginCreate(sources, cache);
+  return EndCreate(error_info_log);
+}
+
+void GpuProgram::BeginCreate(const ProgramSources& sources,
+                             ProgramBinaryCache* cache) {
+  WVU_PROFILE_ZONE("GpuProgram::BeginCreate");
+  Delete();
+  const bool use_cache = cache != nullptr && cache->is_enabled();
+  program_id_ = glCreateProgram();
+  if (use_cache) {
+    if (cache->Load(sources, program_id_)) {
+      loaded_from_cache_ = true;
+      ReflectUniforms();
+      return;
+    }
+    // A rejected binary leaves the program unusable.
+    glDeleteProgram(program_id_);
+    program_id_ = glCreateProgram();
+  }
+
+  // The compilation and link status are not queried until EndCreate(), which
+  // would wait for the driver.
+  for (const GLuint shader :
+       {AttachShader(GL_VERTEX_SHADER, sources.vertex, program_id_),
+        AttachShader(GL_FRAGMENT_SHADER, sources.fragment, program_id_),
+        AttachShader(GL_COMPUTE_SHADER, sources.compute, program_id_)}) {
+    if (shader != 0) shader_ids_.push_back(shader);
+  }
+  if (use_cache) {
+    glProgramParameteri(program_id_, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                        GL_TRUE);
+    pending_sources_ = sources;
+    pending_cache_ = cache;
+  }
+  glLinkProgram(program_id_);
+  pending_ = true;
+}
+
+bool GpuProgram::IsCreated() const {
+  if (!pending_ || !HasParallelShaderCompile()) return true;
+  GLint completed = GL_FALSE;
+  glGetProgramiv(program_id_, GL_COMPLETION_STATUS_KHR, &completed);
+  return completed == GL_TRUE;
+}
+
+bool GpuProgram::EndCreate(std::string* error_info_log) {
+  WVU_PROFILE_ZONE("GpuProgram::EndCreate");
+  DCHECK(error_info_log != nullptr);
+  if (!pending_) return program_id_ != 0;
+  pending_ = false;
+  GLint success = GL_FALSE;
+  glGetProgramiv(program_id_, GL_LINK_STATUS, &success);
+  if (!success) {
+    // The log of a shader that did not compile is more useful than the one
+    // of the link.
+    char info_log[1024];
+    for (const GLuint shader : shader_ids_) {
+      GLint compiled = GL_FALSE;
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+      if (compiled) continue;
+      glGetShaderInfoLog(shader, sizeof(info_log), nullptr, info_log);
+      error_info_log->append("Could not compile a shader: ");
+      error_info_log->append(info_log);
+    }
+    glGetProgramInfoLog(program_id_, sizeof(info_log), nullptr, info_log);
+    error_info_log->append("Could not link the program: ");
+    error_info_log->append(info_log);
+    Delete();
+    return false;
+  }
+  // The shaders are deleted once the program is.
+  for (const GLuint shader : shader_ids_) glDeleteShader(shader);
+  shader_ids_.clear();
+  if (pending_cache_ != nullptr) {
+    pending_cache_->Store(pending_sources_, program_id_);
+    pending_sources_ = ProgramSources();
+    pending_cache_ = nullptr;
+  }
+  ReflectUniforms();
+  return true;
+}
+
+void GpuProgram::Delete() {
+  for (const GLuint shader : shader_ids_) glDeleteShader(shader);
+  shader_ids_.clear();
+  if (program_id_ != 0) glDeleteProgram(program_id_);
+  program_id_ = 0;
+  loaded_from_cache_ = false;
+  pending_ = false;
+  pending_sources_ = ProgramSources();
+  pending_cache_ = nullptr;
+  uniform_locations_.clear();
+  uniform_block_indices_.clear();
+}
+
+bool GpuProgram::BindUniformBlock(const uint64_t name_hash,
+                                  const GLuint binding) const {
+  const GLint block_index = uniform_block_index(name_hash);
+  if (block_index < 0) return false;
+  glUniformBlockBinding(program_id_, block_index, binding);
+  return true;
+}
+
+void GpuProgram::ReflectUniforms() {
+  std::vector<std::pair<std::string, GLint>> uniforms;
+  std::vector<std::pair<std::string, GLint>> uniform_blocks;
+  GLint max_name_length = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+  GLint max_block_name_length = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH,
+                 &max_block_name_length);
+  std::vector<char> name(std::max(max_name_length, max_block_name_length) + 1);
+
+  GLint num_uniforms = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORMS, &num_uniforms);
+  for (GLint i = 0; i < num_uniforms; ++i) {
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(program_id_, i, name.size(), nullptr, &size, &type,
+                       name.data());
+    const GLint location = glGetUniformLocation(program_id_, name.data());
+    // The uniforms of blocks have no location.
+    if (location < 0) continue;
+    uniforms.emplace_back(name.data(), location);
+    // Arrays are reported by their first element, e.g., "lights[0]".
+    const std::string& uniform_name = uniforms.back().first;
+    const size_t array_suffix = uniform_name.rfind("[0]");
+    if (array_suffix != std::string::npos &&
+        array_suffix + 3 == uniform_name.size()) {
+      uniforms.emplace_back(uniform_name.substr(0, array_suffix), location);
+    }
+  }
+  GLint num_uniform_blocks = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORM_BLOCKS, &num_uniform_blocks);
+  for (GLint i = 0; i < num_uniform_blocks; ++i) {
+    glGetActiveUniformBlockName(program_id_, i, name.size(), nullptr,
+                                name.data());
+    uniform_blocks.emplace_back(name.data(), i);
+  }
+
+  const auto build_table = [](
+      const std::vector<std::pair<std::string, GLint>>& names,
+      std::vector<ReflectedName>* table) {
+    table->clear();
+    if (names.empty()) return;
+    size_t size = 2;
+    while (size < 2 * names.size()) size *= 2;
+    table->assign(size, ReflectedName{0, -1});
+    const size_t mask = size - 1;
+    for (const auto& name : names) {
+      const uint64_t hash = HashUniformName(name.first.c_str());
+      size_t i = hash & mask;
+      while ((*table)[i].value >= 0) {
+        CHECK_NE((*table)[i].hash, hash)
+            << "Hash collision of the uniform " << name.first;
+        i = (i + 1) & mask;
+      }
+      (*table)[i] = ReflectedName{hash, name.second};
+    }
+  };
+  build_table(uniforms, &uniform_locations_);
+  build_table(uniform_blocks, &uniform_block_indices_);
+}
+
+}  // namespace wvu
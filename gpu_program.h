@@ -0,0 +1,233 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GPU_PROGRAM_H_
+#define GPU_PROGRAM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+namespace wvu {
+// The GLSL sources of the stages of a program. The empty stages are not part
+// of the program.
+struct ProgramSources {
+  std::string vertex;
+  std::string fragment;
+  std::string compute;
+};
+
+// Stores the binaries of linked programs on disk (see glGetProgramBinary()) so
+// later runs load them with glProgramBinary() instead of compiling the
+// shaders. A binary is keyed by a hash of the sources and of the vendor,
+// renderer and version strings of the driver, so editing a shader or updating
+// the driver misses the cache. The driver may still reject a binary, in which
+// case the program is compiled again and its binary replaced.
+//
+// The cache requires a current OpenGL context. Several processes may share the
+// directory: the binaries are written to a temporary file and then renamed.
+class ProgramBinaryCache {
+ public:
+  // Creates the directory if it does not exist. See is_enabled().
+  explicit ProgramBinaryCache(const std::string& directory);
+
+  ProgramBinaryCache(const ProgramBinaryCache&) = delete;
+  ProgramBinaryCache& operator=(const ProgramBinaryCache&) = delete;
+
+  // Returns false if the driver has no program binary format or the directory
+  // could not be created, in which case the cache does nothing.
+  bool is_enabled() const { return enabled_; }
+
+  // Loads the binary of the program of the sources into an unlinked program.
+  // Returns true if the program is linked.
+  bool Load(const ProgramSources& sources, const GLuint program_id);
+
+  // Stores the binary of a program linked from the sources. Returns true upon
+  // success.
+  bool Store(const ProgramSources& sources, const GLuint program_id);
+
+  int num_hits() const { return num_hits_; }
+  int num_misses() const { return num_misses_; }
+
+ private:
+  uint64_t ComputeKey(const ProgramSources& sources) const;
+  std::string GetFilepath(const uint64_t key) const;
+
+  const std::string directory_;
+  bool enabled_;
+  // Hash of the strings identifying the driver.
+  uint64_t driver_key_;
+  int num_hits_;
+  int num_misses_;
+};
+
+namespace internal {
+constexpr uint64_t HashUniformName(const char* name, const uint64_t hash) {
+  return *name == '\0'
+             ? hash
+             : HashUniformName(
+                   name + 1,
+                   (hash ^ static_cast<uint8_t>(*name)) * 1099511628211ull);
+}
+}  // namespace internal
+
+// Computes the FNV-1a hash that GpuProgram looks up uniforms and uniform blocks
+// with. Constant names are hashed at compile time, e.g.,
+//
+//   constexpr uint64_t kModelUniform = HashUniformName("model");
+//   glUniformMatrix4fv(program.uniform_location(kModelUniform), ...);
+constexpr uint64_t HashUniformName(const char* name) {
+  return internal::HashUniformName(name, 14695981039346656037ull);
+}
+
+// Lets the driver compile and link programs in as many background threads as
+// it wants, with KHR_parallel_shader_compile or ARB_parallel_shader_compile.
+// Returns false if the driver supports neither. Requires a current OpenGL
+// context.
+bool EnableParallelShaderCompile();
+
+// A linked OpenGL program. Unlike ShaderProgram, the program may come from a
+// ProgramBinaryCache, it may be created asynchronously, and it is deleted with
+// the object.
+//
+// Programs are created asynchronously by submitting all of them before
+// waiting for any, so the driver compiles them while the caller does other
+// work, e.g., loading textures and meshes:
+//
+//   EnableParallelShaderCompile();
+//   program1.BeginCreate(sources1, cache);
+//   program2.BeginCreate(sources2, cache);
+//   LoadTextures();
+//   if (!program1.EndCreate(&error_info_log) ||
+//       !program2.EndCreate(&error_info_log)) ...
+class GpuProgram {
+ public:
+  GpuProgram();
+  ~GpuProgram();
+
+  GpuProgram(const GpuProgram&) = delete;
+  GpuProgram& operator=(const GpuProgram&) = delete;
+
+  // Compiles and links the sources, or loads the program from the cache.
+  // Returns true upon success.
+  // Params:
+  //   sources  The sources of the stages.
+  //   cache  The binary cache. May be null.
+  //   error_info_log  The compilation and link errors.
+  bool Create(const ProgramSources& sources,
+              ProgramBinaryCache* cache,
+              std::string* error_info_log);
+
+  // Starts compiling and linking the sources, or loads the program from the
+  // cache, without waiting for the driver. The errors are reported by
+  // EndCreate(). See Create().
+  void BeginCreate(const ProgramSources& sources, ProgramBinaryCache* cache);
+
+  // Returns true if EndCreate() would not wait for the driver. Without
+  // parallel shader compilation, there is nothing to poll and it returns
+  // true.
+  bool IsCreated() const;
+
+  // Waits until the program started by BeginCreate() is linked. Returns true
+  // upon success.
+  bool EndCreate(std::string* error_info_log);
+
+  // Deletes the program.
+  void Delete();
+
+  // Makes the program current.
+  void Use() const { glUseProgram(program_id_); }
+
+  // Returns zero if the program was not created.
+  GLuint program_id() const { return program_id_; }
+
+  // Returns the location of the active uniform with the hashed name (see
+  // HashUniformName()), or -1 if the program has none. The uniforms are
+  // reflected when the program is linked, so this does not call OpenGL. The
+  // elements of an array are found by the name of the array too.
+  GLint uniform_location(const uint64_t name_hash) const {
+    return FindReflectedName(uniform_locations_, name_hash);
+  }
+  // Returns the index of the active uniform block with the hashed name, or -1
+  // if the program has none.
+  GLint uniform_block_index(const uint64_t name_hash) const {
+    return FindReflectedName(uniform_block_indices_, name_hash);
+  }
+  // Assigns the uniform block with the hashed name to a GL_UNIFORM_BUFFER
+  // binding point. Returns false if the program has no such block.
+  bool BindUniformBlock(const uint64_t name_hash, const GLuint binding) const;
+
+  // Returns true if the last Create() loaded the binary from the cache.
+  bool loaded_from_cache() const { return loaded_from_cache_; }
+
+ private:
+  // An entry of an open-addressing table of reflected names. Empty entries
+  // have a negative value.
+  struct ReflectedName {
+    uint64_t hash;
+    GLint value;
+  };
+
+  static GLint FindReflectedName(const std::vector<ReflectedName>& table,
+                                 const uint64_t name_hash) {
+    if (table.empty()) return -1;
+    const size_t mask = table.size() - 1;
+    for (size_t i = name_hash & mask;; i = (i + 1) & mask) {
+      if (table[i].value < 0 || table[i].hash == name_hash) {
+        return table[i].value;
+      }
+    }
+  }
+  // Fills the tables of the active uniforms and uniform blocks of the linked
+  // program.
+  void ReflectUniforms();
+
+  GLuint program_id_;
+  bool loaded_from_cache_;
+  // Between BeginCreate() and EndCreate(), the compiled shaders, and the
+  // sources and cache to store the binary in.
+  bool pending_;
+  std::vector<GLuint> shader_ids_;
+  ProgramSources pending_sources_;
+  ProgramBinaryCache* pending_cache_;
+  // The tables have a power of two size and are at most half full.
+  std::vector<ReflectedName> uniform_locations_;
+  std::vector<ReflectedName> uniform_block_indices_;
+};
+
+}  // namespace wvu
+
+#endif  // GPU_PROGRAM_H_
@@ -0,0 +1,187 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "gpu_resources.h"
+
+#include <algorithm>
+
+#include <GL/glew.h>
+
+namespace wvu {
+namespace {
+
+void DeleteObject(const GpuResourceType type, const GLuint name) {
+  switch (type) {
+    case GpuResourceType::kBuffer:
+      glDeleteBuffers(1, &name);
+      break;
+    case GpuResourceType::kTexture:
+      glDeleteTextures(1, &name);
+      break;
+    case GpuResourceType::kVertexArray:
+      glDeleteVertexArrays(1, &name);
+      break;
+    case GpuResourceType::kFramebuffer:
+      glDeleteFramebuffers(1, &name);
+      break;
+  }
+}
+
+}  // namespace
+
+GpuResourcePool::GpuResourcePool()
+    : frame_index_(0), frame_has_releases_(false), num_live_resources_(0) {}
+
+// The context may be gone by now, so the objects released after Finish() are
+// left to the destruction of the context.
+GpuResourcePool::~GpuResourcePool() {}
+
+GpuHandle GpuResourcePool::Register(const GpuResourceType type,
+                                    const GLuint name) {
+  GpuHandle handle;
+  if (name == 0) return handle;
+  if (free_slots_.empty()) {
+    free_slots_.push_back(slots_.size());
+    slots_.push_back(Slot{type, 0, 0});
+  }
+  handle.index = free_slots_.back();
+  free_slots_.pop_back();
+  Slot& slot = slots_[handle.index];
+  slot.type = type;
+  slot.name = name;
+  ++slot.generation;
+  handle.generation = slot.generation;
+  ++num_live_resources_;
+  return handle;
+}
+
+GLuint GpuResourcePool::Get(const GpuHandle handle) const {
+  if (handle.is_null() || handle.index >= slots_.size()) return 0;
+  const Slot& slot = slots_[handle.index];
+  return slot.generation == handle.generation ? slot.name : 0;
+}
+
+void GpuResourcePool::Release(const GpuHandle handle) {
+  if (!IsAlive(handle)) return;
+  Slot& slot = slots_[handle.index];
+  pending_releases_.push_back(PendingRelease{slot.type, slot.name,
+                                             frame_index_});
+  frame_has_releases_ = true;
+  slot.name = 0;
+  ++slot.generation;
+  free_slots_.push_back(handle.index);
+  --num_live_resources_;
+}
+
+void GpuResourcePool::EndFrame() {
+  if (frame_has_releases_) {
+    frame_fences_.push_back(FrameFence{
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frame_index_});
+    frame_has_releases_ = false;
+  }
+  ++frame_index_;
+  // The fences signal in order, so the first one still pending ends the scan.
+  bool deleted = false;
+  uint64_t last_finished_frame = 0;
+  while (!frame_fences_.empty() &&
+         glClientWaitSync(frame_fences_.front().fence, 0, 0) !=
+             GL_TIMEOUT_EXPIRED) {
+    glDeleteSync(frame_fences_.front().fence);
+    last_finished_frame = frame_fences_.front().frame_index;
+    frame_fences_.pop_front();
+    deleted = true;
+  }
+  if (deleted) DeletePendingReleases(last_finished_frame);
+}
+
+void GpuResourcePool::Finish() {
+  for (const FrameFence& frame_fence : frame_fences_) {
+    glClientWaitSync(frame_fence.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                     GL_TIMEOUT_IGNORED);
+    glDeleteSync(frame_fence.fence);
+  }
+  frame_fences_.clear();
+  // The objects released in the current frame have no fence yet.
+  glFinish();
+  DeletePendingReleases(frame_index_);
+  frame_has_releases_ = false;
+}
+
+void GpuResourcePool::DeletePendingReleases(const uint64_t last_frame_index) {
+  // The releases are in frame order.
+  const auto first_kept = std::partition_point(
+      pending_releases_.begin(), pending_releases_.end(),
+      [last_frame_index](const PendingRelease& release) {
+        return release.frame_index <= last_frame_index;
+      });
+  for (auto release = pending_releases_.begin(); release != first_kept;
+       ++release) {
+    DeleteObject(release->type, release->name);
+  }
+  pending_releases_.erase(pending_releases_.begin(), first_kept);
+}
+
+GpuResource::GpuResource() : pool_(nullptr) {}
+
+GpuResource::GpuResource(GpuResourcePool* pool,
+                         const GpuResourceType type,
+                         const GLuint name)
+    : pool_(pool), handle_(pool->Register(type, name)) {}
+
+GpuResource::~GpuResource() { Reset(); }
+
+GpuResource::GpuResource(GpuResource&& other)
+    : pool_(other.pool_), handle_(other.handle_) {
+  other.pool_ = nullptr;
+  other.handle_ = GpuHandle();
+}
+
+GpuResource& GpuResource::operator=(GpuResource&& other) {
+  if (this != &other) {
+    Reset();
+    pool_ = other.pool_;
+    handle_ = other.handle_;
+    other.pool_ = nullptr;
+    other.handle_ = GpuHandle();
+  }
+  return *this;
+}
+
+void GpuResource::Reset() {
+  if (pool_ != nullptr) pool_->Release(handle_);
+  pool_ = nullptr;
+  handle_ = GpuHandle();
+}
+
+}  // namespace wvu
@@ -0,0 +1,176 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef GPU_RESOURCES_H_
+#define GPU_RESOURCES_H_
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <GL/glew.h>
+
+namespace wvu {
+
+// The kinds of OpenGL objects a GpuResourcePool deletes.
+enum class GpuResourceType { kBuffer, kTexture, kVertexArray, kFramebuffer };
+
+// Refers to an OpenGL object registered in a GpuResourcePool. A handle is an
+// index into the pool and the generation of the slot at that index, so a
+// handle to a released object stays invalid after the slot is reused. The
+// default handle is null.
+struct GpuHandle {
+  uint32_t index = 0;
+  uint32_t generation = 0;
+
+  bool is_null() const { return generation == 0; }
+};
+
+// Owns OpenGL objects and defers their deletion until the GPU is done with
+// them. A released object is deleted once a fence placed at the end of the
+// frame that released it signals, so commands that were already submitted may
+// still use it, and the render thread never waits for the GPU to free memory.
+// The slots of released objects are recycled, so a scene that streams models
+// in and out keeps a flat footprint.
+//
+// Usage:
+//   GpuResourcePool pool;
+//   GpuResource texture(&pool, GpuResourceType::kTexture, texture_id);
+//   glBindTexture(GL_TEXTURE_2D, texture.id());
+//   ...
+//   texture = GpuResource();  // Deleted a few frames later.
+//   pool.EndFrame();
+//   ...
+//   pool.Finish();  // Before the OpenGL context is destroyed.
+//
+// The pool requires a current OpenGL context and must be used from the
+// thread that owns it.
+class GpuResourcePool {
+ public:
+  GpuResourcePool();
+  ~GpuResourcePool();
+
+  GpuResourcePool(const GpuResourcePool&) = delete;
+  GpuResourcePool& operator=(const GpuResourcePool&) = delete;
+
+  // Takes ownership of an OpenGL object. Returns the null handle if the name
+  // is zero.
+  GpuHandle Register(const GpuResourceType type, const GLuint name);
+
+  // Returns the name of the object, or zero if the handle was released.
+  GLuint Get(const GpuHandle handle) const;
+  bool IsAlive(const GpuHandle handle) const { return Get(handle) != 0; }
+
+  // Invalidates the handle and schedules the deletion of its object after the
+  // commands submitted so far. Releasing a dead handle does nothing.
+  void Release(const GpuHandle handle);
+
+  // Marks the end of the commands of a frame, and deletes the objects released
+  // in the frames that the GPU finished. Never waits for the GPU.
+  void EndFrame();
+
+  // Waits for the GPU and deletes every released object. Must be called
+  // before the OpenGL context is destroyed.
+  void Finish();
+
+  // Number of objects registered and not released.
+  int num_live_resources() const { return num_live_resources_; }
+  // Number of objects released and not deleted yet.
+  int num_pending_releases() const { return pending_releases_.size(); }
+
+ private:
+  struct Slot {
+    GpuResourceType type;
+    GLuint name;
+    // Odd while the slot holds an object, so that the generation of a free
+    // slot never matches a handle.
+    uint32_t generation;
+  };
+
+  // An object waiting for the GPU to finish the frame that released it.
+  struct PendingRelease {
+    GpuResourceType type;
+    GLuint name;
+    uint64_t frame_index;
+  };
+
+  // The fence at the end of a frame that released objects.
+  struct FrameFence {
+    GLsync fence;
+    uint64_t frame_index;
+  };
+
+  // Deletes the pending objects released up to and including the frame.
+  void DeletePendingReleases(const uint64_t last_frame_index);
+
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  std::vector<PendingRelease> pending_releases_;
+  std::deque<FrameFence> frame_fences_;
+  uint64_t frame_index_;
+  // Whether an object was released in the current frame.
+  bool frame_has_releases_;
+  int num_live_resources_;
+};
+
+// A movable, non-copyable owner of an OpenGL object in a GpuResourcePool. The
+// object is released when the owner is destroyed or assigned.
+class GpuResource {
+ public:
+  GpuResource();
+  GpuResource(GpuResourcePool* pool,
+              const GpuResourceType type,
+              const GLuint name);
+  ~GpuResource();
+
+  GpuResource(GpuResource&& other);
+  GpuResource& operator=(GpuResource&& other);
+  GpuResource(const GpuResource&) = delete;
+  GpuResource& operator=(const GpuResource&) = delete;
+
+  // Returns the name of the object, or zero if there is none.
+  GLuint id() const { return pool_ != nullptr ? pool_->Get(handle_) : 0; }
+  GpuHandle handle() const { return handle_; }
+
+  // Releases the object, if any.
+  void Reset();
+
+ private:
+  GpuResourcePool* pool_;
+  GpuHandle handle_;
+};
+
+}  // namespace wvu
+
+#endif  // GPU_RESOURCES_H_
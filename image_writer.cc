@@ -0,0 +1,340 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "image_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace wvu {
+namespace {
+// Maximum size of a stored (uncompressed) deflate block.
+constexpr size_t kMaxStoredBlockSize = 65535;
+constexpr uint32_t kAdlerModulus = 65521;
+
+// Returns the tables of the CRC-32 used by PNG chunks. Table k holds the CRC
+// of a byte followed by k zero bytes, which lets UpdateCrc32() consume eight
+// bytes per step ("slicing-by-8") instead of one.
+const uint32_t (*Crc32Tables())[256] {
+  static const std::vector<std::array<uint32_t, 256>> tables = []() {
+    std::vector<std::array<uint32_t, 256>> crc_tables(8);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+      }
+      crc_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int k = 1; k < 8; ++k) {
+        const uint32_t crc = crc_tables[k - 1][i];
+        crc_tables[k][i] = crc_tables[0][crc & 0xff] ^ (crc >> 8);
+      }
+    }
+    return crc_tables;
+  }();
+  return reinterpret_cast<const uint32_t(*)[256]>(tables.data());
+}
+
+uint32_t UpdateCrc32(uint32_t crc, const uint8_t* data, size_t size) {
+  const uint32_t(*tables)[256] = Crc32Tables();
+  for (; size >= 8; size -= 8, data += 8) {
+    const uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 |
+                                static_cast<uint32_t>(data[3]) << 24);
+    crc = tables[7][low & 0xff] ^ tables[6][(low >> 8) & 0xff] ^
+          tables[5][(low >> 16) & 0xff] ^ tables[4][low >> 24] ^
+          tables[3][data[4]] ^ tables[2][data[5]] ^ tables[1][data[6]] ^
+          tables[0][data[7]];
+  }
+  for (; size > 0; --size, ++data) {
+    crc = tables[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+void StoreBigEndian(const uint32_t value, uint8_t* bytes) {
+  bytes[0] = value >> 24;
+  bytes[1] = value >> 16;
+  bytes[2] = value >> 8;
+  bytes[3] = value;
+}
+
+// Converts an RGB color to BT.601 limited-range YUV.
+inline void ConvertRgbToYuv(const int red, const int green, const int blue,
+                            uint8_t* y, uint8_t* u, uint8_t* v) {
+  *y = ((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16;
+  *u = ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+  *v = ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
+}
+
+}  // namespace
+
+bool WritePpm(const std::string& filepath, const ImageView& image) {
+  FILE* file = fopen(filepath.c_str(), "wb");
+  if (file == nullptr) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+  fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+  std::vector<uint8_t> row(3 * image.width);
+  bool success = true;
+  for (int y = 0; y < image.height && success; ++y) {
+    const uint8_t* pixels = image.Row(y);
+    for (int x = 0; x < image.width; ++x) {
+      row[3 * x + 0] = pixels[image.num_channels * x + 0];
+      row[3 * x + 1] = pixels[image.num_channels * x + 1];
+      row[3 * x + 2] = pixels[image.num_channels * x + 2];
+    }
+    success = fwrite(row.data(), 1, row.size(), file) == row.size();
+  }
+  return fclose(file) == 0 && success;
+}
+
+bool WritePng(const std::string& filepath, const ImageView& image) {
+  PngWriter writer;
+  if (!writer.Open(filepath, image.width, image.height)) return false;
+  for (int y = 0; y < image.height; ++y) {
+    writer.WriteRows(image.Row(y), 1, image.num_channels);
+  }
+  return writer.Close();
+}
+
+PngWriter::PngWriter()
+    : file_(nullptr),
+      width_(0),
+      height_(0),
+      num_rows_written_(0),
+      adler_a_(1),
+      adler_b_(0),
+      zlib_header_written_(false),
+      failed_(false) {}
+
+PngWriter::~PngWriter() {
+  if (file_ != nullptr) fclose(file_);
+}
+
+bool PngWriter::Open(const std::string& filepath,
+                     const int width,
+                     const int height) {
+  file_ = fopen(filepath.c_str(), "wb");
+  if (file_ == nullptr) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  pending_data_.reserve(kMaxStoredBlockSize);
+
+  static const uint8_t kSignature[] = {0x89, 'P', 'N', 'G', '\r', '\n',
+                                       0x1a, '\n'};
+  fwrite(kSignature, 1, sizeof(kSignature), file_);
+  // 8 bits per channel, RGB, default compression, filtering and no interlace.
+  uint8_t header[13] = {0};
+  StoreBigEndian(width, header);
+  StoreBigEndian(height, header + 4);
+  header[8] = 8;
+  header[9] = 2;
+  WriteChunk("IHDR", header, sizeof(header));
+  return !failed_;
+}
+
+bool PngWriter::WriteRows(const uint8_t* pixels,
+                          const int num_rows,
+                          const int num_channels) {
+  row_.resize(1 + 3 * width_);
+  // Every row starts with its filter type. Zero means no filter.
+  row_[0] = 0;
+  for (int y = 0; y < num_rows; ++y) {
+    const uint8_t* row_pixels =
+        pixels + static_cast<size_t>(y) * width_ * num_channels;
+    for (int x = 0; x < width_; ++x) {
+      row_[1 + 3 * x + 0] = row_pixels[num_channels * x + 0];
+      row_[1 + 3 * x + 1] = row_pixels[num_channels * x + 1];
+      row_[1 + 3 * x + 2] = row_pixels[num_channels * x + 2];
+    }
+    AppendImageData(row_.data(), row_.size());
+  }
+  num_rows_written_ += num_rows;
+  return !failed_;
+}
+
+bool PngWriter::Close() {
+  if (file_ == nullptr) return false;
+  if (num_rows_written_ != height_) {
+    LOG(ERROR) << "Only " << num_rows_written_ << " of " << height_
+               << " rows were written.";
+    failed_ = true;
+  }
+  FlushImageData(true);
+  WriteChunk("IEND", nullptr, 0);
+  const bool success = fclose(file_) == 0 && !failed_;
+  file_ = nullptr;
+  return success;
+}
+
+void PngWriter::AppendImageData(const uint8_t* data, const size_t num_bytes) {
+  // Update the Adler-32 checksum. Deferring the modulo to every 5552 bytes is
+  // what zlib does; it is the largest run that cannot overflow.
+  for (size_t begin = 0; begin < num_bytes; begin += 5552) {
+    const size_t end = std::min(num_bytes, begin + 5552);
+    for (size_t i = begin; i < end; ++i) {
+      adler_a_ += data[i];
+      adler_b_ += adler_a_;
+    }
+    adler_a_ %= kAdlerModulus;
+    adler_b_ %= kAdlerModulus;
+  }
+
+  size_t offset = 0;
+  while (offset < num_bytes) {
+    const size_t capacity = kMaxStoredBlockSize - pending_data_.size();
+    const size_t count = std::min(capacity, num_bytes - offset);
+    pending_data_.insert(pending_data_.end(), data + offset,
+                         data + offset + count);
+    offset += count;
+    if (pending_data_.size() == kMaxStoredBlockSize) FlushImageData(false);
+  }
+}
+
+void PngWriter::FlushImageData(const bool last_block) {
+  std::vector<uint8_t>& chunk = chunk_;
+  chunk.clear();
+  if (!zlib_header_written_) {
+    // The zlib stream header: deflate with a 32K window and no dictionary.
+    chunk.push_back(0x78);
+    chunk.push_back(0x01);
+    zlib_header_written_ = true;
+  }
+  // A stored block: the final flag, two bytes of length and their complement.
+  const size_t block_size = pending_data_.size();
+  chunk.push_back(last_block ? 1 : 0);
+  chunk.push_back(block_size & 0xff);
+  chunk.push_back(block_size >> 8);
+  chunk.push_back(~block_size & 0xff);
+  chunk.push_back((~block_size >> 8) & 0xff);
+  chunk.insert(chunk.end(), pending_data_.begin(), pending_data_.end());
+  if (last_block) {
+    uint8_t adler[4];
+    StoreBigEndian((adler_b_ << 16) | adler_a_, adler);
+    chunk.insert(chunk.end(), adler, adler + 4);
+  }
+  WriteChunk("IDAT", chunk.data(), chunk.size());
+  pending_data_.clear();
+}
+
+void PngWriter::WriteChunk(const char* type,
+                           const uint8_t* data,
+                           const size_t size) {
+  uint8_t length[4];
+  StoreBigEndian(size, length);
+  uint32_t crc = UpdateCrc32(0xffffffffu,
+                             reinterpret_cast<const uint8_t*>(type), 4);
+  if (size > 0) crc = UpdateCrc32(crc, data, size);
+  uint8_t crc_bytes[4];
+  StoreBigEndian(crc ^ 0xffffffffu, crc_bytes);
+  const bool success = fwrite(length, 1, 4, file_) == 4 &&
+                       fwrite(type, 1, 4, file_) == 4 &&
+                       (size == 0 || fwrite(data, 1, size, file_) == size) &&
+                       fwrite(crc_bytes, 1, 4, file_) == 4;
+  failed_ = failed_ || !success;
+}
+
+Y4mWriter::Y4mWriter() : file_(nullptr), width_(0), height_(0) {}
+
+Y4mWriter::~Y4mWriter() {
+  Close();
+}
+
+bool Y4mWriter::Open(const std::string& filepath,
+                     const int width,
+                     const int height,
+                     const int frame_rate) {
+  file_ = fopen(filepath.c_str(), "wb");
+  if (file_ == nullptr) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+  width_ = width;
+  height_ = height;
+  return fprintf(file_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width,
+                 height, frame_rate) > 0;
+}
+
+bool Y4mWriter::WriteFrame(const ImageView& image) {
+  if (image.width != width_ || image.height != height_) return false;
+  ConvertFrame(image, &planes_);
+  return WriteConvertedFrame(planes_);
+}
+
+void Y4mWriter::ConvertFrame(const ImageView& image,
+                             std::vector<uint8_t>* planes) {
+  const size_t plane_size = static_cast<size_t>(image.width) * image.height;
+  planes->resize(3 * plane_size);
+  uint8_t* y_plane = planes->data();
+  uint8_t* u_plane = y_plane + plane_size;
+  uint8_t* v_plane = u_plane + plane_size;
+  for (int y = 0; y < image.height; ++y) {
+    const uint8_t* pixels = image.Row(y);
+    const size_t row_offset = static_cast<size_t>(y) * image.width;
+    for (int x = 0; x < image.width; ++x) {
+      const uint8_t* pixel = pixels + image.num_channels * x;
+      ConvertRgbToYuv(pixel[0], pixel[1], pixel[2], y_plane + row_offset + x,
+                      u_plane + row_offset + x, v_plane + row_offset + x);
+    }
+  }
+}
+
+bool Y4mWriter::WriteConvertedFrame(const std::vector<uint8_t>& planes) {
+  if (file_ == nullptr ||
+      planes.size() != 3 * static_cast<size_t>(width_) * height_) {
+    return false;
+  }
+  return fputs("FRAME\n", file_) >= 0 &&
+         fwrite(planes.data(), 1, planes.size(), file_) == planes.size();
+}
+
+bool Y4mWriter::Close() {
+  if (file_ == nullptr) return true;
+  const bool success = fclose(file_) == 0;
+  file_ = nullptr;
+  return success;
+}
+
+}  // namespace wvu
@@ -0,0 +1,153 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef IMAGE_WRITER_H_
+#define IMAGE_WRITER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace wvu {
+// A view of an 8-bit image with interleaved channels (RGB or RGBA) in memory.
+// Images read from OpenGL have their rows stored bottom-up.
+struct ImageView {
+  const uint8_t* pixels = nullptr;
+  int width = 0;
+  int height = 0;
+  // 3 for RGB or 4 for RGBA. The alpha channel is never written.
+  int num_channels = 4;
+  bool bottom_up = true;
+
+  // Returns the row y, counting from the top of the image.
+  const uint8_t* Row(const int y) const {
+    const int row = bottom_up ? height - 1 - y : y;
+    return pixels + static_cast<size_t>(row) * width * num_channels;
+  }
+};
+
+// Writes an image as a binary PPM (P6) file. Returns true upon success.
+bool WritePpm(const std::string& filepath, const ImageView& image);
+
+// Writes an image as an RGB PNG file. Returns true upon success.
+bool WritePng(const std::string& filepath, const ImageView& image);
+
+// Writes a PNG file row by row, from top to bottom, so images that do not fit
+// in memory can be written in strips. The image data is stored without
+// compression, trading file size for encoding speed and no dependency on a
+// compression library.
+class PngWriter {
+ public:
+  PngWriter();
+  ~PngWriter();
+
+  PngWriter(const PngWriter&) = delete;
+  PngWriter& operator=(const PngWriter&) = delete;
+
+  // Creates the file and writes the header. Returns true upon success.
+  bool Open(const std::string& filepath, const int width, const int height);
+
+  // Writes the next rows of the image. The pixels are RGB or RGBA as given by
+  // num_channels, and the rows are contiguous.
+  bool WriteRows(const uint8_t* pixels, const int num_rows,
+                 const int num_channels);
+
+  // Writes the end of the file. Every row must have been written. Returns true
+  // upon success.
+  bool Close();
+
+ private:
+  // Appends bytes to the image data stream, flushing full deflate blocks.
+  void AppendImageData(const uint8_t* data, const size_t num_bytes);
+  // Writes the pending image data as a stored deflate block in an IDAT chunk.
+  void FlushImageData(const bool last_block);
+  void WriteChunk(const char* type, const uint8_t* data, const size_t size);
+
+  FILE* file_;
+  int width_;
+  int height_;
+  int num_rows_written_;
+  // Image data not written yet. At most the size of a stored deflate block.
+  std::vector<uint8_t> pending_data_;
+  // Buffers reused between rows and chunks.
+  std::vector<uint8_t> row_;
+  std::vector<uint8_t> chunk_;
+  // Adler-32 checksum of the uncompressed image data.
+  uint32_t adler_a_;
+  uint32_t adler_b_;
+  bool zlib_header_written_;
+  bool failed_;
+};
+
+// Writes a sequence of frames as a YUV4MPEG2 (Y4M) video in 4:4:4 format,
+// which ffmpeg and most video tools read directly.
+class Y4mWriter {
+ public:
+  Y4mWriter();
+  ~Y4mWriter();
+
+  Y4mWriter(const Y4mWriter&) = delete;
+  Y4mWriter& operator=(const Y4mWriter&) = delete;
+
+  // Creates the file and writes the stream header. Returns true upon success.
+  bool Open(const std::string& filepath,
+            const int width,
+            const int height,
+            const int frame_rate);
+
+  // Appends a frame. Frames must have the dimensions given to Open().
+  bool WriteFrame(const ImageView& image);
+
+  // Converts an image to the Y, U and V planes of a frame. Converting is the
+  // expensive part of writing a frame, so it can run in parallel.
+  static void ConvertFrame(const ImageView& image,
+                           std::vector<uint8_t>* planes);
+
+  // Appends a frame converted with ConvertFrame().
+  bool WriteConvertedFrame(const std::vector<uint8_t>& planes);
+
+  bool Close();
+
+ private:
+  FILE* file_;
+  int width_;
+  int height_;
+  // Planes of the frame being written, reused between frames.
+  std::vector<uint8_t> planes_;
+};
+
+}  // namespace wvu
+
+#endif  // IMAGE_WRITER_H_
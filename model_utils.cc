@@ -0,0 +1,124 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "model_utils.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <GL/glew.h>
+
+#include "cpu_profiler.h"
+#include "frame_statistics.h"
+#include "gl_state_cache.h"
+#include "gpu_resources.h"
+#include "model.h"
+#include "resource_registry.h"
+
+namespace wvu {
+namespace {
+// Orientations with a smaller angle than this are considered the identity.
+constexpr float kMinRotationAngle = 1e-8f;
+
+}  // namespace
+
+Eigen::Matrix4f ComputeModelMatrix4f(const Model& model) {
+  Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+  const Eigen::Vector3f& orientation = model.orientation();
+  const float angle = orientation.norm();
+  if (angle > kMinRotationAngle) {
+    model_matrix.topLeftCorner<3, 3>() =
+        Eigen::AngleAxisf(angle, orientation / angle).toRotationMatrix();
+  }
+  model_matrix.topRightCorner<3, 1>() = model.position();
+  return model_matrix;
+}
+
+std::vector<Eigen::Vector3f> GetTriangleVertices(const Model& model) {
+  const Eigen::MatrixXf& vertices = model.vertices();
+  const std::vector<GLuint>& indices = model.indices();
+  const int num_vertices = indices.empty() ? vertices.cols() : indices.size();
+  std::vector<Eigen::Vector3f> triangle_vertices(num_vertices);
+  for (int i = 0; i < num_vertices; ++i) {
+    triangle_vertices[i] = vertices.col(indices.empty() ? i : indices[i]);
+  }
+  return triangle_vertices;
+}
+
+void DrawModel(const GLuint texture_id, const Model& model) {
+  WVU_PROFILE_ZONE("DrawModel");
+  GlStateCache& state_cache = ThreadGlStateCache();
+  state_cache.BindTexture2D(0, texture_id);
+  state_cache.BindVertexArray(model.vertex_array_object_id());
+  if (model.indices().empty()) {
+    glDrawArrays(GL_TRIANGLES, 0, model.vertices().cols());
+    CountDrawCall(model.vertices().cols() / 3);
+  } else {
+    glDrawElements(GL_TRIANGLES, model.indices().size(), GL_UNSIGNED_INT, 0);
+    CountDrawCall(model.indices().size() / 3);
+  }
+}
+
+GpuModel::GpuModel() {}
+
+GpuModel::GpuModel(GpuResourcePool* pool,
+                   ResourceRegistry* registry,
+                   const std::string& name,
+                   std::unique_ptr<Model> model)
+    : model_(std::move(model)),
+      vertex_array_(pool, GpuResourceType::kVertexArray,
+                    model_->vertex_array_object_id()),
+      vertex_buffer_(pool, GpuResourceType::kBuffer,
+                     model_->vertex_buffer_object_id()),
+      element_buffer_(pool, GpuResourceType::kBuffer,
+                      model_->element_buffer_object_id()) {
+  if (registry == nullptr) return;
+  // The buffers hold the same vertices and indices as the model.
+  ResourceInfo info;
+  info.name = name;
+  info.num_bytes = model_->vertices().size() * sizeof(float) +
+                   model_->indices().size() * sizeof(GLuint);
+  info.category = "model buffers";
+  info.domain = MemoryDomain::kGpu;
+  gpu_memory_ = ResourceRecord(registry, info);
+  info.category = "model vertex copies";
+  info.domain = MemoryDomain::kCpu;
+  cpu_memory_ = ResourceRecord(registry, info);
+}
+
+}  // namespace wvu
@@ -0,0 +1,110 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef MODEL_UTILS_H_
+#define MODEL_UTILS_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <GL/glew.h>
+
+#include "gpu_resources.h"
+#include "model.h"
+#include "resource_registry.h"
+
+namespace wvu {
+// Computes the model matrix of a model, i.e., the rotation given by its
+// angle-axis orientation followed by the translation to its position. Unlike
+// Model::ComputeModelMatrix(), the result is a fixed-size matrix and thus this
+// function never allocates memory.
+Eigen::Matrix4f ComputeModelMatrix4f(const Model& model);
+
+// Returns the vertices of the triangles of a model in object coordinates,
+// three consecutive per triangle, resolving the indices if the model has any.
+std::vector<Eigen::Vector3f> GetTriangleVertices(const Model& model);
+
+// Draws a model with a texture using the program in use. The program is
+// expected to read its model, view and projection matrices from uniform
+// blocks that the caller binds, e.g., ranges of a StreamingBuffer. This is the
+// allocation-free version of Model::Draw(). The texture and the vertex array
+// are bound through ThreadGlStateCache(), so consecutive draws sharing them do
+// not bind them again.
+// Params:
+//   texture_id  The texture bound to the first texture unit.
+//   model  The model to draw. Its vertices must be in the GPU.
+void DrawModel(const GLuint texture_id, const Model& model);
+
+// Owns a model and the vertex array and buffers that SetVerticesIntoGpu()
+// created for it, which Model itself never deletes. When the owner is
+// destroyed, the model is deleted and its OpenGL objects are released to the
+// pool, which deletes them once the GPU no longer draws them. The memory of
+// the buffers and of the vertices kept in the CPU is recorded in the
+// registry, if any, under the "model buffers" and "model vertex copies"
+// categories.
+class GpuModel {
+ public:
+  GpuModel();
+  // Params:
+  //   pool  The pool that deletes the OpenGL objects of the model.
+  //   registry  The registry of the memory of the model. May be null.
+  //   name  The name of the model in the registry.
+  //   model  The model. Its vertices must be in the GPU.
+  GpuModel(GpuResourcePool* pool,
+           ResourceRegistry* registry,
+           const std::string& name,
+           std::unique_ptr<Model> model);
+
+  GpuModel(GpuModel&& other) = default;
+  GpuModel& operator=(GpuModel&& other) = default;
+  GpuModel(const GpuModel&) = delete;
+  GpuModel& operator=(const GpuModel&) = delete;
+
+  Model* get() const { return model_.get(); }
+
+ private:
+  // Declared first so that the model outlives the handles to its objects.
+  std::unique_ptr<Model> model_;
+  GpuResource vertex_array_;
+  GpuResource vertex_buffer_;
+  GpuResource element_buffer_;
+  ResourceRecord gpu_memory_;
+  ResourceRecord cpu_memory_;
+};
+
+}  // namespace wvu
+
+#endif  // MODEL_UTILS_H_
@@ -0,0 +1,474 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "occlusion_culler.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WVU_OCCLUSION_CULLER_SIMD
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "cpu_profiler.h"
+#include "cpu_utils.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+constexpr int kTileWidth = 32;
+constexpr int kTileHeight = 8;
+constexpr uint32_t kFullRow = 0xFFFFFFFFu;
+constexpr float kInfinity = std::numeric_limits<float>::infinity();
+
+// Returns the bits [begin, end) of a row of a tile. Both are in [0, 32].
+inline uint32_t ComputeRowMask(const int begin, const int end) {
+  const uint32_t below_end = end >= kTileWidth ? kFullRow : (1u << end) - 1;
+  const uint32_t below_begin =
+      begin >= kTileWidth ? kFullRow : (1u << begin) - 1;
+  return below_end & ~below_begin;
+}
+
+inline int Clamp(const int value, const int min, const int max) {
+  return std::min(std::max(value, min), max);
+}
+
+// Converts a window coordinate to a pixel coordinate in [0, size].
+inline int ClampToPixels(const float value, const int size) {
+  return std::min(std::max(value, 0.0f), static_cast<float>(size));
+}
+
+// Computes the coverage of the rows of a tile, where row i covers the pixels
+// [begins[i], ends[i]) of the buffer.
+void ComputeRowMasks(const int* begins,
+                     const int* ends,
+                     const int tile_x,
+                     uint32_t* masks) {
+  for (int i = 0; i < kTileHeight; ++i) {
+    masks[i] = ComputeRowMask(Clamp(begins[i] - tile_x, 0, kTileWidth),
+                              Clamp(ends[i] - tile_x, 0, kTileWidth));
+  }
+}
+
+#ifdef WVU_OCCLUSION_CULLER_SIMD
+// ComputeRowMasks() for the eight rows at once. The variable shifts of AVX2
+// yield zero for counts of 32 or more, so the full rows need no special case.
+__attribute__((target("avx2")))
+void ComputeRowMasksAvx2(const int* begins,
+                         const int* ends,
+                         const int tile_x,
+                         uint32_t* masks) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i tile_width = _mm256_set1_epi32(kTileWidth);
+  const __m256i offset = _mm256_set1_epi32(tile_x);
+  const __m256i begin = _mm256_min_epi32(
+      _mm256_max_epi32(
+          _mm256_sub_epi32(
+              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begins)),
+              offset),
+          zero),
+      tile_width);
+  const __m256i end = _mm256_min_epi32(
+      _mm256_max_epi32(
+          _mm256_sub_epi32(
+              _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ends)),
+              offset),
+          zero),
+      tile_width);
+  const __m256i ones = _mm256_set1_epi32(-1);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(masks),
+                      _mm256_andnot_si256(_mm256_sllv_epi32(ones, end),
+                                          _mm256_sllv_epi32(ones, begin)));
+}
+#endif  // WVU_OCCLUSION_CULLER_SIMD
+
+}  // namespace
+
+// A tile of the depth buffer. The depth of a pixel is the layer depth if its
+// coverage bit is set, and the far depth otherwise. The layer depth is never
+// farther than the far depth.
+struct OcclusionCuller::Tile {
+  // The coverage of the rows, a bit per pixel.
+  uint32_t masks[kTileHeight];
+  // The pixels of the rows inside the buffer.
+  uint32_t valid_masks[kTileHeight];
+  // The farthest depth of the whole tile.
+  float far_depth;
+  // The farthest depth of the triangles that covered the pixels of the masks.
+  float layer_depth;
+};
+
+// A triangle of an occluder in window coordinates.
+struct OcclusionCuller::Triangle {
+  // The edge functions a * x + b * y + c of the pixel coordinates, which are
+  // nonnegative inside the triangle.
+  float edge_a[3];
+  float edge_b[3];
+  float edge_c[3];
+  // The plane of the depth, depth_a * x + depth_b * y + depth_c.
+  float depth_a;
+  float depth_b;
+  float depth_c;
+  float max_depth;
+  // The pixels [min_x, max_x) x [min_y, max_y) of the buffer the triangle
+  // may cover.
+  int min_x;
+  int max_x;
+  int min_y;
+  int max_y;
+};
+
+struct OcclusionCuller::Occluder {
+  Eigen::Matrix4f model_view_projection;
+  const std::vector<Eigen::Vector3f>* vertices;
+  std::vector<Triangle> triangles;
+};
+
+OcclusionCuller::OcclusionCuller(const int width,
+                                 const int height,
+                                 ThreadPool* thread_pool)
+    : width_(width),
+      height_(height),
+      num_tiles_x_(internal::DivideRoundingUp(width, kTileWidth)),
+      num_tiles_y_(internal::DivideRoundingUp(height, kTileHeight)),
+      thread_pool_(thread_pool),
+      use_avx2_(internal::CpuSupportsAvx2()),
+      view_projection_(Eigen::Matrix4f::Identity()),
+      tiles_(num_tiles_x_ * num_tiles_y_),
+      num_occluders_(0) {
+  // The pixels of the tiles past the edges of the buffer count as covered, so
+  // that the tiles on the edges can be fully covered.
+  for (int tile_y = 0; tile_y < num_tiles_y_; ++tile_y) {
+    for (int tile_x = 0; tile_x < num_tiles_x_; ++tile_x) {
+      Tile& tile = tiles_[tile_y * num_tiles_x_ + tile_x];
+      for (int row = 0; row < kTileHeight; ++row) {
+        tile.valid_masks[row] =
+            tile_y * kTileHeight + row < height
+                ? ComputeRowMask(
+                      0, std::min(kTileWidth, width - tile_x * kTileWidth))
+                : 0;
+      }
+    }
+  }
+  BeginFrame(view_projection_);
+}
+
+OcclusionCuller::~OcclusionCuller() {}
+
+void OcclusionCuller::BeginFrame(const Eigen::Matrix4f& view_projection) {
+  view_projection_ = view_projection;
+  for (Tile& tile : tiles_) {
+    std::fill(tile.masks, tile.masks + kTileHeight, 0);
+    tile.far_depth = kInfinity;
+    tile.layer_depth = 0.0f;
+  }
+  num_occluders_ = 0;
+  stats_ = OcclusionCullerStats();
+}
+
+void OcclusionCuller::AddOccluder(
+    const Eigen::Matrix4f& model_matrix,
+    const std::vector<Eigen::Vector3f>* vertices) {
+  if (num_occluders_ == static_cast<int>(occluders_.size())) {
+    occluders_.emplace_back();
+  }
+  Occluder& occluder = occluders_[num_occluders_++];
+  occluder.model_view_projection = view_projection_ * model_matrix;
+  occluder.vertices = vertices;
+}
+
+void OcclusionCuller::RenderOccluders() {
+  WVU_PROFILE_ZONE("OcclusionCuller::RenderOccluders");
+  if (thread_pool_ != nullptr) {
+    thread_pool_->ParallelFor(
+        num_occluders_, [this](const int i) { SetUpTriangles(i); });
+  } else {
+    for (int i = 0; i < num_occluders_; ++i) SetUpTriangles(i);
+  }
+  for (int i = 0; i < num_occluders_; ++i) {
+    stats_.num_occluder_triangles += occluders_[i].vertices->size() / 3;
+    stats_.num_occluder_triangles_rasterized +=
+        occluders_[i].triangles.size();
+  }
+  if (thread_pool_ != nullptr) {
+    thread_pool_->ParallelFor(
+        num_tiles_y_, [this](const int i) { RasterizeTileRow(i); });
+  } else {
+    for (int i = 0; i < num_tiles_y_; ++i) RasterizeTileRow(i);
+  }
+}
+
+void OcclusionCuller::SetUpTriangles(const int occluder_index) {
+  Occluder& occluder = occluders_[occluder_index];
+  occluder.triangles.clear();
+  const std::vector<Eigen::Vector3f>& vertices = *occluder.vertices;
+  for (int i = 0; i + 2 < static_cast<int>(vertices.size()); i += 3) {
+    // Clip the triangle to the near plane, z >= -w, which leaves a polygon of
+    // up to four vertices.
+    Eigen::Vector4f clip_vertices[3];
+    for (int j = 0; j < 3; ++j) {
+      clip_vertices[j] =
+          occluder.model_view_projection * vertices[i + j].homogeneous();
+    }
+    Eigen::Vector4f polygon[4];
+    int num_polygon_vertices = 0;
+    for (int j = 0; j < 3; ++j) {
+      const Eigen::Vector4f& current = clip_vertices[j];
+      const Eigen::Vector4f& next = clip_vertices[(j + 1) % 3];
+      const float current_distance = current.z() + current.w();
+      const float next_distance = next.z() + next.w();
+      if (current_distance >= 0.0f) polygon[num_polygon_vertices++] = current;
+      if ((current_distance >= 0.0f) != (next_distance >= 0.0f)) {
+        polygon[num_polygon_vertices++] =
+            current + (next - current) *
+                          (current_distance /
+                           (current_distance - next_distance));
+      }
+    }
+    if (num_polygon_vertices < 3) continue;
+
+    Eigen::Vector3f window[4];
+    for (int j = 0; j < num_polygon_vertices; ++j) {
+      const Eigen::Vector3f ndc = polygon[j].head<3>() / polygon[j].w();
+      window[j] = Eigen::Vector3f((0.5f * ndc.x() + 0.5f) * width_,
+                                  (0.5f * ndc.y() + 0.5f) * height_,
+                                  0.5f * ndc.z() + 0.5f);
+    }
+    for (int j = 1; j + 1 < num_polygon_vertices; ++j) {
+      const Eigen::Vector3f* points[3] = {&window[0], &window[j],
+                                          &window[j + 1]};
+      const Eigen::Vector3f& p0 = *points[0];
+      const Eigen::Vector3f& p1 = *points[1];
+      const Eigen::Vector3f& p2 = *points[2];
+      const float area = (p1.x() - p0.x()) * (p2.y() - p0.y()) -
+                         (p2.x() - p0.x()) * (p1.y() - p0.y());
+      if (!(std::abs(area) > 0.0f)) continue;
+      Triangle triangle;
+      const float min_x = std::min({p0.x(), p1.x(), p2.x()});
+      const float max_x = std::max({p0.x(), p1.x(), p2.x()});
+      const float min_y = std::min({p0.y(), p1.y(), p2.y()});
+      const float max_y = std::max({p0.y(), p1.y(), p2.y()});
+      triangle.min_x = ClampToPixels(std::floor(min_x), width_);
+      triangle.max_x = ClampToPixels(std::ceil(max_x), width_);
+      triangle.min_y = ClampToPixels(std::floor(min_y), height_);
+      triangle.max_y = ClampToPixels(std::ceil(max_y), height_);
+      if (triangle.min_x >= triangle.max_x ||
+          triangle.min_y >= triangle.max_y) {
+        continue;
+      }
+      const float orientation = area > 0.0f ? 1.0f : -1.0f;
+      for (int k = 0; k < 3; ++k) {
+        const Eigen::Vector3f& start = *points[k];
+        const Eigen::Vector3f& end = *points[(k + 1) % 3];
+        triangle.edge_a[k] = orientation * (start.y() - end.y());
+        triangle.edge_b[k] = orientation * (end.x() - start.x());
+        triangle.edge_c[k] =
+            orientation * (start.x() * end.y() - end.x() * start.y());
+      }
+      const float depth1 = p1.z() - p0.z();
+      const float depth2 = p2.z() - p0.z();
+      triangle.depth_a = (depth1 * (p2.y() - p0.y()) -
+                          depth2 * (p1.y() - p0.y())) / area;
+      triangle.depth_b = (depth2 * (p1.x() - p0.x()) -
+                          depth1 * (p2.x() - p0.x())) / area;
+      triangle.depth_c = p0.z() - triangle.depth_a * p0.x() -
+                         triangle.depth_b * p0.y();
+      triangle.max_depth = std::max({p0.z(), p1.z(), p2.z()});
+      occluder.triangles.push_back(triangle);
+    }
+  }
+}
+
+void OcclusionCuller::RasterizeTileRow(const int tile_row) {
+  const int first_y = tile_row * kTileHeight;
+  Tile* tiles = &tiles_[tile_row * num_tiles_x_];
+  int begins[kTileHeight];
+  int ends[kTileHeight];
+  uint32_t masks[kTileHeight];
+  for (int occluder_index = 0; occluder_index < num_occluders_;
+       ++occluder_index) {
+    for (const Triangle& triangle : occluders_[occluder_index].triangles) {
+      if (triangle.max_y <= first_y ||
+          triangle.min_y >= first_y + kTileHeight) {
+        continue;
+      }
+      // The span of every row is where the centers of its pixels are inside
+      // the three edges.
+      for (int row = 0; row < kTileHeight; ++row) {
+        const int y = first_y + row;
+        if (y < triangle.min_y || y >= triangle.max_y) {
+          begins[row] = ends[row] = 0;
+          continue;
+        }
+        const float center_y = y + 0.5f;
+        float left = triangle.min_x;
+        float right = triangle.max_x;
+        for (int edge = 0; edge < 3; ++edge) {
+          const float a = triangle.edge_a[edge];
+          const float value =
+              triangle.edge_b[edge] * center_y + triangle.edge_c[edge];
+          if (a > 0.0f) {
+            left = std::max(left, -value / a);
+          } else if (a < 0.0f) {
+            right = std::min(right, -value / a);
+          } else if (value < 0.0f) {
+            right = -1.0f;
+          }
+        }
+        begins[row] = std::ceil(left - 0.5f);
+        ends[row] = right < left ? begins[row]
+                                 : static_cast<int>(
+                                       std::floor(right - 0.5f)) + 1;
+      }
+
+      const int first_tile = triangle.min_x / kTileWidth;
+      const int last_tile = (triangle.max_x - 1) / kTileWidth;
+      for (int tile_x = first_tile; tile_x <= last_tile; ++tile_x) {
+        const int first_x = tile_x * kTileWidth;
+#ifdef WVU_OCCLUSION_CULLER_SIMD
+        if (use_avx2_) {
+          ComputeRowMasksAvx2(begins, ends, first_x, masks);
+        } else {
+          ComputeRowMasks(begins, ends, first_x, masks);
+        }
+#else
+        ComputeRowMasks(begins, ends, first_x, masks);
+#endif
+        uint32_t any_coverage = 0;
+        for (const uint32_t mask : masks) any_coverage |= mask;
+        if (any_coverage == 0) continue;
+
+        // The farthest depth of the triangle over the tile is at one of the
+        // corners of the tile, unless it is at a vertex inside the tile.
+        const float x = triangle.depth_a > 0.0f ? first_x + kTileWidth
+                                                : first_x;
+        const float y = triangle.depth_b > 0.0f ? first_y + kTileHeight
+                                                : first_y;
+        const float depth = std::min(
+            triangle.max_depth,
+            triangle.depth_a * x + triangle.depth_b * y + triangle.depth_c);
+
+        Tile& tile = tiles[tile_x];
+        if (depth >= tile.far_depth) continue;
+        // A triangle much nearer than the layer starts a new layer, dropping
+        // the coverage of the previous one.
+        if (tile.layer_depth - depth > tile.far_depth - tile.layer_depth) {
+          std::fill(tile.masks, tile.masks + kTileHeight, 0);
+          tile.layer_depth = 0.0f;
+        }
+        tile.layer_depth = std::max(tile.layer_depth, depth);
+        uint32_t full_coverage = kFullRow;
+        for (int row = 0; row < kTileHeight; ++row) {
+          tile.masks[row] |= masks[row];
+          full_coverage &= tile.masks[row] | ~tile.valid_masks[row];
+        }
+        // The layer covers the whole tile and becomes its far depth.
+        if (full_coverage == kFullRow) {
+          tile.far_depth = tile.layer_depth;
+          tile.layer_depth = 0.0f;
+          std::fill(tile.masks, tile.masks + kTileHeight, 0);
+        }
+      }
+    }
+  }
+}
+
+bool OcclusionCuller::IsOccluded(const Eigen::AlignedBox3f& bounds) const {
+  if (bounds.isEmpty()) return false;
+  float min_x = kInfinity;
+  float max_x = -kInfinity;
+  float min_y = kInfinity;
+  float max_y = -kInfinity;
+  float min_depth = kInfinity;
+  for (int i = 0; i < 8; ++i) {
+    const Eigen::Vector4f clip =
+        view_projection_ *
+        bounds.corner(static_cast<Eigen::AlignedBox3f::CornerType>(i))
+            .homogeneous();
+    if (clip.z() < -clip.w() || clip.w() <= 0.0f) return false;
+    const Eigen::Vector3f ndc = clip.head<3>() / clip.w();
+    const float x = (0.5f * ndc.x() + 0.5f) * width_;
+    const float y = (0.5f * ndc.y() + 0.5f) * height_;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+    min_depth = std::min(min_depth, 0.5f * ndc.z() + 0.5f);
+  }
+  // The pixels the box touches.
+  const int first_x = ClampToPixels(std::floor(min_x), width_);
+  const int end_x = ClampToPixels(std::ceil(max_x), width_);
+  const int first_y = ClampToPixels(std::floor(min_y), height_);
+  const int end_y = ClampToPixels(std::ceil(max_y), height_);
+  if (first_x >= end_x || first_y >= end_y) return false;
+
+  for (int tile_y = first_y / kTileHeight;
+       tile_y <= (end_y - 1) / kTileHeight; ++tile_y) {
+    const int first_row = std::max(first_y - tile_y * kTileHeight, 0);
+    const int end_row = std::min(end_y - tile_y * kTileHeight, kTileHeight);
+    for (int tile_x = first_x / kTileWidth;
+         tile_x <= (end_x - 1) / kTileWidth; ++tile_x) {
+      const Tile& tile = tiles_[tile_y * num_tiles_x_ + tile_x];
+      if (min_depth >= tile.far_depth) continue;
+      const uint32_t row_mask = ComputeRowMask(
+          Clamp(first_x - tile_x * kTileWidth, 0, kTileWidth),
+          Clamp(end_x - tile_x * kTileWidth, 0, kTileWidth));
+      for (int row = first_row; row < end_row; ++row) {
+        if ((row_mask & ~tile.masks[row]) != 0) return false;
+        if (min_depth < tile.layer_depth &&
+            (row_mask & tile.masks[row]) != 0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+float OcclusionCuller::GetPixelDepth(const int x, const int y) const {
+  const Tile& tile =
+      tiles_[(y / kTileHeight) * num_tiles_x_ + x / kTileWidth];
+  return tile.masks[y % kTileHeight] >> (x % kTileWidth) & 1
+             ? tile.layer_depth
+             : tile.far_depth;
+}
+
+}  // namespace wvu
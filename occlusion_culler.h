@@ -0,0 +1,150 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef OCCLUSION_CULLER_H_
+#define OCCLUSION_CULLER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include "thread_pool.h"
+
+namespace wvu {
+// Counters of the occluders rendered by the last RenderOccluders().
+struct OcclusionCullerStats {
+  // Triangles of the occluders, and those that survived clipping.
+  int64_t num_occluder_triangles = 0;
+  int64_t num_occluder_triangles_rasterized = 0;
+};
+
+// A low-resolution CPU depth buffer of the occluders of a frame, which the
+// bounds of the other models are tested against before they are drawn
+// (masked software occlusion culling, see Andersson et al., "Masked Depth
+// Culling for Graphics Hardware", 2015, and Hasselgren et al., "Masked
+// Software Occlusion Culling", 2016).
+//
+// The buffer is made of 32x8 pixel tiles. Instead of a depth per pixel, a
+// tile has a coverage bit per pixel and two depths: the farthest depth of the
+// whole tile, and the farthest depth of the triangles that covered the pixels
+// whose bit is set. When the bits cover the whole tile, the second depth
+// becomes the first one. Both depths are conservative, so a model is culled
+// only if it is occluded, while the buffer takes a few bytes per tile.
+//
+// RenderOccluders() clips the triangles of the occluders to the near plane,
+// then rasterizes the rows of tiles in parallel, computing the coverage of
+// the eight rows of a tile at once with AVX2 when the CPU supports it.
+class OcclusionCuller {
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // Params:
+  //   width  Width of the depth buffer in pixels, e.g., a fraction of the
+  //     width of the framebuffer.
+  //   height  Height of the depth buffer in pixels.
+  //   thread_pool  The threads rasterizing the occluders, along with the
+  //     calling thread. If null, the culler is single-threaded.
+  OcclusionCuller(const int width, const int height, ThreadPool* thread_pool);
+  ~OcclusionCuller();
+
+  OcclusionCuller(const OcclusionCuller&) = delete;
+  OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+  // Clears the depth buffer and the occluders, and sets the camera of the
+  // frame.
+  // Params:
+  //   view_projection  The projection times the view matrix.
+  void BeginFrame(const Eigen::Matrix4f& view_projection);
+
+  // Adds an occluder to the frame. The vertices must outlive the next
+  // RenderOccluders().
+  // Params:
+  //   model_matrix  The model matrix of the occluder.
+  //   vertices  The vertices of its triangles in object coordinates, three
+  //     consecutive per triangle.
+  void AddOccluder(const Eigen::Matrix4f& model_matrix,
+                   const std::vector<Eigen::Vector3f>* vertices);
+
+  // Rasterizes the occluders added since BeginFrame() into the depth buffer.
+  void RenderOccluders();
+
+  // Returns true if a box is hidden by the occluders, i.e., if its nearest
+  // depth is behind the depth buffer over every pixel it covers. Boxes that
+  // cross the near plane or are outside the view are never occluded.
+  // Params:
+  //   bounds  The box in world coordinates.
+  bool IsOccluded(const Eigen::AlignedBox3f& bounds) const;
+
+  // Returns the conservative depth of a pixel in window coordinates, i.e., in
+  // [0, 1], or infinity if no occluder covers it.
+  float GetPixelDepth(const int x, const int y) const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Whether the coverage is computed with AVX2.
+  bool uses_avx2() const { return use_avx2_; }
+  const OcclusionCullerStats& stats() const { return stats_; }
+
+ private:
+  struct Tile;
+  struct Triangle;
+  struct Occluder;
+
+  // Transforms, clips and sets up the triangles of an occluder.
+  void SetUpTriangles(const int occluder_index);
+  // Rasterizes the triangles of the occluders into a row of tiles.
+  void RasterizeTileRow(const int tile_row);
+
+  const int width_;
+  const int height_;
+  const int num_tiles_x_;
+  const int num_tiles_y_;
+  ThreadPool* thread_pool_;
+  const bool use_avx2_;
+
+  Eigen::Matrix4f view_projection_;
+  std::vector<Tile> tiles_;
+  // The occluders of the frame are the first num_occluders_ ones. The others
+  // are kept to reuse their memory.
+  std::vector<Occluder, Eigen::aligned_allocator<Occluder>> occluders_;
+  int num_occluders_;
+  OcclusionCullerStats stats_;
+};
+
+}  // namespace wvu
+
+#endif  // OCCLUSION_CULLER_H_
@@ -0,0 +1,218 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+// Measures the throughput of the software rasterizer in millions of triangles
+// and millions of shaded pixels per second. Two workloads are rendered:
+//   * Triangles: many small triangles, which stress the set-up and binning.
+//   * Fill: a few screen-sized textured quads with overdraw, which stress the
+//     pixel pipeline.
+
+#ifdef GFLAGS_NAMESPACE_GOOGLE
+#define GLUTILS_GFLAGS_NAMESPACE google
+#else
+#define GLUTILS_GFLAGS_NAMESPACE gflags
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "camera_utils.h"
+#include "model.h"
+#include "software_rasterizer.h"
+#include "thread_pool.h"
+#include "transformations.h"
+
+DEFINE_int32(width, 1920, "Width of the framebuffer.");
+DEFINE_int32(height, 1080, "Height of the framebuffer.");
+DEFINE_int32(num_threads, 0,
+             "Number of rasterizer threads besides the calling thread. Zero "
+             "uses one per core; -1 runs single-threaded.");
+DEFINE_int32(num_frames, 20, "Number of frames measured per workload.");
+DEFINE_int32(grid_size, 128,
+             "Cells per side of the meshes of the triangles workload. Each "
+             "cell is two triangles.");
+DEFINE_int32(num_meshes, 16, "Number of meshes of the triangles workload.");
+
+namespace {
+using wvu::Model;
+
+// Builds a grid of cells in [0, 1] x [0, 1] on the z = 0 plane.
+std::unique_ptr<Model> MakeGrid(const int grid_size) {
+  Eigen::MatrixXf vertices(3, (grid_size + 1) * (grid_size + 1));
+  for (int y = 0; y <= grid_size; ++y) {
+    for (int x = 0; x <= grid_size; ++x) {
+      vertices.col(y * (grid_size + 1) + x) =
+          Eigen::Vector3f(static_cast<float>(x) / grid_size,
+                          static_cast<float>(y) / grid_size, 0.0f);
+    }
+  }
+  std::vector<GLuint> indices;
+  indices.reserve(6 * grid_size * grid_size);
+  for (int y = 0; y < grid_size; ++y) {
+    for (int x = 0; x < grid_size; ++x) {
+      const GLuint corner = y * (grid_size + 1) + x;
+      indices.insert(indices.end(),
+                     {corner, corner + 1, corner + grid_size + 2, corner,
+                      corner + grid_size + 2, corner + grid_size + 1});
+    }
+  }
+  return std::unique_ptr<Model>(new Model(
+      Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(), vertices, indices));
+}
+
+// Makes a checkerboard texture.
+wvu::SoftwareTexture MakeCheckerboard(const int size) {
+  wvu::SoftwareTexture texture;
+  texture.width = size;
+  texture.height = size;
+  texture.texels.resize(4 * size * size);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const uint8_t value = ((x / 8 + y / 8) % 2) ? 230 : 40;
+      uint8_t* texel = &texture.texels[4 * (y * size + x)];
+      texel[0] = value;
+      texel[1] = value;
+      texel[2] = 255 - value;
+      texel[3] = 255;
+    }
+  }
+  return texture;
+}
+
+// A model drawn with its model matrix.
+struct Instance {
+  const Model* model;
+  Eigen::Matrix4f model_matrix;
+};
+
+// Renders the instances for a number of frames and prints the throughput.
+void RunWorkload(const char* name,
+                 const std::vector<Instance>& instances,
+                 const wvu::SoftwareTexture& texture,
+                 const Eigen::Matrix4f& projection,
+                 wvu::SoftwareRasterizer* rasterizer) {
+  const Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+  int64_t num_triangles = 0;
+  int64_t num_pixels_shaded = 0;
+  double seconds = 0.0;
+  // The first frame warms up the caches and grows the bins.
+  for (int frame = -1; frame < FLAGS_num_frames; ++frame) {
+    const auto start_time = std::chrono::steady_clock::now();
+    rasterizer->Clear(Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
+    for (const Instance& instance : instances) {
+      rasterizer->DrawModel(projection, view, instance.model_matrix, &texture,
+                            *instance.model);
+    }
+    rasterizer->Flush();
+    const auto end_time = std::chrono::steady_clock::now();
+    if (frame < 0) continue;
+    seconds += std::chrono::duration<double>(end_time - start_time).count();
+    num_triangles += rasterizer->stats().num_triangles;
+    num_pixels_shaded += rasterizer->stats().num_pixels_shaded;
+  }
+  printf("%-10s %8.2f ms/frame %9.2f Mtris/s %9.2f Mpix/s "
+         "(%lld tris, %lld pixels shaded per frame)\n",
+         name, 1e3 * seconds / FLAGS_num_frames, 1e-6 * num_triangles / seconds,
+         1e-6 * num_pixels_shaded / seconds,
+         static_cast<long long>(num_triangles / FLAGS_num_frames),
+         static_cast<long long>(num_pixels_shaded / FLAGS_num_frames));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  GLUTILS_GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  std::unique_ptr<wvu::ThreadPool> thread_pool;
+  if (FLAGS_num_threads >= 0) {
+    thread_pool.reset(new wvu::ThreadPool(FLAGS_num_threads, "Rasterizer"));
+  }
+  wvu::SoftwareRasterizer rasterizer(FLAGS_width, FLAGS_height,
+                                     thread_pool.get());
+  printf("%dx%d, %d threads, %s\n", FLAGS_width, FLAGS_height,
+         thread_pool == nullptr ? 1 : thread_pool->num_threads() + 1,
+         rasterizer.uses_avx2() ? "AVX2" : "scalar");
+
+  const wvu::SoftwareTexture texture = MakeCheckerboard(256);
+  const Eigen::Matrix4f projection = wvu::ComputePerspectiveProjectionMatrix(
+      wvu::ConvertDegreesToRadians(45.0f),
+      static_cast<float>(FLAGS_width) / FLAGS_height, 0.1f, 100.0f);
+
+  // Small triangles: randomly oriented grids spread over the view.
+  const std::unique_ptr<Model> grid = MakeGrid(FLAGS_grid_size);
+  std::mt19937 random_engine(5);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  std::vector<Instance> instances;
+  for (int i = 0; i < FLAGS_num_meshes; ++i) {
+    Instance instance;
+    instance.model = grid.get();
+    instance.model_matrix = Eigen::Matrix4f::Identity();
+    instance.model_matrix.block<3, 3>(0, 0) =
+        Eigen::AngleAxisf(uniform(random_engine),
+                          Eigen::Vector3f::Random().normalized())
+            .toRotationMatrix();
+    instance.model_matrix.block<3, 1>(0, 3) = Eigen::Vector3f(
+        1.5f * uniform(random_engine) - 0.5f,
+        uniform(random_engine) - 0.5f, -3.0f - uniform(random_engine));
+    instances.push_back(instance);
+  }
+  RunWorkload("Triangles", instances, texture, projection, &rasterizer);
+
+  // Fill: screen-filling quads drawn back to front, so that every one of them
+  // passes the depth test.
+  const std::unique_ptr<Model> quad = MakeGrid(1);
+  instances.clear();
+  for (int i = 0; i < 8; ++i) {
+    Instance instance;
+    instance.model = quad.get();
+    const float distance = 10.0f - i;
+    instance.model_matrix = Eigen::Matrix4f::Identity();
+    instance.model_matrix.block<3, 3>(0, 0) *= 2.0f * distance;
+    instance.model_matrix.block<3, 1>(0, 3) =
+        Eigen::Vector3f(-distance, -distance, -distance);
+    instances.push_back(instance);
+  }
+  RunWorkload("Fill", instances, texture, projection, &rasterizer);
+  return 0;
+}
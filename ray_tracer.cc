@@ -0,0 +1,197 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "ray_tracer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/LU>
+#include <glog/logging.h>
+
+#include "bvh.h"
+#include "camera_utils.h"
+#include "cpu_profiler.h"
+#include "cpu_utils.h"
+#include "scene_bvh.h"
+#include "software_rasterizer.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+constexpr int kTileSize = 32;
+// The pixels of a ray packet.
+constexpr int kPacketWidth = 4;
+constexpr int kPacketHeight = kRayPacketSize / kPacketWidth;
+
+uint32_t PackColor(const Eigen::Vector4f& color) {
+  uint32_t packed_color = 0;
+  for (int i = 0; i < 4; ++i) {
+    packed_color |= static_cast<uint32_t>(
+        std::min(std::max(color[i], 0.0f), 1.0f) * 255.0f + 0.5f) << (8 * i);
+  }
+  return packed_color;
+}
+
+}  // namespace
+
+RayTracer::RayTracer(const int width,
+                     const int height,
+                     ThreadPool* thread_pool)
+    : width_(width),
+      height_(height),
+      num_tiles_x_(internal::DivideRoundingUp(width, kTileSize)),
+      num_tiles_y_(internal::DivideRoundingUp(height, kTileSize)),
+      thread_pool_(thread_pool),
+      use_ray_packets_(true),
+      color_buffer_(4 * width * height),
+      tile_num_hits_(num_tiles_x_ * num_tiles_y_) {}
+
+RayTracer::~RayTracer() {}
+
+void RayTracer::Render(const SceneBvh& scene,
+                       const SoftwareTexture* const* instance_textures,
+                       const Eigen::Matrix4f& projection,
+                       const Eigen::Matrix4f& view,
+                       const Eigen::Vector4f& background_color) {
+  Frame frame;
+  frame.scene = &scene;
+  frame.instance_textures = instance_textures;
+  frame.inverse_view_projection = (projection * view).inverse();
+  frame.background_color = PackColor(background_color);
+  RenderFrame(frame);
+}
+
+void RayTracer::Render(const SceneBvh& scene,
+                       const SoftwareTexture* const* instance_textures,
+                       const Camera& camera,
+                       const Eigen::Vector4f& background_color) {
+  DCHECK(camera.depth_mode() == DepthMode::kStandard &&
+         !camera.has_infinite_far_plane());
+  Frame frame;
+  frame.scene = &scene;
+  frame.instance_textures = instance_textures;
+  frame.inverse_view_projection = camera.inverse_view_projection();
+  frame.background_color = PackColor(background_color);
+  RenderFrame(frame);
+}
+
+void RayTracer::RenderFrame(const Frame& frame) {
+  WVU_PROFILE_ZONE("RayTracer::Render");
+  const int num_tiles = num_tiles_x_ * num_tiles_y_;
+  const auto render_tile = [&](const int tile_index) {
+    tile_num_hits_[tile_index] = RenderTile(tile_index, frame);
+  };
+  if (thread_pool_ != nullptr) {
+    thread_pool_->ParallelFor(num_tiles, render_tile);
+  } else {
+    for (int i = 0; i < num_tiles; ++i) render_tile(i);
+  }
+  stats_.num_rays = static_cast<int64_t>(width_) * height_;
+  stats_.num_hits = 0;
+  for (const int num_hits : tile_num_hits_) stats_.num_hits += num_hits;
+}
+
+int RayTracer::RenderTile(const int tile_index, const Frame& frame) {
+  const int first_x = (tile_index % num_tiles_x_) * kTileSize;
+  const int first_y = (tile_index / num_tiles_x_) * kTileSize;
+  const int end_x = std::min(first_x + kTileSize, width_);
+  const int end_y = std::min(first_y + kTileSize, height_);
+  int num_hits = 0;
+  const auto write_pixel = [&](const int x, const int y, const SceneHit& hit) {
+    const uint32_t color = Shade(hit, frame);
+    memcpy(&color_buffer_[4 * (y * width_ + x)], &color, sizeof(color));
+    num_hits += hit.instance_index >= 0;
+  };
+
+  if (!use_ray_packets_) {
+    for (int y = first_y; y < end_y; ++y) {
+      for (int x = first_x; x < end_x; ++x) {
+        SceneHit hit;
+        frame.scene->Intersect(
+            ComputePixelRay(frame.inverse_view_projection, width_, height_, x,
+                            y),
+            &hit);
+        write_pixel(x, y, hit);
+      }
+    }
+    return num_hits;
+  }
+
+  RayPacket packet;
+  SceneHit hits[kRayPacketSize];
+  for (int y = first_y; y < end_y; y += kPacketHeight) {
+    for (int x = first_x; x < end_x; x += kPacketWidth) {
+      // The pixels past the edges of the image repeat the last one.
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        const Ray ray = ComputePixelRay(
+            frame.inverse_view_projection, width_, height_,
+            std::min(x + i % kPacketWidth, end_x - 1),
+            std::min(y + i / kPacketWidth, end_y - 1));
+        for (int axis = 0; axis < 3; ++axis) {
+          packet.origin[axis][i] = ray.origin[axis];
+          packet.direction[axis][i] = ray.direction[axis];
+        }
+        packet.max_distance[i] = ray.max_distance;
+      }
+      frame.scene->IntersectPacket(packet, hits);
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        const int pixel_x = x + i % kPacketWidth;
+        const int pixel_y = y + i / kPacketWidth;
+        if (pixel_x < end_x && pixel_y < end_y) {
+          write_pixel(pixel_x, pixel_y, hits[i]);
+        }
+      }
+    }
+  }
+  return num_hits;
+}
+
+uint32_t RayTracer::Shade(const SceneHit& hit, const Frame& frame) const {
+  if (hit.instance_index < 0) return frame.background_color;
+  // The texel is given by the position of the hit in object coordinates.
+  const std::vector<Eigen::Vector3f>& mesh_vertices =
+      frame.scene->mesh_vertices(
+          frame.scene->instance_mesh(hit.instance_index));
+  const Eigen::Vector3f* vertices = &mesh_vertices[3 * hit.triangle_index];
+  const Eigen::Vector3f position = (1.0f - hit.u - hit.v) * vertices[0] +
+                                   hit.u * vertices[1] + hit.v * vertices[2];
+  return SampleSoftwareTexture(frame.instance_textures[hit.instance_index],
+                               position.x(), position.y());
+}
+
+}  // namespace wvu
@@ -0,0 +1,146 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef RAY_TRACER_H_
+#define RAY_TRACER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "camera_utils.h"
+#include "scene_bvh.h"
+#include "software_rasterizer.h"
+#include "thread_pool.h"
+
+namespace wvu {
+// Counters of the work done by the last Render().
+struct RayTracerStats {
+  int64_t num_rays = 0;
+  // Rays that hit a triangle.
+  int64_t num_hits = 0;
+};
+
+// A CPU ray tracer that renders the models the way SoftwareRasterizer does:
+// every pixel shows the nearest triangle through its center, textured at the
+// texel the scene's vertex shader takes from the x and y of the vertex
+// position. It renders the reference frames the rasterized ones are compared
+// to.
+//
+// Render() traces a ray per pixel from the near to the far plane of the
+// projection through the instances of a SceneBvh, whose top level is rebuilt
+// every frame as the models move while the BVHs of the meshes are not. The
+// image is rendered in 32x32 pixel tiles in parallel, and the rays of every
+// 4x2 pixels are traced together as a packet.
+class RayTracer {
+ public:
+  // Params:
+  //   width  Width of the image in pixels.
+  //   height  Height of the image in pixels.
+  //   thread_pool  The threads rendering the tiles, along with the calling
+  //     thread. If null, the ray tracer is single-threaded.
+  RayTracer(const int width, const int height, ThreadPool* thread_pool);
+  ~RayTracer();
+
+  RayTracer(const RayTracer&) = delete;
+  RayTracer& operator=(const RayTracer&) = delete;
+
+  // Renders the instances of a scene.
+  // Params:
+  //   scene  The scene, whose top level must be built.
+  //   instance_textures  The textures of the instances, in the order of the
+  //     instances. A null or empty texture renders the instance in white.
+  //   projection  The projection matrix.
+  //   view  The view matrix.
+  //   background_color  The RGBA color in [0, 1] of the pixels whose rays
+  //     miss every triangle.
+  void Render(const SceneBvh& scene,
+              const SoftwareTexture* const* instance_textures,
+              const Eigen::Matrix4f& projection,
+              const Eigen::Matrix4f& view,
+              const Eigen::Vector4f& background_color);
+  // Same as above with the cached inverse view projection of a camera, whose
+  // depth mode must be the standard one with a far plane.
+  void Render(const SceneBvh& scene,
+              const SoftwareTexture* const* instance_textures,
+              const Camera& camera,
+              const Eigen::Vector4f& background_color);
+
+  // Whether the rays are traced in packets. Otherwise they are traced one at
+  // a time. Defaults to true.
+  void set_use_ray_packets(const bool use_ray_packets) {
+    use_ray_packets_ = use_ray_packets;
+  }
+
+  // The image, RGBA with four bytes per pixel. As with glReadPixels(), the
+  // first row is the bottom of the image.
+  const uint8_t* color_buffer() const { return color_buffer_.data(); }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  const RayTracerStats& stats() const { return stats_; }
+
+ private:
+  // The scene and the camera of a Render().
+  struct Frame {
+    const SceneBvh* scene;
+    const SoftwareTexture* const* instance_textures;
+    Eigen::Matrix4f inverse_view_projection;
+    uint32_t background_color;
+  };
+
+  // Renders the image of a frame.
+  void RenderFrame(const Frame& frame);
+  // Renders a tile of the image and returns the number of rays that hit a
+  // triangle.
+  int RenderTile(const int tile_index, const Frame& frame);
+  // Returns the color of a hit.
+  uint32_t Shade(const SceneHit& hit, const Frame& frame) const;
+
+  const int width_;
+  const int height_;
+  const int num_tiles_x_;
+  const int num_tiles_y_;
+  ThreadPool* thread_pool_;
+  bool use_ray_packets_;
+
+  std::vector<uint8_t> color_buffer_;
+  std::vector<int> tile_num_hits_;
+  RayTracerStats stats_;
+};
+
+}  // namespace wvu
+
+#endif  // RAY_TRACER_H_
@@ -0,0 +1,189 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+// Measures the throughput of the ray tracer: the time to build the BVH of a
+// mesh, to build and to refit the top level over the instances of the mesh
+// placed at random, and the millions of primary rays per second traced
+// through them in packets and one at a time.
+
+#ifdef GFLAGS_NAMESPACE_GOOGLE
+#define GLUTILS_GFLAGS_NAMESPACE google
+#else
+#define GLUTILS_GFLAGS_NAMESPACE gflags
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "bvh.h"
+#include "camera_utils.h"
+#include "ray_tracer.h"
+#include "scene_bvh.h"
+#include "thread_pool.h"
+#include "transformations.h"
+
+DEFINE_int32(width, 1920, "Width of the image.");
+DEFINE_int32(height, 1080, "Height of the image.");
+DEFINE_int32(num_threads, 0,
+             "Number of ray tracer threads besides the calling thread. Zero "
+             "uses one per core; -1 runs single-threaded.");
+DEFINE_int32(num_frames, 5, "Number of builds and frames measured.");
+DEFINE_int32(grid_size, 128,
+             "Cells per side of the mesh. Each cell is two triangles.");
+DEFINE_int32(num_instances, 16, "Number of instances of the mesh.");
+
+namespace {
+// Builds the triangles of a grid of cells in [0, 1] x [0, 1] on the z = 0
+// plane.
+std::vector<Eigen::Vector3f> MakeGrid(const int grid_size) {
+  std::vector<Eigen::Vector3f> vertices;
+  vertices.reserve(6 * grid_size * grid_size);
+  const auto vertex = [grid_size](const int x, const int y) {
+    return Eigen::Vector3f(static_cast<float>(x) / grid_size,
+                           static_cast<float>(y) / grid_size, 0.0f);
+  };
+  for (int y = 0; y < grid_size; ++y) {
+    for (int x = 0; x < grid_size; ++x) {
+      vertices.insert(vertices.end(),
+                      {vertex(x, y), vertex(x + 1, y), vertex(x + 1, y + 1),
+                       vertex(x, y), vertex(x + 1, y + 1), vertex(x, y + 1)});
+    }
+  }
+  return vertices;
+}
+
+// Runs a function for a number of times and returns the average seconds.
+double MeasureSeconds(const std::function<void()>& function) {
+  const auto start_time = std::chrono::steady_clock::now();
+  for (int i = 0; i < FLAGS_num_frames; ++i) function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start_time).count() /
+         FLAGS_num_frames;
+}
+
+// Renders the scene for a number of frames and prints the throughput.
+void RunWorkload(const char* name,
+                 const bool use_ray_packets,
+                 const wvu::SceneBvh& scene,
+                 const Eigen::Matrix4f& projection,
+                 wvu::RayTracer* ray_tracer) {
+  ray_tracer->set_use_ray_packets(use_ray_packets);
+  const Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+  const Eigen::Vector4f background_color(0.0f, 0.0f, 0.0f, 1.0f);
+  const std::vector<const wvu::SoftwareTexture*> instance_textures(
+      scene.num_instances(), nullptr);
+  int64_t num_rays = 0;
+  int64_t num_hits = 0;
+  double seconds = 0.0;
+  // The first frame warms up the caches.
+  for (int frame = -1; frame < FLAGS_num_frames; ++frame) {
+    const auto start_time = std::chrono::steady_clock::now();
+    ray_tracer->Render(scene, instance_textures.data(), projection, view,
+                       background_color);
+    const auto end_time = std::chrono::steady_clock::now();
+    if (frame < 0) continue;
+    seconds += std::chrono::duration<double>(end_time - start_time).count();
+    num_rays += ray_tracer->stats().num_rays;
+    num_hits += ray_tracer->stats().num_hits;
+  }
+  printf("%-12s %8.2f ms/frame %9.2f Mrays/s (%.1f%% of the rays hit)\n",
+         name, 1e3 * seconds / FLAGS_num_frames, 1e-6 * num_rays / seconds,
+         100.0 * num_hits / num_rays);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  GLUTILS_GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  std::unique_ptr<wvu::ThreadPool> thread_pool;
+  if (FLAGS_num_threads >= 0) {
+    thread_pool.reset(new wvu::ThreadPool(FLAGS_num_threads, "RayTracer"));
+  }
+  wvu::RayTracer ray_tracer(FLAGS_width, FLAGS_height, thread_pool.get());
+  wvu::SceneBvh scene;
+  const std::vector<Eigen::Vector3f> grid = MakeGrid(FLAGS_grid_size);
+  const int num_triangles = grid.size() / 3;
+  const double mesh_seconds = MeasureSeconds([&]() {
+    wvu::Bvh bvh;
+    bvh.Build(grid, thread_pool.get());
+  });
+  scene.AddMesh(grid, thread_pool.get());
+  printf("%dx%d, %d threads, %s packets\n", FLAGS_width, FLAGS_height,
+         thread_pool == nullptr ? 1 : thread_pool->num_threads() + 1,
+         scene.mesh_bvh(0).uses_avx2() ? "AVX2" : "scalar");
+  printf("%-12s %8.2f ms/build %9.2f Mtris/s (%d triangles, %d nodes)\n",
+         "Mesh BVH", 1e3 * mesh_seconds, 1e-6 * num_triangles / mesh_seconds,
+         num_triangles, scene.mesh_bvh(0).num_nodes());
+
+  // Randomly oriented grids spread over the view.
+  std::mt19937 random_engine(5);
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  for (int i = 0; i < FLAGS_num_instances; ++i) {
+    Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+    model_matrix.block<3, 3>(0, 0) =
+        Eigen::AngleAxisf(uniform(random_engine),
+                          Eigen::Vector3f::Random().normalized())
+            .toRotationMatrix();
+    model_matrix.block<3, 1>(0, 3) = Eigen::Vector3f(
+        1.5f * uniform(random_engine) - 0.5f,
+        uniform(random_engine) - 0.5f, -3.0f - uniform(random_engine));
+    scene.AddInstance(0, model_matrix);
+  }
+  const double top_level_seconds =
+      MeasureSeconds([&]() { scene.BuildTopLevel(thread_pool.get()); });
+  const double refit_seconds =
+      MeasureSeconds([&]() { scene.RefitTopLevel(thread_pool.get()); });
+  printf("%-12s %8.3f ms/build %8.3f ms/refit (%d instances)\n",
+         "Top level", 1e3 * top_level_seconds, 1e3 * refit_seconds,
+         scene.num_instances());
+
+  const Eigen::Matrix4f projection = wvu::ComputePerspectiveProjectionMatrix(
+      wvu::ConvertDegreesToRadians(45.0f),
+      static_cast<float>(FLAGS_width) / FLAGS_height, 0.1f, 100.0f);
+  RunWorkload("Packets", true, scene, projection, &ray_tracer);
+  RunWorkload("Single rays", false, scene, projection, &ray_tracer);
+  return 0;
+}
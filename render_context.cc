@@ -0,0 +1,373 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "render_context.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+// EGL creates contexts without a window system. See
+// https://www.khronos.org/registry/EGL/ for more information.
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+// The header of GLFW. This library is a C-based and light-weight library for
+// creating windows for OpenGL rendering.
+// See http://www.glfw.org/ for more information.
+#include <GLFW/glfw3.h>
+#include <glog/logging.h>
+
+namespace wvu {
+namespace {
+// OpenGL versions requested for headless contexts, from the most preferred to
+// the least preferred.
+constexpr int kHeadlessGlVersions[][2] = {{4, 5}, {3, 3}};
+
+// Initializes GLEW for the current context. Returns true upon success.
+bool InitializeGlew() {
+  glewExperimental = GL_TRUE;
+  const GLenum result = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+  // GLEW built for GLX reports this error for EGL contexts, even though the
+  // OpenGL entry points were loaded correctly.
+  if (result == GLEW_ERROR_NO_GLX_DISPLAY) return true;
+#endif
+  if (result != GLEW_OK) {
+    LOG(ERROR) << "Glew did not initialize properly: "
+               << glewGetErrorString(result);
+    return false;
+  }
+  return true;
+}
+
+// A framebuffer object with a color and a depth-stencil renderbuffer.
+struct OffscreenFramebuffer {
+  // Creates the framebuffer object and its renderbuffers, and binds it.
+  // Returns true upon success.
+  bool Create(const int width, const int height, const GLenum depth_format) {
+    glGenRenderbuffers(1, &color_renderbuffer_id);
+    glBindRenderbuffer(GL_RENDERBUFFER, color_renderbuffer_id);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depth_renderbuffer_id);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer_id);
+    glRenderbufferStorage(GL_RENDERBUFFER, depth_format, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &framebuffer_id);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color_renderbuffer_id);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth_renderbuffer_id);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      LOG(ERROR) << "The offscreen framebuffer is incomplete.";
+      return false;
+    }
+    return true;
+  }
+
+  // Deletes the framebuffer object and its renderbuffers. The context must be
+  // current.
+  void Delete() {
+    glDeleteFramebuffers(1, &framebuffer_id);
+    glDeleteRenderbuffers(1, &color_renderbuffer_id);
+    glDeleteRenderbuffers(1, &depth_renderbuffer_id);
+    framebuffer_id = 0;
+    color_renderbuffer_id = 0;
+    depth_renderbuffer_id = 0;
+  }
+
+  GLuint framebuffer_id = 0;
+  GLuint color_renderbuffer_id = 0;
+  GLuint depth_renderbuffer_id = 0;
+};
+
+// Returns the internal format of the depth buffer requested by the options.
+GLenum GetDepthFormat(const RenderContextOptions& options) {
+  return options.float_depth ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8;
+}
+
+// Error callback function. This function follows the required signature of
+// GLFW. See http://www.glfw.org/docs/3.0/group__error.html for more
+// information.
+void ErrorCallback(int error, const char* description) {
+  std::cerr << "ERROR: " << description << std::endl;
+}
+
+// Key callback. This function follows the required signature of GLFW. See
+// http://www.glfw.org/docs/latest/input_guide.html fore more information.
+void KeyCallback(GLFWwindow* window,
+                 int key,
+                 int scancode,
+                 int action,
+                 int mods) {
+  if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+    glfwSetWindowShouldClose(window, GL_TRUE);
+  }
+}
+
+// Configures glfw.
+void SetWindowHints(const bool visible) {
+  // Sets properties of windows and have to be set before creation.
+  // GLFW_CONTEXT_VERSION_{MAJOR|MINOR} sets the minimum OpenGL API version
+  // that this program will use.
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+  // Sets the OpenGL profile.
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  // Sets the property of resizability of a window.
+  glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+  glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
+}
+
+// A GLFW window and its OpenGL context.
+class WindowRenderContext : public RenderContext {
+ public:
+  ~WindowRenderContext() override {
+    if (window_ != nullptr) {
+      offscreen_framebuffer_.Delete();
+      glfwDestroyWindow(window_);
+    }
+    glfwTerminate();
+  }
+
+  static std::unique_ptr<RenderContext> Create(
+      const RenderContextOptions& options) {
+    glfwSetErrorCallback(ErrorCallback);
+    if (!glfwInit()) {
+      LOG(ERROR) << "GLFW did not initialize correctly.";
+      return nullptr;
+    }
+    std::unique_ptr<WindowRenderContext> context(new WindowRenderContext);
+    SetWindowHints(options.visible);
+    context->window_ = glfwCreateWindow(options.width,
+                                        options.height,
+                                        options.window_name.c_str(),
+                                        nullptr,
+                                        nullptr);
+    if (context->window_ == nullptr) {
+      LOG(ERROR) << "Could not create a window.";
+      return nullptr;
+    }
+    // Make the window's context current.
+    glfwMakeContextCurrent(context->window_);
+    glfwSwapInterval(options.vsync ? 1 : 0);
+    glfwSetKeyCallback(context->window_, KeyCallback);
+    if (!InitializeGlew()) return nullptr;
+    // We get the frame buffer dimensions, which may differ from the window
+    // dimensions on high resolution displays.
+    glfwGetFramebufferSize(context->window_, &context->width_,
+                           &context->height_);
+    if (options.float_depth) {
+      context->depth_format_ = GetDepthFormat(options);
+      if (!context->offscreen_framebuffer_.Create(context->width_,
+                                                  context->height_,
+                                                  context->depth_format_)) {
+        return nullptr;
+      }
+    }
+    return context;
+  }
+
+  bool ShouldClose() const override {
+    return glfwWindowShouldClose(window_);
+  }
+
+  void SwapBuffers() override {
+    const GLuint framebuffer_id = offscreen_framebuffer_.framebuffer_id;
+    if (framebuffer_id != 0) {
+      // Copies the offscreen frame to the window.
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer_id);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_,
+                        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_id);
+    }
+    glfwSwapBuffers(window_);
+  }
+
+  void PollEvents() override {
+    glfwPollEvents();
+  }
+
+  GLuint framebuffer_id() const override {
+    return offscreen_framebuffer_.framebuffer_id;
+  }
+
+  bool is_headless() const override { return false; }
+
+ private:
+  WindowRenderContext() : window_(nullptr) {}
+
+  GLFWwindow* window_;
+  // The framebuffer with a floating point depth buffer the frames are
+  // rendered to, if requested. Otherwise, the frames are rendered to the
+  // default framebuffer.
+  OffscreenFramebuffer offscreen_framebuffer_;
+};
+
+// An EGL context without any surface that renders into a framebuffer object.
+class HeadlessRenderContext : public RenderContext {
+ public:
+  ~HeadlessRenderContext() override {
+    if (context_ != EGL_NO_CONTEXT) {
+      framebuffer_.Delete();
+      eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     EGL_NO_CONTEXT);
+      eglDestroyContext(display_, context_);
+    }
+    if (display_ != EGL_NO_DISPLAY) eglTerminate(display_);
+  }
+
+  static std::unique_ptr<RenderContext> Create(
+      const RenderContextOptions& options) {
+    std::unique_ptr<HeadlessRenderContext> context(new HeadlessRenderContext);
+    if (!context->CreateEglContext() || !InitializeGlew()) return nullptr;
+    context->width_ = options.width;
+    context->height_ = options.height;
+    context->depth_format_ = GetDepthFormat(options);
+    if (!context->framebuffer_.Create(context->width_, context->height_,
+                                      context->depth_format_)) {
+      return nullptr;
+    }
+    return context;
+  }
+
+  bool ShouldClose() const override { return false; }
+
+  // There is nothing to present. Flushing keeps the GPU busy with the frame
+  // while the CPU prepares the next one.
+  void SwapBuffers() override { glFlush(); }
+
+  void PollEvents() override {}
+
+  GLuint framebuffer_id() const override {
+    return framebuffer_.framebuffer_id;
+  }
+
+  bool is_headless() const override { return true; }
+
+ private:
+  HeadlessRenderContext()
+      : display_(EGL_NO_DISPLAY), context_(EGL_NO_CONTEXT) {}
+
+  // Returns the surfaceless display of Mesa if available, which does not need
+  // a display server nor a GPU. Otherwise, returns the default display.
+  static EGLDisplay GetDisplay() {
+    const char* client_extensions =
+        eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_extensions != nullptr &&
+        strstr(client_extensions, "EGL_MESA_platform_surfaceless") !=
+            nullptr) {
+      const auto get_platform_display =
+          reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+              eglGetProcAddress("eglGetPlatformDisplayEXT"));
+      if (get_platform_display != nullptr) {
+        return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                    EGL_DEFAULT_DISPLAY, nullptr);
+      }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  bool CreateEglContext() {
+    display_ = GetDisplay();
+    EGLint major_version;
+    EGLint minor_version;
+    if (display_ == EGL_NO_DISPLAY ||
+        !eglInitialize(display_, &major_version, &minor_version)) {
+      LOG(ERROR) << "Could not initialize an EGL display.";
+      return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+      LOG(ERROR) << "The EGL display does not support OpenGL.";
+      return false;
+    }
+    // The context never renders to an EGL surface, so any configuration
+    // works. The surfaceless platform only supports pixel buffer surfaces.
+    const EGLint config_attributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(display_, config_attributes, &config, 1,
+                         &num_configs) || num_configs == 0) {
+      LOG(ERROR) << "Could not find an EGL configuration for OpenGL.";
+      return false;
+    }
+    for (const auto& version : kHeadlessGlVersions) {
+      const EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, version[0],
+        EGL_CONTEXT_MINOR_VERSION, version[1],
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+      };
+      context_ = eglCreateContext(display_, config, EGL_NO_CONTEXT,
+                                  context_attributes);
+      if (context_ != EGL_NO_CONTEXT) break;
+    }
+    if (context_ == EGL_NO_CONTEXT) {
+      LOG(ERROR) << "Could not create an EGL context.";
+      return false;
+    }
+    // Surfaceless contexts require EGL_KHR_surfaceless_context, which Mesa
+    // and the proprietary drivers support.
+    if (!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+      LOG(ERROR) << "Could not make the EGL context current.";
+      return false;
+    }
+    return true;
+  }
+
+  EGLDisplay display_;
+  EGLContext context_;
+  // The framebuffer the frames are rendered to.
+  OffscreenFramebuffer framebuffer_;
+};
+
+}  // namespace
+
+std::unique_ptr<RenderContext> CreateRenderContext(
+    const RenderContextOptions& options) {
+  if (options.headless) return HeadlessRenderContext::Create(options);
+  return WindowRenderContext::Create(options);
+}
+
+}  // namespace wvu
@@ -0,0 +1,110 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef RENDER_CONTEXT_H_
+#define RENDER_CONTEXT_H_
+
+#include <memory>
+#include <string>
+
+#include <GL/glew.h>
+
+namespace wvu {
+// Options to create a render context.
+struct RenderContextOptions {
+  // Dimensions of the window or of the offscreen framebuffer.
+  int width = 640;
+  int height = 480;
+  std::string window_name;
+  // Renders to an offscreen framebuffer without a window or a display server.
+  bool headless = false;
+  // Shows the window. Ignored by headless contexts.
+  bool visible = true;
+  // Synchronizes the buffer swaps with the display. Ignored by headless
+  // contexts.
+  bool vsync = true;
+  // Uses a 32-bit floating point depth buffer (GL_DEPTH32F_STENCIL8) instead
+  // of the 24-bit fixed point one. Paired with the reverse-Z depth mode, it
+  // keeps the depth precision of distant geometry. The default framebuffer of
+  // a window has a fixed point depth buffer, so windows render to an
+  // offscreen framebuffer that is copied to the window on every swap.
+  bool float_depth = false;
+};
+
+// An OpenGL context and the framebuffer the frames are rendered to. There are
+// two implementations: a GLFW window, and a headless context created with EGL
+// (surfaceless on Mesa, which runs on llvmpipe without a GPU) that renders to
+// a framebuffer object. Both initialize GLEW, bind their framebuffer and make
+// the context current on creation.
+class RenderContext {
+ public:
+  virtual ~RenderContext() {}
+
+  // Returns true when the user asked to close the window. Headless contexts
+  // never close by themselves.
+  virtual bool ShouldClose() const = 0;
+
+  // Presents the frame rendered into the framebuffer.
+  virtual void SwapBuffers() = 0;
+
+  // Processes the window events.
+  virtual void PollEvents() = 0;
+
+  // The framebuffer the frames are rendered to. Zero is the default
+  // framebuffer of the window.
+  virtual GLuint framebuffer_id() const = 0;
+
+  virtual bool is_headless() const = 0;
+
+  // Dimensions of the framebuffer in pixels.
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // The internal format of the depth buffer of the framebuffer.
+  GLenum depth_format() const { return depth_format_; }
+
+ protected:
+  int width_ = 0;
+  int height_ = 0;
+  GLenum depth_format_ = GL_DEPTH24_STENCIL8;
+};
+
+// Creates a render context. Returns nullptr and logs the reason if the context
+// could not be created.
+std::unique_ptr<RenderContext> CreateRenderContext(
+    const RenderContextOptions& options);
+
+}  // namespace wvu
+
+#endif  // RENDER_CONTEXT_H_
@@ -0,0 +1,253 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "resource_registry.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+namespace wvu {
+namespace {
+
+const char* DomainName(const MemoryDomain domain) {
+  return domain == MemoryDomain::kGpu ? "GPU" : "CPU";
+}
+
+const char* FormatName(const GLenum format) {
+  switch (format) {
+    case GL_RGB8:
+      return "GL_RGB8";
+    case GL_RGBA8:
+      return "GL_RGBA8";
+    case GL_R32F:
+      return "GL_R32F";
+    case GL_DEPTH_COMPONENT32F:
+      return "GL_DEPTH_COMPONENT32F";
+    default:
+      return "other format";
+  }
+}
+
+// Appends the bytes in the largest unit that keeps them above one, e.g.,
+// "12.50 MiB".
+void AppendBytes(const uint64_t num_bytes, std::string* report) {
+  const char* units[] = {"bytes", "KiB", "MiB", "GiB"};
+  double size = num_bytes;
+  int unit = 0;
+  while (size >= 1024.0 && unit < 3) {
+    size /= 1024.0;
+    ++unit;
+  }
+  char bytes[32];
+  snprintf(bytes, sizeof(bytes), unit == 0 ? "%.0f %s" : "%.2f %s", size,
+           units[unit]);
+  *report += bytes;
+}
+
+}  // namespace
+
+int CountMipLevels(const int width, const int height) {
+  int num_mip_levels = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    ++num_mip_levels;
+  }
+  return num_mip_levels;
+}
+
+uint64_t ComputeTextureBytes(const int width,
+                             const int height,
+                             const int bytes_per_texel,
+                             const int num_mip_levels) {
+  uint64_t num_bytes = 0;
+  for (int level = 0; level < num_mip_levels; ++level) {
+    num_bytes += static_cast<uint64_t>(std::max(width >> level, 1)) *
+                 std::max(height >> level, 1) * bytes_per_texel;
+  }
+  return num_bytes;
+}
+
+ResourceRegistry::ResourceRegistry()
+    : next_id_(1), gpu_bytes_(0), cpu_bytes_(0) {}
+
+uint64_t ResourceRegistry::Add(const ResourceInfo& info) {
+  const uint64_t id = next_id_++;
+  resources_[id] = info;
+  Category& category = categories_[info.category];
+  category.domain = info.domain;
+  category.num_bytes += info.num_bytes;
+  ++category.num_resources;
+  (info.domain == MemoryDomain::kGpu ? gpu_bytes_ : cpu_bytes_) +=
+      info.num_bytes;
+  return id;
+}
+
+void ResourceRegistry::Remove(const uint64_t id) {
+  const auto resource = resources_.find(id);
+  if (resource == resources_.end()) return;
+  const ResourceInfo& info = resource->second;
+  // The categories are kept, even empty, along with their budgets.
+  Category& category = categories_[info.category];
+  category.num_bytes -= info.num_bytes;
+  --category.num_resources;
+  (info.domain == MemoryDomain::kGpu ? gpu_bytes_ : cpu_bytes_) -=
+      info.num_bytes;
+  resources_.erase(resource);
+}
+
+void ResourceRegistry::SetBudget(const std::string& category,
+                                 const uint64_t num_bytes,
+                                 const EvictionFunction& evict) {
+  categories_[category].budget = num_bytes;
+  categories_[category].evict = evict;
+}
+
+bool ResourceRegistry::EnforceBudgets() {
+  bool within_budgets = true;
+  for (auto& category : categories_) {
+    Category& totals = category.second;
+    if (totals.budget == 0 || totals.num_bytes <= totals.budget) continue;
+    if (totals.evict) totals.evict(totals.num_bytes - totals.budget);
+    if (totals.num_bytes > totals.budget) {
+      LOG(WARNING) << "The " << category.first << " use "
+                   << totals.num_bytes << " bytes, over their budget of "
+                   << totals.budget << " bytes.";
+      within_budgets = false;
+    }
+  }
+  return within_budgets;
+}
+
+uint64_t ResourceRegistry::num_bytes(const MemoryDomain domain) const {
+  return domain == MemoryDomain::kGpu ? gpu_bytes_ : cpu_bytes_;
+}
+
+uint64_t ResourceRegistry::category_num_bytes(
+    const std::string& category) const {
+  const auto totals = categories_.find(category);
+  return totals != categories_.end() ? totals->second.num_bytes : 0;
+}
+
+std::string ResourceRegistry::Report(const int max_resources) const {
+  std::string report = "Memory: ";
+  AppendBytes(gpu_bytes_, &report);
+  report += " in the GPU, ";
+  AppendBytes(cpu_bytes_, &report);
+  report += " in the CPU.\n";
+
+  std::vector<std::pair<uint64_t, const std::string*>> categories;
+  for (const auto& category : categories_) {
+    categories.emplace_back(category.second.num_bytes, &category.first);
+  }
+  std::sort(categories.rbegin(), categories.rend());
+  for (const auto& category : categories) {
+    const Category& totals = categories_.at(*category.second);
+    report += "  ";
+    report += DomainName(totals.domain);
+    report += " " + *category.second + ": ";
+    AppendBytes(totals.num_bytes, &report);
+    report += " in " + std::to_string(totals.num_resources) + " resources";
+    if (totals.budget > 0) {
+      report += " of a budget of ";
+      AppendBytes(totals.budget, &report);
+    }
+    report += "\n";
+  }
+
+  std::vector<const ResourceInfo*> resources;
+  for (const auto& resource : resources_) {
+    resources.push_back(&resource.second);
+  }
+  const int num_listed =
+      std::min(max_resources, static_cast<int>(resources.size()));
+  std::partial_sort(resources.begin(), resources.begin() + num_listed,
+                    resources.end(),
+                    [](const ResourceInfo* a, const ResourceInfo* b) {
+                      return a->num_bytes > b->num_bytes;
+                    });
+  if (num_listed > 0) report += "Largest resources:\n";
+  for (int i = 0; i < num_listed; ++i) {
+    const ResourceInfo& info = *resources[i];
+    report += "  ";
+    AppendBytes(info.num_bytes, &report);
+    report += " ";
+    report += DomainName(info.domain);
+    report += " " + info.category + ": " + info.name;
+    if (info.format != 0) {
+      report += " (" + std::to_string(info.width) + "x" +
+                std::to_string(info.height) + " " + FormatName(info.format) +
+                ", " + std::to_string(info.num_mip_levels) + " mip levels)";
+    }
+    report += "\n";
+  }
+  return report;
+}
+
+ResourceRecord::ResourceRecord() : registry_(nullptr), id_(0) {}
+
+ResourceRecord::ResourceRecord(ResourceRegistry* registry,
+                               const ResourceInfo& info)
+    : registry_(registry), id_(registry->Add(info)) {}
+
+ResourceRecord::~ResourceRecord() { Reset(); }
+
+ResourceRecord::ResourceRecord(ResourceRecord&& other)
+    : registry_(other.registry_), id_(other.id_) {
+  other.registry_ = nullptr;
+  other.id_ = 0;
+}
+
+ResourceRecord& ResourceRecord::operator=(ResourceRecord&& other) {
+  if (this != &other) {
+    Reset();
+    registry_ = other.registry_;
+    id_ = other.id_;
+    other.registry_ = nullptr;
+    other.id_ = 0;
+  }
+  return *this;
+}
+
+void ResourceRecord::Reset() {
+  if (registry_ != nullptr) registry_->Remove(id_);
+  registry_ = nullptr;
+  id_ = 0;
+}
+
+}  // namespace wvu
@@ -0,0 +1,171 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef RESOURCE_REGISTRY_H_
+#define RESOURCE_REGISTRY_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <GL/glew.h>
+
+namespace wvu {
+
+// Where the memory of a resource lives.
+enum class MemoryDomain { kGpu, kCpu };
+
+// Describes a resource and the memory it uses.
+struct ResourceInfo {
+  // Identifies the resource in reports, e.g., the file of a texture.
+  std::string name;
+  // The group whose memory is aggregated and budgeted, e.g., "textures".
+  std::string category;
+  MemoryDomain domain = MemoryDomain::kGpu;
+  uint64_t num_bytes = 0;
+  // The internal format, size and mip levels of a texture. Zero for others.
+  GLenum format = 0;
+  int width = 0;
+  int height = 0;
+  int num_mip_levels = 0;
+};
+
+// Returns the number of levels of a full mip chain of a texture.
+int CountMipLevels(const int width, const int height);
+
+// Returns the bytes of the first num_mip_levels levels of a texture whose
+// texels take bytes_per_texel bytes.
+uint64_t ComputeTextureBytes(const int width,
+                             const int height,
+                             const int bytes_per_texel,
+                             const int num_mip_levels);
+
+// Accounts for the memory of the resources of a scene, e.g., the buffers and
+// textures in the GPU and the copies of the vertices in the CPU, so that the
+// memory a scene uses can be reported and bounded. The memory is aggregated
+// by category, and a category can have a budget along with a function that
+// frees memory when the category goes over it.
+//
+// Usage:
+//   ResourceRegistry registry;
+//   registry.SetBudget("textures", 256 << 20, [&](const uint64_t num_bytes) {
+//     ...  // Free at least num_bytes of textures.
+//   });
+//   ResourceRecord record(&registry, texture_info);
+//   ...
+//   registry.EnforceBudgets();  // Between frames.
+//   LOG(INFO) << registry.Report(10);
+//
+// The registry is not thread-safe.
+class ResourceRegistry {
+ public:
+  // Frees memory of a category that is over its budget.
+  // Params:
+  //   num_bytes  The bytes over the budget.
+  using EvictionFunction = std::function<void(const uint64_t num_bytes)>;
+
+  ResourceRegistry();
+
+  ResourceRegistry(const ResourceRegistry&) = delete;
+  ResourceRegistry& operator=(const ResourceRegistry&) = delete;
+
+  // Records a resource. Returns its id, which is never zero.
+  uint64_t Add(const ResourceInfo& info);
+  // Forgets a resource. Unknown ids are ignored.
+  void Remove(const uint64_t id);
+
+  // Sets the budget of a category, in bytes, and the function that evicts
+  // resources of the category when it goes over the budget.
+  void SetBudget(const std::string& category,
+                 const uint64_t num_bytes,
+                 const EvictionFunction& evict);
+
+  // Calls the eviction function of each category that is over its budget.
+  // Returns false if a category is still over its budget afterwards.
+  bool EnforceBudgets();
+
+  // Returns the bytes used in a domain or by a category.
+  uint64_t num_bytes(const MemoryDomain domain) const;
+  uint64_t category_num_bytes(const std::string& category) const;
+  int num_resources() const { return resources_.size(); }
+
+  // Returns a report of the memory of each domain and category, followed by
+  // the largest resources, largest first.
+  // Params:
+  //   max_resources  The number of resources listed.
+  std::string Report(const int max_resources) const;
+
+ private:
+  struct Category {
+    MemoryDomain domain = MemoryDomain::kGpu;
+    uint64_t num_bytes = 0;
+    int num_resources = 0;
+    // Zero if the category has no budget.
+    uint64_t budget = 0;
+    EvictionFunction evict;
+  };
+
+  std::map<uint64_t, ResourceInfo> resources_;
+  std::map<std::string, Category> categories_;
+  uint64_t next_id_;
+  uint64_t gpu_bytes_;
+  uint64_t cpu_bytes_;
+};
+
+// A movable, non-copyable record of a resource in a ResourceRegistry. The
+// resource is removed from the registry when the record is destroyed or
+// assigned.
+class ResourceRecord {
+ public:
+  ResourceRecord();
+  ResourceRecord(ResourceRegistry* registry, const ResourceInfo& info);
+  ~ResourceRecord();
+
+  ResourceRecord(ResourceRecord&& other);
+  ResourceRecord& operator=(ResourceRecord&& other);
+  ResourceRecord(const ResourceRecord&) = delete;
+  ResourceRecord& operator=(const ResourceRecord&) = delete;
+
+  // Removes the resource from the registry, if any.
+  void Reset();
+
+ private:
+  ResourceRegistry* registry_;
+  uint64_t id_;
+};
+
+}  // namespace wvu
+
+#endif  // RESOURCE_REGISTRY_H_
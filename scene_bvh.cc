@@ -0,0 +1,594 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "scene_bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+#include <glog/logging.h>
+
+#include "bvh.h"
+#include "camera_utils.h"
+#include "cpu_profiler.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+// Fewer instances are processed by a single thread.
+constexpr int kMinInstancesPerTask = 256;
+// The top level is at most 64 levels deep, one per bit of the sort keys, and
+// a node pushes at most one node more than the one popped.
+constexpr int kStackSize = 66;
+// Direction components closer to zero are clamped, so that their inverses
+// are finite.
+constexpr float kMinDirection = 1e-20f;
+// Bits of the Morton codes per axis.
+constexpr int kMortonBits = 10;
+
+// Spreads the kMortonBits low bits of a value to every third bit.
+uint32_t SpreadBits(uint32_t value) {
+  value = (value * 0x00010001u) & 0xFF0000FFu;
+  value = (value * 0x00000101u) & 0x0F00F00Fu;
+  value = (value * 0x00000011u) & 0xC30C30C3u;
+  value = (value * 0x00000005u) & 0x49249249u;
+  return value;
+}
+
+// Computes the Morton code of a point, i.e., the interleaved bits of its
+// coordinates quantized within the given bounds.
+uint32_t ComputeMortonCode(const Eigen::Vector3f& point,
+                           const Eigen::AlignedBox3f& bounds) {
+  const float max_coordinate = (1 << kMortonBits) - 1;
+  uint32_t code = 0;
+  for (int axis = 0; axis < 3; ++axis) {
+    const float extent = bounds.max()[axis] - bounds.min()[axis];
+    const float coordinate =
+        extent > 0.0f
+            ? (point[axis] - bounds.min()[axis]) / extent * max_coordinate
+            : 0.0f;
+    code |= SpreadBits(static_cast<uint32_t>(
+                std::min(std::max(coordinate, 0.0f), max_coordinate)))
+            << (2 - axis);
+  }
+  return code;
+}
+
+// Computes the inverse of a ray direction, clamping its components away from
+// zero.
+Eigen::Vector3f ComputeInverseDirection(const Eigen::Vector3f& direction) {
+  Eigen::Vector3f inverse_direction;
+  for (int axis = 0; axis < 3; ++axis) {
+    float component = direction[axis];
+    if (std::abs(component) < kMinDirection) {
+      component = component < 0.0f ? -kMinDirection : kMinDirection;
+    }
+    inverse_direction[axis] = 1.0f / component;
+  }
+  return inverse_direction;
+}
+
+// Intersects a ray with a box. Returns true if the ray enters the box before
+// max_distance, and sets the distance at which it does.
+bool IntersectBox(const Eigen::AlignedBox3f& box,
+                  const Eigen::Vector3f& origin,
+                  const Eigen::Vector3f& inverse_direction,
+                  const float max_distance,
+                  float* entry) {
+  if (box.isEmpty()) return false;
+  const Eigen::Array3f near =
+      (box.min() - origin).array() * inverse_direction.array();
+  const Eigen::Array3f far =
+      (box.max() - origin).array() * inverse_direction.array();
+  *entry = std::max(0.0f, near.min(far).maxCoeff());
+  return *entry <= std::min(max_distance, near.max(far).minCoeff());
+}
+
+// Returns true if a box is entirely on the negative side of one of the planes
+// of a frustum, given as a * x + b * y + c * z + d >= 0 inside.
+bool IsOutsideFrustum(const Eigen::AlignedBox3f& box,
+                      const Eigen::Vector4f* planes) {
+  if (box.isEmpty()) return true;
+  for (int i = 0; i < 6; ++i) {
+    const Eigen::Vector4f& plane = planes[i];
+    // The corner of the box farthest along the normal of the plane.
+    const Eigen::Vector3f corner(
+        plane.x() >= 0.0f ? box.max().x() : box.min().x(),
+        plane.y() >= 0.0f ? box.max().y() : box.min().y(),
+        plane.z() >= 0.0f ? box.max().z() : box.min().z());
+    if (plane.head<3>().dot(corner) + plane.w() < 0.0f) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+Ray ComputePixelRay(const Eigen::Matrix4f& inverse_view_projection,
+                    const int width,
+                    const int height,
+                    const int x,
+                    const int y) {
+  const float ndc_x = 2.0f * (x + 0.5f) / width - 1.0f;
+  const float ndc_y = 2.0f * (y + 0.5f) / height - 1.0f;
+  const Eigen::Vector4f near =
+      inverse_view_projection * Eigen::Vector4f(ndc_x, ndc_y, -1.0f, 1.0f);
+  const Eigen::Vector4f far =
+      inverse_view_projection * Eigen::Vector4f(ndc_x, ndc_y, 1.0f, 1.0f);
+  Ray ray;
+  ray.origin = near.head<3>() / near.w();
+  ray.direction = far.head<3>() / far.w() - ray.origin;
+  ray.max_distance = ray.direction.norm();
+  ray.direction /= ray.max_distance;
+  return ray;
+}
+
+struct SceneBvh::Mesh {
+  std::vector<Eigen::Vector3f> vertices;
+  Bvh bvh;
+};
+
+struct SceneBvh::Instance {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  Eigen::Matrix4f model_matrix;
+  Eigen::Matrix4f inverse_model_matrix;
+  Eigen::AlignedBox3f bounds;
+  int mesh;
+};
+
+// An inner node of the top level.
+struct SceneBvh::Node {
+  Eigen::AlignedBox3f bounds;
+  // The index of the node of an inner child, or the bitwise complement of
+  // the index of the instance of a leaf.
+  int children[2];
+};
+
+SceneBvh::SceneBvh()
+    : num_bounded_children_size_(0), num_top_level_instances_(0) {}
+
+SceneBvh::~SceneBvh() {}
+
+int SceneBvh::AddMesh(std::vector<Eigen::Vector3f> vertices,
+                      ThreadPool* thread_pool) {
+  WVU_PROFILE_ZONE("SceneBvh::AddMesh");
+  std::unique_ptr<Mesh> mesh(new Mesh);
+  mesh->vertices = std::move(vertices);
+  mesh->bvh.Build(mesh->vertices, thread_pool);
+  meshes_.push_back(std::move(mesh));
+  return meshes_.size() - 1;
+}
+
+void SceneBvh::ClearInstances() {
+  instances_.clear();
+  num_top_level_instances_ = 0;
+  bounds_.setEmpty();
+}
+
+int SceneBvh::AddInstance(const int mesh_index,
+                          const Eigen::Matrix4f& model_matrix) {
+  CHECK_GE(mesh_index, 0);
+  CHECK_LT(mesh_index, num_meshes());
+  instances_.emplace_back();
+  instances_.back().mesh = mesh_index;
+  SetInstanceModelMatrix(instances_.size() - 1, model_matrix);
+  return instances_.size() - 1;
+}
+
+void SceneBvh::SetInstanceModelMatrix(const int instance_index,
+                                      const Eigen::Matrix4f& model_matrix) {
+  Instance& instance = instances_[instance_index];
+  instance.model_matrix = model_matrix;
+  instance.inverse_model_matrix = model_matrix.inverse();
+  // The bounds of the transformed corners of the bounds of the mesh.
+  const Eigen::AlignedBox3f& mesh_bounds = meshes_[instance.mesh]->bvh.bounds();
+  instance.bounds.setEmpty();
+  if (mesh_bounds.isEmpty()) return;
+  for (int i = 0; i < 8; ++i) {
+    const Eigen::Vector3f corner =
+        mesh_bounds.corner(static_cast<Eigen::AlignedBox3f::CornerType>(i));
+    instance.bounds.extend(model_matrix.topLeftCorner<3, 3>() * corner +
+                           model_matrix.topRightCorner<3, 1>());
+  }
+}
+
+void SceneBvh::BuildTopLevel(ThreadPool* thread_pool) {
+  WVU_PROFILE_ZONE("SceneBvh::BuildTopLevel");
+  const int num_instances = instances_.size();
+  num_top_level_instances_ = num_instances;
+  bounds_.setEmpty();
+  if (num_instances == 0) return;
+
+  // Sort the instances by the Morton codes of their centers. The index of an
+  // instance breaks the ties, so that the keys are unique.
+  Eigen::AlignedBox3f center_bounds;
+  for (const Instance& instance : instances_) {
+    center_bounds.extend(instance.bounds.center());
+  }
+  sorted_keys_.resize(num_instances);
+  ParallelForChunks(thread_pool, num_instances, kMinInstancesPerTask,
+                    [&](const int, const int begin, const int end) {
+    for (int i = begin; i < end; ++i) {
+      sorted_keys_[i] =
+          static_cast<uint64_t>(ComputeMortonCode(instances_[i].bounds.center(),
+                                                  center_bounds))
+              << 32 |
+          static_cast<uint32_t>(i);
+    }
+  });
+  std::sort(sorted_keys_.begin(), sorted_keys_.end());
+
+  // Every inner node i covers a range of the sorted instances that starts or
+  // ends at i, and is split where the common prefix of the keys grows (see
+  // Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and
+  // k-d Trees", 2012).
+  nodes_.resize(num_instances - 1);
+  node_parents_.resize(num_instances - 1);
+  instance_parents_.resize(num_instances);
+  if (num_instances > 1) node_parents_[0] = -1;
+  const auto common_prefix_length = [&](const int i, const int j) {
+    if (j < 0 || j >= num_instances) return -1;
+    return __builtin_clzll(sorted_keys_[i] ^ sorted_keys_[j]);
+  };
+  const auto instance_at = [&](const int i) {
+    return static_cast<int>(sorted_keys_[i] & 0xFFFFFFFFu);
+  };
+  ParallelForChunks(thread_pool, num_instances - 1, kMinInstancesPerTask,
+                    [&](const int, const int begin, const int end) {
+    for (int i = begin; i < end; ++i) {
+      // The direction of the range and its length.
+      const int direction =
+          common_prefix_length(i, i + 1) > common_prefix_length(i, i - 1)
+              ? 1
+              : -1;
+      const int min_prefix_length = common_prefix_length(i, i - direction);
+      int max_length = 2;
+      while (common_prefix_length(i, i + max_length * direction) >
+             min_prefix_length) {
+        max_length *= 2;
+      }
+      int length = 0;
+      for (int step = max_length / 2; step >= 1; step /= 2) {
+        if (common_prefix_length(i, i + (length + step) * direction) >
+            min_prefix_length) {
+          length += step;
+        }
+      }
+      const int j = i + length * direction;
+
+      // The last instance that shares more than the prefix of the range
+      // with i.
+      const int prefix_length = common_prefix_length(i, j);
+      int split = 0;
+      int step = length;
+      do {
+        step = (step + 1) / 2;
+        if (split + step < length &&
+            common_prefix_length(i, i + (split + step) * direction) >
+                prefix_length) {
+          split += step;
+        }
+      } while (step > 1);
+      const int left = i + split * direction + std::min(direction, 0);
+
+      Node& node = nodes_[i];
+      if (std::min(i, j) == left) {
+        node.children[0] = ~instance_at(left);
+        instance_parents_[instance_at(left)] = i;
+      } else {
+        node.children[0] = left;
+        node_parents_[left] = i;
+      }
+      if (std::max(i, j) == left + 1) {
+        node.children[1] = ~instance_at(left + 1);
+        instance_parents_[instance_at(left + 1)] = i;
+      } else {
+        node.children[1] = left + 1;
+        node_parents_[left + 1] = i;
+      }
+    }
+  });
+  if (num_instances == 1) instance_parents_[0] = -1;
+  ComputeNodeBounds(thread_pool);
+}
+
+void SceneBvh::RefitTopLevel(ThreadPool* thread_pool) {
+  WVU_PROFILE_ZONE("SceneBvh::RefitTopLevel");
+  CHECK_EQ(num_top_level_instances_, num_instances())
+      << "Instances were added or removed since the top level was built.";
+  if (num_top_level_instances_ == 0) return;
+  ComputeNodeBounds(thread_pool);
+}
+
+void SceneBvh::ComputeNodeBounds(ThreadPool* thread_pool) {
+  const int num_nodes = nodes_.size();
+  if (num_nodes == 0) {
+    bounds_ = instances_[0].bounds;
+    return;
+  }
+  if (num_bounded_children_size_ < num_nodes) {
+    num_bounded_children_.reset(new std::atomic<int>[num_nodes]);
+    num_bounded_children_size_ = num_nodes;
+  }
+  for (int i = 0; i < num_nodes; ++i) {
+    num_bounded_children_[i].store(0, std::memory_order_relaxed);
+  }
+  // Every instance walks up the tree. The second child reaching a node
+  // computes its bounds and keeps walking, so that the bounds of both
+  // children are known.
+  ParallelForChunks(thread_pool, num_top_level_instances_,
+                    kMinInstancesPerTask,
+                    [&](const int, const int begin, const int end) {
+    for (int i = begin; i < end; ++i) {
+      for (int node_index = instance_parents_[i]; node_index >= 0;
+           node_index = node_parents_[node_index]) {
+        if (num_bounded_children_[node_index].fetch_add(
+                1, std::memory_order_acq_rel) == 0) {
+          break;
+        }
+        Node& node = nodes_[node_index];
+        node.bounds.setEmpty();
+        for (const int child : node.children) {
+          node.bounds.extend(child < 0 ? instances_[~child].bounds
+                                       : nodes_[child].bounds);
+        }
+      }
+    }
+  });
+  bounds_ = nodes_[0].bounds;
+}
+
+bool SceneBvh::IntersectInstance(const int instance_index,
+                                 const Ray& ray,
+                                 SceneHit* hit) const {
+  const Instance& instance = instances_[instance_index];
+  Ray object_ray;
+  object_ray.origin =
+      instance.inverse_model_matrix.topLeftCorner<3, 3>() * ray.origin +
+      instance.inverse_model_matrix.topRightCorner<3, 1>();
+  object_ray.direction =
+      instance.inverse_model_matrix.topLeftCorner<3, 3>() * ray.direction;
+  object_ray.max_distance = ray.max_distance;
+  RayHit mesh_hit;
+  if (!meshes_[instance.mesh]->bvh.Intersect(object_ray, &mesh_hit)) {
+    return false;
+  }
+  hit->instance_index = instance_index;
+  hit->triangle_index = mesh_hit.triangle_index;
+  hit->distance = mesh_hit.distance;
+  hit->u = mesh_hit.u;
+  hit->v = mesh_hit.v;
+  return true;
+}
+
+bool SceneBvh::Intersect(const Ray& ray, SceneHit* hit) const {
+  *hit = SceneHit();
+  if (num_top_level_instances_ == 0) return false;
+  const Eigen::Vector3f inverse_direction =
+      ComputeInverseDirection(ray.direction);
+  Ray nearest_ray = ray;
+  int stack[kStackSize];
+  int stack_size = 1;
+  stack[0] = nodes_.empty() ? ~0 : 0;
+  while (stack_size > 0) {
+    const int node_index = stack[--stack_size];
+    if (node_index < 0) {
+      if (IntersectInstance(~node_index, nearest_ray, hit)) {
+        nearest_ray.max_distance = hit->distance;
+      }
+      continue;
+    }
+    // Visit the nearest child first.
+    const Node& node = nodes_[node_index];
+    float entries[2];
+    bool box_hits[2];
+    for (int i = 0; i < 2; ++i) {
+      const int child = node.children[i];
+      box_hits[i] = IntersectBox(
+          child < 0 ? instances_[~child].bounds : nodes_[child].bounds,
+          ray.origin, inverse_direction, nearest_ray.max_distance,
+          &entries[i]);
+    }
+    const int near = box_hits[0] && box_hits[1] ? entries[1] < entries[0] : 0;
+    if (box_hits[1 - near]) stack[stack_size++] = node.children[1 - near];
+    if (box_hits[near]) stack[stack_size++] = node.children[near];
+  }
+  return hit->instance_index >= 0;
+}
+
+void SceneBvh::IntersectPacket(const RayPacket& packet,
+                               SceneHit* hits) const {
+  for (int i = 0; i < kRayPacketSize; ++i) hits[i] = SceneHit();
+  if (num_top_level_instances_ == 0) return;
+  RayPacket nearest_packet = packet;
+  float inverse_direction[3][kRayPacketSize];
+  for (int i = 0; i < kRayPacketSize; ++i) {
+    const Eigen::Vector3f inverse = ComputeInverseDirection(Eigen::Vector3f(
+        packet.direction[0][i], packet.direction[1][i],
+        packet.direction[2][i]));
+    for (int axis = 0; axis < 3; ++axis) {
+      inverse_direction[axis][i] = inverse[axis];
+    }
+  }
+
+  RayPacket object_packet;
+  RayHit mesh_hits[kRayPacketSize];
+  int stack[kStackSize];
+  int stack_size = 1;
+  stack[0] = nodes_.empty() ? ~0 : 0;
+  while (stack_size > 0) {
+    const int node_index = stack[--stack_size];
+    if (node_index < 0) {
+      // Trace the packet through the mesh in the object coordinates of the
+      // instance, up to the nearest hits so far.
+      const Instance& instance = instances_[~node_index];
+      const Eigen::Matrix4f& inverse = instance.inverse_model_matrix;
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        for (int row = 0; row < 3; ++row) {
+          object_packet.origin[row][i] = inverse(row, 3);
+          object_packet.direction[row][i] = 0.0f;
+          for (int column = 0; column < 3; ++column) {
+            object_packet.origin[row][i] +=
+                inverse(row, column) * packet.origin[column][i];
+            object_packet.direction[row][i] +=
+                inverse(row, column) * packet.direction[column][i];
+          }
+        }
+        object_packet.max_distance[i] = nearest_packet.max_distance[i];
+      }
+      meshes_[instance.mesh]->bvh.IntersectPacket(object_packet, mesh_hits);
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        const RayHit& mesh_hit = mesh_hits[i];
+        if (mesh_hit.triangle_index < 0) continue;
+        SceneHit& hit = hits[i];
+        hit.instance_index = ~node_index;
+        hit.triangle_index = mesh_hit.triangle_index;
+        hit.distance = mesh_hit.distance;
+        hit.u = mesh_hit.u;
+        hit.v = mesh_hit.v;
+        nearest_packet.max_distance[i] = mesh_hit.distance;
+      }
+      continue;
+    }
+
+    // A child is visited if any ray enters it, the one entered first by a ray
+    // being visited first.
+    const Node& node = nodes_[node_index];
+    float entries[2];
+    bool box_hits[2];
+    for (int child_index = 0; child_index < 2; ++child_index) {
+      const int child = node.children[child_index];
+      const Eigen::AlignedBox3f& box =
+          child < 0 ? instances_[~child].bounds : nodes_[child].bounds;
+      entries[child_index] = std::numeric_limits<float>::infinity();
+      box_hits[child_index] = false;
+      if (box.isEmpty()) continue;
+      for (int i = 0; i < kRayPacketSize; ++i) {
+        float entry = 0.0f;
+        float exit = nearest_packet.max_distance[i];
+        for (int axis = 0; axis < 3; ++axis) {
+          const float near =
+              (box.min()[axis] - packet.origin[axis][i]) *
+              inverse_direction[axis][i];
+          const float far =
+              (box.max()[axis] - packet.origin[axis][i]) *
+              inverse_direction[axis][i];
+          entry = std::max(entry, std::min(near, far));
+          exit = std::min(exit, std::max(near, far));
+        }
+        if (entry <= exit) {
+          box_hits[child_index] = true;
+          entries[child_index] = std::min(entries[child_index], entry);
+        }
+      }
+    }
+    const int near = entries[1] < entries[0];
+    if (box_hits[1 - near]) stack[stack_size++] = node.children[1 - near];
+    if (box_hits[near]) stack[stack_size++] = node.children[near];
+  }
+}
+
+int SceneBvh::CullFrustum(const Eigen::Matrix4f& view_projection,
+                          int* visible_instances) const {
+  Eigen::Vector4f planes[6];
+  ComputeFrustumPlanes(view_projection, planes);
+  return CullFrustumPlanes(planes, visible_instances);
+}
+
+int SceneBvh::CullFrustum(const Camera& camera,
+                          int* visible_instances) const {
+  return CullFrustumPlanes(camera.frustum_planes(), visible_instances);
+}
+
+int SceneBvh::CullFrustumPlanes(const Eigen::Vector4f* planes,
+                                int* visible_instances) const {
+  WVU_PROFILE_ZONE("SceneBvh::CullFrustum");
+  if (num_top_level_instances_ == 0) return 0;
+  int num_visible_instances = 0;
+  int stack[kStackSize];
+  int stack_size = 1;
+  stack[0] = nodes_.empty() ? ~0 : 0;
+  while (stack_size > 0) {
+    const int node_index = stack[--stack_size];
+    if (node_index < 0) {
+      if (!IsOutsideFrustum(instances_[~node_index].bounds, planes)) {
+        visible_instances[num_visible_instances++] = ~node_index;
+      }
+      continue;
+    }
+    const Node& node = nodes_[node_index];
+    if (IsOutsideFrustum(node.bounds, planes)) continue;
+    stack[stack_size++] = node.children[0];
+    stack[stack_size++] = node.children[1];
+  }
+  std::sort(visible_instances, visible_instances + num_visible_instances);
+  return num_visible_instances;
+}
+
+const Bvh& SceneBvh::mesh_bvh(const int mesh_index) const {
+  return meshes_[mesh_index]->bvh;
+}
+
+const std::vector<Eigen::Vector3f>& SceneBvh::mesh_vertices(
+    const int mesh_index) const {
+  return meshes_[mesh_index]->vertices;
+}
+
+int SceneBvh::num_instances() const { return instances_.size(); }
+
+int SceneBvh::instance_mesh(const int instance_index) const {
+  return instances_[instance_index].mesh;
+}
+
+const Eigen::Matrix4f& SceneBvh::instance_model_matrix(
+    const int instance_index) const {
+  return instances_[instance_index].model_matrix;
+}
+
+const Eigen::AlignedBox3f& SceneBvh::instance_bounds(
+    const int instance_index) const {
+  return instances_[instance_index].bounds;
+}
+
+}  // namespace wvu
@@ -0,0 +1,214 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef SCENE_BVH_H_
+#define SCENE_BVH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include "bvh.h"
+#include "camera_utils.h"
+#include "thread_pool.h"
+
+namespace wvu {
+// The nearest intersection of a ray with the instances of a SceneBvh.
+struct SceneHit {
+  // Index of the instance hit, or -1 if the ray missed every instance.
+  int instance_index = -1;
+  // Index of the triangle hit in the vertices of the mesh of the instance.
+  int triangle_index = -1;
+  // The t of the ray at the hit, in world coordinates.
+  float distance = 0.0f;
+  // Barycentric coordinates of the hit, see RayHit.
+  float u = 0.0f;
+  float v = 0.0f;
+};
+
+// Computes the ray through the center of a pixel from the near to the far
+// plane, e.g., the primary ray of a ray tracer or the ray that picks the
+// instance under the cursor.
+// Params:
+//   inverse_view_projection  The inverse of the projection times the view
+//     matrix.
+//   width  Width of the image in pixels.
+//   height  Height of the image in pixels.
+//   x  Column of the pixel, from the left.
+//   y  Row of the pixel, from the bottom.
+Ray ComputePixelRay(const Eigen::Matrix4f& inverse_view_projection,
+                    const int width,
+                    const int height,
+                    const int x,
+                    const int y);
+
+// A two-level bounding volume hierarchy of an animated scene. Every mesh has
+// its own static Bvh in object coordinates, built once by AddMesh(). The
+// instances of the meshes are placed by their model matrices, and a top-level
+// binary BVH over their bounds in world coordinates is rebuilt every frame by
+// BuildTopLevel(), or refit by RefitTopLevel() when the instances only moved
+// a little.
+//
+// The top level is a linear BVH: the instances are sorted by the Morton codes
+// of the centers of their bounds and the tree is given by the prefixes the
+// codes share, so that every inner node is built independently. The bounds
+// are then computed bottom-up. Both steps run in parallel for large numbers
+// of instances.
+//
+// Rays are intersected with an instance in its object coordinates, where the
+// direction is not normalized so that the distances of the hits do not
+// change. The ray tracer, the frustum culling and the picking query the same
+// hierarchy.
+class SceneBvh {
+ public:
+  SceneBvh();
+  ~SceneBvh();
+
+  SceneBvh(const SceneBvh&) = delete;
+  SceneBvh& operator=(const SceneBvh&) = delete;
+
+  // Builds the BVH of a mesh and returns the index of the mesh.
+  // Params:
+  //   vertices  The vertices of the triangles in object coordinates, three
+  //     consecutive per triangle, see GetTriangleVertices().
+  //   thread_pool  The threads building the BVH, along with the calling
+  //     thread. May be null.
+  int AddMesh(std::vector<Eigen::Vector3f> vertices, ThreadPool* thread_pool);
+
+  // Removes the instances. The top level is empty until the next
+  // BuildTopLevel().
+  void ClearInstances();
+
+  // Adds an instance of a mesh and returns the index of the instance.
+  // Params:
+  //   mesh_index  The mesh returned by AddMesh().
+  //   model_matrix  The affine model matrix of the instance.
+  int AddInstance(const int mesh_index, const Eigen::Matrix4f& model_matrix);
+
+  // Moves an instance. The top level is outdated until the next
+  // BuildTopLevel() or RefitTopLevel().
+  void SetInstanceModelMatrix(const int instance_index,
+                              const Eigen::Matrix4f& model_matrix);
+
+  // Builds the top level over the instances.
+  // Params:
+  //   thread_pool  The threads building the top level, along with the calling
+  //     thread. May be null.
+  void BuildTopLevel(ThreadPool* thread_pool);
+
+  // Recomputes the bounds of the top level for the current model matrices
+  // while keeping its tree. Faster than BuildTopLevel(), but the tree gets
+  // worse as the instances move away from where they were when it was built.
+  // There must be no instances added since the last BuildTopLevel().
+  void RefitTopLevel(ThreadPool* thread_pool);
+
+  // Finds the nearest triangle hit by a ray. Returns true if there is one.
+  bool Intersect(const Ray& ray, SceneHit* hit) const;
+
+  // Finds the nearest triangles hit by the rays of a packet.
+  // Params:
+  //   packet  The rays.
+  //   hits  The kRayPacketSize hits of the rays, in the order of the rays.
+  void IntersectPacket(const RayPacket& packet, SceneHit* hits) const;
+
+  // Finds the instances whose bounds are inside or intersect the view
+  // frustum. Returns the number of visible instances.
+  // Params:
+  //   view_projection  The projection times the view matrix.
+  //   visible_instances  Holds num_instances() elements. The indices of the
+  //     visible instances are written to it in increasing order.
+  int CullFrustum(const Eigen::Matrix4f& view_projection,
+                  int* visible_instances) const;
+  // Same as above with the cached frustum planes of a camera.
+  int CullFrustum(const Camera& camera, int* visible_instances) const;
+
+  int num_meshes() const { return meshes_.size(); }
+  const Bvh& mesh_bvh(const int mesh_index) const;
+  // The vertices given to AddMesh().
+  const std::vector<Eigen::Vector3f>& mesh_vertices(
+      const int mesh_index) const;
+
+  int num_instances() const;
+  int instance_mesh(const int instance_index) const;
+  const Eigen::Matrix4f& instance_model_matrix(
+      const int instance_index) const;
+  // The bounds of an instance in world coordinates.
+  const Eigen::AlignedBox3f& instance_bounds(const int instance_index) const;
+  // The bounds of the instances as of the last BuildTopLevel() or
+  // RefitTopLevel().
+  const Eigen::AlignedBox3f& bounds() const { return bounds_; }
+
+ private:
+  struct Mesh;
+  struct Instance;
+  struct Node;
+
+  // Finds the instances inside the six planes of a frustum, see
+  // ComputeFrustumPlanes().
+  int CullFrustumPlanes(const Eigen::Vector4f* planes,
+                        int* visible_instances) const;
+  // Computes the bounds of the inner nodes from those of the instances.
+  void ComputeNodeBounds(ThreadPool* thread_pool);
+  // Intersects a ray with the mesh of an instance.
+  bool IntersectInstance(const int instance_index,
+                         const Ray& ray,
+                         SceneHit* hit) const;
+
+  std::vector<std::unique_ptr<Mesh>> meshes_;
+  std::vector<Instance, Eigen::aligned_allocator<Instance>> instances_;
+  // The inner nodes, the root being the first one. The top level of n
+  // instances has n - 1 inner nodes.
+  std::vector<Node> nodes_;
+  // The parents of the inner nodes and of the instances; -1 for the root.
+  std::vector<int> node_parents_;
+  std::vector<int> instance_parents_;
+  // The Morton codes of the instances in the high 32 bits and their indices
+  // in the low ones, in increasing order.
+  std::vector<uint64_t> sorted_keys_;
+  // The number of children whose bounds are known, for every inner node.
+  std::unique_ptr<std::atomic<int>[]> num_bounded_children_;
+  int num_bounded_children_size_;
+  // The number of instances when the top level was last built.
+  int num_top_level_instances_;
+  Eigen::AlignedBox3f bounds_;
+};
+
+}  // namespace wvu
+
+#endif  // SCENE_BVH_H_
@@ -0,0 +1,352 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "shader_permutations.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+namespace {
+
+constexpr char kIncludeDirective[] = "#include";
+constexpr char kVersionDirective[] = "#version";
+
+// Returns true if the line, without its indentation, begins with the
+// directive.
+bool IsDirective(const std::string& line, const char* directive) {
+  const size_t begin = line.find_first_not_of(" \t");
+  return begin != std::string::npos &&
+         line.compare(begin, std::strlen(directive), directive) == 0;
+}
+
+// Computes the source with the macros defined after its #version directive,
+// which must precede everything but comments.
+std::string DefineMacros(const std::string& source,
+                         const std::string& definitions) {
+  size_t line_begin = 0;
+  while (line_begin < source.size()) {
+    size_t line_end = source.find('\n', line_begin);
+    if (line_end == std::string::npos) line_end = source.size();
+    const std::string line =
+        source.substr(line_begin, line_end - line_begin);
+    if (IsDirective(line, kVersionDirective)) {
+      const size_t insert_position = std::min(line_end + 1, source.size());
+      std::string defined_source = source.substr(0, insert_position);
+      if (line_end == source.size()) defined_source += "\n";
+      return defined_source + definitions + source.substr(insert_position);
+    }
+    line_begin = line_end + 1;
+  }
+  return definitions + source;
+}
+
+}  // namespace
+
+ShaderPermutations::ShaderPermutations(
+    const ProgramSources& sources,
+    const std::vector<std::string>& feature_names,
+    ProgramBinaryCache* cache)
+    : sources_(sources), feature_names_(feature_names), cache_(cache) {
+  CHECK_LE(feature_names_.size(), 32);
+}
+
+ShaderPermutations::~ShaderPermutations() {}
+
+void ShaderPermutations::SetUniformBlockBinding(const std::string& name,
+                                                const GLuint binding) {
+  uniform_block_bindings_.emplace_back(HashUniformName(name.c_str()),
+                                       binding);
+  for (const auto& variant : variants_) {
+    if (!variant.second.pending && !variant.second.failed) {
+      variant.second.program->BindUniformBlock(
+          uniform_block_bindings_.back().first, binding);
+    }
+  }
+}
+
+void ShaderPermutations::BindUniformBlocks(const GpuProgram& program) const {
+  for (const auto& binding : uniform_block_bindings_) {
+    program.BindUniformBlock(binding.first, binding.second);
+  }
+}
+
+void ShaderPermutations::AddInclude(const std::string& name,
+                                    const std::string& source) {
+  includes_[name] = source;
+}
+
+bool ShaderPermutations::ResolveIncludes(
+    const std::string& source,
+    std::vector<std::string>* included_names,
+    std::string* resolved_source,
+    std::string* error) const {
+  std::istringstream lines(source);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (!IsDirective(line, kIncludeDirective)) {
+      *resolved_source += line;
+      *resolved_source += "\n";
+      continue;
+    }
+    const size_t name_begin = line.find('"');
+    const size_t name_end = name_begin == std::string::npos
+                                ? std::string::npos
+                                : line.find('"', name_begin + 1);
+    if (name_end == std::string::npos) {
+      *error = "Malformed directive: " + line;
+      return false;
+    }
+    const std::string name =
+        line.substr(name_begin + 1, name_end - name_begin - 1);
+    // Every file is included once, which also stops include cycles.
+    if (std::find(included_names->begin(), included_names->end(), name) !=
+        included_names->end()) {
+      continue;
+    }
+    const auto include = includes_.find(name);
+    if (include == includes_.end()) {
+      *error = "Unknown include: " + name;
+      return false;
+    }
+    included_names->push_back(name);
+    if (!ResolveIncludes(include->second, included_names, resolved_source,
+                         error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShaderPermutations::PreprocessVariant(const uint32_t features,
+                                           ProgramSources* variant_sources,
+                                           std::string* error) const {
+  return PreprocessSources(sources_, features, variant_sources, error);
+}
+
+bool ShaderPermutations::PreprocessSources(const ProgramSources& sources,
+                                           const uint32_t features,
+                                           ProgramSources* variant_sources,
+                                           std::string* error) const {
+  DCHECK(variant_sources != nullptr);
+  DCHECK(error != nullptr);
+  std::string definitions;
+  for (size_t i = 0; i < feature_names_.size(); ++i) {
+    if (features & (1u << i)) {
+      definitions += "#define " + feature_names_[i] + " 1\n";
+    }
+  }
+  std::string* const variant_stages[] = {&variant_sources->vertex,
+                                         &variant_sources->fragment,
+                                         &variant_sources->compute};
+  const std::string* const stages[] = {&sources.vertex, &sources.fragment,
+                                       &sources.compute};
+  for (int i = 0; i < 3; ++i) {
+    variant_stages[i]->clear();
+    // Empty stages are not part of the program.
+    if (stages[i]->empty()) continue;
+    std::vector<std::string> included_names;
+    std::string resolved_source;
+    if (!ResolveIncludes(*stages[i], &included_names, &resolved_source,
+                         error)) {
+      return false;
+    }
+    *variant_stages[i] = DefineMacros(resolved_source, definitions);
+  }
+  return true;
+}
+
+ShaderPermutations::Variant* ShaderPermutations::BeginVariant(
+    const uint32_t features) {
+  DCHECK_EQ(static_cast<uint64_t>(features) >> feature_names_.size(), 0)
+      << "Unknown feature in " << features;
+  Variant& variant = variants_[features];
+  variant.program.reset(new GpuProgram());
+  variant.pending = false;
+  variant.failed = false;
+  variant.used = false;
+  ProgramSources variant_sources;
+  std::string error;
+  if (!PreprocessVariant(features, &variant_sources, &error)) {
+    LOG(ERROR) << "Could not preprocess the shader variant " << features
+               << ": " << error;
+    variant.failed = true;
+    return &variant;
+  }
+  variant.program->BeginCreate(variant_sources, cache_);
+  variant.pending = true;
+  return &variant;
+}
+
+void ShaderPermutations::Prewarm(const std::vector<uint32_t>& variants) {
+  WVU_PROFILE_ZONE("PrewarmShaderPermutations");
+  for (const uint32_t features : variants) {
+    if (variants_.count(features) == 0) BeginVariant(features);
+  }
+}
+
+void ShaderPermutations::EndVariant(const uint32_t features,
+                                    Variant* variant) {
+  if (!variant->pending) return;
+  WVU_PROFILE_ZONE("EndShaderVariant");
+  variant->pending = false;
+  std::string error_info_log;
+  if (!variant->program->EndCreate(&error_info_log)) {
+    LOG(ERROR) << "Could not create the shader variant " << features << ": "
+               << error_info_log;
+    variant->failed = true;
+    return;
+  }
+  BindUniformBlocks(*variant->program);
+}
+
+bool ShaderPermutations::FinishPrewarm() {
+  bool succeeded = true;
+  for (auto& variant : variants_) {
+    EndVariant(variant.first, &variant.second);
+    succeeded &= !variant.second.failed;
+  }
+  return succeeded;
+}
+
+const GpuProgram* ShaderPermutations::GetProgram(const uint32_t features) {
+  auto variant_it = variants_.find(features);
+  Variant* variant = variant_it == variants_.end() ? BeginVariant(features)
+                                                   : &variant_it->second;
+  EndVariant(features, variant);
+  if (!variant->used) {
+    variant->used = true;
+    used_variants_.push_back(features);
+  }
+  return variant->failed ? nullptr : variant->program.get();
+}
+
+void ShaderPermutations::BeginReload(const ProgramSources& sources) {
+  WVU_PROFILE_ZONE("BeginShaderReload");
+  // A reload that has not been swapped in yet is superseded.
+  reloaded_programs_.clear();
+  sources_ = sources;
+  for (const auto& variant : variants_) {
+    ProgramSources variant_sources;
+    std::string error;
+    if (!PreprocessSources(sources_, variant.first, &variant_sources,
+                           &error)) {
+      LOG(ERROR) << "Could not preprocess the shader variant "
+                 << variant.first << ": " << error;
+      continue;
+    }
+    std::unique_ptr<GpuProgram>& program = reloaded_programs_[variant.first];
+    program.reset(new GpuProgram());
+    program->BeginCreate(variant_sources, cache_);
+  }
+}
+
+bool ShaderPermutations::SwapReloadedVariants() {
+  if (reloaded_programs_.empty()) return false;
+  for (const auto& program : reloaded_programs_) {
+    if (!program.second->IsCreated()) return false;
+  }
+  WVU_PROFILE_ZONE("SwapShaderVariants");
+  for (auto& program : reloaded_programs_) {
+    std::string error_info_log;
+    if (!program.second->EndCreate(&error_info_log)) {
+      LOG(ERROR) << "Could not reload the shader variant " << program.first
+                 << ": " << error_info_log;
+      continue;
+    }
+    // The variant may still be waiting for its old program.
+    Variant& variant = variants_[program.first];
+    EndVariant(program.first, &variant);
+    variant.program = std::move(program.second);
+    variant.failed = false;
+    BindUniformBlocks(*variant.program);
+  }
+  reloaded_programs_.clear();
+  return true;
+}
+
+bool ShaderPermutations::ReadUsageList(const std::string& filepath,
+                                       std::vector<uint32_t>* variants) const {
+  DCHECK(variants != nullptr);
+  std::ifstream file(filepath);
+  if (!file) return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream names(line);
+    std::string name;
+    uint32_t features = 0;
+    while (names >> name) {
+      const auto feature =
+          std::find(feature_names_.begin(), feature_names_.end(), name);
+      if (feature == feature_names_.end()) {
+        LOG(WARNING) << "Unknown shader feature in " << filepath << ": "
+                     << name;
+        continue;
+      }
+      features |= 1u << (feature - feature_names_.begin());
+    }
+    variants->push_back(features);
+  }
+  return true;
+}
+
+bool ShaderPermutations::WriteUsageList(const std::string& filepath) const {
+  std::ofstream file(filepath);
+  if (!file) {
+    LOG(ERROR) << "Could not open " << filepath;
+    return false;
+  }
+  // A variant without features is an empty line.
+  for (const uint32_t features : used_variants_) {
+    std::string line;
+    for (size_t i = 0; i < feature_names_.size(); ++i) {
+      if ((features & (1u << i)) == 0) continue;
+      if (!line.empty()) line += " ";
+      line += feature_names_[i];
+    }
+    file << line << "\n";
+  }
+  return static_cast<bool>(file);
+}
+
+}  // namespace wvu
@@ -0,0 +1,176 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef SHADER_PERMUTATIONS_H_
+#define SHADER_PERMUTATIONS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "gpu_program.h"
+
+namespace wvu {
+
+// Compiles the variants of a program that the sources select with feature
+// macros, e.g.,
+//
+//   #version 330 core
+//   #include "scene_transforms.glsl"
+//   #ifdef TEXTURED
+//   color = texture(texture_sampler, texel);
+//   #else
+//   color = vertex_color;
+//   #endif
+//
+// A variant is keyed by a bitmask of features: bit i defines the i-th feature
+// name. Every draw uses the variant of exactly the features of its material,
+// so no shader branches over features at run time. Variants are compiled on
+// first use, or ahead of time with Prewarm(), and their binaries go to the
+// cache like the ones of any other program.
+//
+// Lines of the form #include "name" are replaced by the source added with
+// AddInclude(), once per variant and stage.
+class ShaderPermutations {
+ public:
+  // Params:
+  //   sources  The sources of the stages, with the feature macros.
+  //   feature_names  The macro of every bit of the feature bitmask. At most 32.
+  //   cache  The binary cache. May be null.
+  ShaderPermutations(const ProgramSources& sources,
+                     const std::vector<std::string>& feature_names,
+                     ProgramBinaryCache* cache);
+  ~ShaderPermutations();
+
+  ShaderPermutations(const ShaderPermutations&) = delete;
+  ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+  // Adds the source that replaces the #include directives of the name.
+  void AddInclude(const std::string& name, const std::string& source);
+
+  // Assigns the uniform block of the name to a GL_UNIFORM_BUFFER binding point
+  // in every variant that declares it, including the ones created later.
+  void SetUniformBlockBinding(const std::string& name, const GLuint binding);
+
+  // Computes the sources of a variant: resolves the includes and defines the
+  // macros of the features after the #version directive. Returns false if an
+  // include is missing.
+  // Params:
+  //   features  The feature bitmask of the variant.
+  //   variant_sources  The sources of the variant.
+  //   error  The reason of a failure.
+  bool PreprocessVariant(const uint32_t features,
+                         ProgramSources* variant_sources,
+                         std::string* error) const;
+
+  // Starts creating the variants that are not created yet without waiting for
+  // the driver (see GpuProgram::BeginCreate()).
+  void Prewarm(const std::vector<uint32_t>& variants);
+
+  // Waits for the variants started by Prewarm(). Returns false if any of
+  // them does not compile.
+  bool FinishPrewarm();
+
+  // Returns the variant of the features, creating it if needed, or null if it
+  // does not compile. The errors are logged once per variant.
+  const GpuProgram* GetProgram(const uint32_t features);
+
+  // Starts recompiling the variants from new sources, e.g., after the shader
+  // files changed, without waiting for the driver. The variants keep their
+  // programs until SwapReloadedVariants() replaces them, and the variants
+  // created in between use the new sources.
+  void BeginReload(const ProgramSources& sources);
+
+  // Replaces the programs of the variants by the ones started by
+  // BeginReload() once the driver created all of them, so a frame never mixes
+  // old and new variants. Returns true if it replaced them. The variants that
+  // do not compile keep their programs, and their errors are logged.
+  bool SwapReloadedVariants();
+
+  // Returns the features of the variants returned by GetProgram(), in the
+  // order of their first use.
+  const std::vector<uint32_t>& used_variants() const { return used_variants_; }
+
+  // Reads a usage list written by WriteUsageList(): a variant per line, the
+  // names of its features separated by spaces. Unknown feature names are
+  // ignored with a warning. Returns false if the file cannot be read.
+  bool ReadUsageList(const std::string& filepath,
+                     std::vector<uint32_t>* variants) const;
+  // Writes the used variants to a usage list. Returns true upon success.
+  bool WriteUsageList(const std::string& filepath) const;
+
+  // Returns the number of variants created or being created.
+  int num_variants() const { return static_cast<int>(variants_.size()); }
+
+ private:
+  struct Variant {
+    std::unique_ptr<GpuProgram> program;
+    // True between GpuProgram::BeginCreate() and GpuProgram::EndCreate().
+    bool pending;
+    bool failed;
+    bool used;
+  };
+
+  bool PreprocessSources(const ProgramSources& sources,
+                         const uint32_t features,
+                         ProgramSources* variant_sources,
+                         std::string* error) const;
+  bool ResolveIncludes(const std::string& source,
+                       std::vector<std::string>* included_names,
+                       std::string* resolved_source,
+                       std::string* error) const;
+  Variant* BeginVariant(const uint32_t features);
+  void EndVariant(const uint32_t features, Variant* variant);
+  void BindUniformBlocks(const GpuProgram& program) const;
+
+  ProgramSources sources_;
+  const std::vector<std::string> feature_names_;
+  ProgramBinaryCache* cache_;
+  std::unordered_map<std::string, std::string> includes_;
+  // The binding points of the uniform blocks, by hashed name.
+  std::vector<std::pair<uint64_t, GLuint>> uniform_block_bindings_;
+  std::unordered_map<uint32_t, Variant> variants_;
+  std::vector<uint32_t> used_variants_;
+  // The programs started by BeginReload(), by features.
+  std::unordered_map<uint32_t, std::unique_ptr<GpuProgram>> reloaded_programs_;
+};
+
+}  // namespace wvu
+
+#endif  // SHADER_PERMUTATIONS_H_
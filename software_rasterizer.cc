@@ -0,0 +1,815 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "software_rasterizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WVU_RASTERIZER_AVX2
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <Eigen/Core>
+#include <glog/logging.h>
+
+#include "camera_utils.h"
+#include "cpu_profiler.h"
+#include "cpu_utils.h"
+#include "model.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+constexpr int kTileSize = 64;
+constexpr int kBlockSize = 8;
+constexpr int kNumBlocksPerTileRow = kTileSize / kBlockSize;
+// Fewer triangles than this are binned by a single thread.
+constexpr int kMinTrianglesPerBin = 256;
+
+uint32_t PackColor(const float red,
+                   const float green,
+                   const float blue,
+                   const float alpha) {
+  const auto to_byte = [](const float value) {
+    return static_cast<uint32_t>(
+        std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+  };
+  return to_byte(red) | to_byte(green) << 8 | to_byte(blue) << 16 |
+         to_byte(alpha) << 24;
+}
+
+// Returns the largest integer not greater than the value. Unlike std::floor()
+// it is not a library call when SSE4.1 is unavailable.
+inline int FloorToInt(const float value) {
+  const int truncated = static_cast<int>(value);
+  return truncated - (value < truncated);
+}
+
+// Interpolates two RGBA colors with a weight in [0, 256], two channels at a
+// time.
+inline uint32_t LerpColor(const uint32_t first,
+                          const uint32_t second,
+                          const uint32_t weight) {
+  const uint32_t red_blue = (((first & 0x00ff00ffu) * (256 - weight) +
+                              (second & 0x00ff00ffu) * weight) >> 8) &
+                            0x00ff00ffu;
+  const uint32_t green_alpha = (((first >> 8) & 0x00ff00ffu) * (256 - weight) +
+                                ((second >> 8) & 0x00ff00ffu) * weight) &
+                               0xff00ff00u;
+  return red_blue | green_alpha;
+}
+
+// Returns the index and the weight (in [0, 256)) of the first of the two
+// texels a coordinate is interpolated from. The coordinate is wrapped like
+// GL_REPEAT.
+inline void ComputeTexelIndex(const float coordinate,
+                              const int size,
+                              int* index,
+                              uint32_t* weight) {
+  const float wrapped = coordinate - FloorToInt(coordinate);
+  // The texel centers are at half-texel offsets, with 8 fractional bits.
+  int fixed_point = static_cast<int>(wrapped * size * 256.0f) - 128;
+  if (fixed_point < 0) fixed_point += size * 256;
+  *index = std::min(fixed_point >> 8, size - 1);
+  *weight = fixed_point & 0xff;
+}
+
+// Samples a texture with GL_LINEAR filtering and GL_REPEAT wrapping, as the
+// textures of draw_scene are configured. Returns a packed RGBA color.
+inline uint32_t SampleTexture(const SoftwareTexture* texture,
+                              const float s,
+                              const float t) {
+  if (texture == nullptr || texture->texels.empty()) return 0xffffffffu;
+  int x0, y0;
+  uint32_t x_weight, y_weight;
+  ComputeTexelIndex(s, texture->width, &x0, &x_weight);
+  ComputeTexelIndex(t, texture->height, &y0, &y_weight);
+  const int x1 = x0 + 1 == texture->width ? 0 : x0 + 1;
+  const int y1 = y0 + 1 == texture->height ? 0 : y0 + 1;
+  const auto texel = [texture](const int x, const int y) {
+    uint32_t color;
+    memcpy(&color, &texture->texels[4 * (y * texture->width + x)],
+           sizeof(color));
+    return color;
+  };
+  return LerpColor(LerpColor(texel(x0, y0), texel(x1, y0), x_weight),
+                   LerpColor(texel(x0, y1), texel(x1, y1), x_weight),
+                   y_weight);
+}
+
+}  // namespace
+
+uint32_t SampleSoftwareTexture(const SoftwareTexture* texture,
+                               const float s,
+                               const float t) {
+  return SampleTexture(texture, s, t);
+}
+
+// A draw recorded by DrawModel().
+struct SoftwareRasterizer::Draw {
+  // The vertices of the model, 3 floats each, and its indices or null if the
+  // model is not indexed.
+  const float* vertices;
+  const GLuint* indices;
+  const SoftwareTexture* texture;
+  // Index of the first vertex of the model in clip_vertices_.
+  int first_vertex;
+  // Index of the first triangle of the draw among the triangles of the frame.
+  int64_t first_triangle;
+  int num_triangles;
+};
+
+// A triangle set up for rasterization in window coordinates, where the pixel
+// (x, y) covers [x, x + 1) x [y, y + 1) and y points up.
+struct SoftwareRasterizer::Triangle {
+  // The edge functions e(x, y) = a * (x - x0) + b * (y - y0), positive inside
+  // the triangle. The edge shared by two triangles is evaluated from the same
+  // origin with negated coefficients, so exactly one of them covers the
+  // pixels on the edge.
+  float edge_a[3];
+  float edge_b[3];
+  float edge_x0[3];
+  float edge_y0[3];
+  // Whether the pixels on the edge are covered (e(x, y) == 0).
+  bool edge_inclusive[3];
+  // Plane equations p(x, y) = p0 + dx * (x - x0) + dy * (y - y0) of the depth,
+  // 1 / w, s / w and t / w, where (s, t) is the texel.
+  float origin_x;
+  float origin_y;
+  float plane_p0[4];
+  float plane_dx[4];
+  float plane_dy[4];
+  // The nearest depth of the triangle.
+  float min_depth;
+  // Bounding box in pixels, clipped to the framebuffer.
+  int min_x;
+  int min_y;
+  int max_x;
+  int max_y;
+  const SoftwareTexture* texture;
+};
+
+// The triangles of a range of the frame set up by one thread and the indices
+// of those overlapping every tile.
+struct SoftwareRasterizer::Bin {
+  std::vector<Triangle> triangles;
+  std::vector<std::vector<uint32_t>> tile_triangles;
+  int64_t num_triangles_binned;
+};
+
+// Aligned to a cache line since each tile's counters are updated by the thread
+// that rasterizes it.
+struct alignas(64) SoftwareRasterizer::TileStats {
+  int64_t num_pixels_shaded;
+  int64_t num_blocks_occluded;
+};
+
+namespace {
+// The depth and color buffers of an 8x8 block.
+struct BlockBuffers {
+  float* depths;
+  int depth_stride;
+  uint32_t* colors;
+  int color_stride;
+  // The columns and rows of the block to rasterize, i.e., those inside both
+  // the framebuffer and the bounding box of the triangle.
+  int first_column;
+  int end_column;
+  int first_row;
+  int end_row;
+};
+
+// The fragments of an 8x8 block that passed the depth test and their texels.
+struct BlockFragments {
+  int row_masks[kBlockSize];
+  alignas(32) float ss[kBlockSize][kBlockSize];
+  alignas(32) float ts[kBlockSize][kBlockSize];
+};
+
+// Returns the farthest depth of an 8x8 block.
+float ComputeBlockMaxDepth(const float* depths, const int depth_stride) {
+  float max_depth = 0.0f;
+  for (int row = 0; row < kBlockSize; ++row) {
+    for (int column = 0; column < kBlockSize; ++column) {
+      max_depth = std::max(max_depth, depths[row * depth_stride + column]);
+    }
+  }
+  return max_depth;
+}
+
+// Tests the coverage and the depth of the pixels of an 8x8 block, one pixel
+// at a time, and writes the depth of the fragments that passed. Updates the
+// farthest depth of the block if any fragment passed.
+template <typename Triangle>
+void RasterizeBlock(const Triangle& triangle,
+                    const int block_x,
+                    const int block_y,
+                    const BlockBuffers& block,
+                    BlockFragments* fragments,
+                    float* block_max_depth) {
+  int any_fragment = 0;
+  for (int row = 0; row < kBlockSize; ++row) fragments->row_masks[row] = 0;
+  for (int row = block.first_row; row < block.end_row; ++row) {
+    const float y = block_y + row + 0.5f;
+    float* depths = block.depths + row * block.depth_stride;
+    int mask = 0;
+    for (int column = block.first_column; column < block.end_column;
+         ++column) {
+      const float x = block_x + column + 0.5f;
+      bool covered = true;
+      for (int edge = 0; edge < 3 && covered; ++edge) {
+        const float value =
+            triangle.edge_a[edge] * (x - triangle.edge_x0[edge]) +
+            triangle.edge_b[edge] * (y - triangle.edge_y0[edge]);
+        covered = value > 0.0f ||
+                  (value == 0.0f && triangle.edge_inclusive[edge]);
+      }
+      if (!covered) continue;
+      const float dx = x - triangle.origin_x;
+      const float dy = y - triangle.origin_y;
+      float planes[4];
+      for (int i = 0; i < 4; ++i) {
+        planes[i] = triangle.plane_p0[i] + triangle.plane_dx[i] * dx +
+                    triangle.plane_dy[i] * dy;
+      }
+      if (!(planes[0] < depths[column])) continue;
+      depths[column] = planes[0];
+      // Perspective-correct interpolation of the texel.
+      const float w = 1.0f / planes[1];
+      fragments->ss[row][column] = planes[2] * w;
+      fragments->ts[row][column] = planes[3] * w;
+      mask |= 1 << column;
+    }
+    fragments->row_masks[row] = mask;
+    any_fragment |= mask;
+  }
+  if (any_fragment != 0) {
+    *block_max_depth = ComputeBlockMaxDepth(block.depths, block.depth_stride);
+  }
+}
+
+#ifdef WVU_RASTERIZER_AVX2
+// Same as RasterizeBlock(), one row of 8 pixels at a time. The texture is
+// sampled outside, so that this function does not call non-AVX code, which
+// would pay the transition penalties between AVX and SSE.
+template <typename Triangle>
+__attribute__((target("avx2,fma"))) void RasterizeBlockAvx2(
+    const Triangle& triangle,
+    const int block_x,
+    const int block_y,
+    const BlockBuffers& block,
+    BlockFragments* fragments,
+    float* block_max_depth) {
+  const __m256 lane_offsets =
+      _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256 xs =
+      _mm256_add_ps(_mm256_set1_ps(static_cast<float>(block_x)), lane_offsets);
+  const __m256 zero = _mm256_setzero_ps();
+  // The lanes of the columns to rasterize.
+  const __m256i columns = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 columns_inside = _mm256_castsi256_ps(_mm256_and_si256(
+      _mm256_cmpgt_epi32(columns,
+                         _mm256_set1_epi32(block.first_column - 1)),
+      _mm256_cmpgt_epi32(_mm256_set1_epi32(block.end_column), columns)));
+
+  __m256 edge_dxs[3];
+  for (int edge = 0; edge < 3; ++edge) {
+    edge_dxs[edge] = _mm256_mul_ps(
+        _mm256_set1_ps(triangle.edge_a[edge]),
+        _mm256_sub_ps(xs, _mm256_set1_ps(triangle.edge_x0[edge])));
+  }
+  __m256 plane_dxs[4];
+  const __m256 dxs = _mm256_sub_ps(xs, _mm256_set1_ps(triangle.origin_x));
+  for (int i = 0; i < 4; ++i) {
+    plane_dxs[i] = _mm256_fmadd_ps(_mm256_set1_ps(triangle.plane_dx[i]), dxs,
+                                   _mm256_set1_ps(triangle.plane_p0[i]));
+  }
+
+  int any_fragment = 0;
+  for (int row = 0; row < kBlockSize; ++row) fragments->row_masks[row] = 0;
+  for (int row = block.first_row; row < block.end_row; ++row) {
+    const float y = block_y + row + 0.5f;
+    __m256 covered = columns_inside;
+    for (int edge = 0; edge < 3; ++edge) {
+      const __m256 value = _mm256_add_ps(
+          edge_dxs[edge],
+          _mm256_set1_ps(triangle.edge_b[edge] * (y - triangle.edge_y0[edge])));
+      const __m256 inside =
+          triangle.edge_inclusive[edge]
+              ? _mm256_cmp_ps(value, zero, _CMP_GE_OQ)
+              : _mm256_cmp_ps(value, zero, _CMP_GT_OQ);
+      covered = _mm256_and_ps(covered, inside);
+    }
+    if (_mm256_movemask_ps(covered) == 0) continue;
+
+    const __m256 dys = _mm256_set1_ps(y - triangle.origin_y);
+    float* depths = block.depths + row * block.depth_stride;
+    const __m256 old_depths = _mm256_loadu_ps(depths);
+    const __m256 new_depths = _mm256_fmadd_ps(
+        _mm256_set1_ps(triangle.plane_dy[0]), dys, plane_dxs[0]);
+    const __m256 passed = _mm256_and_ps(
+        covered, _mm256_cmp_ps(new_depths, old_depths, _CMP_LT_OQ));
+    const int mask = _mm256_movemask_ps(passed);
+    if (mask == 0) continue;
+    // The lanes past the border are masked out, so they keep their depth.
+    _mm256_storeu_ps(depths, _mm256_blendv_ps(old_depths, new_depths, passed));
+    // Perspective-correct interpolation of the texel.
+    const __m256 ws = _mm256_div_ps(
+        _mm256_set1_ps(1.0f),
+        _mm256_fmadd_ps(_mm256_set1_ps(triangle.plane_dy[1]), dys,
+                        plane_dxs[1]));
+    _mm256_store_ps(
+        fragments->ss[row],
+        _mm256_mul_ps(_mm256_fmadd_ps(_mm256_set1_ps(triangle.plane_dy[2]),
+                                      dys, plane_dxs[2]),
+                      ws));
+    _mm256_store_ps(
+        fragments->ts[row],
+        _mm256_mul_ps(_mm256_fmadd_ps(_mm256_set1_ps(triangle.plane_dy[3]),
+                                      dys, plane_dxs[3]),
+                      ws));
+    fragments->row_masks[row] = mask;
+    any_fragment |= mask;
+  }
+  if (any_fragment == 0) return;
+
+  // The rows of the depth buffer are padded, so the 8 rows can be read even
+  // if the block crosses the border of the framebuffer.
+  __m256 max_depths = _mm256_loadu_ps(block.depths);
+  for (int row = 1; row < kBlockSize; ++row) {
+    max_depths = _mm256_max_ps(
+        max_depths, _mm256_loadu_ps(block.depths + row * block.depth_stride));
+  }
+  __m128 max_depth = _mm_max_ps(_mm256_castps256_ps128(max_depths),
+                                _mm256_extractf128_ps(max_depths, 1));
+  max_depth = _mm_max_ps(max_depth, _mm_movehl_ps(max_depth, max_depth));
+  max_depth = _mm_max_ss(max_depth, _mm_shuffle_ps(max_depth, max_depth, 1));
+  *block_max_depth = _mm_cvtss_f32(max_depth);
+}
+#endif  // WVU_RASTERIZER_AVX2
+
+// Shades the fragments of a block, i.e., samples the texture at their texels
+// like fragment_shader.glsl. Returns the number of fragments shaded.
+template <typename Triangle>
+int ShadeBlock(const Triangle& triangle,
+               const BlockFragments& fragments,
+               const BlockBuffers& block) {
+  int num_fragments = 0;
+  for (int row = block.first_row; row < block.end_row; ++row) {
+    uint32_t* colors = block.colors + row * block.color_stride;
+    int mask = fragments.row_masks[row];
+    num_fragments += __builtin_popcount(mask);
+    while (mask != 0) {
+      const int column = __builtin_ctz(mask);
+      mask &= mask - 1;
+      colors[column] = SampleTexture(triangle.texture,
+                                     fragments.ss[row][column],
+                                     fragments.ts[row][column]);
+    }
+  }
+  return num_fragments;
+}
+
+}  // namespace
+
+// A vertex being clipped.
+struct SoftwareRasterizer::ClipVertex {
+  Eigen::Vector4f position;
+  Eigen::Vector2f texel;
+};
+
+SoftwareRasterizer::SoftwareRasterizer(const int width,
+                                       const int height,
+                                       ThreadPool* thread_pool)
+    : width_(width),
+      height_(height),
+      num_tiles_x_(internal::DivideRoundingUp(width, kTileSize)),
+      num_tiles_y_(internal::DivideRoundingUp(height, kTileSize)),
+      thread_pool_(thread_pool),
+      use_avx2_(internal::CpuSupportsAvx2()),
+      num_triangles_(0),
+      tile_stats_(num_tiles_x_ * num_tiles_y_) {
+  // The depth buffer is padded to whole tiles so that every block can be
+  // read 8 pixels at a time.
+  color_buffer_.resize(static_cast<size_t>(width_) * height_ * 4);
+  depth_buffer_.resize(static_cast<size_t>(num_tiles_x_) * num_tiles_y_ *
+                       kTileSize * kTileSize);
+  block_max_depths_.resize(static_cast<size_t>(num_tiles_x_) * num_tiles_y_ *
+                           kNumBlocksPerTileRow * kNumBlocksPerTileRow);
+  Clear(Eigen::Vector4f(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+SoftwareRasterizer::~SoftwareRasterizer() {}
+
+int SoftwareRasterizer::depth_buffer_stride() const {
+  return num_tiles_x_ * kTileSize;
+}
+
+void SoftwareRasterizer::Clear(const Eigen::Vector4f& color) {
+  WVU_PROFILE_ZONE("SoftwareRasterizer::Clear");
+  clear_color_ = PackColor(color[0], color[1], color[2], color[3]);
+  uint32_t* colors = reinterpret_cast<uint32_t*>(color_buffer_.data());
+  std::fill(colors, colors + static_cast<size_t>(width_) * height_,
+            clear_color_);
+  std::fill(depth_buffer_.begin(), depth_buffer_.end(), 1.0f);
+  std::fill(block_max_depths_.begin(), block_max_depths_.end(), 1.0f);
+  draws_.clear();
+  clip_vertices_.clear();
+  num_triangles_ = 0;
+}
+
+void SoftwareRasterizer::DrawModel(const Eigen::Matrix4f& projection,
+                                   const Eigen::Matrix4f& view,
+                                   const Eigen::Matrix4f& model_matrix,
+                                   const SoftwareTexture* texture,
+                                   const Model& model) {
+  RecordDraw(projection * view * model_matrix, texture, model);
+}
+
+void SoftwareRasterizer::DrawModel(const Camera& camera,
+                                   const Eigen::Matrix4f& model_matrix,
+                                   const SoftwareTexture* texture,
+                                   const Model& model) {
+  DCHECK(camera.depth_mode() == DepthMode::kStandard);
+  RecordDraw(camera.view_projection() * model_matrix, texture, model);
+}
+
+void SoftwareRasterizer::RecordDraw(
+    const Eigen::Matrix4f& model_view_projection,
+    const SoftwareTexture* texture,
+    const Model& model) {
+  WVU_PROFILE_ZONE("SoftwareRasterizer::DrawModel");
+  const Eigen::MatrixXf& vertices = model.vertices();
+  Draw draw;
+  draw.vertices = vertices.data();
+  draw.indices = model.indices().empty() ? nullptr : model.indices().data();
+  draw.texture = texture;
+  draw.first_vertex = clip_vertices_.size();
+  draw.first_triangle = num_triangles_;
+  draw.num_triangles = model.indices().empty() ? vertices.cols() / 3
+                                               : model.indices().size() / 3;
+  if (draw.num_triangles == 0) return;
+
+  // The vertex shader.
+  for (int i = 0; i < vertices.cols(); ++i) {
+    clip_vertices_.push_back(
+        model_view_projection *
+        Eigen::Vector4f(vertices(0, i), vertices(1, i), vertices(2, i), 1.0f));
+  }
+  draws_.push_back(draw);
+  num_triangles_ += draw.num_triangles;
+}
+
+void SoftwareRasterizer::Flush() {
+  WVU_PROFILE_ZONE("SoftwareRasterizer::Flush");
+  const int num_threads =
+      thread_pool_ == nullptr ? 1 : thread_pool_->num_threads() + 1;
+  const int num_bins = std::max<int64_t>(
+      1, std::min<int64_t>(4 * num_threads,
+                           num_triangles_ / kMinTrianglesPerBin));
+  const int num_tiles = num_tiles_x_ * num_tiles_y_;
+  if (static_cast<int>(bins_.size()) < num_bins) bins_.resize(num_bins);
+  for (int i = 0; i < num_bins; ++i) {
+    bins_[i].triangles.clear();
+    bins_[i].tile_triangles.resize(num_tiles);
+    for (std::vector<uint32_t>& tile_triangles : bins_[i].tile_triangles) {
+      tile_triangles.clear();
+    }
+    bins_[i].num_triangles_binned = 0;
+  }
+  std::fill(tile_stats_.begin(), tile_stats_.end(), TileStats());
+
+  const auto bin_triangles = [this](const int i) { BinTriangles(i); };
+  const auto rasterize_tile = [this](const int i) { RasterizeTile(i); };
+  num_bins_ = num_bins;
+  if (thread_pool_ == nullptr) {
+    for (int i = 0; i < num_bins; ++i) BinTriangles(i);
+    for (int i = 0; i < num_tiles; ++i) RasterizeTile(i);
+  } else {
+    thread_pool_->ParallelFor(num_bins, bin_triangles);
+    thread_pool_->ParallelFor(num_tiles, rasterize_tile);
+  }
+
+  stats_ = SoftwareRasterizerStats();
+  stats_.num_triangles = num_triangles_;
+  for (int i = 0; i < num_bins; ++i) {
+    stats_.num_triangles_binned += bins_[i].num_triangles_binned;
+  }
+  for (const TileStats& tile_stats : tile_stats_) {
+    stats_.num_pixels_shaded += tile_stats.num_pixels_shaded;
+    stats_.num_blocks_occluded += tile_stats.num_blocks_occluded;
+  }
+  draws_.clear();
+  clip_vertices_.clear();
+  num_triangles_ = 0;
+}
+
+void SoftwareRasterizer::BinTriangles(const int bin_index) {
+  WVU_PROFILE_ZONE("SoftwareRasterizer::BinTriangles");
+  Bin* bin = &bins_[bin_index];
+  const int64_t begin = num_triangles_ * bin_index / num_bins_;
+  const int64_t end = num_triangles_ * (bin_index + 1) / num_bins_;
+  // The draw of the first triangle of the range.
+  int draw_index =
+      std::upper_bound(draws_.begin(), draws_.end(), begin,
+                       [](const int64_t triangle, const Draw& draw) {
+                         return triangle < draw.first_triangle;
+                       }) -
+      draws_.begin() - 1;
+  for (int64_t triangle_index = begin; triangle_index < end;
+       ++triangle_index) {
+    while (triangle_index >= draws_[draw_index].first_triangle +
+                                 draws_[draw_index].num_triangles) {
+      ++draw_index;
+    }
+    const Draw& draw = draws_[draw_index];
+    const int first_index = 3 * (triangle_index - draw.first_triangle);
+
+    ClipVertex triangle[3];
+    for (int i = 0; i < 3; ++i) {
+      const int vertex_index = draw.indices == nullptr
+                                   ? first_index + i
+                                   : draw.indices[first_index + i];
+      triangle[i].position = clip_vertices_[draw.first_vertex + vertex_index];
+      // The vertex shader of the scene reads the texel from the position
+      // attribute (both are bound to location 0).
+      triangle[i].texel = Eigen::Vector2f(draw.vertices[3 * vertex_index],
+                                          draw.vertices[3 * vertex_index + 1]);
+    }
+
+    // Discard the triangles outside one of the planes of the frustum.
+    bool outside = false;
+    for (int axis = 0; axis < 3 && !outside; ++axis) {
+      outside = (triangle[0].position[axis] > triangle[0].position[3] &&
+                 triangle[1].position[axis] > triangle[1].position[3] &&
+                 triangle[2].position[axis] > triangle[2].position[3]) ||
+                (triangle[0].position[axis] < -triangle[0].position[3] &&
+                 triangle[1].position[axis] < -triangle[1].position[3] &&
+                 triangle[2].position[axis] < -triangle[2].position[3]);
+    }
+    if (outside) continue;
+
+    // Clip the triangle to the near plane, z = -w. Only the near plane needs
+    // clipping: it keeps w positive, and the depth test and the tiles clip the
+    // rest.
+    ClipVertex polygon[4];
+    int num_polygon_vertices = 0;
+    for (int i = 0; i < 3; ++i) {
+      const ClipVertex& current = triangle[i];
+      const ClipVertex& next = triangle[(i + 1) % 3];
+      const float current_distance = current.position[2] + current.position[3];
+      const float next_distance = next.position[2] + next.position[3];
+      if (current_distance >= 0.0f) polygon[num_polygon_vertices++] = current;
+      if ((current_distance >= 0.0f) != (next_distance >= 0.0f)) {
+        const float t = current_distance / (current_distance - next_distance);
+        ClipVertex& intersection = polygon[num_polygon_vertices++];
+        intersection.position =
+            current.position + t * (next.position - current.position);
+        intersection.texel = current.texel + t * (next.texel - current.texel);
+      }
+    }
+    for (int i = 2; i < num_polygon_vertices; ++i) {
+      const ClipVertex fan[3] = {polygon[0], polygon[i - 1], polygon[i]};
+      SetUpTriangle(draw, fan, bin);
+    }
+  }
+}
+
+void SoftwareRasterizer::SetUpTriangle(const Draw& draw,
+                                       const ClipVertex* vertices,
+                                       Bin* bin) const {
+  // Perspective division and viewport transform.
+  float xs[3];
+  float ys[3];
+  float plane_values[4][3];
+  for (int i = 0; i < 3; ++i) {
+    const Eigen::Vector4f& position = vertices[i].position;
+    const float inverse_w = 1.0f / position[3];
+    xs[i] = (position[0] * inverse_w * 0.5f + 0.5f) * width_;
+    ys[i] = (position[1] * inverse_w * 0.5f + 0.5f) * height_;
+    plane_values[0][i] = position[2] * inverse_w * 0.5f + 0.5f;
+    plane_values[1][i] = inverse_w;
+    plane_values[2][i] = vertices[i].texel[0] * inverse_w;
+    plane_values[3][i] = vertices[i].texel[1] * inverse_w;
+  }
+  const float doubled_area =
+      (xs[1] - xs[0]) * (ys[2] - ys[0]) - (xs[2] - xs[0]) * (ys[1] - ys[0]);
+  if (!std::isfinite(doubled_area) || doubled_area == 0.0f) return;
+
+  Triangle triangle;
+  triangle.min_x = std::max(
+      0, static_cast<int>(std::floor(std::min({xs[0], xs[1], xs[2]}))));
+  triangle.min_y = std::max(
+      0, static_cast<int>(std::floor(std::min({ys[0], ys[1], ys[2]}))));
+  triangle.max_x =
+      std::min(width_ - 1,
+               static_cast<int>(std::ceil(std::max({xs[0], xs[1], xs[2]}))));
+  triangle.max_y =
+      std::min(height_ - 1,
+               static_cast<int>(std::ceil(std::max({ys[0], ys[1], ys[2]}))));
+  if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+    return;
+  }
+
+  // Triangles are not culled by their winding: the edge functions are flipped
+  // so that they are positive inside either way.
+  const float orientation = doubled_area > 0.0f ? 1.0f : -1.0f;
+  for (int edge = 0; edge < 3; ++edge) {
+    int first = (edge + 1) % 3;
+    int second = (edge + 2) % 3;
+    float sign = orientation;
+    // Evaluate a shared edge from the same vertex in both triangles.
+    if (xs[second] < xs[first] ||
+        (xs[second] == xs[first] && ys[second] < ys[first])) {
+      std::swap(first, second);
+      sign = -sign;
+    }
+    triangle.edge_a[edge] = sign * (ys[first] - ys[second]);
+    triangle.edge_b[edge] = sign * (xs[second] - xs[first]);
+    triangle.edge_x0[edge] = xs[first];
+    triangle.edge_y0[edge] = ys[first];
+    // Pixels on an edge belong to the triangle on its left or, if the edge is
+    // horizontal, to the one below it.
+    triangle.edge_inclusive[edge] =
+        triangle.edge_a[edge] > 0.0f ||
+        (triangle.edge_a[edge] == 0.0f && triangle.edge_b[edge] > 0.0f);
+  }
+
+  // The plane equations come from the barycentric coordinates, which are the
+  // edge functions divided by the doubled area.
+  const float inverse_area = 1.0f / std::abs(doubled_area);
+  triangle.origin_x = xs[0];
+  triangle.origin_y = ys[0];
+  for (int i = 0; i < 4; ++i) {
+    const float delta1 = plane_values[i][1] - plane_values[i][0];
+    const float delta2 = plane_values[i][2] - plane_values[i][0];
+    triangle.plane_p0[i] = plane_values[i][0];
+    triangle.plane_dx[i] =
+        (triangle.edge_a[1] * delta1 + triangle.edge_a[2] * delta2) *
+        inverse_area;
+    triangle.plane_dy[i] =
+        (triangle.edge_b[1] * delta1 + triangle.edge_b[2] * delta2) *
+        inverse_area;
+  }
+  triangle.min_depth = std::max(
+      0.0f, std::min({plane_values[0][0], plane_values[0][1],
+                      plane_values[0][2]}));
+  triangle.texture = draw.texture;
+
+  const uint32_t triangle_index = bin->triangles.size();
+  bin->triangles.push_back(triangle);
+  ++bin->num_triangles_binned;
+  for (int tile_y = triangle.min_y / kTileSize;
+       tile_y <= triangle.max_y / kTileSize; ++tile_y) {
+    for (int tile_x = triangle.min_x / kTileSize;
+         tile_x <= triangle.max_x / kTileSize; ++tile_x) {
+      bin->tile_triangles[tile_y * num_tiles_x_ + tile_x].push_back(
+          triangle_index);
+    }
+  }
+}
+
+void SoftwareRasterizer::RasterizeTile(const int tile_index) {
+  const int tile_x = tile_index % num_tiles_x_;
+  const int tile_y = tile_index / num_tiles_x_;
+  const int tile_min_x = tile_x * kTileSize;
+  const int tile_min_y = tile_y * kTileSize;
+  const int tile_max_x = std::min(tile_min_x + kTileSize, width_) - 1;
+  const int tile_max_y = std::min(tile_min_y + kTileSize, height_) - 1;
+  const int depth_stride = depth_buffer_stride();
+  const int num_blocks_x = num_tiles_x_ * kNumBlocksPerTileRow;
+  uint32_t* colors = reinterpret_cast<uint32_t*>(color_buffer_.data());
+  TileStats* tile_stats = &tile_stats_[tile_index];
+
+  // The farthest depth of the tile, which rejects whole triangles.
+  const auto compute_tile_max_depth = [&]() {
+    float max_depth = 0.0f;
+    for (int block_y = tile_min_y / kBlockSize;
+         block_y <= tile_max_y / kBlockSize; ++block_y) {
+      for (int block_x = tile_min_x / kBlockSize;
+           block_x <= tile_max_x / kBlockSize; ++block_x) {
+        max_depth = std::max(
+            max_depth, block_max_depths_[block_y * num_blocks_x + block_x]);
+      }
+    }
+    return max_depth;
+  };
+  float tile_max_depth = compute_tile_max_depth();
+
+  for (int bin_index = 0; bin_index < num_bins_; ++bin_index) {
+    const Bin& bin = bins_[bin_index];
+    for (const uint32_t triangle_index : bin.tile_triangles[tile_index]) {
+      const Triangle& triangle = bin.triangles[triangle_index];
+      if (triangle.min_depth >= tile_max_depth) continue;
+      const int min_x = std::max(triangle.min_x, tile_min_x);
+      const int min_y = std::max(triangle.min_y, tile_min_y);
+      const int max_x = std::min(triangle.max_x, tile_max_x);
+      const int max_y = std::min(triangle.max_y, tile_max_y);
+      // Whether a block that was the farthest of the tile got nearer.
+      bool tile_max_depth_changed = false;
+      for (int block_y = min_y / kBlockSize; block_y <= max_y / kBlockSize;
+           ++block_y) {
+        for (int block_x = min_x / kBlockSize; block_x <= max_x / kBlockSize;
+             ++block_x) {
+          const int pixel_x = block_x * kBlockSize;
+          const int pixel_y = block_y * kBlockSize;
+          // Skip the block if it is outside an edge, i.e., if the edge
+          // function is negative at the block's pixel center that maximizes
+          // it.
+          bool outside = false;
+          for (int edge = 0; edge < 3 && !outside; ++edge) {
+            const float x = pixel_x + (triangle.edge_a[edge] > 0.0f
+                                           ? kBlockSize - 0.5f
+                                           : 0.5f);
+            const float y = pixel_y + (triangle.edge_b[edge] > 0.0f
+                                           ? kBlockSize - 0.5f
+                                           : 0.5f);
+            outside = triangle.edge_a[edge] * (x - triangle.edge_x0[edge]) +
+                          triangle.edge_b[edge] *
+                              (y - triangle.edge_y0[edge]) <
+                      0.0f;
+          }
+          if (outside) continue;
+          // Hierarchical depth test: every pixel of the block is nearer than
+          // the triangle.
+          float* block_max_depth =
+              &block_max_depths_[block_y * num_blocks_x + block_x];
+          if (triangle.min_depth >= *block_max_depth) {
+            ++tile_stats->num_blocks_occluded;
+            continue;
+          }
+
+          BlockBuffers block;
+          block.depths =
+              &depth_buffer_[static_cast<size_t>(pixel_y) * depth_stride +
+                             pixel_x];
+          block.depth_stride = depth_stride;
+          block.colors = colors + static_cast<size_t>(pixel_y) * width_ +
+                         pixel_x;
+          block.color_stride = width_;
+          block.first_column = std::max(min_x - pixel_x, 0);
+          block.end_column = std::min(max_x - pixel_x + 1, kBlockSize);
+          block.first_row = std::max(min_y - pixel_y, 0);
+          block.end_row = std::min(max_y - pixel_y + 1, kBlockSize);
+          const float old_block_max_depth = *block_max_depth;
+          BlockFragments fragments;
+#ifdef WVU_RASTERIZER_AVX2
+          if (use_avx2_) {
+            RasterizeBlockAvx2(triangle, pixel_x, pixel_y, block, &fragments,
+                               block_max_depth);
+          } else {
+            RasterizeBlock(triangle, pixel_x, pixel_y, block, &fragments,
+                           block_max_depth);
+          }
+#else
+          RasterizeBlock(triangle, pixel_x, pixel_y, block, &fragments,
+                         block_max_depth);
+#endif
+          tile_stats->num_pixels_shaded +=
+              ShadeBlock(triangle, fragments, block);
+          tile_max_depth_changed |= old_block_max_depth == tile_max_depth &&
+                                    *block_max_depth < old_block_max_depth;
+        }
+      }
+      if (tile_max_depth_changed) tile_max_depth = compute_tile_max_depth();
+    }
+  }
+}
+
+}  // namespace wvu
@@ -0,0 +1,200 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef SOFTWARE_RASTERIZER_H_
+#define SOFTWARE_RASTERIZER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "camera_utils.h"
+#include "model.h"
+#include "thread_pool.h"
+
+namespace wvu {
+// An RGBA texture in main memory. The rows are stored in the order OpenGL
+// receives them from glTexImage2D(), i.e., the first row is at t = 0.
+struct SoftwareTexture {
+  int width = 0;
+  int height = 0;
+  // RGBA values, four bytes per texel.
+  std::vector<uint8_t> texels;
+};
+
+// Samples a texture with GL_LINEAR filtering and GL_REPEAT wrapping, as the
+// textures of draw_scene are configured. Returns the RGBA color packed in the
+// byte order of SoftwareTexture::texels, or white if the texture is null or
+// empty.
+uint32_t SampleSoftwareTexture(const SoftwareTexture* texture,
+                               const float s,
+                               const float t);
+
+// Counters of the work done by the last Flush().
+struct SoftwareRasterizerStats {
+  // Triangles submitted by DrawModel().
+  int64_t num_triangles = 0;
+  // Triangles that survived clipping and were binned into tiles.
+  int64_t num_triangles_binned = 0;
+  // Pixels that passed the depth test and were shaded.
+  int64_t num_pixels_shaded = 0;
+  // 8x8 blocks skipped because the hierarchical depth test rejected them.
+  int64_t num_blocks_occluded = 0;
+};
+
+// A CPU rasterizer that draws the models the way draw_scene does with
+// OpenGL: the vertices are transformed by the projection, view and model
+// matrices, the depth test is GL_LESS, and every fragment samples the model's
+// texture with GL_LINEAR filtering and GL_REPEAT wrapping at its texel, which
+// the scene's vertex shader takes from the x and y of the vertex position.
+// Triangles are filled; the wireframe polygon mode is not emulated.
+//
+// DrawModel() transforms and records the draws. Flush() clips the triangles
+// to the near plane and bins them into 64x64 pixel tiles, then rasterizes the
+// tiles in parallel. Each tile walks its triangles in submission order in 8x8
+// blocks, tests 8 pixels at a time with AVX2 edge functions when the CPU
+// supports it, and skips the blocks whose farthest depth is nearer than the
+// triangle (hierarchical depth test).
+class SoftwareRasterizer {
+ public:
+  // Params:
+  //   width  Width of the framebuffer in pixels.
+  //   height  Height of the framebuffer in pixels.
+  //   thread_pool  The threads binning and rasterizing the tiles, along with
+  //     the calling thread. If null, the rasterizer is single-threaded.
+  SoftwareRasterizer(const int width,
+                     const int height,
+                     ThreadPool* thread_pool);
+  ~SoftwareRasterizer();
+
+  SoftwareRasterizer(const SoftwareRasterizer&) = delete;
+  SoftwareRasterizer& operator=(const SoftwareRasterizer&) = delete;
+
+  // Clears the color buffer to an RGBA color in [0, 1] and the depth buffer
+  // to 1. Pending draws are discarded.
+  void Clear(const Eigen::Vector4f& color);
+
+  // Records a draw of a model. The model and the texture must outlive the
+  // next Flush(). A null or empty texture draws the model in white.
+  // Params:
+  //   projection  The projection matrix.
+  //   view  The view matrix.
+  //   model_matrix  The model matrix, see ComputeModelMatrix4f().
+  //   texture  The texture of the model.
+  //   model  The model to draw.
+  void DrawModel(const Eigen::Matrix4f& projection,
+                 const Eigen::Matrix4f& view,
+                 const Eigen::Matrix4f& model_matrix,
+                 const SoftwareTexture* texture,
+                 const Model& model);
+  // Same as above with the cached view projection of a camera, whose depth
+  // mode must be the standard one.
+  void DrawModel(const Camera& camera,
+                 const Eigen::Matrix4f& model_matrix,
+                 const SoftwareTexture* texture,
+                 const Model& model);
+
+  // Rasterizes the recorded draws into the framebuffer.
+  void Flush();
+
+  // The color buffer, RGBA with four bytes per pixel. As with glReadPixels(),
+  // the first row is the bottom of the image.
+  const uint8_t* color_buffer() const { return color_buffer_.data(); }
+  // The depth buffer in window coordinates, i.e., in [0, 1]. The rows are
+  // padded to whole tiles, so a row starts every depth_buffer_stride()
+  // floats.
+  const float* depth_buffer() const { return depth_buffer_.data(); }
+  int depth_buffer_stride() const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Whether the blocks are rasterized with AVX2.
+  bool uses_avx2() const { return use_avx2_; }
+  const SoftwareRasterizerStats& stats() const { return stats_; }
+
+ private:
+  struct ClipVertex;
+  struct Draw;
+  struct Triangle;
+  struct Bin;
+  struct TileStats;
+
+  // Records a draw of a model whose vertices are transformed by a model view
+  // projection matrix.
+  void RecordDraw(const Eigen::Matrix4f& model_view_projection,
+                  const SoftwareTexture* texture,
+                  const Model& model);
+  // Clips, sets up and bins the triangles of a range of the frame's
+  // triangles.
+  void BinTriangles(const int bin_index);
+  // Rasterizes the binned triangles overlapping a tile.
+  void RasterizeTile(const int tile_index);
+  // Sets up a triangle in clip coordinates and appends it to the bin.
+  void SetUpTriangle(const Draw& draw,
+                     const ClipVertex* vertices,
+                     Bin* bin) const;
+
+  const int width_;
+  const int height_;
+  const int num_tiles_x_;
+  const int num_tiles_y_;
+  ThreadPool* thread_pool_;
+  // True if the CPU supports AVX2 and FMA.
+  const bool use_avx2_;
+
+  std::vector<uint8_t> color_buffer_;
+  std::vector<float> depth_buffer_;
+  // Farthest depth of every 8x8 block of the depth buffer.
+  std::vector<float> block_max_depths_;
+  uint32_t clear_color_;
+
+  // The draws recorded since the last flush and their vertices in clip
+  // coordinates.
+  std::vector<Draw> draws_;
+  std::vector<Eigen::Vector4f, Eigen::aligned_allocator<Eigen::Vector4f>>
+      clip_vertices_;
+  int64_t num_triangles_;
+
+  // The triangles are binned in ranges, each by one thread. A tile walks the
+  // ranges in order, so the triangles keep their submission order.
+  std::vector<Bin> bins_;
+  int num_bins_;
+  std::vector<TileStats> tile_stats_;
+  SoftwareRasterizerStats stats_;
+};
+
+}  // namespace wvu
+
+#endif  // SOFTWARE_RASTERIZER_H_
@@ -0,0 +1,165 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "streaming_buffer.h"
+
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+namespace {
+constexpr GLbitfield kPersistentMapFlags =
+    GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+// Rounds value up to a multiple of alignment.
+GLintptr AlignOffset(const GLintptr value, const GLsizeiptr alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+}  // namespace
+
+StreamingBuffer::StreamingBuffer(const GLsizeiptr frame_capacity,
+                                 const int num_frames)
+    : frame_capacity_(frame_capacity),
+      buffer_id_(0),
+      uniform_alignment_(UniformAlignment()),
+      mapped_data_(nullptr),
+      fences_(std::max(num_frames, 1), nullptr),
+      frame_index_(-1),
+      frame_offset_(0),
+      flushed_offset_(0),
+      num_stalls_(0) {
+  const GLsizeiptr size = frame_capacity_ * fences_.size();
+  glGenBuffers(1, &buffer_id_);
+  // The copy target does not disturb the bindings that the renderers use.
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id_);
+  if (GLEW_ARB_buffer_storage) {
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, kPersistentMapFlags);
+    mapped_data_ = static_cast<uint8_t*>(glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, 0, size, kPersistentMapFlags));
+    if (mapped_data_ == nullptr) {
+      LOG(ERROR) << "Could not map the streaming buffer persistently.";
+      glDeleteBuffers(1, &buffer_id_);
+      buffer_id_ = 0;
+    }
+  } else {
+    glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    staging_data_.resize(frame_capacity_);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+StreamingBuffer::~StreamingBuffer() {
+  for (GLsync fence : fences_) {
+    if (fence != nullptr) glDeleteSync(fence);
+  }
+  if (buffer_id_ == 0) return;
+  if (mapped_data_ != nullptr) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id_);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+  glDeleteBuffers(1, &buffer_id_);
+}
+
+GLsizeiptr StreamingBuffer::UniformAlignment() {
+  GLint alignment = 1;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  return std::max(alignment, 1);
+}
+
+void StreamingBuffer::BeginFrame() {
+  if (!is_valid()) return;
+  frame_index_ = (frame_index_ + 1) % fences_.size();
+  frame_offset_ = 0;
+  flushed_offset_ = 0;
+  GLsync& fence = fences_[frame_index_];
+  if (fence == nullptr) return;
+  // In the steady state the GPU read the region frames ago and the fence is
+  // already signaled, so polling it returns right away.
+  if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+    WVU_PROFILE_ZONE("StreamingBuffer::Stall");
+    ++num_stalls_;
+    if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED) == GL_WAIT_FAILED) {
+      LOG(ERROR) << "Could not wait for the region " << frame_index_
+                 << " of the streaming buffer.";
+    }
+  }
+  glDeleteSync(fence);
+  fence = nullptr;
+}
+
+void* StreamingBuffer::Allocate(const GLsizeiptr num_bytes,
+                                const GLsizeiptr alignment,
+                                GLintptr* offset) {
+  DCHECK_GE(frame_index_, 0) << "Allocate() before BeginFrame().";
+  if (!is_valid()) return nullptr;
+  const GLintptr region_offset = frame_index_ * frame_capacity_;
+  // The offset is aligned in the buffer, not in the region, since the regions
+  // need not start at a multiple of the alignment.
+  const GLintptr allocation_offset =
+      AlignOffset(region_offset + frame_offset_, alignment) - region_offset;
+  if (allocation_offset + num_bytes > frame_capacity_) return nullptr;
+  frame_offset_ = allocation_offset + num_bytes;
+  *offset = region_offset + allocation_offset;
+  if (mapped_data_ != nullptr) return mapped_data_ + *offset;
+  return staging_data_.data() + allocation_offset;
+}
+
+void StreamingBuffer::Flush() {
+  if (!is_valid() || mapped_data_ != nullptr) return;
+  if (frame_offset_ == flushed_offset_) return;
+  const GLintptr region_offset = frame_index_ * frame_capacity_;
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer_id_);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, region_offset + flushed_offset_,
+                  frame_offset_ - flushed_offset_,
+                  staging_data_.data() + flushed_offset_);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  flushed_offset_ = frame_offset_;
+}
+
+void StreamingBuffer::EndFrame() {
+  if (!is_valid() || frame_index_ < 0) return;
+  // The driver orders glBufferSubData() against the draws by itself, so only
+  // the persistent mapping needs a fence.
+  if (mapped_data_ == nullptr) return;
+  fences_[frame_index_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+}  // namespace wvu
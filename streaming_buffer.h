@@ -0,0 +1,146 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef STREAMING_BUFFER_H_
+#define STREAMING_BUFFER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+
+namespace wvu {
+
+// A buffer object for the data the CPU writes every frame, e.g., uniform
+// blocks, instance data or dynamic vertices. The buffer is split into
+// num_frames regions used in turn, one per frame, and each is a bump
+// allocator: Allocate() returns memory that the CPU writes directly and the
+// offset of that memory in the buffer, which is bound with glBindBufferRange()
+// or used as a vertex offset.
+//
+// With ARB_buffer_storage, the buffer is mapped once with
+// GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT, so the writes need neither a
+// map nor a copy. A fence marks when the GPU finishes reading the region of a
+// frame, and BeginFrame() only waits for it when the region comes around
+// again, num_frames frames later. Thus, with enough frames in flight, the CPU
+// never waits for the GPU. Without the extension, the allocations come from a
+// CPU copy of the region that Flush() uploads with glBufferSubData().
+//
+// Usage:
+//   StreamingBuffer stream(frame_capacity, 3);
+//   stream.BeginFrame();
+//   GLintptr offset;
+//   void* data = stream.Allocate(size, stream.uniform_alignment(), &offset);
+//   memcpy(data, ..., size);
+//   stream.Flush();
+//   glBindBufferRange(GL_UNIFORM_BUFFER, binding, stream.buffer_id(), offset,
+//                     size);
+//   ...  // Draw.
+//   stream.EndFrame();
+//
+// The buffer requires a current OpenGL context and must be used from the
+// thread that owns it.
+class StreamingBuffer {
+ public:
+  // Params:
+  //   frame_capacity  The bytes that a single frame can allocate.
+  //   num_frames  The number of regions, i.e., how many frames the GPU may be
+  //     behind before BeginFrame() waits. Three hides the latency of most
+  //     drivers.
+  StreamingBuffer(const GLsizeiptr frame_capacity, const int num_frames);
+  ~StreamingBuffer();
+
+  StreamingBuffer(const StreamingBuffer&) = delete;
+  StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+
+  // Returns the alignment that glBindBufferRange() requires for uniform
+  // buffers.
+  static GLsizeiptr UniformAlignment();
+
+  // Returns false if the buffer could not be created or mapped.
+  bool is_valid() const { return buffer_id_ != 0; }
+
+  // Moves to the region of the next frame and releases its allocations,
+  // waiting until the GPU finished reading them if it has not yet.
+  void BeginFrame();
+
+  // Returns memory for num_bytes bytes at an offset that is a multiple of
+  // alignment, or nullptr if the region of the frame is full. The memory is
+  // write-only: it may be uncached and reading it is slow.
+  // Params:
+  //   num_bytes  The size of the allocation.
+  //   alignment  The alignment of the offset, e.g., uniform_alignment().
+  //   offset  The offset of the allocation in the buffer.
+  void* Allocate(const GLsizeiptr num_bytes,
+                 const GLsizeiptr alignment,
+                 GLintptr* offset);
+
+  // Makes the writes since the last flush visible to the GPU. It must be
+  // called before the draws that read them. A coherent mapping needs nothing.
+  void Flush();
+
+  // Marks the end of the commands that read the region of the frame.
+  void EndFrame();
+
+  GLuint buffer_id() const { return buffer_id_; }
+  GLsizeiptr frame_capacity() const { return frame_capacity_; }
+  // Whether the buffer is persistently mapped or falls back to copies.
+  bool is_persistent() const { return mapped_data_ != nullptr; }
+  // The alignment of uniform blocks, see UniformAlignment().
+  GLsizeiptr uniform_alignment() const { return uniform_alignment_; }
+  // Bytes allocated in the current frame.
+  GLsizeiptr bytes_used() const { return frame_offset_; }
+  // Number of times BeginFrame() had to wait for the GPU.
+  int num_stalls() const { return num_stalls_; }
+
+ private:
+  const GLsizeiptr frame_capacity_;
+  GLuint buffer_id_;
+  GLsizeiptr uniform_alignment_;
+  // The persistent mapping of the whole buffer, or nullptr when falling back
+  // to copies.
+  uint8_t* mapped_data_;
+  // The CPU copy of the current region when falling back to copies.
+  std::vector<uint8_t> staging_data_;
+  // The fence after the last commands that read each region.
+  std::vector<GLsync> fences_;
+  int frame_index_;
+  GLsizeiptr frame_offset_;
+  GLsizeiptr flushed_offset_;
+  int num_stalls_;
+};
+
+}  // namespace wvu
+
+#endif  // STREAMING_BUFFER_H_
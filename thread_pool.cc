@@ -0,0 +1,155 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "cpu_profiler.h"
+
+namespace wvu {
+
+ThreadPool::ThreadPool(const int num_threads, const std::string& name)
+    : name_(name), num_pending_tasks_(0), stopping_(false) {
+  const int num_workers =
+      num_threads > 0
+          ? num_threads
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  workers_.reserve(num_workers);
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back(&ThreadPool::RunWorker, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  task_available_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+    ++num_pending_tasks_;
+  }
+  task_available_.notify_one();
+}
+
+void ThreadPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  all_tasks_done_.wait(lock, [this]() { return num_pending_tasks_ == 0; });
+}
+
+void ThreadPool::ParallelFor(const int num_tasks,
+                             const std::function<void(int)>& task) {
+  if (num_tasks <= 0) return;
+  // The state is shared through a single pointer so that scheduling the
+  // helpers does not allocate their closures.
+  struct ParallelForState {
+    const std::function<void(int)>* task;
+    int num_tasks;
+    std::atomic<int> next_task;
+    int num_running_helpers;
+    std::mutex mutex;
+    std::condition_variable helpers_done;
+
+    void RunTasks() {
+      for (int i = next_task++; i < num_tasks; i = next_task++) (*task)(i);
+    }
+  } state;
+  state.task = &task;
+  state.num_tasks = num_tasks;
+  state.next_task = 0;
+  // The helpers decrement the count as they finish, possibly before the last
+  // one is scheduled.
+  const int num_helpers = std::min(num_threads(), num_tasks - 1);
+  state.num_running_helpers = num_helpers;
+
+  ParallelForState* shared_state = &state;
+  for (int i = 0; i < num_helpers; ++i) {
+    Schedule([shared_state]() {
+      shared_state->RunTasks();
+      std::lock_guard<std::mutex> lock(shared_state->mutex);
+      if (--shared_state->num_running_helpers == 0) {
+        shared_state->helpers_done.notify_all();
+      }
+    });
+  }
+  state.RunTasks();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.helpers_done.wait(
+      lock, [&state]() { return state.num_running_helpers == 0; });
+}
+
+void ThreadPool::RunWorker() {
+  SetProfilerThreadName(name_.c_str());
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_available_.wait(lock,
+                           [this]() { return stopping_ || !tasks_.empty(); });
+      // Drain the queue before stopping.
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_pending_tasks_ == 0) all_tasks_done_.notify_all();
+    }
+  }
+}
+
+int ComputeNumChunks(const ThreadPool* thread_pool,
+                     const int size,
+                     const int min_chunk_size) {
+  return thread_pool == nullptr || size < 2 * min_chunk_size
+             ? 1
+             : thread_pool->num_threads() + 1;
+}
+
+}  // namespace wvu
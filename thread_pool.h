@@ -0,0 +1,142 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wvu {
+// A fixed set of worker threads that run tasks in the order they were
+// scheduled.
+class ThreadPool {
+ public:
+  // Params:
+  //   num_threads  Number of worker threads. Zero uses one thread per core.
+  //   name  Name of the workers in the profiler traces.
+  ThreadPool(const int num_threads, const std::string& name);
+  // Waits for the scheduled tasks to finish.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Schedules a task to run in a worker thread.
+  void Schedule(std::function<void()> task);
+
+  // Blocks until every scheduled task finished.
+  void Wait();
+
+  // Calls task(i) for every i in [0, num_tasks) from the workers and the
+  // calling thread, and returns once all the calls finished. Unlike Wait(), it
+  // does not wait for other scheduled tasks. Must not be called from a worker.
+  void ParallelFor(const int num_tasks, const std::function<void(int)>& task);
+
+  int num_threads() const { return workers_.size(); }
+
+ private:
+  void RunWorker();
+
+  const std::string name_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  // Signaled when a task is scheduled or the pool is destroyed.
+  std::condition_variable task_available_;
+  // Signaled when the last pending task finishes.
+  std::condition_variable all_tasks_done_;
+  std::deque<std::function<void()>> tasks_;
+  // Number of tasks scheduled that did not finish yet.
+  int num_pending_tasks_;
+  bool stopping_;
+};
+
+// Returns the number of chunks ParallelForChunks() splits a loop into: one per
+// thread if there is a thread pool and at least two chunks of work, one
+// otherwise.
+// Params:
+//   thread_pool  Pool running the chunks. May be null.
+//   size  Number of iterations of the loop.
+//   min_chunk_size  Fewer iterations per thread are not worth a task.
+int ComputeNumChunks(const ThreadPool* thread_pool,
+                     const int size,
+                     const int min_chunk_size);
+
+// Calls function(chunk, begin, end) over ComputeNumChunks() consecutive chunks
+// of [0, size), from the workers of the thread pool and the calling thread.
+// The callable is a template parameter so that passing a lambda never copies
+// its captures to the heap.
+// Params:
+//   thread_pool  Pool running the chunks. If null, the calling thread runs the
+//     whole loop as a single chunk.
+//   size  Number of iterations of the loop.
+//   min_chunk_size  Fewer iterations per thread are not worth a task.
+//   function  Called with the index of the chunk and its range of iterations.
+template <typename Function>
+void ParallelForChunks(ThreadPool* thread_pool,
+                       const int size,
+                       const int min_chunk_size,
+                       const Function& function) {
+  const int num_chunks = ComputeNumChunks(thread_pool, size, min_chunk_size);
+  if (num_chunks == 1) {
+    function(0, 0, size);
+    return;
+  }
+  // The loop is shared through a single pointer so that the task fits in the
+  // std::function of ParallelFor() without allocating.
+  const struct {
+    const Function* function;
+    int size;
+    int num_chunks;
+  } loop = {&function, size, num_chunks};
+  const auto* shared_loop = &loop;
+  thread_pool->ParallelFor(num_chunks, [shared_loop](const int chunk) {
+    (*shared_loop->function)(
+        chunk,
+        static_cast<int64_t>(shared_loop->size) * chunk /
+            shared_loop->num_chunks,
+        static_cast<int64_t>(shared_loop->size) * (chunk + 1) /
+            shared_loop->num_chunks);
+  });
+}
+
+}  // namespace wvu
+
+#endif  // THREAD_POOL_H_
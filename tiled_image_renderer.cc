@@ -0,0 +1,158 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#include "tiled_image_renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "cpu_profiler.h"
+#include "image_writer.h"
+#include "thread_pool.h"
+
+namespace wvu {
+namespace {
+constexpr int kNumChannels = 4;
+
+// Returns the region of the image covered by a tile, in the [0, 1] x [0, 1]
+// image coordinates of Camera::SetImageRegion(). Rows of tiles are counted
+// from the top of the image, so the last row may extend below the image.
+Eigen::AlignedBox2f ComputeTileRegion(const TiledImageOptions& options,
+                                      const int tile_x,
+                                      const int tile_y) {
+  const Eigen::Vector2f image_size(options.width, options.height);
+  const Eigen::Vector2f tile_size(options.tile_width, options.tile_height);
+  const Eigen::Vector2f max_corner(
+      (tile_x + 1) * options.tile_width,
+      options.height - tile_y * options.tile_height);
+  return Eigen::AlignedBox2f(
+      (max_corner - tile_size).cwiseQuotient(image_size),
+      max_corner.cwiseQuotient(image_size));
+}
+
+}  // namespace
+
+bool RenderTiledImage(const TiledImageOptions& options,
+                      const Camera& camera,
+                      const RenderTileFunction& render_tile,
+                      const std::string& filepath) {
+  WVU_PROFILE_ZONE("RenderTiledImage");
+  if (options.width <= 0 || options.height <= 0 || options.tile_width <= 0 ||
+      options.tile_height <= 0) {
+    LOG(ERROR) << "Invalid tiled image of " << options.width << "x"
+               << options.height << " pixels with tiles of "
+               << options.tile_width << "x" << options.tile_height;
+    return false;
+  }
+  PngWriter writer;
+  if (!writer.Open(filepath, options.width, options.height)) {
+    LOG(ERROR) << "Could not create " << filepath;
+    return false;
+  }
+  const int num_tiles_x =
+      (options.width + options.tile_width - 1) / options.tile_width;
+  const int num_tiles_y =
+      (options.height + options.tile_height - 1) / options.tile_height;
+  // A strip is a row of tiles, stored top-down as the PNG rows. One strip is
+  // rendered while the other one is written.
+  const size_t strip_row_size =
+      static_cast<size_t>(options.width) * kNumChannels;
+  std::vector<uint8_t> strips[2];
+  for (std::vector<uint8_t>& strip : strips) {
+    strip.resize(strip_row_size * options.tile_height);
+  }
+  std::vector<uint8_t> tile_pixels(static_cast<size_t>(options.tile_width) *
+                                   options.tile_height * kNumChannels);
+  std::atomic<bool> strips_written(true);
+  ThreadPool strip_writer(1, "StripWriter");
+
+  Camera tile_camera = camera;
+  bool tiles_rendered = true;
+  for (int tile_y = 0; tile_y < num_tiles_y && tiles_rendered; ++tile_y) {
+    std::vector<uint8_t>& strip = strips[tile_y % 2];
+    // The rows of the last strip below the image are dropped.
+    const int image_top_row = tile_y * options.tile_height;
+    const int num_rows =
+        std::min(options.tile_height, options.height - image_top_row);
+    for (int tile_x = 0; tile_x < num_tiles_x; ++tile_x) {
+      tile_camera.SetImageRegion(ComputeTileRegion(options, tile_x, tile_y));
+      if (!render_tile(tile_camera, tile_pixels.data())) {
+        LOG(ERROR) << "Could not render the tile (" << tile_x << ", " << tile_y
+                   << ") of " << filepath;
+        tiles_rendered = false;
+        break;
+      }
+      // Flips the bottom-up tile rows into the top-down strip, cropping the
+      // columns past the right edge of the image.
+      const int first_column = tile_x * options.tile_width;
+      const int num_columns =
+          std::min(options.tile_width, options.width - first_column);
+      for (int row = 0; row < num_rows; ++row) {
+        const int tile_row = options.tile_height - 1 - row;
+        std::memcpy(strip.data() + row * strip_row_size +
+                        first_column * kNumChannels,
+                    tile_pixels.data() + static_cast<size_t>(tile_row) *
+                                             options.tile_width * kNumChannels,
+                    num_columns * kNumChannels);
+      }
+    }
+    if (!tiles_rendered) {
+      break;
+    }
+    // The previous strip must be written before this one, and its buffer is
+    // the next one to render into.
+    strip_writer.Wait();
+    strip_writer.Schedule([&writer, &strip, num_rows, &strips_written]() {
+      WVU_PROFILE_ZONE("WriteStrip");
+      if (!writer.WriteRows(strip.data(), num_rows, kNumChannels)) {
+        strips_written = false;
+      }
+    });
+  }
+  strip_writer.Wait();
+  if (!tiles_rendered) {
+    return false;
+  }
+  if (!strips_written || !writer.Close()) {
+    LOG(ERROR) << "Could not write " << filepath;
+    return false;
+  }
+  return true;
+}
+
+}  // namespace wvu
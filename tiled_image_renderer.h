@@ -0,0 +1,83 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef TILED_IMAGE_RENDERER_H_
+#define TILED_IMAGE_RENDERER_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "camera_utils.h"
+
+namespace wvu {
+// Options of a tiled image.
+struct TiledImageOptions {
+  // Dimensions of the image in pixels, e.g., 32768 x 32768 for a poster.
+  int width = 0;
+  int height = 0;
+  // Dimensions of a tile in pixels, i.e., of the framebuffer tiles are
+  // rendered into.
+  int tile_width = 0;
+  int tile_height = 0;
+};
+
+// Renders a tile seen by tile_camera, whose projection is restricted to the
+// tile (see Camera::SetImageRegion()), into tile_width x tile_height RGBA
+// pixels stored bottom-up, as read by glReadPixels(). Returns true upon
+// success.
+using RenderTileFunction =
+    std::function<bool(const Camera& tile_camera, uint8_t* pixels)>;
+
+// Renders an image larger than any framebuffer, or than memory, as a grid of
+// tiles with off-axis projections of the camera, and writes it to a PNG file.
+// The tiles are rendered row by row from the top of the image, and every row
+// of tiles is written as a strip of the PNG file on another thread while the
+// next row renders, so only two strips are held in memory. The tiles on the
+// right and bottom edges cover regions past the image and are cropped. Returns
+// true upon success.
+// Params:
+//   options  The dimensions of the image and of the tiles.
+//   camera  The camera of the whole image. Its aspect ratio should be the one
+//     of the image.
+//   render_tile  Renders a tile.
+//   filepath  The PNG file to write.
+bool RenderTiledImage(const TiledImageOptions& options,
+                      const Camera& camera,
+                      const RenderTileFunction& render_tile,
+                      const std::string& filepath);
+
+}  // namespace wvu
+
+#endif  // TILED_IMAGE_RENDERER_H_
@@ -0,0 +1,329 @@
+// Copyright (C) 2016 West Virginia University.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//
+//     * Redistributions in binary form must reproduce the above
+//       copyright notice, this list of conditions and the following
+//       disclaimer in the documentation and/or other materials provided
+//       with the distribution.
+//
+//     * Neither the name of West Virginia University nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+// Please contact the author of this library if you have any questions.
+// Author: Victor Fragoso (victor.fragoso@mail.wvu.edu)
+
+#ifndef UNIFORM_BLOCK_H_
+#define UNIFORM_BLOCK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include <Eigen/Core>
+
+namespace wvu {
+
+// The memory layouts of GLSL blocks. Uniform blocks use std140, and shader
+// storage blocks use std430, which does not round arrays up to vec4.
+enum class BlockLayout { kStd140, kStd430 };
+
+namespace internal {
+
+constexpr size_t RoundUp(const size_t value, const size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+constexpr size_t Max(const size_t a, const size_t b) { return a > b ? a : b; }
+
+// The GLSL type of a C++ type, with its base alignment and size in a layout.
+// Other C++ types are not supported and do not compile.
+template <typename T, BlockLayout kLayout>
+struct GlslType;
+
+template <BlockLayout kLayout>
+struct GlslType<float, kLayout> {
+  static constexpr size_t kAlignment = 4;
+  static constexpr size_t kSize = 4;
+  static std::string Declare(const std::string& name) {
+    return "float " + name;
+  }
+};
+
+template <BlockLayout kLayout>
+struct GlslType<int32_t, kLayout> {
+  static constexpr size_t kAlignment = 4;
+  static constexpr size_t kSize = 4;
+  static std::string Declare(const std::string& name) { return "int " + name; }
+};
+
+template <BlockLayout kLayout>
+struct GlslType<uint32_t, kLayout> {
+  static constexpr size_t kAlignment = 4;
+  static constexpr size_t kSize = 4;
+  static std::string Declare(const std::string& name) {
+    return "uint " + name;
+  }
+};
+
+template <BlockLayout kLayout>
+struct GlslType<Eigen::Vector2f, kLayout> {
+  static constexpr size_t kAlignment = 8;
+  static constexpr size_t kSize = 8;
+  static std::string Declare(const std::string& name) {
+    return "vec2 " + name;
+  }
+};
+
+// A vec3 is aligned like a vec4, but a scalar may follow it in its last four
+// bytes.
+template <BlockLayout kLayout>
+struct GlslType<Eigen::Vector3f, kLayout> {
+  static constexpr size_t kAlignment = 16;
+  static constexpr size_t kSize = 12;
+  static std::string Declare(const std::string& name) {
+    return "vec3 " + name;
+  }
+};
+
+template <BlockLayout kLayout>
+struct GlslType<Eigen::Vector4f, kLayout> {
+  static constexpr size_t kAlignment = 16;
+  static constexpr size_t kSize = 16;
+  static std::string Declare(const std::string& name) {
+    return "vec4 " + name;
+  }
+};
+
+template <BlockLayout kLayout>
+struct GlslType<Eigen::Vector4i, kLayout> {
+  static constexpr size_t kAlignment = 16;
+  static constexpr size_t kSize = 16;
+  static std::string Declare(const std::string& name) {
+    return "ivec4 " + name;
+  }
+};
+
+// Column-major, like Eigen, i.e., an array of four vec4 columns.
+template <BlockLayout kLayout>
+struct GlslType<Eigen::Matrix4f, kLayout> {
+  static constexpr size_t kAlignment = 16;
+  static constexpr size_t kSize = 64;
+  static std::string Declare(const std::string& name) {
+    return "mat4 " + name;
+  }
+};
+
+// In std140, the elements of an array are aligned to a vec4.
+template <typename T, size_t kNumElements, BlockLayout kLayout>
+struct GlslType<T[kNumElements], kLayout> {
+  using Element = GlslType<T, kLayout>;
+  static constexpr size_t kAlignment =
+      kLayout == BlockLayout::kStd140 ? RoundUp(Element::kAlignment, 16)
+                                      : Element::kAlignment;
+  static constexpr size_t kStride = RoundUp(Element::kSize, kAlignment);
+  static constexpr size_t kSize = kStride * kNumElements;
+  static_assert(sizeof(T) == kStride,
+                "The elements of the C++ array are not as large as the GLSL "
+                "array stride, e.g., std140 arrays need vec4 elements.");
+  static std::string Declare(const std::string& name) {
+    return Element::Declare(name) + "[" + std::to_string(kNumElements) + "]";
+  }
+};
+
+// A field of a block: its C++ type and offset.
+template <typename T, size_t kCppOffset>
+struct BlockField {
+  using Type = T;
+  static constexpr size_t kOffset = kCppOffset;
+};
+
+// Lays out the fields after the end of the previous ones and checks that
+// every C++ field is at the offset of its GLSL counterpart.
+template <BlockLayout kLayout, size_t kBegin, typename... Fields>
+struct BlockFieldLayout {
+  static constexpr size_t kEnd = kBegin;
+  static constexpr size_t kAlignment = 1;
+  static void Declare(const char* const*, std::string*) {}
+};
+
+template <BlockLayout kLayout, size_t kBegin, typename Field,
+          typename... Fields>
+struct BlockFieldLayout<kLayout, kBegin, Field, Fields...> {
+  using Glsl = GlslType<typename Field::Type, kLayout>;
+  static constexpr size_t kOffset = RoundUp(kBegin, Glsl::kAlignment);
+  static_assert(Field::kOffset == kOffset,
+                "A field of the C++ struct is not at the offset of the GLSL "
+                "block. Reorder the fields or add explicit padding fields.");
+  using Next = BlockFieldLayout<kLayout, kOffset + Glsl::kSize, Fields...>;
+  static constexpr size_t kEnd = Next::kEnd;
+  static constexpr size_t kAlignment = Max(Glsl::kAlignment, Next::kAlignment);
+
+  static void Declare(const char* const* names, std::string* declaration) {
+    *declaration += "  " + Glsl::Declare(names[0]) + ";\n";
+    Next::Declare(names + 1, declaration);
+  }
+};
+
+// Describes a block declared with WVU_UNIFORM_BLOCK().
+template <typename Block, BlockLayout kBlockLayout, typename... Fields>
+struct BlockDescription {
+  using Layout = BlockFieldLayout<kBlockLayout, 0, Fields...>;
+  static constexpr BlockLayout kLayout = kBlockLayout;
+  // The size of a block includes the padding that aligns it like its largest
+  // field, which in std140 is at least a vec4.
+  static constexpr size_t kSize = RoundUp(
+      Layout::kEnd, kBlockLayout == BlockLayout::kStd140
+                        ? RoundUp(Layout::kAlignment, 16)
+                        : Layout::kAlignment);
+  static_assert(std::is_standard_layout<Block>::value,
+                "The C++ struct of a block must have a standard layout.");
+  static_assert(sizeof(Block) == kSize,
+                "The C++ struct does not have the size of the GLSL block. "
+                "Every field must be declared and the struct padded to the "
+                "alignment of the block.");
+};
+
+}  // namespace internal
+
+// Compile-time description of a C++ struct that mirrors a GLSL block, so the
+// struct is uploaded with a single copy into the buffer backing the block.
+// The fields are declared with WVU_UNIFORM_BLOCK(), which fails to compile if
+// their offsets or the size of the struct differ from the GLSL ones, e.g.,
+//
+//   struct FrameUniforms {
+//     Eigen::Matrix4f view;
+//     Eigen::Vector3f camera_position;
+//     float time;
+//   };
+//   WVU_UNIFORM_BLOCK(FrameUniforms, kStd140, view, camera_position, time);
+//
+//   const std::string glsl = UniformBlock<FrameUniforms>::Declaration();
+template <typename Block>
+class UniformBlock {
+ public:
+  using Description =
+      decltype(GetUniformBlockDescription(static_cast<const Block*>(nullptr)));
+  static constexpr BlockLayout kLayout = Description::kLayout;
+  static constexpr size_t kSize = Description::kSize;
+
+  // Returns the name of the block in GLSL, which is the name of the struct.
+  static const char* name() { return Description::name(); }
+
+  // Returns the GLSL declaration of the block: a uniform block for std140 and
+  // a shader storage block for std430. The fields are not scoped by an
+  // instance name.
+  static std::string Declaration() {
+    std::string declaration =
+        kLayout == BlockLayout::kStd140
+            ? std::string("layout (std140) uniform ") + name() + " {\n"
+            : std::string("layout (std430) buffer ") + name() + " {\n";
+    Description::Layout::Declare(Description::field_names(), &declaration);
+    declaration += "};\n";
+    return declaration;
+  }
+};
+
+}  // namespace wvu
+
+// Implementation of WVU_UNIFORM_BLOCK(): applies a macro to each of up to 16
+// fields.
+#define WVU_INTERNAL_EXPAND(x) x
+#define WVU_INTERNAL_FOR_EACH_1(m, b, f) m(b, f)
+#define WVU_INTERNAL_FOR_EACH_2(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_1(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_3(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_2(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_4(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_3(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_5(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_4(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_6(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_5(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_7(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_6(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_8(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_7(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_9(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_8(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_10(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_9(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_11(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_10(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_12(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_11(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_13(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_12(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_14(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_13(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_15(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_14(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_FOR_EACH_16(m, b, f, ...) \
+  m(b, f), WVU_INTERNAL_EXPAND(WVU_INTERNAL_FOR_EACH_15(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_SELECT_FOR_EACH(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, \
+                                     _11, _12, _13, _14, _15, _16, name,     \
+                                     ...)                                    \
+  name
+#define WVU_INTERNAL_FOR_EACH(m, b, ...)                                      \
+  WVU_INTERNAL_EXPAND(WVU_INTERNAL_SELECT_FOR_EACH(                           \
+      __VA_ARGS__, WVU_INTERNAL_FOR_EACH_16, WVU_INTERNAL_FOR_EACH_15,        \
+      WVU_INTERNAL_FOR_EACH_14, WVU_INTERNAL_FOR_EACH_13,                     \
+      WVU_INTERNAL_FOR_EACH_12, WVU_INTERNAL_FOR_EACH_11,                     \
+      WVU_INTERNAL_FOR_EACH_10, WVU_INTERNAL_FOR_EACH_9,                      \
+      WVU_INTERNAL_FOR_EACH_8, WVU_INTERNAL_FOR_EACH_7,                       \
+      WVU_INTERNAL_FOR_EACH_6, WVU_INTERNAL_FOR_EACH_5,                       \
+      WVU_INTERNAL_FOR_EACH_4, WVU_INTERNAL_FOR_EACH_3,                       \
+      WVU_INTERNAL_FOR_EACH_2, WVU_INTERNAL_FOR_EACH_1)(m, b, __VA_ARGS__))
+#define WVU_INTERNAL_BLOCK_FIELD(block, field) \
+  ::wvu::internal::BlockField<decltype(block::field), offsetof(block, field)>
+#define WVU_INTERNAL_FIELD_NAME(block, field) #field
+
+// Declares the fields of a C++ struct mirroring a GLSL block, in their order,
+// and checks its layout at compile time (see UniformBlock). Must be used in
+// the namespace of the struct.
+// Params:
+//   block  The struct, which is also the name of the GLSL block.
+//   layout  kStd140 or kStd430.
+//   ...  The names of the fields.
+#define WVU_UNIFORM_BLOCK(block, layout, ...)                                 \
+  struct block##BlockDescription                                             \
+      : ::wvu::internal::BlockDescription<                                   \
+            block, ::wvu::BlockLayout::layout,                               \
+            WVU_INTERNAL_FOR_EACH(WVU_INTERNAL_BLOCK_FIELD, block,           \
+                                  __VA_ARGS__)> {                            \
+    static const char* name() { return #block; }                             \
+    static const char* const* field_names() {                                \
+      static const char* const names[] = {WVU_INTERNAL_FOR_EACH(             \
+          WVU_INTERNAL_FIELD_NAME, block, __VA_ARGS__)};                     \
+      return names;                                                          \
+    }                                                                        \
+  };                                                                         \
+  static_assert(block##BlockDescription::kSize > 0, "Empty block.");         \
+  /* Found by argument-dependent lookup. Only its return type is used. */    \
+  [[maybe_unused]] inline block##BlockDescription GetUniformBlockDescription( \
+      const block*) {                                                        \
+    return block##BlockDescription();                                        \
+  }                                                                          \
+  static_assert(true, "")
+
+#endif  // UNIFORM_BLOCK_H_